@@ -4,14 +4,20 @@
 #include <gtk/gtk.h>
 #include <json-c/json.h>
 #include "ollama_api.h"
+#include "conversation.h"
+#include "context_budget.h"
 
-#define MAX_MESSAGE_LEN 16 * 1024
 #define MAX_MODELS 50
 
-typedef struct {
-    char content[MAX_MESSAGE_LEN];
-    gboolean is_user;
-} ChatMessage;
+typedef struct _ChatMessageItem ChatMessageItem;
+typedef struct _ConversationModel ConversationModel;
+typedef struct _ChatListModel ChatListModel;
+typedef struct ContextGather ContextGather;
+typedef struct ChatJournal ChatJournal;
+typedef struct ChatCatalog ChatCatalog;
+typedef struct ChatSearch ChatSearch;
+typedef struct ChatWatch ChatWatch;
+typedef struct ChatSession ChatSession;
 
 // To be used in future refactoring
 typedef struct GuiObject {
@@ -19,7 +25,7 @@ typedef struct GuiObject {
     GtkWindow *window;
     GtkDropDown *model_dropdown;
     GtkLabel *status_label;
-    GtkBox *chat_box;
+    GtkListView *chat_list;
     GtkTextView *text_view;
     GtkTextBuffer *text_buffer;
     GtkButton *send_btn;
@@ -33,34 +39,54 @@ typedef struct AppData {
     GtkWindow *window;
     GtkDropDown *model_dropdown;
     GtkLabel *status_label;
-    GtkBox *chat_box;
+    ConversationModel *chat_model;
+    GtkListView *chat_list;
     GtkTextView *text_view;
     GtkTextBuffer *text_buffer;
     GtkButton *send_btn;
     GtkSpinner *spinner;
+    GtkLabel *context_label;
     GtkScrolledWindow *chat_scroll;
     char **models;
     int model_count;
     char *current_model;
-    gboolean is_generating;
-    gboolean request_cancelled;
-    json_object *messages_array;
-    GtkWidget *current_response_widget;
-    GtkLabel *current_response_label;
-    GString *response_buffer;
+    Conversation *conversation;
+    GHashTable *sessions; // chat id -> ChatSession generating a response for it
+    GtkWidget *current_response_widget; // bound row of the shown chat's streaming response, if visible
+    ContextPlan *context_plan; // of the shown chat's history, as the next request would send it
+    gint prompt_cached_percent; // of the shown chat's last prompt, that Ollama had cached; -1 if unknown
     // Chat History
-    GtkListBox *history_list_box;
-    GListStore *history_store;
+    GtkListView *history_list;
+    GtkSingleSelection *history_selection;
+    ChatListModel *history_model; // chat_catalog, in its order
+    ChatCatalog *chat_catalog;
+    ChatSearch *chat_search;
+    ChatWatch *chat_watch; // of the history directory
+    GtkStack *history_stack; // "chats" or "results"
+    GtkListBox *search_results_box;
     GtkRevealer *history_revealer;
     char *current_chat_id;
+    ChatJournal *chat_journal; // of current_chat_id
+    char *loading_chat_id; // chat being read to be shown next, NULL if none
     // Configuration
     int window_width;
     int window_height;
     int pane_position;
     gboolean history_panel_visible;
     int ollama_context_size;
+    gboolean summarize_chats; // fold the oldest turns of long chats into a summary
+    char *summary_model;      // NULL or empty for the chat's own model
+    GHashTable *keep_alive;   // model name, or "*" for any other -> Ollama keep_alive
     char *theme;
     gboolean web_search_enabled;
+    // Request timeouts, in seconds (0 disables)
+    int connect_timeout;
+    int first_byte_timeout;
+    int stall_timeout;
+    int url_fetch_timeout;
+    int file_read_timeout;
+    int context_deadline;
+    int pack_after_days; // chats unchanged for longer are packed (0 disables)
     // Ollama Model Parameters
     double temperature;
     double top_p;
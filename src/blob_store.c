@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "blob_store.h"
+#include "persist.h"
+
+/**
+ * Attached files and fetched pages are kept once each, in a file named after
+ * the SHA-256 of their contents, so chat files only hold the key. Blobs are
+ * written on the persist thread; until a blob's write has landed it is kept
+ * in `recent`, and read from its file after that.
+ *
+ * Blobs are never removed: a key may be shared by any number of messages.
+ */
+#define BLOB_KEY_LENGTH 64
+
+static char *blob_dir = NULL;
+static GHashTable *recent = NULL; // key -> GBytes not on disk yet
+
+// --- Private Helper Functions ---
+
+static gboolean is_valid_key(const char *key) {
+    if (!key || strlen(key) != BLOB_KEY_LENGTH) return FALSE;
+    for (const char *p = key; *p; p++) {
+        if (!g_ascii_isxdigit(*p) || g_ascii_isupper(*p)) return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean forget_written_blob(gpointer data) {
+    char *key = data;
+    if (recent) g_hash_table_remove(recent, key);
+    g_free(key);
+    return G_SOURCE_REMOVE;
+}
+
+// Runs on the persist thread once the blob `data` (its key) is written.
+static void on_blob_written(gpointer data) {
+    g_idle_add(forget_written_blob, data);
+}
+
+// --- Public Functions ---
+
+// Blobs live in the hidden `.blobs` directory of `dir`.
+void blob_store_init(const char *dir) {
+    blob_dir = g_build_filename(dir, ".blobs", NULL);
+    g_mkdir_with_parents(blob_dir, 0755);
+    recent = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_bytes_unref);
+}
+
+void blob_store_shutdown(void) {
+    g_clear_pointer(&recent, g_hash_table_unref);
+    g_clear_pointer(&blob_dir, g_free);
+}
+
+// Stores `data` unless it is already there and returns its key.
+char *blob_store_put(const char *data, gsize len) {
+    char *key = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)data, len);
+    if (g_hash_table_contains(recent, key)) return key;
+
+    char *path = g_build_filename(blob_dir, key, NULL);
+    if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+        GBytes *bytes = g_bytes_new(data, len);
+        persist_write(path, bytes);
+        persist_call(path, NULL, on_blob_written, g_strdup(key));
+        g_hash_table_insert(recent, g_strdup(key), bytes);
+    }
+    g_free(path);
+    return key;
+}
+
+// Returns the contents stored under `key`, or NULL if there are none.
+GBytes *blob_store_get(const char *key) {
+    if (!is_valid_key(key)) return NULL;
+    GBytes *bytes = g_hash_table_lookup(recent, key);
+    if (bytes) return g_bytes_ref(bytes);
+
+    char *path = g_build_filename(blob_dir, key, NULL);
+    GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+    if (file) {
+        bytes = g_mapped_file_get_bytes(file);
+        g_mapped_file_unref(file);
+    } else {
+        fprintf(stderr, "Error reading attachment %s: not found\n", key);
+    }
+    g_free(path);
+    return bytes;
+}
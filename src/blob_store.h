@@ -0,0 +1,14 @@
+#ifndef BLOB_STORE_H
+#define BLOB_STORE_H
+
+#include <glib.h>
+
+// Content-addressed store for attachment contents, keyed by their SHA-256.
+// All functions are called from the main thread.
+void blob_store_init(const char *dir);
+void blob_store_shutdown(void);
+
+char *blob_store_put(const char *data, gsize len);
+GBytes *blob_store_get(const char *key);
+
+#endif // BLOB_STORE_H
@@ -0,0 +1,389 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include <json-c/json.h>
+#include "chat_catalog.h"
+#include "chat_journal.h"
+#include "chat_pack.h"
+#include "json_util.h"
+#include "persist.h"
+
+/**
+ * What the history list shows about each chat, so that startup reads one
+ * file instead of every chat. The catalog lives in `.catalog` in the history
+ * directory as JSON lines: each line is either a whole entry, replacing any
+ * earlier one with the same id, or `{"id":…,"deleted":true}`. Every change
+ * appends one line; once most lines are stale the file is rewritten.
+ *
+ * `order` is the display order, newest first at load time. Each entry keeps
+ * its position less `shift`, so that a chat added at the top moves every
+ * other one down by bumping `shift` alone, and a removal only renumbers the
+ * entries after it.
+ */
+#define CATALOG_FILE ".catalog"
+#define PREVIEW_CHARS 80
+// Our own saves land on disk shortly after the entry was updated
+#define RESCAN_SLACK_SECONDS 2
+
+struct ChatCatalog {
+    char *dir;
+    char *path;
+    GHashTable *entries; // id -> ChatCatalogEntry
+    GPtrArray *order;    // ChatCatalogEntry, not owned
+    gint shift; // added to each entry's `position`
+    guint records; // lines in the catalog file
+};
+
+// --- Private Helper Functions ---
+
+static void free_entry(gpointer data) {
+    ChatCatalogEntry *entry = data;
+    g_free(entry->id);
+    g_free(entry->title);
+    g_free(entry->preview);
+    g_free(entry->model);
+    g_free(entry);
+}
+
+static void append_entry_json(const ChatCatalogEntry *entry, GString *out) {
+    g_string_append(out, "{\"id\":");
+    json_util_append_string(out, entry->id, -1);
+    if (entry->title) {
+        g_string_append(out, ",\"title\":");
+        json_util_append_string(out, entry->title, -1);
+    }
+    g_string_append_printf(out, ",\"modified_at\":%" G_GINT64_FORMAT ",\"messages\":%u",
+                           entry->modified_at, entry->message_count);
+    if (entry->preview) {
+        g_string_append(out, ",\"preview\":");
+        json_util_append_string(out, entry->preview, -1);
+    }
+    if (entry->model) {
+        g_string_append(out, ",\"model\":");
+        json_util_append_string(out, entry->model, -1);
+    }
+    g_string_append(out, "}\n");
+}
+
+static char *dup_string_field(json_object *obj, const char *key) {
+    json_object *val;
+    return json_object_object_get_ex(obj, key, &val) ? g_strdup(json_object_get_string(val)) : NULL;
+}
+
+static void apply_record(ChatCatalog *catalog, json_object *record) {
+    json_object *val;
+    if (!json_object_object_get_ex(record, "id", &val)) return;
+    const char *id = json_object_get_string(val);
+    if (json_object_object_get_ex(record, "deleted", &val) && json_object_get_boolean(val)) {
+        g_hash_table_remove(catalog->entries, id);
+        return;
+    }
+    ChatCatalogEntry *entry = g_new0(ChatCatalogEntry, 1);
+    entry->id = g_strdup(id);
+    entry->title = dup_string_field(record, "title");
+    entry->preview = dup_string_field(record, "preview");
+    entry->model = dup_string_field(record, "model");
+    entry->modified_at = json_object_object_get_ex(record, "modified_at", &val) ? json_object_get_int64(val) : 0;
+    entry->message_count = json_object_object_get_ex(record, "messages", &val) ? (guint)json_object_get_int(val) : 0;
+    g_hash_table_replace(catalog->entries, entry->id, entry);
+}
+
+static gboolean read_catalog(ChatCatalog *catalog) {
+    char *contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(catalog->path, &contents, &length, NULL)) return FALSE;
+
+    json_tokener *tokener = json_tokener_new();
+    const char *line = contents;
+    const char *end = contents + length;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', end - line);
+        if (!newline) break; // torn by a crash
+        json_tokener_reset(tokener);
+        json_object *record = json_tokener_parse_ex(tokener, line, newline - line);
+        line = newline + 1;
+        if (!record) continue;
+        apply_record(catalog, record);
+        json_object_put(record);
+        catalog->records++;
+    }
+    json_tokener_free(tokener);
+    g_free(contents);
+    return TRUE;
+}
+
+static char *make_preview(const char *text) {
+    while (g_ascii_isspace(*text)) text++;
+    const char *end = text;
+    for (int i = 0; i < PREVIEW_CHARS && *end && *end != '\n'; i++) {
+        end = g_utf8_next_char(end);
+    }
+    return end > text ? g_strndup(text, end - text) : NULL;
+}
+
+static char *find_preview(Conversation *conversation) {
+    guint length = conversation_get_length(conversation);
+    for (guint i = 0; i < length; i++) {
+        if (conversation_get_message(conversation, i)->role == CONVERSATION_ROLE_USER) {
+            return make_preview(conversation_get_content(conversation, i));
+        }
+    }
+    return NULL;
+}
+
+static gint64 modified_time(const char *path) {
+    GStatBuf st;
+    gint64 mtime = g_stat(path, &st) == 0 ? st.st_mtime : chat_pack_get_modified_at(path);
+    char *journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+    if (g_stat(journal_path, &st) == 0 && st.st_mtime > mtime) mtime = st.st_mtime;
+    g_free(journal_path);
+    return mtime;
+}
+
+// A new entry for the chat `id`, read from its files. NULL if it has none.
+// Only reads: another instance may still be streaming into a chat whose
+// journal ends in an unfinished response, which is repaired when it is
+// opened.
+static ChatCatalogEntry *read_entry(ChatCatalog *catalog, const char *id) {
+    char *filepath = g_build_filename(catalog->dir, id, NULL);
+    Conversation *conversation = chat_journal_read(filepath);
+    ChatCatalogEntry *entry = NULL;
+    if (conversation) {
+        entry = g_new0(ChatCatalogEntry, 1);
+        entry->id = g_strdup(id);
+        entry->title = g_uuid_string_is_valid(id) ? NULL : g_strdup(id);
+        entry->modified_at = modified_time(filepath);
+        entry->message_count = conversation_get_length(conversation);
+        entry->preview = find_preview(conversation);
+        conversation_unref(conversation);
+    }
+    g_free(filepath);
+    return entry;
+}
+
+static void scan_chat(ChatCatalog *catalog, const char *id) {
+    if (g_hash_table_contains(catalog->entries, id)) return;
+    ChatCatalogEntry *entry = read_entry(catalog, id);
+    if (entry) g_hash_table_replace(catalog->entries, entry->id, entry);
+}
+
+// Builds the catalog from the chat files and packs, for histories written
+// before it existed. Chats renamed back then were named after their title.
+static void scan_chats(ChatCatalog *catalog) {
+    GDir *dir = g_dir_open(catalog->dir, 0, NULL);
+    if (!dir) return;
+    const char *filename;
+    while ((filename = g_dir_read_name(dir))) {
+        if (chat_catalog_is_chat_filename(filename)) scan_chat(catalog, filename);
+    }
+    g_dir_close(dir);
+    GPtrArray *packed_ids = chat_pack_list_ids();
+    for (guint i = 0; i < packed_ids->len; i++) {
+        scan_chat(catalog, g_ptr_array_index(packed_ids, i));
+    }
+    g_ptr_array_unref(packed_ids);
+}
+
+static void write_catalog(ChatCatalog *catalog) {
+    GString *contents = g_string_new(NULL);
+    for (guint i = 0; i < catalog->order->len; i++) {
+        append_entry_json(g_ptr_array_index(catalog->order, i), contents);
+    }
+    catalog->records = catalog->order->len;
+    GBytes *bytes = g_string_free_to_bytes(contents);
+    persist_write(catalog->path, bytes);
+    g_bytes_unref(bytes);
+}
+
+static void write_record(ChatCatalog *catalog, GString *record) {
+    catalog->records++;
+    if (catalog->records > 2 * catalog->order->len + 256) {
+        g_string_free(record, TRUE);
+        write_catalog(catalog);
+        return;
+    }
+    GBytes *bytes = g_string_free_to_bytes(record);
+    persist_append(catalog->path, bytes);
+    g_bytes_unref(bytes);
+}
+
+static void write_entry(ChatCatalog *catalog, const ChatCatalogEntry *entry) {
+    GString *record = g_string_new(NULL);
+    append_entry_json(entry, record);
+    write_record(catalog, record);
+}
+
+// Puts `entry` at the top of the order.
+static void insert_first(ChatCatalog *catalog, ChatCatalogEntry *entry) {
+    g_ptr_array_insert(catalog->order, 0, entry);
+    catalog->shift++;
+    entry->position = -catalog->shift;
+}
+
+static gint compare_newest_first(gconstpointer a, gconstpointer b) {
+    const ChatCatalogEntry *entry_a = *(ChatCatalogEntry *const *)a;
+    const ChatCatalogEntry *entry_b = *(ChatCatalogEntry *const *)b;
+    if (entry_a->modified_at != entry_b->modified_at) {
+        return entry_a->modified_at < entry_b->modified_at ? 1 : -1;
+    }
+    return strcmp(entry_a->id, entry_b->id);
+}
+
+// --- Public Functions ---
+
+ChatCatalog *chat_catalog_load(const char *dir) {
+    ChatCatalog *catalog = g_new0(ChatCatalog, 1);
+    catalog->dir = g_strdup(dir);
+    catalog->path = g_build_filename(dir, CATALOG_FILE, NULL);
+    catalog->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_entry);
+
+    gboolean found = read_catalog(catalog);
+    if (!found) scan_chats(catalog);
+
+    catalog->order = g_ptr_array_sized_new(g_hash_table_size(catalog->entries));
+    GHashTableIter iter;
+    gpointer entry;
+    g_hash_table_iter_init(&iter, catalog->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &entry)) {
+        g_ptr_array_add(catalog->order, entry);
+    }
+    g_ptr_array_sort(catalog->order, compare_newest_first);
+    for (guint i = 0; i < catalog->order->len; i++) {
+        ((ChatCatalogEntry *)g_ptr_array_index(catalog->order, i))->position = i;
+    }
+
+    if (!found) write_catalog(catalog);
+    return catalog;
+}
+
+void chat_catalog_free(ChatCatalog *catalog) {
+    if (!catalog) return;
+    g_ptr_array_unref(catalog->order);
+    g_hash_table_unref(catalog->entries);
+    g_free(catalog->path);
+    g_free(catalog->dir);
+    g_free(catalog);
+}
+
+guint chat_catalog_get_length(ChatCatalog *catalog) {
+    return catalog->order->len;
+}
+
+const ChatCatalogEntry *chat_catalog_get_entry(ChatCatalog *catalog, guint position) {
+    g_return_val_if_fail(position < catalog->order->len, NULL);
+    return g_ptr_array_index(catalog->order, position);
+}
+
+const ChatCatalogEntry *chat_catalog_lookup(ChatCatalog *catalog, const char *id) {
+    return g_hash_table_lookup(catalog->entries, id);
+}
+
+// Position of `id` in the display order, or -1.
+gint chat_catalog_get_position(ChatCatalog *catalog, const char *id) {
+    ChatCatalogEntry *entry = g_hash_table_lookup(catalog->entries, id);
+    return entry ? entry->position + catalog->shift : -1;
+}
+
+const char *chat_catalog_entry_get_title(const ChatCatalogEntry *entry) {
+    if (entry->title) return entry->title;
+    if (entry->preview) return entry->preview;
+    return "New Chat";
+}
+
+// Adds an empty chat at the top of the order.
+void chat_catalog_add(ChatCatalog *catalog, const char *id) {
+    ChatCatalogEntry *entry = g_new0(ChatCatalogEntry, 1);
+    entry->id = g_strdup(id);
+    entry->modified_at = g_get_real_time() / G_USEC_PER_SEC;
+    g_hash_table_replace(catalog->entries, entry->id, entry);
+    insert_first(catalog, entry);
+    write_entry(catalog, entry);
+}
+
+/**
+ * Records the state of `conversation` after a save; does nothing if no
+ * message was added since the last update. Returns TRUE if the entry's
+ * title changed.
+ */
+gboolean chat_catalog_update(ChatCatalog *catalog, const char *id, Conversation *conversation, const char *model) {
+    ChatCatalogEntry *entry = g_hash_table_lookup(catalog->entries, id);
+    guint length = conversation_get_length(conversation);
+    if (!entry || entry->message_count == length) return FALSE;
+    gboolean title_changed = FALSE;
+    entry->message_count = length;
+    entry->modified_at = g_get_real_time() / G_USEC_PER_SEC;
+    if (!entry->preview) {
+        entry->preview = find_preview(conversation);
+        title_changed = entry->preview && !entry->title;
+    }
+    if (model && g_strcmp0(entry->model, model) != 0) {
+        g_free(entry->model);
+        entry->model = g_strdup(model);
+    }
+    write_entry(catalog, entry);
+    return title_changed;
+}
+
+void chat_catalog_set_title(ChatCatalog *catalog, const char *id, const char *title) {
+    ChatCatalogEntry *entry = g_hash_table_lookup(catalog->entries, id);
+    if (!entry) return;
+    g_free(entry->title);
+    entry->title = g_strdup(title);
+    write_entry(catalog, entry);
+}
+
+void chat_catalog_remove(ChatCatalog *catalog, const char *id) {
+    gint position = chat_catalog_get_position(catalog, id);
+    if (position < 0) return;
+    g_ptr_array_remove_index(catalog->order, position);
+    for (guint i = position; i < catalog->order->len; i++) {
+        ((ChatCatalogEntry *)g_ptr_array_index(catalog->order, i))->position--;
+    }
+
+    GString *record = g_string_new("{\"id\":");
+    json_util_append_string(record, id, -1);
+    g_string_append(record, ",\"deleted\":true}\n");
+    g_hash_table_remove(catalog->entries, id);
+    write_record(catalog, record);
+}
+
+/**
+ * Brings the entry of `id` in line with the chat's files after they were
+ * changed by someone else. Only reads the chat if it was added, or changed
+ * after the entry was last updated. An added chat goes to the top of the
+ * order; the title of a known one is kept.
+ */
+ChatCatalogChange chat_catalog_rescan(ChatCatalog *catalog, const char *id) {
+    ChatCatalogEntry *entry = g_hash_table_lookup(catalog->entries, id);
+    char *filepath = g_build_filename(catalog->dir, id, NULL);
+    gint64 mtime = modified_time(filepath);
+    g_free(filepath);
+
+    if (mtime == 0) {
+        if (!entry) return CHAT_CATALOG_UNCHANGED;
+        chat_catalog_remove(catalog, id);
+        return CHAT_CATALOG_REMOVED;
+    }
+    if (entry && mtime <= entry->modified_at + RESCAN_SLACK_SECONDS) return CHAT_CATALOG_UNCHANGED;
+
+    ChatCatalogEntry *scanned = read_entry(catalog, id);
+    if (!scanned) return CHAT_CATALOG_UNCHANGED; // still being written, or not a chat
+    if (!entry) {
+        g_hash_table_replace(catalog->entries, scanned->id, scanned);
+        insert_first(catalog, scanned);
+        write_entry(catalog, scanned);
+        return CHAT_CATALOG_ADDED;
+    }
+    entry->modified_at = scanned->modified_at;
+    entry->message_count = scanned->message_count;
+    g_free(entry->preview);
+    entry->preview = g_steal_pointer(&scanned->preview);
+    free_entry(scanned);
+    write_entry(catalog, entry);
+    return CHAT_CATALOG_UPDATED;
+}
+
+// Whether `filename` in the history directory is a chat, rather than a
+// journal, the catalog or a temporary file.
+gboolean chat_catalog_is_chat_filename(const char *filename) {
+    return filename[0] != '.' && !g_str_has_suffix(filename, CHAT_JOURNAL_SUFFIX);
+}
@@ -0,0 +1,43 @@
+#ifndef CHAT_CATALOG_H
+#define CHAT_CATALOG_H
+
+#include <glib.h>
+#include "conversation.h"
+
+typedef struct {
+    char *id;
+    char *title; // NULL until the chat is renamed
+    gint64 modified_at; // unix time in seconds
+    guint message_count;
+    char *preview; // start of the first user message, NULL if none
+    char *model;
+    gint position; // in the display order less the catalog's shift, see chat_catalog_get_position()
+} ChatCatalogEntry;
+
+typedef struct ChatCatalog ChatCatalog;
+
+typedef enum {
+    CHAT_CATALOG_UNCHANGED,
+    CHAT_CATALOG_ADDED, // at position 0
+    CHAT_CATALOG_UPDATED,
+    CHAT_CATALOG_REMOVED,
+} ChatCatalogChange;
+
+ChatCatalog *chat_catalog_load(const char *dir);
+void chat_catalog_free(ChatCatalog *catalog);
+
+guint chat_catalog_get_length(ChatCatalog *catalog);
+const ChatCatalogEntry *chat_catalog_get_entry(ChatCatalog *catalog, guint position);
+const ChatCatalogEntry *chat_catalog_lookup(ChatCatalog *catalog, const char *id);
+gint chat_catalog_get_position(ChatCatalog *catalog, const char *id);
+const char *chat_catalog_entry_get_title(const ChatCatalogEntry *entry);
+
+void chat_catalog_add(ChatCatalog *catalog, const char *id);
+gboolean chat_catalog_update(ChatCatalog *catalog, const char *id, Conversation *conversation, const char *model);
+void chat_catalog_set_title(ChatCatalog *catalog, const char *id, const char *title);
+void chat_catalog_remove(ChatCatalog *catalog, const char *id);
+ChatCatalogChange chat_catalog_rescan(ChatCatalog *catalog, const char *id);
+
+gboolean chat_catalog_is_chat_filename(const char *filename);
+
+#endif // CHAT_CATALOG_H
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <json-c/json.h>
+#include "chat_journal.h"
+#include "json_util.h"
+#include "persist.h"
+#include "chat_pack.h"
+
+/**
+ * A chat is stored as a snapshot (the JSON array of conversation_to_json())
+ * plus a journal of what happened since, one JSON record per line:
+ *
+ *   {"index":3,"role":"user","content":"…","created_at":…}   a stored message
+ *   {"index":4,"partial":"…"}                                 streamed text
+ *   {"summary":"…","covers":3}                                a new summary
+ *
+ * Saving a turn appends one record. Partial records carry only the text
+ * streamed since the previous checkpoint; if the journal ends with some, the
+ * response was interrupted and is recovered on load. Records are keyed by
+ * message index, so replaying one the snapshot already holds is harmless.
+ *
+ * Once the journal outgrows the snapshot, the conversation is written as a
+ * new snapshot and the journal is emptied, which keeps the cost of
+ * compaction proportional to the number of turns saved. All writes go
+ * through the persist thread, in order, and a chat is opened by a read on
+ * that thread queued behind them, so the main loop never waits on the disk.
+ *
+ * A chat that was moved into a pack has no snapshot file; its packed copy
+ * stands in for one until the chat changes, when it gets a snapshot file of
+ * its own again.
+ */
+#define JOURNAL_MIN_COMPACT_BYTES (64 * 1024)
+
+struct ChatJournal {
+    char *path;
+    char *journal_path;
+    Conversation *conversation;
+    guint synced;        // messages written to the snapshot or journal
+    guint partial_index; // message the checkpointed text belongs to
+    gsize partial_len;   // bytes of it already checkpointed
+    gsize journal_bytes;
+    gsize snapshot_bytes;
+    gboolean packed; // the snapshot is in a pack, not yet at `path`
+};
+
+// A chat being read on the persist thread for chat_journal_load().
+typedef struct {
+    char *path;
+    char *journal_path;
+    Conversation *conversation;
+    GString *partial;
+    gsize snapshot_bytes;
+    gsize journal_bytes;
+    gboolean packed;
+    ChatJournalLoadFunc callback;
+    gpointer user_data;
+} ChatLoad;
+
+// --- Private Helper Functions ---
+
+static gsize file_size(const char *path) {
+    GStatBuf st;
+    return g_stat(path, &st) == 0 ? (gsize)st.st_size : 0;
+}
+
+static ChatJournal *journal_new(const char *path, Conversation *conversation) {
+    ChatJournal *journal = g_new0(ChatJournal, 1);
+    journal->path = g_strdup(path);
+    journal->journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+    journal->conversation = conversation_ref(conversation);
+    journal->synced = conversation_get_length(conversation);
+    journal->partial_index = G_MAXUINT;
+    return journal;
+}
+
+// Drops the incomplete last record a crash may have left, so that the next
+// one starts on a line of its own.
+static void trim_torn_record(const char *journal_path) {
+    FILE *file = fopen(journal_path, "r");
+    if (!file) return;
+    gboolean torn = fseek(file, -1, SEEK_END) == 0 && fgetc(file) != '\n';
+    fclose(file);
+    if (!torn) return;
+
+    char *contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(journal_path, &contents, &length, NULL)) return;
+    const char *last = g_strrstr_len(contents, length, "\n");
+    if (truncate(journal_path, last ? last - contents + 1 : 0) != 0) {
+        fprintf(stderr, "Error truncating chat journal %s\n", journal_path);
+    }
+    g_free(contents);
+}
+
+// Queues `records` (complete lines) for appending to the journal.
+static void write_records(ChatJournal *journal, GString *records) {
+    journal->journal_bytes += records->len;
+    GBytes *bytes = g_string_free_to_bytes(records);
+    persist_append(journal->journal_path, bytes);
+    g_bytes_unref(bytes);
+}
+
+// Replays `contents` onto `conversation`. Returns the text of an interrupted
+// response (NULL if none). A torn last line, left by a crash, ends the replay.
+static GString *replay(Conversation *conversation, const char *contents, gsize length) {
+    json_tokener *tokener = json_tokener_new();
+    GString *partial = NULL;
+    guint partial_index = 0;
+    const char *line = contents;
+    const char *end = contents + length;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', end - line);
+        if (!newline) break;
+        json_tokener_reset(tokener);
+        json_object *record = json_tokener_parse_ex(tokener, line, newline - line);
+        line = newline + 1;
+        if (!record) break;
+
+        json_object *val;
+        guint index = json_object_object_get_ex(record, "index", &val) ? (guint)json_object_get_int(val) : G_MAXUINT;
+        guint length_now = conversation_get_length(conversation);
+        if (json_object_object_get_ex(record, "summary", &val)) {
+            json_object *covers;
+            if (json_object_object_get_ex(record, "covers", &covers)) {
+                conversation_set_summary(conversation, json_object_get_string(val), json_object_get_int(covers));
+            }
+        } else if (json_object_object_get_ex(record, "partial", &val)) {
+            if (index == length_now) {
+                if (!partial || partial_index != index) {
+                    if (partial) g_string_free(partial, TRUE);
+                    partial = g_string_new(NULL);
+                    partial_index = index;
+                }
+                g_string_append_len(partial, json_object_get_string(val), json_object_get_string_len(val));
+            }
+        } else if (index == length_now) {
+            conversation_append_from_json(conversation, record);
+        }
+        json_object_put(record);
+    }
+    json_tokener_free(tokener);
+    if (partial && partial_index != conversation_get_length(conversation)) {
+        g_string_free(partial, TRUE);
+        partial = NULL;
+    }
+    return partial;
+}
+
+static void compact(ChatJournal *journal) {
+    GString *snapshot = g_string_sized_new(journal->snapshot_bytes + journal->journal_bytes);
+    conversation_to_json(journal->conversation, snapshot);
+    journal->snapshot_bytes = snapshot->len;
+    journal->journal_bytes = 0;
+    GBytes *bytes = g_string_free_to_bytes(snapshot);
+    persist_compact(journal->path, bytes, journal->journal_path);
+    g_bytes_unref(bytes);
+}
+
+/**
+ * Writes the conversation as the new snapshot when the journal outgrew the
+ * one there is, or the chat is still packed. Returns whether it did; the
+ * journal is then empty.
+ */
+static gboolean compact_if_due(ChatJournal *journal) {
+    if (!journal->packed && journal->journal_bytes < MAX(JOURNAL_MIN_COMPACT_BYTES, journal->snapshot_bytes)) {
+        return FALSE;
+    }
+    journal->synced = conversation_get_length(journal->conversation);
+    compact(journal);
+    if (journal->packed) {
+        // Dropped from the pack only after the snapshot is written
+        journal->packed = FALSE;
+        chat_pack_remove(journal->path);
+    }
+    return TRUE;
+}
+
+// Reads the snapshot of the chat at `path`, or its packed copy, then its
+// journal. The text of an interrupted response is returned in `partial`, or
+// dropped if that is NULL.
+static Conversation *read_chat(const char *path, GString **partial) {
+    Conversation *conversation = conversation_new_from_file(path);
+    if (!conversation) {
+        GBytes *packed = chat_pack_read(path);
+        if (!packed) return NULL;
+        conversation = conversation_new_from_bytes(packed);
+        g_bytes_unref(packed);
+        if (!conversation) return NULL;
+    }
+
+    char *journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+    char *contents = NULL;
+    gsize length = 0;
+    if (g_file_get_contents(journal_path, &contents, &length, NULL)) {
+        GString *text = replay(conversation, contents, length);
+        if (partial) {
+            *partial = text;
+        } else if (text) {
+            g_string_free(text, TRUE);
+        }
+        g_free(contents);
+    }
+    g_free(journal_path);
+    return conversation;
+}
+
+// Back on the main loop: opens the journal of the chat read, restores an
+// interrupted response, and hands both over.
+static gboolean finish_load(gpointer user_data) {
+    ChatLoad *load = (ChatLoad *)user_data;
+    ChatJournal *journal = NULL;
+    if (load->conversation) {
+        journal = journal_new(load->path, load->conversation);
+        journal->snapshot_bytes = load->snapshot_bytes;
+        journal->journal_bytes = load->journal_bytes;
+        journal->packed = load->packed;
+        if (load->partial) {
+            journal->synced = conversation_append(load->conversation, CONVERSATION_ROLE_ASSISTANT,
+                                                  load->partial->str, load->partial->len);
+            chat_journal_sync(journal);
+        }
+    }
+    load->callback(load->conversation, journal, load->user_data);
+    if (load->partial) g_string_free(load->partial, TRUE);
+    g_free(load->path);
+    g_free(load->journal_path);
+    g_free(load);
+    return G_SOURCE_REMOVE;
+}
+
+// Reads the chat, and drops a torn record from its journal before anything
+// is appended to it.
+static void load_on_persist_thread(gpointer data) {
+    ChatLoad *load = (ChatLoad *)data;
+    load->conversation = read_chat(load->path, &load->partial);
+    if (load->conversation) {
+        GStatBuf st;
+        load->packed = g_stat(load->path, &st) != 0;
+        load->snapshot_bytes = load->packed ? 0 : (gsize)st.st_size;
+        trim_torn_record(load->journal_path);
+        load->journal_bytes = file_size(load->journal_path);
+    }
+    g_idle_add(finish_load, load);
+}
+
+// --- Public Functions ---
+
+// Like chat_journal_load(), but never writes: an interrupted response is
+// left out. Safe to call from any thread.
+Conversation *chat_journal_read(const char *path) {
+    return read_chat(path, NULL);
+}
+
+// The chat at `path` as one snapshot, with an interrupted response restored
+// as by chat_journal_load(), but without writing anything. Safe to call from
+// any thread.
+GBytes *chat_journal_read_snapshot(const char *path) {
+    GString *partial = NULL;
+    Conversation *conversation = read_chat(path, &partial);
+    if (!conversation) return NULL;
+    if (partial) {
+        conversation_append(conversation, CONVERSATION_ROLE_ASSISTANT, partial->str, partial->len);
+        g_string_free(partial, TRUE);
+    }
+    GString *json = g_string_new(NULL);
+    conversation_to_json(conversation, json);
+    conversation_unref(conversation);
+    return g_string_free_to_bytes(json);
+}
+
+/**
+ * Reads the chat at `path` on the persist thread, behind the writes queued
+ * for it, and hands it to `callback` on the main loop with its journal open;
+ * both NULL if the chat has no files. An interrupted response is restored
+ * as an assistant message and written back as such.
+ */
+void chat_journal_load(const char *path, ChatJournalLoadFunc callback, gpointer user_data) {
+    ChatLoad *load = g_new0(ChatLoad, 1);
+    load->path = g_strdup(path);
+    load->journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+    load->callback = callback;
+    load->user_data = user_data;
+    persist_call(load->path, load->journal_path, load_on_persist_thread, load);
+}
+
+// Starts journaling the new chat `conversation`, writing its first snapshot.
+ChatJournal *chat_journal_new(const char *path, Conversation *conversation) {
+    ChatJournal *journal = journal_new(path, conversation);
+    GString *json = g_string_new(NULL);
+    conversation_to_json(conversation, json);
+    journal->snapshot_bytes = json->len;
+    GBytes *bytes = g_string_free_to_bytes(json);
+    persist_write(path, bytes);
+    g_bytes_unref(bytes);
+    return journal;
+}
+
+// Stops journaling. Writes already queued still complete.
+void chat_journal_close(ChatJournal *journal) {
+    if (!journal) return;
+    conversation_unref(journal->conversation);
+    g_free(journal->path);
+    g_free(journal->journal_path);
+    g_free(journal);
+}
+
+// Appends the messages added to the conversation since the last sync.
+void chat_journal_sync(ChatJournal *journal) {
+    guint length = conversation_get_length(journal->conversation);
+    if (journal->synced >= length || compact_if_due(journal)) return;
+
+    GString *message = g_string_new(NULL);
+    GString *records = g_string_new(NULL);
+    for (; journal->synced < length; journal->synced++) {
+        g_string_truncate(message, 0);
+        conversation_append_message_json(journal->conversation, journal->synced, TRUE, message);
+        g_string_append_printf(records, "{\"index\":%u,", journal->synced);
+        g_string_append_len(records, message->str + 1, message->len - 1);
+        g_string_append_c(records, '\n');
+    }
+    g_string_free(message, TRUE);
+    write_records(journal, records);
+}
+
+// Records the conversation's summary, replacing the one stored. Messages not
+// synced yet are left for chat_journal_sync(), unless the chat is compacted.
+void chat_journal_save_summary(ChatJournal *journal) {
+    if (compact_if_due(journal)) return;
+    GString *record = g_string_new(NULL);
+    conversation_append_summary_json(journal->conversation, record);
+    g_string_append_c(record, '\n');
+    write_records(journal, record);
+}
+
+/**
+ * Records the response streamed so far (`len` bytes of `text`) for the next
+ * message of the conversation. Only the text added since the previous
+ * checkpoint is written.
+ */
+void chat_journal_checkpoint(ChatJournal *journal, const char *text, gsize len) {
+    guint index = conversation_get_length(journal->conversation);
+    if (journal->partial_index != index) {
+        journal->partial_index = index;
+        journal->partial_len = 0;
+    }
+    if (len <= journal->partial_len) return;
+    GString *record = g_string_new(NULL);
+    g_string_append_printf(record, "{\"index\":%u,\"partial\":", index);
+    json_util_append_string(record, text + journal->partial_len, len - journal->partial_len);
+    g_string_append(record, "}\n");
+    write_records(journal, record);
+    journal->partial_len = len;
+}
+
+// Removes every stored copy of the chat at `path`, once the writes queued
+// for it are done.
+void chat_journal_remove_files(const char *path) {
+    chat_pack_remove(path);
+    char *journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+    persist_remove(path);
+    persist_remove(journal_path);
+    g_free(journal_path);
+}
@@ -0,0 +1,26 @@
+#ifndef CHAT_JOURNAL_H
+#define CHAT_JOURNAL_H
+
+#include <glib.h>
+#include "conversation.h"
+
+// Suffix of the journal kept next to each chat file.
+#define CHAT_JOURNAL_SUFFIX ".journal"
+
+typedef struct ChatJournal ChatJournal;
+
+// Receives a loaded chat and its journal, both owned by the callee.
+typedef void (*ChatJournalLoadFunc)(Conversation *conversation, ChatJournal *journal, gpointer user_data);
+
+void chat_journal_load(const char *path, ChatJournalLoadFunc callback, gpointer user_data);
+Conversation *chat_journal_read(const char *path);
+GBytes *chat_journal_read_snapshot(const char *path);
+ChatJournal *chat_journal_new(const char *path, Conversation *conversation);
+void chat_journal_close(ChatJournal *journal);
+void chat_journal_sync(ChatJournal *journal);
+void chat_journal_save_summary(ChatJournal *journal);
+void chat_journal_checkpoint(ChatJournal *journal, const char *text, gsize len);
+
+void chat_journal_remove_files(const char *path);
+
+#endif // CHAT_JOURNAL_H
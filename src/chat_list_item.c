@@ -0,0 +1,130 @@
+#include "chat_list_item.h"
+
+// One entry of the history sidebar model. It keeps a copy of what the row
+// shows from the catalog entry, as entries are freed when a chat is deleted
+// while the list view may still hold the item for a moment.
+struct _ChatListItem {
+    GObject parent_instance;
+    char *id;
+    char *title;
+    char *preview; // NULL unless the chat was renamed, see chat_list_item_get_preview()
+    gint64 modified_at;
+    gboolean busy; // a response is being generated
+};
+
+enum {
+    PROP_0,
+    PROP_TITLE,
+    PROP_PREVIEW,
+    PROP_MODIFIED_AT,
+    PROP_BUSY,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES];
+
+G_DEFINE_TYPE(ChatListItem, chat_list_item, G_TYPE_OBJECT)
+
+static void set_string(ChatListItem *item, char **field, const char *value, guint prop_id) {
+    if (g_strcmp0(*field, value) == 0) return;
+    g_free(*field);
+    *field = g_strdup(value);
+    g_object_notify_by_pspec(G_OBJECT(item), properties[prop_id]);
+}
+
+static void chat_list_item_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec) {
+    ChatListItem *item = CHAT_LIST_ITEM(object);
+    switch (prop_id) {
+        case PROP_TITLE:
+            g_value_set_string(value, item->title);
+            break;
+        case PROP_PREVIEW:
+            g_value_set_string(value, item->preview);
+            break;
+        case PROP_MODIFIED_AT:
+            g_value_set_int64(value, item->modified_at);
+            break;
+        case PROP_BUSY:
+            g_value_set_boolean(value, item->busy);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    }
+}
+
+static void chat_list_item_finalize(GObject *object) {
+    ChatListItem *item = CHAT_LIST_ITEM(object);
+    g_free(item->id);
+    g_free(item->title);
+    g_free(item->preview);
+    G_OBJECT_CLASS(chat_list_item_parent_class)->finalize(object);
+}
+
+static void chat_list_item_class_init(ChatListItemClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    object_class->get_property = chat_list_item_get_property;
+    object_class->finalize = chat_list_item_finalize;
+    properties[PROP_TITLE] = g_param_spec_string("title", NULL, NULL, NULL,
+                                                 G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    properties[PROP_PREVIEW] = g_param_spec_string("preview", NULL, NULL, NULL,
+                                                   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    properties[PROP_MODIFIED_AT] = g_param_spec_int64("modified-at", NULL, NULL, 0, G_MAXINT64, 0,
+                                                      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    properties[PROP_BUSY] = g_param_spec_boolean("busy", NULL, NULL, FALSE,
+                                                 G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_properties(object_class, N_PROPERTIES, properties);
+}
+
+static void chat_list_item_init(ChatListItem *item) {
+    (void)item;
+}
+
+ChatListItem *chat_list_item_new(const ChatCatalogEntry *entry) {
+    ChatListItem *item = g_object_new(CHAT_TYPE_LIST_ITEM, NULL);
+    item->id = g_strdup(entry->id);
+    item->title = g_strdup(chat_catalog_entry_get_title(entry));
+    item->preview = entry->title ? g_strdup(entry->preview) : NULL;
+    item->modified_at = entry->modified_at;
+    return item;
+}
+
+// Takes over the current state of `entry`, notifying the fields that changed,
+// so a bound row stays in place and keeps its selection.
+void chat_list_item_update(ChatListItem *item, const ChatCatalogEntry *entry) {
+    g_object_freeze_notify(G_OBJECT(item));
+    set_string(item, &item->title, chat_catalog_entry_get_title(entry), PROP_TITLE);
+    set_string(item, &item->preview, entry->title ? entry->preview : NULL, PROP_PREVIEW);
+    if (item->modified_at != entry->modified_at) {
+        item->modified_at = entry->modified_at;
+        g_object_notify_by_pspec(G_OBJECT(item), properties[PROP_MODIFIED_AT]);
+    }
+    g_object_thaw_notify(G_OBJECT(item));
+}
+
+const char *chat_list_item_get_id(ChatListItem *item) {
+    return item->id;
+}
+
+const char *chat_list_item_get_title(ChatListItem *item) {
+    return item->title;
+}
+
+// Start of the first user message, for chats whose title was set by the user.
+// Otherwise the title already is that text and there is no preview.
+const char *chat_list_item_get_preview(ChatListItem *item) {
+    return item->preview;
+}
+
+gint64 chat_list_item_get_modified_at(ChatListItem *item) {
+    return item->modified_at;
+}
+
+gboolean chat_list_item_get_busy(ChatListItem *item) {
+    return item->busy;
+}
+
+void chat_list_item_set_busy(ChatListItem *item, gboolean busy) {
+    if (item->busy == busy) return;
+    item->busy = busy;
+    g_object_notify_by_pspec(G_OBJECT(item), properties[PROP_BUSY]);
+}
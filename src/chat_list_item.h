@@ -0,0 +1,19 @@
+#ifndef CHAT_LIST_ITEM_H
+#define CHAT_LIST_ITEM_H
+
+#include <glib-object.h>
+#include "chat_catalog.h"
+
+#define CHAT_TYPE_LIST_ITEM (chat_list_item_get_type())
+G_DECLARE_FINAL_TYPE(ChatListItem, chat_list_item, CHAT, LIST_ITEM, GObject)
+
+ChatListItem *chat_list_item_new(const ChatCatalogEntry *entry);
+void chat_list_item_update(ChatListItem *item, const ChatCatalogEntry *entry);
+const char *chat_list_item_get_id(ChatListItem *item);
+const char *chat_list_item_get_title(ChatListItem *item);
+const char *chat_list_item_get_preview(ChatListItem *item);
+gint64 chat_list_item_get_modified_at(ChatListItem *item);
+gboolean chat_list_item_get_busy(ChatListItem *item);
+void chat_list_item_set_busy(ChatListItem *item, gboolean busy);
+
+#endif // CHAT_LIST_ITEM_H
@@ -0,0 +1,122 @@
+#include "chat_list_model.h"
+
+/**
+ * GListModel view of the chat catalog, in its display order. Like the
+ * transcript model, items are only created for positions the list view asks
+ * for, so building the sidebar costs the same whatever the number of chats.
+ * The catalog is edited by the caller, who then reports the edit here; the
+ * item cache is kept parallel to the catalog order.
+ */
+struct _ChatListModel {
+    GObject parent_instance;
+    ChatCatalog *catalog; // not owned
+    GPtrArray *items;     // ChatListItem cache, NULL until requested
+    GHashTable *busy_ids; // chats generating a response
+};
+
+static void chat_list_model_list_model_init(GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(ChatListModel, chat_list_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL, chat_list_model_list_model_init))
+
+static GType chat_list_model_get_item_type(GListModel *list) {
+    (void)list;
+    return CHAT_TYPE_LIST_ITEM;
+}
+
+static guint chat_list_model_get_n_items(GListModel *list) {
+    return CHAT_LIST_MODEL(list)->items->len;
+}
+
+static gpointer chat_list_model_get_item(GListModel *list, guint position) {
+    ChatListModel *model = CHAT_LIST_MODEL(list);
+    if (position >= model->items->len) return NULL;
+    ChatListItem *item = g_ptr_array_index(model->items, position);
+    if (!item) {
+        const ChatCatalogEntry *entry = chat_catalog_get_entry(model->catalog, position);
+        item = chat_list_item_new(entry);
+        chat_list_item_set_busy(item, g_hash_table_contains(model->busy_ids, entry->id));
+        g_ptr_array_index(model->items, position) = item;
+    }
+    return g_object_ref(item);
+}
+
+static void chat_list_model_list_model_init(GListModelInterface *iface) {
+    iface->get_item_type = chat_list_model_get_item_type;
+    iface->get_n_items = chat_list_model_get_n_items;
+    iface->get_item = chat_list_model_get_item;
+}
+
+static void chat_list_model_finalize(GObject *object) {
+    ChatListModel *model = CHAT_LIST_MODEL(object);
+    g_ptr_array_unref(model->items);
+    g_hash_table_unref(model->busy_ids);
+    G_OBJECT_CLASS(chat_list_model_parent_class)->finalize(object);
+}
+
+static void chat_list_model_class_init(ChatListModelClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = chat_list_model_finalize;
+}
+
+static void unref_item(gpointer item) {
+    if (item) g_object_unref(item);
+}
+
+static void chat_list_model_init(ChatListModel *model) {
+    model->items = g_ptr_array_new_with_free_func(unref_item);
+    model->busy_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+ChatListModel *chat_list_model_new(void) {
+    return g_object_new(CHAT_TYPE_LIST_MODEL, NULL);
+}
+
+// Shows the chats of `catalog` (may be NULL), which must outlive the model
+// or be replaced first.
+void chat_list_model_set_catalog(ChatListModel *model, ChatCatalog *catalog) {
+    guint removed = model->items->len;
+    g_ptr_array_set_size(model->items, 0);
+    model->catalog = catalog;
+    if (catalog) {
+        g_ptr_array_set_size(model->items, chat_catalog_get_length(catalog));
+    }
+    g_list_model_items_changed(G_LIST_MODEL(model), 0, removed, model->items->len);
+}
+
+// The catalog gained an entry at `position`.
+void chat_list_model_inserted(ChatListModel *model, guint position) {
+    g_return_if_fail(position <= model->items->len);
+    g_ptr_array_insert(model->items, position, NULL);
+    g_list_model_items_changed(G_LIST_MODEL(model), position, 0, 1);
+}
+
+// The catalog entry at `position` was removed.
+void chat_list_model_removed(ChatListModel *model, guint position) {
+    g_return_if_fail(position < model->items->len);
+    g_ptr_array_remove_index(model->items, position);
+    g_list_model_items_changed(G_LIST_MODEL(model), position, 1, 0);
+}
+
+// The catalog entry at `position` changed. Its item is updated in place
+// rather than replaced, so the row stays bound and selected.
+void chat_list_model_changed(ChatListModel *model, guint position) {
+    g_return_if_fail(position < model->items->len);
+    ChatListItem *item = g_ptr_array_index(model->items, position);
+    if (item) {
+        chat_list_item_update(item, chat_catalog_get_entry(model->catalog, position));
+    }
+}
+
+// Marks the chat `id` as generating a response, or not any more. Also holds
+// for a chat not in the catalog (yet).
+void chat_list_model_set_busy(ChatListModel *model, const char *id, gboolean busy) {
+    if (busy) {
+        g_hash_table_add(model->busy_ids, g_strdup(id));
+    } else {
+        g_hash_table_remove(model->busy_ids, id);
+    }
+    gint position = model->catalog ? chat_catalog_get_position(model->catalog, id) : -1;
+    if (position < 0) return;
+    ChatListItem *item = g_ptr_array_index(model->items, position);
+    if (item) chat_list_item_set_busy(item, busy);
+}
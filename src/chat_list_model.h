@@ -0,0 +1,18 @@
+#ifndef CHAT_LIST_MODEL_H
+#define CHAT_LIST_MODEL_H
+
+#include <gio/gio.h>
+#include "chat_catalog.h"
+#include "chat_list_item.h"
+
+#define CHAT_TYPE_LIST_MODEL (chat_list_model_get_type())
+G_DECLARE_FINAL_TYPE(ChatListModel, chat_list_model, CHAT, LIST_MODEL, GObject)
+
+ChatListModel *chat_list_model_new(void);
+void chat_list_model_set_catalog(ChatListModel *model, ChatCatalog *catalog);
+void chat_list_model_inserted(ChatListModel *model, guint position);
+void chat_list_model_removed(ChatListModel *model, guint position);
+void chat_list_model_changed(ChatListModel *model, guint position);
+void chat_list_model_set_busy(ChatListModel *model, const char *id, gboolean busy);
+
+#endif // CHAT_LIST_MODEL_H
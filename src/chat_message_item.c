@@ -0,0 +1,107 @@
+#include "chat_message_item.h"
+
+// One entry of the chat transcript model. It refers to a message of the
+// conversation store instead of holding a copy of its text. A pending item
+// has no message yet: a user message whose context is still being gathered
+// keeps its typed `text`, and a streaming assistant response lives in the
+// response_buffer of its ChatSession until it is complete.
+struct _ChatMessageItem {
+    GObject parent_instance;
+    Conversation *conversation;
+    guint index;
+    ConversationRole role;
+    char *text;
+    char *status;
+};
+
+enum {
+    PROP_0,
+    PROP_STATUS,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES];
+
+G_DEFINE_TYPE(ChatMessageItem, chat_message_item, G_TYPE_OBJECT)
+
+static void chat_message_item_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec) {
+    ChatMessageItem *item = CHAT_MESSAGE_ITEM(object);
+    switch (prop_id) {
+        case PROP_STATUS:
+            g_value_set_string(value, item->status);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    }
+}
+
+static void chat_message_item_finalize(GObject *object) {
+    ChatMessageItem *item = CHAT_MESSAGE_ITEM(object);
+    conversation_unref(item->conversation);
+    g_free(item->text);
+    g_free(item->status);
+    G_OBJECT_CLASS(chat_message_item_parent_class)->finalize(object);
+}
+
+static void chat_message_item_class_init(ChatMessageItemClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    object_class->get_property = chat_message_item_get_property;
+    object_class->finalize = chat_message_item_finalize;
+    // Progress line shown under a pending message, NULL when there is none
+    properties[PROP_STATUS] = g_param_spec_string("status", NULL, NULL, NULL,
+                                                  G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_properties(object_class, N_PROPERTIES, properties);
+}
+
+static void chat_message_item_init(ChatMessageItem *item) {
+    (void)item;
+}
+
+ChatMessageItem *chat_message_item_new(Conversation *conversation, guint index) {
+    ChatMessageItem *item = g_object_new(CHAT_TYPE_MESSAGE_ITEM, NULL);
+    item->conversation = conversation_ref(conversation);
+    item->index = index;
+    return item;
+}
+
+ChatMessageItem *chat_message_item_new_pending(ConversationRole role, const char *text) {
+    ChatMessageItem *item = g_object_new(CHAT_TYPE_MESSAGE_ITEM, NULL);
+    item->role = role;
+    item->text = g_strdup(text);
+    return item;
+}
+
+// Points a pending item at the message it was stored as.
+void chat_message_item_finish(ChatMessageItem *item, Conversation *conversation, guint index) {
+    conversation_unref(item->conversation);
+    item->conversation = conversation_ref(conversation);
+    item->index = index;
+    g_clear_pointer(&item->text, g_free);
+    chat_message_item_set_status(item, NULL);
+}
+
+gboolean chat_message_item_get_is_user(ChatMessageItem *item) {
+    if (!item->conversation) return item->role == CONVERSATION_ROLE_USER;
+    return conversation_get_message(item->conversation, item->index)->role == CONVERSATION_ROLE_USER;
+}
+
+const char *chat_message_item_get_content(ChatMessageItem *item) {
+    if (!item->conversation) return item->text ? item->text : "";
+    return conversation_get_content(item->conversation, item->index);
+}
+
+// TRUE for an assistant response that is still streaming in.
+gboolean chat_message_item_get_streaming(ChatMessageItem *item) {
+    return !item->conversation && item->role == CONVERSATION_ROLE_ASSISTANT;
+}
+
+const char *chat_message_item_get_status(ChatMessageItem *item) {
+    return item->status;
+}
+
+void chat_message_item_set_status(ChatMessageItem *item, const char *status) {
+    if (g_strcmp0(item->status, status) == 0) return;
+    g_free(item->status);
+    item->status = g_strdup(status);
+    g_object_notify_by_pspec(G_OBJECT(item), properties[PROP_STATUS]);
+}
@@ -0,0 +1,19 @@
+#ifndef CHAT_MESSAGE_ITEM_H
+#define CHAT_MESSAGE_ITEM_H
+
+#include <glib-object.h>
+#include "conversation.h"
+
+#define CHAT_TYPE_MESSAGE_ITEM (chat_message_item_get_type())
+G_DECLARE_FINAL_TYPE(ChatMessageItem, chat_message_item, CHAT, MESSAGE_ITEM, GObject)
+
+ChatMessageItem *chat_message_item_new(Conversation *conversation, guint index);
+ChatMessageItem *chat_message_item_new_pending(ConversationRole role, const char *text);
+void chat_message_item_finish(ChatMessageItem *item, Conversation *conversation, guint index);
+gboolean chat_message_item_get_is_user(ChatMessageItem *item);
+const char *chat_message_item_get_content(ChatMessageItem *item);
+gboolean chat_message_item_get_streaming(ChatMessageItem *item);
+const char *chat_message_item_get_status(ChatMessageItem *item);
+void chat_message_item_set_status(ChatMessageItem *item, const char *status);
+
+#endif // CHAT_MESSAGE_ITEM_H
@@ -0,0 +1,653 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <json-c/json.h>
+#include <zstd.h>
+#include <zdict.h>
+#include "chat_pack.h"
+#include "chat_journal.h"
+#include "json_util.h"
+#include "persist.h"
+
+/**
+ * Chats that have not changed for a while are moved out of their loose files
+ * into packs in `.packs` of the history directory, which keeps the directory
+ * small and the history a fraction of its size: chats share most of their
+ * structure, which a dictionary trained on them captures. A pack is two
+ * files:
+ *
+ *   <name>.pack    a zstd dictionary trained on the chats of the pack, then
+ *                  one zstd frame per chat, compressed with it
+ *   <name>.index   JSON lines: {"dict_size":…}, then one line per chat,
+ *                  {"id":…,"offset":…,"size":…,"length":…,"modified_at":…}
+ *
+ * Every index is read at startup; a chat is decompressed, on its own, when it
+ * is read. The loose files of a chat always win over its packed copy, and a
+ * chat leaves its pack (its index is rewritten) when it is written loose
+ * again or deleted. A pack left without chats is removed.
+ *
+ * Packs are built on a thread of their own, from chats the caller found
+ * cold, and each is committed on the main thread as soon as it is built,
+ * where each chat is checked again before its loose files are removed. All
+ * writes go through the persist thread, so the loose files only go once the
+ * pack is on disk.
+ */
+#define PACK_DIR ".packs"
+#define PACK_SUFFIX ".pack"
+#define PACK_INDEX_SUFFIX ".index"
+#define PACK_MAX_BYTES (64 * 1024 * 1024) // of uncompressed chats
+#define PACK_DICT_SIZE (64 * 1024)
+#define PACK_MIN_SAMPLES 8
+#define PACK_SAMPLE_BYTES (16 * 1024)        // per chat, at most
+#define PACK_SAMPLE_TOTAL (4 * 1024 * 1024)  // per pack, at most
+#define PACK_LEVEL 9
+
+typedef struct {
+    char *name;
+    gsize dict_size;
+    guint chats;       // entries in its index
+    GMappedFile *file; // NULL until first read
+    ZSTD_DDict *ddict; // NULL until first read, or if there is no dictionary
+} Pack;
+
+typedef struct {
+    char *id;
+    Pack *pack;
+    guint64 offset;
+    guint64 size;   // compressed
+    guint64 length; // decompressed
+    gint64 modified_at;
+} PackedChat;
+
+/**
+ * The loose files of a chat as they were when it was read for packing, to
+ * tell whether they were written since: a snapshot write replaces the file,
+ * and a journal write changes its size, also within the same second.
+ */
+typedef struct {
+    guint64 snapshot_inode;
+    goffset snapshot_size;
+    guint64 journal_inode;
+    goffset journal_size;
+    gint64 modified_at;
+} LooseFiles;
+
+// A pack built by the migration thread, not written yet.
+typedef struct {
+    GBytes *data;
+    gsize dict_size;
+    GPtrArray *chats; // PackedChat, without `pack`
+    GPtrArray *paths; // of the chats
+    GArray *files;    // LooseFiles of the chats, as they were read
+} NewPack;
+
+typedef struct {
+    GPtrArray *paths; // of the chats to pack
+    GMutex lock;      // guards `packs`, `finished` and `commit_queued`
+    GQueue packs;     // NewPack built, not committed yet
+    gboolean finished;
+    gboolean commit_queued; // commit_built_packs() is due to run
+    guint committed;  // packs committed so far
+    ChatPackCheckFunc check_func;
+    gpointer user_data;
+} Migration;
+
+static GMutex pack_lock; // guards `packed`, `packs` and the packs' mappings
+static char *pack_dir = NULL;
+static GHashTable *packed = NULL; // id -> PackedChat
+static GPtrArray *packs = NULL;   // Pack
+static char *newest_name = NULL;  // of the packs read or written
+static GThread *migration_thread = NULL;
+static Migration *current_migration = NULL;
+static gint quitting = FALSE;
+
+// --- Private Helper Functions ---
+
+static void free_pack(gpointer data) {
+    Pack *pack = data;
+    if (pack->file) g_mapped_file_unref(pack->file);
+    ZSTD_freeDDict(pack->ddict);
+    g_free(pack->name);
+    g_free(pack);
+}
+
+static void free_packed_chat(gpointer data) {
+    PackedChat *chat = data;
+    g_free(chat->id);
+    g_free(chat);
+}
+
+static void free_new_pack(gpointer data) {
+    NewPack *new_pack = data;
+    if (new_pack->data) g_bytes_unref(new_pack->data);
+    g_ptr_array_unref(new_pack->chats);
+    g_ptr_array_unref(new_pack->paths);
+    g_array_unref(new_pack->files);
+    g_free(new_pack);
+}
+
+static void free_migration(Migration *migration) {
+    g_ptr_array_unref(migration->paths);
+    g_queue_clear_full(&migration->packs, free_new_pack);
+    g_mutex_clear(&migration->lock);
+    g_free(migration);
+}
+
+static char *pack_path(const char *name, const char *suffix) {
+    char *filename = g_strconcat(name, suffix, NULL);
+    char *path = g_build_filename(pack_dir, filename, NULL);
+    g_free(filename);
+    return path;
+}
+
+// Queues the index of `pack` for writing. Called with the lock held.
+static void write_index(Pack *pack) {
+    GString *index = g_string_new(NULL);
+    g_string_append_printf(index, "{\"dict_size\":%" G_GSIZE_FORMAT "}\n", pack->dict_size);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, packed);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        PackedChat *chat = value;
+        if (chat->pack != pack) continue;
+        g_string_append(index, "{\"id\":");
+        json_util_append_string(index, chat->id, -1);
+        g_string_append_printf(index, ",\"offset\":%" G_GUINT64_FORMAT ",\"size\":%" G_GUINT64_FORMAT
+                               ",\"length\":%" G_GUINT64_FORMAT ",\"modified_at\":%" G_GINT64_FORMAT "}\n",
+                               chat->offset, chat->size, chat->length, chat->modified_at);
+    }
+    char *path = pack_path(pack->name, PACK_INDEX_SUFFIX);
+    GBytes *bytes = g_string_free_to_bytes(index);
+    persist_write(path, bytes);
+    g_bytes_unref(bytes);
+    g_free(path);
+}
+
+// Queues the removal of both files of `pack` and frees it. Called with the
+// lock held.
+static void remove_pack(Pack *pack) {
+    char *index_path = pack_path(pack->name, PACK_INDEX_SUFFIX);
+    char *data_path = pack_path(pack->name, PACK_SUFFIX);
+    persist_remove(index_path);
+    persist_remove(data_path);
+    g_free(data_path);
+    g_free(index_path);
+    g_ptr_array_remove_fast(packs, pack);
+}
+
+// Takes `chat` out of its pack. Called with the lock held.
+static void drop_chat(PackedChat *chat, gboolean write) {
+    Pack *pack = chat->pack;
+    g_hash_table_remove(packed, chat->id);
+    pack->chats--;
+    if (pack->chats == 0) {
+        remove_pack(pack);
+    } else if (write) {
+        write_index(pack);
+    }
+}
+
+static void set_newest_name(const char *name) {
+    if (newest_name && strcmp(name, newest_name) <= 0) return;
+    g_free(newest_name);
+    newest_name = g_strdup(name);
+}
+
+// Adds the chats listed in the index of pack `name`. A chat also in a pack
+// read before is taken from this one, as pack names sort by creation.
+static void read_index(const char *name) {
+    char *path = pack_path(name, PACK_INDEX_SUFFIX);
+    char *contents = NULL;
+    gsize length = 0;
+    gboolean ok = g_file_get_contents(path, &contents, &length, NULL);
+    g_free(path);
+    if (!ok) return;
+
+    Pack *pack = g_new0(Pack, 1);
+    pack->name = g_strdup(name);
+    g_ptr_array_add(packs, pack);
+    set_newest_name(name);
+    json_tokener *tokener = json_tokener_new();
+    const char *line = contents;
+    const char *end = contents + length;
+    gboolean header = TRUE;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', end - line);
+        if (!newline) break;
+        json_tokener_reset(tokener);
+        json_object *record = json_tokener_parse_ex(tokener, line, newline - line);
+        line = newline + 1;
+        if (!record) continue;
+        json_object *val;
+        if (header) {
+            pack->dict_size = json_object_object_get_ex(record, "dict_size", &val) ? json_object_get_int64(val) : 0;
+            header = FALSE;
+        } else if (json_object_object_get_ex(record, "id", &val)) {
+            PackedChat *chat = g_new0(PackedChat, 1);
+            chat->id = g_strdup(json_object_get_string(val));
+            chat->pack = pack;
+            chat->offset = json_object_object_get_ex(record, "offset", &val) ? json_object_get_int64(val) : 0;
+            chat->size = json_object_object_get_ex(record, "size", &val) ? json_object_get_int64(val) : 0;
+            chat->length = json_object_object_get_ex(record, "length", &val) ? json_object_get_int64(val) : 0;
+            chat->modified_at = json_object_object_get_ex(record, "modified_at", &val) ? json_object_get_int64(val) : 0;
+            PackedChat *older = g_hash_table_lookup(packed, chat->id);
+            if (older && older->pack == pack) {
+                pack->chats--;
+            } else if (older) {
+                drop_chat(older, FALSE);
+            }
+            g_hash_table_replace(packed, chat->id, chat);
+            pack->chats++;
+        }
+        json_object_put(record);
+    }
+    json_tokener_free(tokener);
+    g_free(contents);
+    if (pack->chats == 0) remove_pack(pack);
+}
+
+// Maps the pack file and loads its dictionary. Called with the lock held.
+static gboolean open_pack(Pack *pack) {
+    if (pack->file) return TRUE;
+    char *path = pack_path(pack->name, PACK_SUFFIX);
+    GError *error = NULL;
+    pack->file = g_mapped_file_new(path, FALSE, &error);
+    g_free(path);
+    if (!pack->file) {
+        fprintf(stderr, "Error opening chat pack %s: %s\n", pack->name, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    if (pack->dict_size > 0 && pack->dict_size <= g_mapped_file_get_length(pack->file)) {
+        pack->ddict = ZSTD_createDDict(g_mapped_file_get_contents(pack->file), pack->dict_size);
+    }
+    return TRUE;
+}
+
+/**
+ * Called with the lock held. The index is not trusted: the frame has to lie
+ * within the pack file, and the length it was listed with has to match the
+ * one in the frame's header, before anything is allocated for it.
+ */
+static GBytes *decompress(PackedChat *chat) {
+    Pack *pack = chat->pack;
+    guint64 file_length = g_mapped_file_get_length(pack->file);
+    if (chat->size > file_length || chat->offset > file_length - chat->size) {
+        fprintf(stderr, "Error reading chat %s from pack %s: outside the pack\n", chat->id, pack->name);
+        return NULL;
+    }
+    const char *frame = g_mapped_file_get_contents(pack->file) + chat->offset;
+    unsigned long long frame_length = ZSTD_getFrameContentSize(frame, chat->size);
+    if (frame_length != chat->length) {
+        fprintf(stderr, "Error reading chat %s from pack %s: length does not match\n", chat->id, pack->name);
+        return NULL;
+    }
+    char *text = g_malloc(MAX(chat->length, 1));
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    size_t result = pack->ddict
+        ? ZSTD_decompress_usingDDict(dctx, text, chat->length, frame, chat->size, pack->ddict)
+        : ZSTD_decompressDCtx(dctx, text, chat->length, frame, chat->size);
+    ZSTD_freeDCtx(dctx);
+    if (ZSTD_isError(result) || result != chat->length) {
+        fprintf(stderr, "Error reading chat %s from pack %s\n", chat->id, pack->name);
+        g_free(text);
+        return NULL;
+    }
+    return g_bytes_new_take(text, chat->length);
+}
+
+static void stat_loose_files(const char *path, LooseFiles *files) {
+    GStatBuf st;
+    memset(files, 0, sizeof(*files));
+    if (g_stat(path, &st) == 0) {
+        files->snapshot_inode = st.st_ino;
+        files->snapshot_size = st.st_size;
+        files->modified_at = st.st_mtime;
+    }
+    char *journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+    if (g_stat(journal_path, &st) == 0) {
+        files->journal_inode = st.st_ino;
+        files->journal_size = st.st_size;
+        files->modified_at = MAX(files->modified_at, (gint64)st.st_mtime);
+    }
+    g_free(journal_path);
+}
+
+static gboolean loose_files_unchanged(const char *path, const LooseFiles *read) {
+    LooseFiles now;
+    stat_loose_files(path, &now);
+    return now.snapshot_inode == read->snapshot_inode && now.snapshot_size == read->snapshot_size &&
+           now.journal_inode == read->journal_inode && now.journal_size == read->journal_size &&
+           now.modified_at == read->modified_at;
+}
+
+// Trains a dictionary on the start of each chat. Returns its size, 0 if
+// there are too few chats to train on.
+static gsize train_dictionary(GPtrArray *texts, void *dict) {
+    if (texts->len < PACK_MIN_SAMPLES) return 0;
+    gsize sample_max = MIN(PACK_SAMPLE_BYTES, PACK_SAMPLE_TOTAL / texts->len);
+    GByteArray *samples = g_byte_array_new();
+    size_t *sizes = g_new(size_t, texts->len);
+    for (guint i = 0; i < texts->len; i++) {
+        gsize len = 0;
+        const guint8 *data = g_bytes_get_data(g_ptr_array_index(texts, i), &len);
+        sizes[i] = MIN(len, sample_max);
+        g_byte_array_append(samples, data, sizes[i]);
+    }
+    size_t dict_size = ZDICT_trainFromBuffer(dict, PACK_DICT_SIZE, samples->data, sizes, texts->len);
+    g_free(sizes);
+    g_byte_array_unref(samples);
+    return ZDICT_isError(dict_size) ? 0 : dict_size;
+}
+
+// Compresses `texts` into a pack for the chats at `paths`.
+static NewPack *build_pack(GPtrArray *paths, GPtrArray *texts, GArray *files) {
+    NewPack *new_pack = g_new0(NewPack, 1);
+    new_pack->chats = g_ptr_array_new_with_free_func(free_packed_chat);
+    new_pack->paths = g_ptr_array_new_with_free_func(g_free);
+    new_pack->files = g_array_new(FALSE, FALSE, sizeof(LooseFiles));
+
+    GByteArray *data = g_byte_array_sized_new(PACK_DICT_SIZE);
+    g_byte_array_set_size(data, PACK_DICT_SIZE);
+    new_pack->dict_size = train_dictionary(texts, data->data);
+    g_byte_array_set_size(data, new_pack->dict_size);
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_CDict *cdict = new_pack->dict_size > 0 ? ZSTD_createCDict(data->data, new_pack->dict_size, PACK_LEVEL) : NULL;
+    for (guint i = 0; i < texts->len && !g_atomic_int_get(&quitting); i++) {
+        gsize len = 0;
+        const void *text = g_bytes_get_data(g_ptr_array_index(texts, i), &len);
+        guint offset = data->len;
+        size_t bound = ZSTD_compressBound(len);
+        g_byte_array_set_size(data, offset + bound);
+        size_t size = cdict
+            ? ZSTD_compress_usingCDict(cctx, data->data + offset, bound, text, len, cdict)
+            : ZSTD_compressCCtx(cctx, data->data + offset, bound, text, len, PACK_LEVEL);
+        if (ZSTD_isError(size)) {
+            g_byte_array_set_size(data, offset);
+            continue;
+        }
+        g_byte_array_set_size(data, offset + size);
+        PackedChat *chat = g_new0(PackedChat, 1);
+        chat->id = g_path_get_basename(g_ptr_array_index(paths, i));
+        chat->offset = offset;
+        chat->size = size;
+        chat->length = len;
+        chat->modified_at = g_array_index(files, LooseFiles, i).modified_at;
+        g_ptr_array_add(new_pack->chats, chat);
+        g_ptr_array_add(new_pack->paths, g_strdup(g_ptr_array_index(paths, i)));
+        g_array_append_val(new_pack->files, g_array_index(files, LooseFiles, i));
+    }
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeCCtx(cctx);
+    new_pack->data = g_byte_array_free_to_bytes(data);
+    return new_pack;
+}
+
+/**
+ * Moves the chats of `new_pack` that are still cold, and whose loose files
+ * are as they were when read, into a new pack, then removes those files. A
+ * chat written since, by this instance or another, stays loose and out of
+ * the index; its bytes in the pack are never read.
+ */
+static void commit_pack(Migration *migration, NewPack *new_pack) {
+    Pack *pack = g_new0(Pack, 1);
+    pack->name = g_strdup_printf("%016" G_GINT64_MODIFIER "x-%u", g_get_real_time(), migration->committed++);
+    pack->dict_size = new_pack->dict_size;
+    GPtrArray *moved = g_ptr_array_new();
+
+    g_mutex_lock(&pack_lock);
+    g_ptr_array_add(packs, pack);
+    set_newest_name(pack->name);
+    for (guint i = 0; i < new_pack->chats->len; i++) {
+        const char *path = g_ptr_array_index(new_pack->paths, i);
+        if (!migration->check_func(path, migration->user_data)) continue;
+        if (!loose_files_unchanged(path, &g_array_index(new_pack->files, LooseFiles, i))) continue;
+        PackedChat *chat = g_ptr_array_index(new_pack->chats, i);
+        PackedChat *older = g_hash_table_lookup(packed, chat->id);
+        if (older) drop_chat(older, TRUE);
+        PackedChat *copy = g_new0(PackedChat, 1);
+        copy->id = g_strdup(chat->id);
+        copy->pack = pack;
+        copy->offset = chat->offset;
+        copy->size = chat->size;
+        copy->length = chat->length;
+        copy->modified_at = chat->modified_at;
+        g_hash_table_replace(packed, copy->id, copy);
+        pack->chats++;
+        g_ptr_array_add(moved, (gpointer)path);
+    }
+    if (pack->chats == 0) {
+        g_ptr_array_remove_fast(packs, pack);
+    } else {
+        char *data_path = pack_path(pack->name, PACK_SUFFIX);
+        persist_write(data_path, new_pack->data);
+        g_free(data_path);
+        write_index(pack);
+    }
+    g_mutex_unlock(&pack_lock);
+
+    for (guint i = 0; i < moved->len; i++) {
+        const char *path = g_ptr_array_index(moved, i);
+        char *journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+        persist_remove(path);
+        persist_remove(journal_path);
+        g_free(journal_path);
+    }
+    g_ptr_array_unref(moved);
+}
+
+// Commits the packs built so far, and ends the migration once its thread is
+// done.
+static gboolean commit_built_packs(gpointer data) {
+    Migration *migration = data;
+    g_mutex_lock(&migration->lock);
+    GQueue built = migration->packs;
+    g_queue_init(&migration->packs);
+    gboolean finished = migration->finished;
+    migration->commit_queued = FALSE;
+    g_mutex_unlock(&migration->lock);
+
+    NewPack *new_pack;
+    while ((new_pack = g_queue_pop_head(&built))) {
+        commit_pack(migration, new_pack);
+        free_new_pack(new_pack);
+    }
+    if (finished) {
+        g_thread_join(migration_thread);
+        migration_thread = NULL;
+        g_clear_pointer(&current_migration, free_migration);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Hands `new_pack` (NULL once all are built) to the main thread.
+static void hand_over(Migration *migration, NewPack *new_pack) {
+    g_mutex_lock(&migration->lock);
+    if (new_pack) {
+        g_queue_push_tail(&migration->packs, new_pack);
+    } else {
+        migration->finished = TRUE;
+    }
+    if (!migration->commit_queued) {
+        migration->commit_queued = TRUE;
+        g_idle_add(commit_built_packs, migration);
+    }
+    g_mutex_unlock(&migration->lock);
+}
+
+static gpointer migration_thread_func(gpointer data) {
+    Migration *migration = data;
+    GPtrArray *paths = g_ptr_array_new();
+    GPtrArray *texts = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    GArray *files = g_array_new(FALSE, FALSE, sizeof(LooseFiles));
+    gsize total = 0;
+    for (guint i = 0; i <= migration->paths->len && !g_atomic_int_get(&quitting); i++) {
+        if (i < migration->paths->len) {
+            const char *path = g_ptr_array_index(migration->paths, i);
+            if (!g_file_test(path, G_FILE_TEST_EXISTS)) continue;
+            LooseFiles read;
+            stat_loose_files(path, &read); // before reading, so a write meanwhile shows
+            GBytes *text = chat_journal_read_snapshot(path);
+            if (!text) continue;
+            g_ptr_array_add(paths, (gpointer)path);
+            g_ptr_array_add(texts, text);
+            g_array_append_val(files, read);
+            total += g_bytes_get_size(text);
+            if (total < PACK_MAX_BYTES) continue;
+        }
+        if (texts->len > 0) {
+            hand_over(migration, build_pack(paths, texts, files));
+            g_ptr_array_set_size(paths, 0);
+            g_ptr_array_set_size(texts, 0);
+            g_array_set_size(files, 0);
+            total = 0;
+        }
+    }
+    g_array_unref(files);
+    g_ptr_array_unref(texts);
+    g_ptr_array_unref(paths);
+    hand_over(migration, NULL);
+    return NULL;
+}
+
+static gint compare_names(gconstpointer a, gconstpointer b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Names of the packs in `pack_dir` that sort after `after` (may be NULL),
+// oldest first.
+static GPtrArray *list_pack_names(const char *after) {
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    GDir *pack_gdir = g_dir_open(pack_dir, 0, NULL);
+    if (!pack_gdir) return names;
+    const char *filename;
+    while ((filename = g_dir_read_name(pack_gdir))) {
+        if (filename[0] == '.' || !g_str_has_suffix(filename, PACK_INDEX_SUFFIX)) continue;
+        char *name = g_strndup(filename, strlen(filename) - strlen(PACK_INDEX_SUFFIX));
+        if (after && strcmp(name, after) <= 0) {
+            g_free(name);
+            continue;
+        }
+        g_ptr_array_add(names, name);
+    }
+    g_dir_close(pack_gdir);
+    g_ptr_array_sort(names, compare_names);
+    return names;
+}
+
+// --- Public Functions ---
+
+// Reads the indexes of the packs in `dir`.
+void chat_pack_init(const char *dir) {
+    pack_dir = g_build_filename(dir, PACK_DIR, NULL);
+    packed = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_packed_chat);
+    packs = g_ptr_array_new_with_free_func(free_pack);
+
+    GPtrArray *names = list_pack_names(NULL);
+    for (guint i = 0; i < names->len; i++) {
+        read_index(g_ptr_array_index(names, i));
+    }
+    g_ptr_array_unref(names);
+}
+
+/**
+ * Reads the indexes of packs written since, by another instance sharing the
+ * history directory. Pack names sort by creation, so only names after the
+ * newest known one are new; older packs that are not known any more were
+ * emptied and are only waiting for their removal.
+ */
+void chat_pack_refresh(void) {
+    if (!pack_dir) return;
+    g_mutex_lock(&pack_lock);
+    GPtrArray *names = list_pack_names(newest_name);
+    for (guint i = 0; i < names->len; i++) {
+        read_index(g_ptr_array_index(names, i));
+    }
+    g_mutex_unlock(&pack_lock);
+    g_ptr_array_unref(names);
+}
+
+// Stops a migration in progress; packs not committed yet are dropped.
+void chat_pack_shutdown(void) {
+    if (migration_thread) {
+        g_atomic_int_set(&quitting, TRUE);
+        g_thread_join(migration_thread);
+        migration_thread = NULL;
+        g_atomic_int_set(&quitting, FALSE);
+        g_idle_remove_by_data(current_migration);
+        g_clear_pointer(&current_migration, free_migration);
+    }
+    g_clear_pointer(&packed, g_hash_table_unref);
+    g_clear_pointer(&packs, g_ptr_array_unref);
+    g_clear_pointer(&newest_name, g_free);
+    g_clear_pointer(&pack_dir, g_free);
+}
+
+// The packed copy of the chat at `path`, or NULL if it has none. Safe to
+// call from any thread.
+GBytes *chat_pack_read(const char *path) {
+    char *id = g_path_get_basename(path);
+    GBytes *bytes = NULL;
+    g_mutex_lock(&pack_lock);
+    PackedChat *chat = packed ? g_hash_table_lookup(packed, id) : NULL;
+    if (chat && open_pack(chat->pack)) bytes = decompress(chat);
+    g_mutex_unlock(&pack_lock);
+    g_free(id);
+    return bytes;
+}
+
+// When the packed chat at `path` last changed before it was packed, 0 if
+// it is not packed.
+gint64 chat_pack_get_modified_at(const char *path) {
+    char *id = g_path_get_basename(path);
+    g_mutex_lock(&pack_lock);
+    PackedChat *chat = packed ? g_hash_table_lookup(packed, id) : NULL;
+    gint64 modified_at = chat ? chat->modified_at : 0;
+    g_mutex_unlock(&pack_lock);
+    g_free(id);
+    return modified_at;
+}
+
+// Ids of the packed chats.
+GPtrArray *chat_pack_list_ids(void) {
+    GPtrArray *ids = g_ptr_array_new_with_free_func(g_free);
+    g_mutex_lock(&pack_lock);
+    GHashTableIter iter;
+    gpointer id;
+    g_hash_table_iter_init(&iter, packed);
+    while (g_hash_table_iter_next(&iter, &id, NULL)) {
+        g_ptr_array_add(ids, g_strdup(id));
+    }
+    g_mutex_unlock(&pack_lock);
+    return ids;
+}
+
+// Drops the packed copy of the chat at `path`, if any.
+void chat_pack_remove(const char *path) {
+    char *id = g_path_get_basename(path);
+    g_mutex_lock(&pack_lock);
+    PackedChat *chat = packed ? g_hash_table_lookup(packed, id) : NULL;
+    if (chat) drop_chat(chat, TRUE);
+    g_mutex_unlock(&pack_lock);
+    g_free(id);
+}
+
+/**
+ * Packs the chats at `paths` in the background; those without a loose file
+ * (already packed, or gone) are skipped. Once packed, a chat is only moved
+ * if `check_func` still returns TRUE for it; that is called on the main
+ * thread. Does nothing while a migration is running.
+ */
+void chat_pack_migrate(GPtrArray *paths, ChatPackCheckFunc check_func, gpointer user_data) {
+    if (current_migration || paths->len == 0) return;
+    g_mkdir_with_parents(pack_dir, 0755);
+    Migration *migration = g_new0(Migration, 1);
+    migration->paths = g_ptr_array_ref(paths);
+    g_mutex_init(&migration->lock);
+    g_queue_init(&migration->packs);
+    migration->check_func = check_func;
+    migration->user_data = user_data;
+    current_migration = migration;
+    migration_thread = g_thread_new("pack", migration_thread_func, migration);
+}
@@ -0,0 +1,21 @@
+#ifndef CHAT_PACK_H
+#define CHAT_PACK_H
+
+#include <glib.h>
+
+// Compressed packs holding chats that have not changed for a while. A chat
+// is named by the path its file has in the history directory when loose.
+typedef gboolean (*ChatPackCheckFunc)(const char *path, gpointer user_data);
+
+void chat_pack_init(const char *dir);
+void chat_pack_shutdown(void);
+void chat_pack_refresh(void);
+
+GBytes *chat_pack_read(const char *path);
+gint64 chat_pack_get_modified_at(const char *path);
+GPtrArray *chat_pack_list_ids(void);
+void chat_pack_remove(const char *path);
+
+void chat_pack_migrate(GPtrArray *paths, ChatPackCheckFunc check_func, gpointer user_data);
+
+#endif // CHAT_PACK_H
@@ -0,0 +1,630 @@
+#include <stdio.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "chat_search.h"
+#include "chat_journal.h"
+#include "persist.h"
+#include "trace.h"
+
+/**
+ * Full-text index over the messages of every chat, kept in `.search.db` in
+ * the history directory. Message text lives in `messages` and is indexed by
+ * the FTS5 table `messages_fts`, which triggers keep in step. `chats` holds
+ * how many messages of each chat are indexed, so saving a chat only adds
+ * its new messages.
+ *
+ * Writes run on a worker thread with a connection of its own; queries run on
+ * a second thread with the other connection, which WAL mode lets read while
+ * the worker writes. A new query makes the ones before it stale: they are
+ * skipped, or interrupted if running, and never reported. Chats that are not
+ * indexed yet, such as those from before the index existed, are read from
+ * disk by the worker.
+ */
+#define SEARCH_DB ".search.db"
+#define SNIPPET_CHARS 120
+#define SNIPPET_LEAD_CHARS 30 // shown before the first match
+// Only the newest matches are ranked, which bounds the cost of a query that
+// matches most messages, like the first letters typed.
+#define RANKED_MATCHES 5000
+#define MIN_PREFIX_CHARS 2
+// Virtual machine steps between checks of whether a query went stale
+#define QUERY_CHECK_STEPS 1000
+
+static const char *SCHEMA =
+    "PRAGMA journal_mode = WAL;"
+    "PRAGMA synchronous = NORMAL;"
+    "CREATE TABLE IF NOT EXISTS chats (id TEXT PRIMARY KEY, indexed INTEGER NOT NULL) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS messages (id INTEGER PRIMARY KEY, chat_id TEXT NOT NULL,"
+    " message_index INTEGER NOT NULL, content TEXT NOT NULL);"
+    "CREATE INDEX IF NOT EXISTS messages_by_chat ON messages (chat_id);"
+    "CREATE VIRTUAL TABLE IF NOT EXISTS messages_fts USING fts5(content, content = 'messages',"
+    " content_rowid = 'id', tokenize = 'unicode61 remove_diacritics 2', prefix = '2 3');"
+    "CREATE TRIGGER IF NOT EXISTS messages_insert AFTER INSERT ON messages BEGIN"
+    " INSERT INTO messages_fts (rowid, content) VALUES (new.id, new.content); END;"
+    "CREATE TRIGGER IF NOT EXISTS messages_delete AFTER DELETE ON messages BEGIN"
+    " INSERT INTO messages_fts (messages_fts, rowid, content) VALUES ('delete', old.id, old.content); END;";
+
+typedef enum {
+    JOB_INDEX,
+    JOB_INDEX_FILE,
+    JOB_REMOVE,
+} JobKind;
+
+typedef struct {
+    JobKind kind;
+    char *chat_id;
+    char *path;        // of the chat file, to read what the index lacks
+    guint first_index; // JOB_INDEX: index of texts[0] in the chat
+    GPtrArray *texts;  // JOB_INDEX: message texts, NULL for ones not indexed
+} SearchJob;
+
+typedef struct {
+    char *word; // folded
+    gboolean prefix;
+} QueryTerm;
+
+typedef struct {
+    gint *latest; // generation of the newest query, shared with the ChatSearch
+    gint generation;
+    char *match;
+    GPtrArray *terms;
+    guint limit;
+    GPtrArray *results;
+    ChatSearchFunc callback;
+    gpointer user_data;
+} SearchQuery;
+
+struct ChatSearch {
+    char *dir;
+    sqlite3 *db;        // query thread
+    sqlite3 *writer_db; // worker thread
+    sqlite3_stmt *query_stmt;
+    sqlite3_stmt *get_indexed_stmt;
+    sqlite3_stmt *set_indexed_stmt;
+    sqlite3_stmt *insert_stmt;
+    sqlite3_stmt *delete_messages_stmt;
+    sqlite3_stmt *delete_chat_stmt;
+    GThreadPool *worker;
+    GThreadPool *query_worker;
+    gint *latest_query; // atomic, refcounted: outlives `search` for queries in flight
+    GHashTable *queued;       // chat id -> messages handed to the worker this session
+    GHashTable *indexed_ids;  // chats the index holds, or will once queued jobs run
+    gint quitting;            // atomic
+    int track;
+};
+
+// --- Private Helper Functions ---
+
+static void free_job(SearchJob *job) {
+    g_free(job->chat_id);
+    g_free(job->path);
+    if (job->texts) g_ptr_array_unref(job->texts);
+    g_free(job);
+}
+
+static SearchJob *new_job(JobKind kind, const char *chat_id) {
+    SearchJob *job = g_new0(SearchJob, 1);
+    job->kind = kind;
+    job->chat_id = g_strdup(chat_id);
+    return job;
+}
+
+// Copies the texts of messages [first, end) of `conversation`. System
+// prompts are not indexed.
+static GPtrArray *copy_texts(Conversation *conversation, guint first, guint end) {
+    GPtrArray *texts = g_ptr_array_new_full(end > first ? end - first : 0, g_free);
+    for (guint i = first; i < end; i++) {
+        const ConversationMessage *message = conversation_get_message(conversation, i);
+        g_ptr_array_add(texts, message->role == CONVERSATION_ROLE_SYSTEM
+                                   ? NULL
+                                   : g_strndup(conversation_get_content(conversation, i), message->content_len));
+    }
+    return texts;
+}
+
+static gboolean prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt) {
+    if (sqlite3_prepare_v2(db, sql, -1, stmt, NULL) == SQLITE_OK) return TRUE;
+    fprintf(stderr, "Error preparing search statement: %s\n", sqlite3_errmsg(db));
+    return FALSE;
+}
+
+static gboolean step_done(sqlite3 *db, sqlite3_stmt *stmt) {
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (rc == SQLITE_DONE) return TRUE;
+    fprintf(stderr, "Error updating search index: %s\n", sqlite3_errmsg(db));
+    return FALSE;
+}
+
+static guint get_indexed(ChatSearch *search, const char *chat_id) {
+    guint indexed = 0;
+    sqlite3_bind_text(search->get_indexed_stmt, 1, chat_id, -1, SQLITE_STATIC);
+    if (sqlite3_step(search->get_indexed_stmt) == SQLITE_ROW) {
+        indexed = sqlite3_column_int(search->get_indexed_stmt, 0);
+    }
+    sqlite3_reset(search->get_indexed_stmt);
+    return indexed;
+}
+
+// Adds the texts of messages `first_index` on, skipping the ones already
+// indexed, in one transaction.
+static void insert_texts(ChatSearch *search, const char *chat_id, guint first_index, GPtrArray *texts) {
+    sqlite3 *db = search->writer_db;
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    guint indexed = get_indexed(search, chat_id);
+
+    gboolean ok = TRUE;
+    for (guint i = 0; i < texts->len && ok; i++) {
+        const char *text = g_ptr_array_index(texts, i);
+        if (first_index + i < indexed || !text) continue;
+        sqlite3_bind_text(search->insert_stmt, 1, chat_id, -1, SQLITE_STATIC);
+        sqlite3_bind_int(search->insert_stmt, 2, first_index + i);
+        sqlite3_bind_text(search->insert_stmt, 3, text, -1, SQLITE_STATIC);
+        ok = step_done(db, search->insert_stmt);
+    }
+
+    guint length = first_index + texts->len;
+    if (ok && (length > indexed || indexed == 0)) {
+        sqlite3_bind_text(search->set_indexed_stmt, 1, chat_id, -1, SQLITE_STATIC);
+        sqlite3_bind_int(search->set_indexed_stmt, 2, MAX(length, indexed));
+        ok = step_done(db, search->set_indexed_stmt);
+    }
+    sqlite3_exec(db, ok ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+}
+
+static void remove_chat(ChatSearch *search, const char *chat_id) {
+    sqlite3 *db = search->writer_db;
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    sqlite3_bind_text(search->delete_messages_stmt, 1, chat_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(search->delete_chat_stmt, 1, chat_id, -1, SQLITE_STATIC);
+    gboolean ok = step_done(db, search->delete_messages_stmt) && step_done(db, search->delete_chat_stmt);
+    sqlite3_exec(db, ok ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+}
+
+// Indexes the stored messages before the job's ones that the index lacks,
+// reading them from disk.
+static void fill_gap(ChatSearch *search, SearchJob *job) {
+    guint indexed = get_indexed(search, job->chat_id);
+    if (indexed >= job->first_index) return;
+    persist_flush();
+    Conversation *conversation = chat_journal_read(job->path);
+    if (!conversation) return;
+    GPtrArray *texts = copy_texts(conversation, indexed,
+                                  MIN(job->first_index, conversation_get_length(conversation)));
+    insert_texts(search, job->chat_id, indexed, texts);
+    g_ptr_array_unref(texts);
+    conversation_unref(conversation);
+}
+
+static void run_job(gpointer data, gpointer user_data) {
+    SearchJob *job = data;
+    ChatSearch *search = user_data;
+    // Chats still waiting to be read from disk are picked up next time
+    if (job->kind == JOB_INDEX_FILE && g_atomic_int_get(&search->quitting)) {
+        free_job(job);
+        return;
+    }
+
+    TraceSpan *span = trace_span_begin(search->track, "search",
+                                       job->kind == JOB_REMOVE ? "remove" : "index");
+    trace_span_add_string(span, "chat", job->chat_id);
+    switch (job->kind) {
+        case JOB_INDEX:
+            if (job->path) fill_gap(search, job);
+            insert_texts(search, job->chat_id, job->first_index, job->texts);
+            break;
+        case JOB_INDEX_FILE: {
+            Conversation *conversation = chat_journal_read(job->path);
+            if (conversation) {
+                GPtrArray *texts = copy_texts(conversation, 0, conversation_get_length(conversation));
+                insert_texts(search, job->chat_id, 0, texts);
+                trace_span_add_int(span, "messages", texts->len);
+                g_ptr_array_unref(texts);
+                conversation_unref(conversation);
+            }
+            break;
+        }
+        case JOB_REMOVE:
+            remove_chat(search, job->chat_id);
+            break;
+    }
+    trace_span_end(span);
+    free_job(job);
+}
+
+static void push_job(ChatSearch *search, SearchJob *job) {
+    g_thread_pool_push(search->worker, job, NULL);
+}
+
+static sqlite3 *open_db(const char *path) {
+    sqlite3 *db = NULL;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Error opening search index %s: %s\n", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+    sqlite3_busy_timeout(db, 5000);
+    return db;
+}
+
+static void load_indexed_ids(ChatSearch *search) {
+    sqlite3_stmt *stmt = NULL;
+    if (!prepare(search->db, "SELECT id FROM chats", &stmt)) return;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        g_hash_table_add(search->indexed_ids, g_strdup((const char *)sqlite3_column_text(stmt, 0)));
+    }
+    sqlite3_finalize(stmt);
+}
+
+// Lowercases `word` and strips its accents, like the index tokenizer.
+static char *fold_word(const char *word, gssize len) {
+    char *decomposed = g_utf8_normalize(word, len, G_NORMALIZE_NFD);
+    if (!decomposed) return g_strndup(word, len < 0 ? strlen(word) : (gsize)len);
+    GString *stripped = g_string_sized_new(strlen(decomposed));
+    for (const char *p = decomposed; *p; p = g_utf8_next_char(p)) {
+        gunichar c = g_utf8_get_char(p);
+        if (!g_unichar_ismark(c)) g_string_append_unichar(stripped, c);
+    }
+    char *folded = g_utf8_casefold(stripped->str, stripped->len);
+    g_string_free(stripped, TRUE);
+    g_free(decomposed);
+    return folded;
+}
+
+// Finds the next run of letters and digits at or after `p`, which is how
+// the tokenizer splits words.
+static const char *next_word(const char *p, const char **word_end) {
+    while (*p && !g_unichar_isalnum(g_utf8_get_char(p))) p = g_utf8_next_char(p);
+    if (!*p) return NULL;
+    const char *end = p;
+    while (*end && g_unichar_isalnum(g_utf8_get_char(end))) end = g_utf8_next_char(end);
+    *word_end = end;
+    return p;
+}
+
+static void free_term(gpointer data) {
+    QueryTerm *term = data;
+    g_free(term->word);
+    g_free(term);
+}
+
+static void add_terms(GPtrArray *terms, const char *start, const char *end, gboolean prefix) {
+    char *text = g_strndup(start, end - start);
+    const char *word_end;
+    for (const char *word = next_word(text, &word_end); word; word = next_word(word_end, &word_end)) {
+        QueryTerm *term = g_new0(QueryTerm, 1);
+        term->word = fold_word(word, word_end - word);
+        term->prefix = prefix && !*word_end;
+        g_ptr_array_add(terms, term);
+    }
+    g_free(text);
+}
+
+/**
+ * Turns what the user typed into an FTS5 query: "quoted text" is matched as
+ * a phrase, every other word as a token, all of them required. A trailing
+ * `*` makes a word or phrase a prefix, and so does the end of the input, so
+ * that results follow the user as they type; a single letter there is not
+ * taken as a prefix, since nearly every message would match. The words are
+ * added to `terms` for highlighting.
+ */
+static char *build_match_query(const char *text, GPtrArray *terms) {
+    GString *query = g_string_new(NULL);
+    const char *p = text;
+    while (*p) {
+        if (g_ascii_isspace(*p)) {
+            p++;
+            continue;
+        }
+        const char *start;
+        const char *end;
+        if (*p == '"') {
+            start = ++p;
+            end = strchr(p, '"');
+            if (!end) end = p + strlen(p);
+            p = *end ? end + 1 : end;
+        } else {
+            start = p;
+            while (*p && *p != '"' && !g_ascii_isspace(*p)) p++;
+            end = p;
+        }
+        gboolean prefix = end > start && end[-1] == '*';
+        if (prefix) end--;
+        if (end == start) continue;
+
+        while (g_ascii_isspace(*p)) p++;
+        prefix = prefix || (!*p && g_utf8_strlen(start, end - start) >= MIN_PREFIX_CHARS);
+        if (query->len > 0) g_string_append_c(query, ' ');
+        g_string_append_c(query, '"');
+        g_string_append_len(query, start, end - start);
+        g_string_append_c(query, '"');
+        if (prefix) g_string_append_c(query, '*');
+        add_terms(terms, start, end, prefix);
+    }
+    return g_string_free(query, query->len == 0);
+}
+
+static gboolean matches_term(const char *word, const char *end, GPtrArray *terms) {
+    char *folded = fold_word(word, end - word);
+    gboolean found = FALSE;
+    for (guint i = 0; i < terms->len && !found; i++) {
+        QueryTerm *term = g_ptr_array_index(terms, i);
+        found = term->prefix ? g_str_has_prefix(folded, term->word) : strcmp(folded, term->word) == 0;
+    }
+    g_free(folded);
+    return found;
+}
+
+static void append_escaped(GString *markup, const char *text, const char *end) {
+    char *escaped = g_markup_escape_text(text, end - text);
+    g_strdelimit(escaped, "\n\t\r", ' ');
+    g_string_append(markup, escaped);
+    g_free(escaped);
+}
+
+/**
+ * Pango markup for a piece of `content` around its first match, with the
+ * words that match `terms` in bold. Computed here rather than with FTS5's
+ * snippet(), which would look the matches up again for every result.
+ */
+static char *make_snippet(const char *content, GPtrArray *terms) {
+    const char *word_end;
+    const char *word = next_word(content, &word_end);
+    while (word && !matches_term(word, word_end, terms)) word = next_word(word_end, &word_end);
+
+    const char *start = content;
+    if (word) {
+        start = word;
+        for (int i = 0; i < SNIPPET_LEAD_CHARS && start > content; i++) start = g_utf8_prev_char(start);
+        if (start > content) {
+            const char *space = strchr(start, ' ');
+            if (space && space < word) start = space + 1;
+        }
+    }
+    while (g_ascii_isspace(*start)) start++;
+    const char *end = start;
+    for (int i = 0; i < SNIPPET_CHARS && *end; i++) end = g_utf8_next_char(end);
+
+    GString *markup = g_string_new(start > content ? "…" : NULL);
+    const char *p = start;
+    for (word = next_word(start, &word_end); word && word < end; word = next_word(word_end, &word_end)) {
+        if (word_end > end || !matches_term(word, word_end, terms)) continue;
+        append_escaped(markup, p, word);
+        g_string_append(markup, "<b>");
+        append_escaped(markup, word, word_end);
+        g_string_append(markup, "</b>");
+        p = word_end;
+    }
+    append_escaped(markup, p, end);
+    if (*end) g_string_append(markup, "…");
+    return g_string_free(markup, FALSE);
+}
+
+static void free_result(gpointer data) {
+    ChatSearchResult *result = data;
+    g_free(result->chat_id);
+    g_free(result->snippet);
+    g_free(result);
+}
+
+static void free_query(SearchQuery *query) {
+    g_atomic_rc_box_release(query->latest);
+    g_free(query->match);
+    g_ptr_array_unref(query->terms);
+    if (query->results) g_ptr_array_unref(query->results);
+    g_free(query);
+}
+
+static gboolean query_is_stale(SearchQuery *query) {
+    return g_atomic_int_get(query->latest) != query->generation;
+}
+
+// sqlite3 progress handler: interrupts a query once a newer one was asked for.
+static int interrupt_stale_query(void *data) {
+    return query_is_stale(data);
+}
+
+// Hands the results to the caller on the main loop, unless the query went
+// stale meanwhile.
+static gboolean deliver_query(gpointer data) {
+    SearchQuery *query = data;
+    if (!query_is_stale(query)) {
+        query->callback(g_steal_pointer(&query->results), query->user_data);
+    }
+    free_query(query);
+    return G_SOURCE_REMOVE;
+}
+
+static void run_query(gpointer data, gpointer user_data) {
+    SearchQuery *query = data;
+    ChatSearch *search = user_data;
+    if (query_is_stale(query)) {
+        free_query(query);
+        return;
+    }
+
+    TraceSpan *span = trace_span_begin(search->track, "search", "query");
+    sqlite3_stmt *stmt = search->query_stmt;
+    sqlite3_progress_handler(search->db, QUERY_CHECK_STEPS, interrupt_stale_query, query);
+    sqlite3_bind_text(stmt, 1, query->match, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, query->limit);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        ChatSearchResult *result = g_new0(ChatSearchResult, 1);
+        result->chat_id = g_strdup((const char *)sqlite3_column_text(stmt, 0));
+        result->message_index = sqlite3_column_int(stmt, 1);
+        result->snippet = make_snippet((const char *)sqlite3_column_text(stmt, 2), query->terms);
+        g_ptr_array_add(query->results, result);
+    }
+    if (rc != SQLITE_DONE && rc != SQLITE_INTERRUPT) {
+        fprintf(stderr, "Error searching chats: %s\n", sqlite3_errmsg(search->db));
+    }
+    sqlite3_reset(stmt);
+    sqlite3_progress_handler(search->db, 0, NULL, NULL);
+    trace_span_add_int(span, "results", query->results->len);
+    trace_span_add_int(span, "interrupted", rc == SQLITE_INTERRUPT);
+    trace_span_end(span);
+
+    if (rc == SQLITE_INTERRUPT) {
+        free_query(query);
+    } else {
+        g_idle_add(deliver_query, query);
+    }
+}
+
+// --- Public Functions ---
+
+// Opens the index in `dir`, creating it if needed. Returns NULL on failure.
+ChatSearch *chat_search_open(const char *dir) {
+    char *path = g_build_filename(dir, SEARCH_DB, NULL);
+    sqlite3 *db = open_db(path);
+    sqlite3 *writer_db = db ? open_db(path) : NULL;
+    g_free(path);
+    if (!writer_db) {
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    ChatSearch *search = g_new0(ChatSearch, 1);
+    search->dir = g_strdup(dir);
+    search->db = db;
+    search->writer_db = writer_db;
+    search->queued = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    search->indexed_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    search->latest_query = g_atomic_rc_box_new0(gint);
+
+    char *error = NULL;
+    if (sqlite3_exec(db, SCHEMA, NULL, NULL, &error) != SQLITE_OK) {
+        fprintf(stderr, "Error creating search index: %s\n", error);
+        sqlite3_free(error);
+        chat_search_close(search);
+        return NULL;
+    }
+    if (!prepare(db,
+                 "WITH top AS (SELECT id, score FROM (SELECT rowid AS id, rank AS score FROM messages_fts"
+                 " WHERE messages_fts MATCH ?1 ORDER BY rowid DESC LIMIT " G_STRINGIFY(RANKED_MATCHES) ")"
+                 " ORDER BY score LIMIT ?2)"
+                 " SELECT m.chat_id, m.message_index, m.content FROM top JOIN messages m ON m.id = top.id"
+                 " ORDER BY top.score",
+                 &search->query_stmt) ||
+        !prepare(writer_db, "SELECT indexed FROM chats WHERE id = ?", &search->get_indexed_stmt) ||
+        !prepare(writer_db, "INSERT OR REPLACE INTO chats (id, indexed) VALUES (?, ?)", &search->set_indexed_stmt) ||
+        !prepare(writer_db, "INSERT INTO messages (chat_id, message_index, content) VALUES (?, ?, ?)",
+                 &search->insert_stmt) ||
+        !prepare(writer_db, "DELETE FROM messages WHERE chat_id = ?", &search->delete_messages_stmt) ||
+        !prepare(writer_db, "DELETE FROM chats WHERE id = ?", &search->delete_chat_stmt)) {
+        chat_search_close(search);
+        return NULL;
+    }
+    load_indexed_ids(search);
+
+    search->track = trace_new_track("search");
+    search->worker = g_thread_pool_new(run_job, search, 1, FALSE, NULL);
+    search->query_worker = g_thread_pool_new(run_query, search, 1, FALSE, NULL);
+    return search;
+}
+
+// Finishes the queued updates, except chats still to be read from disk.
+// Queries still running are dropped.
+void chat_search_close(ChatSearch *search) {
+    if (!search) return;
+    if (search->query_worker) {
+        chat_search_cancel_queries(search);
+        g_thread_pool_free(search->query_worker, FALSE, TRUE);
+    }
+    if (search->worker) {
+        g_atomic_int_set(&search->quitting, TRUE);
+        g_thread_pool_free(search->worker, FALSE, TRUE);
+    }
+    sqlite3_finalize(search->query_stmt);
+    sqlite3_finalize(search->get_indexed_stmt);
+    sqlite3_finalize(search->set_indexed_stmt);
+    sqlite3_finalize(search->insert_stmt);
+    sqlite3_finalize(search->delete_messages_stmt);
+    sqlite3_finalize(search->delete_chat_stmt);
+    sqlite3_close(search->writer_db);
+    sqlite3_close(search->db);
+    g_hash_table_unref(search->queued);
+    g_hash_table_unref(search->indexed_ids);
+    g_atomic_rc_box_release(search->latest_query);
+    g_free(search->dir);
+    g_free(search);
+}
+
+/**
+ * Indexes the messages of `conversation` added since it was last indexed,
+ * or since chat_search_set_stored(). The worker skips those the index
+ * already holds, and reads earlier ones it lacks from disk.
+ */
+void chat_search_index(ChatSearch *search, const char *chat_id, Conversation *conversation) {
+    if (!search) return;
+    guint first = GPOINTER_TO_UINT(g_hash_table_lookup(search->queued, chat_id));
+    guint length = conversation_get_length(conversation);
+    if (first >= length) return;
+
+    SearchJob *job = new_job(JOB_INDEX, chat_id);
+    job->first_index = first;
+    job->texts = copy_texts(conversation, first, length);
+    if (first > 0) job->path = g_build_filename(search->dir, chat_id, NULL);
+    g_hash_table_insert(search->queued, g_strdup(chat_id), GUINT_TO_POINTER(length));
+    g_hash_table_add(search->indexed_ids, g_strdup(chat_id));
+    push_job(search, job);
+}
+
+// Tells the index that the first `length` messages of a chat just opened are
+// stored on disk, so that chat_search_index() need not decode them.
+void chat_search_set_stored(ChatSearch *search, const char *chat_id, guint length) {
+    if (!search || GPOINTER_TO_UINT(g_hash_table_lookup(search->queued, chat_id)) >= length) return;
+    g_hash_table_insert(search->queued, g_strdup(chat_id), GUINT_TO_POINTER(length));
+}
+
+// Indexes the chat stored at `path`, unless the index already has it.
+void chat_search_index_file(ChatSearch *search, const char *chat_id, const char *path) {
+    if (!search || g_hash_table_contains(search->indexed_ids, chat_id)) return;
+    g_hash_table_add(search->indexed_ids, g_strdup(chat_id));
+    SearchJob *job = new_job(JOB_INDEX_FILE, chat_id);
+    job->path = g_strdup(path);
+    push_job(search, job);
+}
+
+void chat_search_remove(ChatSearch *search, const char *chat_id) {
+    if (!search) return;
+    g_hash_table_remove(search->queued, chat_id);
+    g_hash_table_remove(search->indexed_ids, chat_id);
+    push_job(search, new_job(JOB_REMOVE, chat_id));
+}
+
+/**
+ * Finds the messages matching `text`, best first, on the query thread.
+ * `callback` gets a GPtrArray of ChatSearchResult, empty if nothing matches,
+ * on the main loop; it is not called if another query is made or the
+ * queries are cancelled first.
+ */
+void chat_search_query(ChatSearch *search, const char *text, guint limit,
+                       ChatSearchFunc callback, gpointer user_data) {
+    GPtrArray *terms = g_ptr_array_new_with_free_func(free_term);
+    char *match = search ? build_match_query(text, terms) : NULL;
+    if (!match) {
+        if (search) chat_search_cancel_queries(search);
+        g_ptr_array_unref(terms);
+        callback(g_ptr_array_new_with_free_func(free_result), user_data);
+        return;
+    }
+
+    SearchQuery *query = g_new0(SearchQuery, 1);
+    query->latest = g_atomic_rc_box_acquire(search->latest_query);
+    query->generation = g_atomic_int_add(search->latest_query, 1) + 1;
+    query->match = match;
+    query->terms = terms;
+    query->limit = limit;
+    query->results = g_ptr_array_new_with_free_func(free_result);
+    query->callback = callback;
+    query->user_data = user_data;
+    g_thread_pool_push(search->query_worker, query, NULL);
+}
+
+// Drops the queries made so far: their callbacks are not called.
+void chat_search_cancel_queries(ChatSearch *search) {
+    if (!search) return;
+    g_atomic_int_inc(search->latest_query);
+}
@@ -0,0 +1,31 @@
+#ifndef CHAT_SEARCH_H
+#define CHAT_SEARCH_H
+
+#include <glib.h>
+#include "conversation.h"
+
+typedef struct {
+    char *chat_id;
+    guint message_index;
+    char *snippet; // Pango markup, matches in bold
+} ChatSearchResult;
+
+typedef struct ChatSearch ChatSearch;
+
+// Receives the results of a query, a GPtrArray of ChatSearchResult owned by
+// the callee.
+typedef void (*ChatSearchFunc)(GPtrArray *results, gpointer user_data);
+
+ChatSearch *chat_search_open(const char *dir);
+void chat_search_close(ChatSearch *search);
+
+void chat_search_set_stored(ChatSearch *search, const char *chat_id, guint length);
+void chat_search_index(ChatSearch *search, const char *chat_id, Conversation *conversation);
+void chat_search_index_file(ChatSearch *search, const char *chat_id, const char *path);
+void chat_search_remove(ChatSearch *search, const char *chat_id);
+
+void chat_search_query(ChatSearch *search, const char *text, guint limit,
+                       ChatSearchFunc callback, gpointer user_data);
+void chat_search_cancel_queries(ChatSearch *search);
+
+#endif // CHAT_SEARCH_H
@@ -0,0 +1,99 @@
+#include "chat_session.h"
+#include "chat_journal.h"
+#include "chat_list_model.h"
+#include "context_gather.h"
+#include "ollama_api.h"
+#include "ui.h"
+
+// --- Private Helper Functions ---
+
+static void clear_session(ChatSession *session) {
+    g_clear_handle_id(&session->response_checkpoint_id, g_source_remove);
+    g_clear_object(&session->pending_user_item);
+    g_clear_object(&session->response_item);
+    g_string_free(session->response_buffer, TRUE);
+    conversation_unref(session->conversation);
+    g_free(session->model);
+    g_free(session->chat_id);
+    g_free(session);
+}
+
+// --- Public Functions ---
+
+/**
+ * Starts a session for the chat shown. The session shares the chat's
+ * journal with AppData while the chat is shown, and closes it itself if the
+ * user switched to another chat before the response was stored.
+ */
+ChatSession *chat_session_new(AppData *app_data) {
+    ChatSession *session = g_new0(ChatSession, 1);
+    session->app_data = app_data;
+    session->chat_id = g_strdup(app_data->current_chat_id);
+    session->model = g_strdup(app_data->current_model);
+    session->conversation = conversation_ref(app_data->conversation);
+    session->journal = app_data->chat_journal;
+    session->response_buffer = g_string_new("");
+    g_hash_table_insert(app_data->sessions, session->chat_id, session);
+    chat_list_model_set_busy(app_data->history_model, session->chat_id, TRUE);
+    ui_update_send_button(app_data);
+    return session;
+}
+
+void chat_session_free(ChatSession *session) {
+    AppData *app_data = session->app_data;
+    api_detach_chat(session);
+    if (session->response_tick_id) {
+        gtk_widget_remove_tick_callback(GTK_WIDGET(app_data->chat_scroll), session->response_tick_id);
+    }
+    if (session->journal != app_data->chat_journal) {
+        chat_journal_close(session->journal);
+    }
+    g_hash_table_remove(app_data->sessions, session->chat_id);
+    chat_list_model_set_busy(app_data->history_model, session->chat_id, FALSE);
+    clear_session(session);
+    ui_update_send_button(app_data);
+}
+
+// At exit, once the main loop stopped: keeps what was streamed so far in
+// the journals and closes them. The UI is gone by then.
+void chat_session_close_all(AppData *app_data) {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, app_data->sessions);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        ChatSession *session = value;
+        g_hash_table_iter_steal(&iter);
+        if (session->journal && session->response_item) {
+            chat_journal_checkpoint(session->journal, session->response_buffer->str, session->response_buffer->len);
+        }
+        if (session->journal != app_data->chat_journal) {
+            chat_journal_close(session->journal);
+        }
+        clear_session(session);
+    }
+}
+
+// The session generating a response for `chat_id`, NULL if there is none.
+ChatSession *chat_session_lookup(AppData *app_data, const char *chat_id) {
+    return chat_id ? g_hash_table_lookup(app_data->sessions, chat_id) : NULL;
+}
+
+// Whether the session's chat is the one in the transcript view.
+gboolean chat_session_is_shown(ChatSession *session) {
+    return session->app_data->conversation == session->conversation;
+}
+
+// The item to show after the stored messages of the session's chat.
+ChatMessageItem *chat_session_get_pending_item(ChatSession *session) {
+    return session->pending_user_item ? session->pending_user_item : session->response_item;
+}
+
+// Stops gathering context or the chat request, whichever is running. The
+// session ends once that has wound down.
+void chat_session_cancel(ChatSession *session) {
+    if (session->context_gather) {
+        context_gather_cancel(session->context_gather);
+    } else {
+        api_cancel_chat(session);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef CHAT_SESSION_H
+#define CHAT_SESSION_H
+
+#include "app_data.h"
+#include "chat_message_item.h"
+
+typedef struct ChatRequest ChatRequest;
+
+/**
+ * A response being generated for one chat, from the moment the user sends a
+ * message until the response is stored. It keeps the chat's conversation
+ * and journal, so the response goes on streaming into the right chat after
+ * the user switched to another one, and several chats can generate at once.
+ * Sessions are kept in AppData.sessions by chat id; all of this runs on the
+ * main thread, except for `cancelled`.
+ */
+struct ChatSession {
+    AppData *app_data;
+    char *chat_id;
+    char *model;
+    Conversation *conversation;
+    ChatJournal *journal;               // NULL once the chat was deleted
+    ChatMessageItem *pending_user_item; // user message whose context is being gathered
+    ContextGather *context_gather;
+    ChatMessageItem *response_item;
+    GString *response_buffer;
+    gboolean response_dirty; // response_buffer changed since the last render
+    guint response_tick_id;
+    guint response_checkpoint_id;
+    ChatRequest *request;
+    gint prompt_tokens; // estimate for the prompt sent, checked against prompt_eval_count
+    gboolean prompt_continues; // the prompt started as the chat's previous one did
+    gint cancelled; // atomic, set by the UI and checked by the chat transfer
+};
+
+ChatSession *chat_session_new(AppData *app_data);
+void chat_session_free(ChatSession *session);
+void chat_session_close_all(AppData *app_data);
+ChatSession *chat_session_lookup(AppData *app_data, const char *chat_id);
+gboolean chat_session_is_shown(ChatSession *session);
+ChatMessageItem *chat_session_get_pending_item(ChatSession *session);
+void chat_session_cancel(ChatSession *session);
+
+#endif // CHAT_SESSION_H
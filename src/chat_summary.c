@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <json-c/json.h>
+#include "chat_summary.h"
+#include "chat_journal.h"
+#include "chat_session.h"
+#include "context_budget.h"
+#include "json_util.h"
+#include "model_catalog.h"
+#include "ollama_api.h"
+#include "transport.h"
+#include "trace.h"
+#include "ui_input.h"
+
+/**
+ * Once the turns after a chat's summary take more than
+ * SUMMARY_THRESHOLD_PERCENT of the context window, a request in the
+ * background has the summary model fold the oldest of them into the
+ * summary, leaving the newest half window's worth as they are.
+ * context_budget_plan() then sends the summary in place of the turns it
+ * covers.
+ *
+ * Each request only sends the previous summary and the turns it adds, so
+ * summaries are built up incrementally. Messages never change once
+ * appended, so a summary stays valid until a newer one covers more; one
+ * that no longer extends the chat's summary when it arrives is dropped.
+ *
+ * Summaries never hold up a chat: while a chat request to the same server
+ * and model is out, which Ollama could otherwise make wait behind them, they
+ * wait, and one already sent is stopped. Each keeps the request it built and
+ * sends it again as it is once those chat requests are done. Summaries made
+ * by another model, or on another server, go on.
+ */
+#define SUMMARY_THRESHOLD_PERCENT 75
+#define SUMMARY_MIN_MESSAGES 4
+#define SUMMARY_MESSAGE_MAX_BYTES 4000 // of each message, in the request
+#define SUMMARY_TIMEOUT 300
+
+static const char SUMMARY_INSTRUCTIONS[] =
+    "You keep a running summary of a conversation between a user and an assistant. Merge the summary so "
+    "far, if any, with the conversation that follows it into one summary. Keep the facts, decisions, names, "
+    "numbers, code identifiers and open questions the rest of the conversation may refer to. Write at most "
+    "300 words, and nothing but the summary.";
+
+typedef struct {
+    AppData *app_data;
+    char *chat_id;
+    char *target; // server and model it goes to, see get_target()
+    guint from; // messages covered by the summary extended
+    guint to;   // messages covered by the new one
+    GBytes *body;
+    ApiPost post;     // its request is NULL while it waits
+    gboolean waiting; // for the chat requests to `target`
+} SummaryRequest;
+
+static GHashTable *requests = NULL; // chat id -> SummaryRequest
+static GHashTable *holds = NULL;    // target -> number of chat requests out to it
+
+// --- Private Helper Functions ---
+
+static void free_request(SummaryRequest *request) {
+    api_post_clear(&request->post);
+    g_bytes_unref(request->body);
+    g_free(request->target);
+    g_free(request->chat_id);
+    g_free(request);
+}
+
+static char *get_target(const char *base_url, const char *model) {
+    return g_strconcat(base_url ? base_url : "", " ", model ? model : "", NULL);
+}
+
+static gboolean is_held(const char *target) {
+    return holds && g_hash_table_contains(holds, target);
+}
+
+static void append_turn(GString *text, Conversation *conversation, guint index) {
+    const ConversationMessage *message = conversation_get_message(conversation, index);
+    const char *content = message->content;
+    gsize len = message->content_len;
+    gboolean cut = len > SUMMARY_MESSAGE_MAX_BYTES;
+    if (cut) len = g_utf8_find_prev_char(content, content + SUMMARY_MESSAGE_MAX_BYTES + 1) - content;
+    g_string_append(text, message->role == CONVERSATION_ROLE_ASSISTANT ? "Assistant: " : "User: ");
+    g_string_append_len(text, content, len);
+    g_string_append(text, cut ? "…\n\n" : "\n\n");
+}
+
+/**
+ * The text to summarize: the summary so far, then the messages from `from`
+ * on, as many as fit in the summary request's `num_ctx` and up to
+ * `*to`, which is moved back to where they end. The messages left for later
+ * begin with a user message, as the history sent after the summary has to.
+ */
+static GString *build_transcript(Conversation *conversation, const char *model, gint num_ctx, guint from,
+                                 guint *to) {
+    GString *text = g_string_new(NULL);
+    guint covers = 0;
+    const char *summary = conversation_get_summary(conversation, &covers);
+    if (summary) g_string_append_printf(text, "Summary so far:\n\n%s\n\nConversation that follows it:\n\n", summary);
+
+    gint budget = context_budget_get_limit(num_ctx) -
+                  context_budget_estimate(model, strlen(SUMMARY_INSTRUCTIONS));
+    guint end = from;
+    guint fitting = from; // end of the messages that fit, at a user message
+    gsize fitting_len = text->len;
+    while (end < *to) {
+        append_turn(text, conversation, end++);
+        if (context_budget_estimate(model, text->len) > budget) break;
+        if (end == *to || conversation_get_message(conversation, end)->role == CONVERSATION_ROLE_USER) {
+            fitting = end;
+            fitting_len = text->len;
+        }
+    }
+    g_string_truncate(text, fitting_len);
+    *to = fitting;
+    return text;
+}
+
+static char *parse_summary(const char *data) {
+    json_object *root = data ? json_tokener_parse(data) : NULL;
+    json_object *message, *content;
+    char *summary = NULL;
+    if (root && json_object_object_get_ex(root, "message", &message) &&
+        json_object_object_get_ex(message, "content", &content)) {
+        summary = g_strstrip(g_strdup(json_object_get_string(content)));
+        if (*summary == '\0') g_clear_pointer(&summary, g_free);
+    }
+    if (root) json_object_put(root);
+    return summary;
+}
+
+// Stores the summary in its chat, if the chat is still open and its summary
+// is still the one the request extended.
+static void store_summary(SummaryRequest *request, const char *summary) {
+    AppData *app_data = request->app_data;
+    ChatSession *session = chat_session_lookup(app_data, request->chat_id);
+    Conversation *conversation = NULL;
+    ChatJournal *journal = NULL;
+    if (session) {
+        conversation = session->conversation;
+        journal = session->journal;
+    } else if (g_strcmp0(app_data->current_chat_id, request->chat_id) == 0) {
+        conversation = app_data->conversation;
+        journal = app_data->chat_journal;
+    }
+    if (!conversation || !journal) return;
+
+    guint covers = 0;
+    conversation_get_summary(conversation, &covers);
+    if (covers != request->from || conversation_get_length(conversation) < request->to) return;
+    conversation_set_summary(conversation, summary, request->to);
+    chat_journal_save_summary(journal);
+    if (conversation == app_data->conversation) ui_input_update_context_usage(app_data);
+}
+
+static void on_summary_done(CURL *easy, CURLcode result, gpointer user_data) {
+    SummaryRequest *request = (SummaryRequest *)user_data;
+    request->post.request = NULL;
+    if (request->waiting) {
+        // Stopped for a chat request; sent again once it is done
+        api_post_clear(&request->post);
+        return;
+    }
+    long status = 0;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+    char *summary = result == CURLE_OK && status == 200 ? parse_summary(request->post.response.data) : NULL;
+    if (summary) {
+        store_summary(request, summary);
+        g_free(summary);
+    } else if (result != CURLE_ABORTED_BY_CALLBACK) {
+        fprintf(stderr, "Error summarizing chat %s: %s\n", request->chat_id,
+                result != CURLE_OK ? curl_easy_strerror(result) : "no summary in the response");
+    }
+    g_hash_table_remove(requests, request->chat_id);
+}
+
+// Sends the request, or drops it if it cannot be.
+static void send_request(SummaryRequest *request) {
+    gsize size;
+    const char *body = g_bytes_get_data(request->body, &size);
+    if (!api_post_start(&request->post, request->app_data, "/api/chat", body, size, SUMMARY_TIMEOUT, on_summary_done,
+                        request, "chat", "summary")) {
+        g_hash_table_remove(requests, request->chat_id);
+        return;
+    }
+    trace_span_add_int(request->post.span, "from", request->from);
+    trace_span_add_int(request->post.span, "to", request->to);
+}
+
+// --- Public Functions ---
+
+/**
+ * Called after a turn was stored in `chat_id`: starts folding its oldest
+ * turns into its summary if they take too much of the context window and
+ * no summary is being made for it already. `model` is the chat's, used
+ * unless a summary model is configured.
+ */
+void chat_summary_update(AppData *app_data, const char *chat_id, Conversation *conversation, const char *model) {
+    if (!app_data->summarize_chats) return;
+    if (!requests) {
+        requests = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)free_request);
+    }
+    if (g_hash_table_contains(requests, chat_id)) return;
+
+    gint num_ctx = model_catalog_get_num_ctx(app_data, model);
+    ContextPlan *plan = context_budget_plan(conversation, model, app_data->system_prompt, num_ctx, 0);
+    gboolean due = plan->first > plan->summarized || plan->collapsed > 0 ||
+                   plan->tokens * 100 > context_budget_get_limit(num_ctx) * SUMMARY_THRESHOLD_PERCENT;
+    guint from = plan->summarized;
+    context_budget_plan_free(plan);
+    if (!due) return;
+    // The newest half window stays as it is
+    plan = context_budget_plan(conversation, model, app_data->system_prompt, num_ctx / 2, 0);
+    guint to = plan->first;
+    context_budget_plan_free(plan);
+    if (to < from + SUMMARY_MIN_MESSAGES) return;
+
+    const char *summary_model = app_data->summary_model && *app_data->summary_model ? app_data->summary_model : model;
+    gint summary_num_ctx = model_catalog_get_num_ctx(app_data, summary_model);
+    GString *transcript = build_transcript(conversation, summary_model, summary_num_ctx, from, &to);
+    if (to <= from) {
+        g_string_free(transcript, TRUE);
+        return;
+    }
+    GString *body = g_string_sized_new(transcript->len + sizeof(SUMMARY_INSTRUCTIONS) + 256);
+    g_string_append(body, "{\"model\":");
+    json_util_append_string(body, summary_model ? summary_model : "", -1);
+    g_string_append(body, ",\"messages\":[{\"role\":\"system\",\"content\":");
+    json_util_append_string(body, SUMMARY_INSTRUCTIONS, -1);
+    g_string_append(body, "},{\"role\":\"user\",\"content\":");
+    json_util_append_string(body, transcript->str, transcript->len);
+    g_string_append_printf(body, "}],\"stream\":false,\"options\":{\"temperature\":0.2,\"num_ctx\":%d}", summary_num_ctx);
+    api_append_keep_alive(body, app_data, summary_model);
+    g_string_append_c(body, '}');
+    g_string_free(transcript, TRUE);
+
+    SummaryRequest *request = g_new0(SummaryRequest, 1);
+    request->app_data = app_data;
+    request->chat_id = g_strdup(chat_id);
+    request->target = get_target(app_data->base_url, summary_model);
+    request->from = from;
+    request->to = to;
+    request->body = g_string_free_to_bytes(body);
+    g_hash_table_insert(requests, request->chat_id, request);
+    request->waiting = is_held(request->target);
+    if (!request->waiting) send_request(request);
+}
+
+/**
+ * Called as a chat request to `model` on `base_url` goes out: the summaries
+ * for the same server and model wait until chat_summary_release() is called
+ * with what this returns, once the request is done.
+ */
+char *chat_summary_hold(const char *base_url, const char *model) {
+    char *target = get_target(base_url, model);
+    if (!holds) holds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    guint count = GPOINTER_TO_UINT(g_hash_table_lookup(holds, target));
+    g_hash_table_insert(holds, g_strdup(target), GUINT_TO_POINTER(count + 1));
+    if (count > 0 || !requests) return target;
+
+    GList *pending = g_hash_table_get_values(requests);
+    for (GList *l = pending; l; l = l->next) {
+        SummaryRequest *request = l->data;
+        if (request->waiting || strcmp(request->target, target) != 0) continue;
+        request->waiting = TRUE;
+        if (request->post.request) transport_cancel(api_get_transport(), request->post.request);
+    }
+    g_list_free(pending);
+    return target;
+}
+
+// Sends the summaries waiting on `target` if no other chat request to it
+// is out. Frees `target`.
+void chat_summary_release(char *target) {
+    guint count = holds ? GPOINTER_TO_UINT(g_hash_table_lookup(holds, target)) : 0;
+    if (count > 1) {
+        g_hash_table_insert(holds, g_strdup(target), GUINT_TO_POINTER(count - 1));
+    } else if (count == 1) {
+        g_hash_table_remove(holds, target);
+        GList *pending = requests ? g_hash_table_get_values(requests) : NULL;
+        for (GList *l = pending; l; l = l->next) {
+            SummaryRequest *request = l->data;
+            if (!request->waiting || strcmp(request->target, target) != 0) continue;
+            request->waiting = FALSE;
+            send_request(request);
+        }
+        g_list_free(pending);
+    }
+    g_free(target);
+}
+
+void chat_summary_shutdown(void) {
+    if (requests) {
+        GList *pending = g_hash_table_get_values(requests);
+        for (GList *l = pending; l; l = l->next) {
+            SummaryRequest *request = l->data;
+            request->waiting = FALSE;
+            if (request->post.request) transport_cancel(api_get_transport(), request->post.request);
+        }
+        g_list_free(pending);
+    }
+    g_clear_pointer(&requests, g_hash_table_unref);
+    g_clear_pointer(&holds, g_hash_table_unref);
+}
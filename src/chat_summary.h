@@ -0,0 +1,13 @@
+#ifndef CHAT_SUMMARY_H
+#define CHAT_SUMMARY_H
+
+#include "app_data.h"
+
+// Summaries of the oldest turns of long chats, made in the background. All
+// functions are called from the main thread.
+void chat_summary_update(AppData *app_data, const char *chat_id, Conversation *conversation, const char *model);
+char *chat_summary_hold(const char *base_url, const char *model);
+void chat_summary_release(char *target);
+void chat_summary_shutdown(void);
+
+#endif // CHAT_SUMMARY_H
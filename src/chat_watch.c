@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+#include <gio/gio.h>
+#include "chat_watch.h"
+#include "chat_catalog.h"
+#include "chat_journal.h"
+
+/**
+ * A save touches a chat's files several times in a row (the journal
+ * append, a compaction renaming a temporary file over the snapshot), and a
+ * sync tool may write many chats at once. Events are therefore collected by
+ * chat id and handed over once the directory has been quiet for
+ * WATCH_QUIET_MS, or WATCH_MAX_DELAY_MS after the first one at the latest.
+ */
+#define WATCH_QUIET_MS 250
+#define WATCH_MAX_DELAY_MS 2000
+
+struct ChatWatch {
+    GFileMonitor *monitor;
+    GHashTable *pending; // chat ids
+    guint timeout_id;
+    gint64 batch_started; // monotonic time of the first pending event
+    ChatWatchFunc func;
+    gpointer user_data;
+};
+
+// --- Private Helper Functions ---
+
+// Id of the chat `file` belongs to, or NULL if it is not a chat file.
+static char *get_chat_id(GFile *file) {
+    if (!file) return NULL;
+    char *name = g_file_get_basename(file);
+    if (name && g_str_has_suffix(name, CHAT_JOURNAL_SUFFIX)) {
+        name[strlen(name) - strlen(CHAT_JOURNAL_SUFFIX)] = '\0';
+    }
+    if (name && (!name[0] || !chat_catalog_is_chat_filename(name))) {
+        g_clear_pointer(&name, g_free);
+    }
+    return name;
+}
+
+static gboolean flush_pending(gpointer user_data) {
+    ChatWatch *watch = (ChatWatch *)user_data;
+    watch->timeout_id = 0;
+    GPtrArray *ids = g_ptr_array_new_with_free_func(g_free);
+    GHashTableIter iter;
+    gpointer id;
+    g_hash_table_iter_init(&iter, watch->pending);
+    while (g_hash_table_iter_next(&iter, &id, NULL)) {
+        g_ptr_array_add(ids, id);
+        g_hash_table_iter_steal(&iter);
+    }
+    watch->func(ids, watch->user_data);
+    g_ptr_array_unref(ids);
+    return G_SOURCE_REMOVE;
+}
+
+static void add_pending(ChatWatch *watch, GFile *file) {
+    char *id = get_chat_id(file);
+    if (!id) return;
+    g_hash_table_add(watch->pending, id);
+
+    gint64 now = g_get_monotonic_time();
+    if (watch->timeout_id) {
+        if (now - watch->batch_started >= WATCH_MAX_DELAY_MS * G_TIME_SPAN_MILLISECOND) return;
+        g_source_remove(watch->timeout_id);
+    } else {
+        watch->batch_started = now;
+    }
+    watch->timeout_id = g_timeout_add(WATCH_QUIET_MS, flush_pending, watch);
+}
+
+static void on_directory_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                                 GFileMonitorEvent event, gpointer user_data) {
+    (void)monitor;
+    ChatWatch *watch = (ChatWatch *)user_data;
+    switch (event) {
+        case G_FILE_MONITOR_EVENT_CHANGED:
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+            add_pending(watch, file);
+            break;
+        case G_FILE_MONITOR_EVENT_RENAMED:
+            // Both names, e.g. a temporary file renamed over a snapshot
+            add_pending(watch, file);
+            add_pending(watch, other_file);
+            break;
+        default:
+            break;
+    }
+}
+
+// --- Public Functions ---
+
+// Returns NULL if `dir` cannot be watched.
+ChatWatch *chat_watch_new(const char *dir, ChatWatchFunc func, gpointer user_data) {
+    GFile *file = g_file_new_for_path(dir);
+    GError *error = NULL;
+    GFileMonitor *monitor = g_file_monitor_directory(file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    g_object_unref(file);
+    if (!monitor) {
+        fprintf(stderr, "Error watching %s: %s\n", dir, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    ChatWatch *watch = g_new0(ChatWatch, 1);
+    watch->monitor = monitor;
+    watch->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    watch->func = func;
+    watch->user_data = user_data;
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_directory_changed), watch);
+    return watch;
+}
+
+// Pending events are dropped.
+void chat_watch_free(ChatWatch *watch) {
+    if (!watch) return;
+    g_signal_handlers_disconnect_by_data(watch->monitor, watch);
+    g_file_monitor_cancel(watch->monitor);
+    g_object_unref(watch->monitor);
+    if (watch->timeout_id) g_source_remove(watch->timeout_id);
+    g_hash_table_unref(watch->pending);
+    g_free(watch);
+}
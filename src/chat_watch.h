@@ -0,0 +1,16 @@
+#ifndef CHAT_WATCH_H
+#define CHAT_WATCH_H
+
+#include <glib.h>
+
+// Watches the history directory for chats changed by someone else, e.g. a
+// second instance or a sync tool. `func` gets the ids of the chats whose
+// files changed; it is called on the main thread once events settle.
+typedef void (*ChatWatchFunc)(GPtrArray *ids, gpointer user_data);
+
+typedef struct ChatWatch ChatWatch;
+
+ChatWatch *chat_watch_new(const char *dir, ChatWatchFunc func, gpointer user_data);
+void chat_watch_free(ChatWatch *watch);
+
+#endif // CHAT_WATCH_H
@@ -1,6 +1,8 @@
 #include "config.h"
+#include "persist.h"
 #include <glib/gstdio.h>
 #include <json-c/json.h>
+#include <string.h>
 
 static const char *CONFIG_DIR = ".config/ollama-chat";
 static const char *CONFIG_FILE = "config.json";
@@ -28,8 +30,17 @@ void config_init(AppData *app_data) {
     app_data->pane_position = 256;
     app_data->history_panel_visible = TRUE;
     app_data->ollama_context_size = 2048;
+    app_data->summarize_chats = FALSE;
+    app_data->keep_alive = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
     app_data->theme = g_strdup("light");
     app_data->web_search_enabled = TRUE;
+    app_data->connect_timeout = 10;
+    app_data->first_byte_timeout = 600; // covers loading a large model
+    app_data->stall_timeout = 60;
+    app_data->url_fetch_timeout = 10;
+    app_data->file_read_timeout = 5;
+    app_data->context_deadline = 20;
+    app_data->pack_after_days = 30;
 
     // Ollama Model Parameters
     app_data->temperature = 0.8;
@@ -68,6 +79,19 @@ void config_load(AppData *app_data) {
         if (json_object_object_get_ex(root, "ollama_context_size", &val)) {
             app_data->ollama_context_size = json_object_get_int(val);
         }
+        if (json_object_object_get_ex(root, "summarize_chats", &val)) {
+            app_data->summarize_chats = json_object_get_boolean(val);
+        }
+        if (json_object_object_get_ex(root, "summary_model", &val)) {
+            if (app_data->summary_model) g_free(app_data->summary_model);
+            app_data->summary_model = g_strdup(json_object_get_string(val));
+        }
+        if (json_object_object_get_ex(root, "keep_alive", &val) && json_object_is_type(val, json_type_object)) {
+            g_hash_table_remove_all(app_data->keep_alive);
+            json_object_object_foreach(val, model, duration) {
+                g_hash_table_insert(app_data->keep_alive, g_strdup(model), g_strdup(json_object_get_string(duration)));
+            }
+        }
         if (json_object_object_get_ex(root, "theme", &val)) {
             if (app_data->theme) g_free(app_data->theme);
             app_data->theme = g_strdup(json_object_get_string(val));
@@ -75,6 +99,27 @@ void config_load(AppData *app_data) {
         if (json_object_object_get_ex(root, "web_search_enabled", &val)) {
             app_data->web_search_enabled = json_object_get_boolean(val);
         }
+        if (json_object_object_get_ex(root, "connect_timeout", &val)) {
+            app_data->connect_timeout = json_object_get_int(val);
+        }
+        if (json_object_object_get_ex(root, "first_byte_timeout", &val)) {
+            app_data->first_byte_timeout = json_object_get_int(val);
+        }
+        if (json_object_object_get_ex(root, "stall_timeout", &val)) {
+            app_data->stall_timeout = json_object_get_int(val);
+        }
+        if (json_object_object_get_ex(root, "url_fetch_timeout", &val)) {
+            app_data->url_fetch_timeout = json_object_get_int(val);
+        }
+        if (json_object_object_get_ex(root, "file_read_timeout", &val)) {
+            app_data->file_read_timeout = json_object_get_int(val);
+        }
+        if (json_object_object_get_ex(root, "context_deadline", &val)) {
+            app_data->context_deadline = json_object_get_int(val);
+        }
+        if (json_object_object_get_ex(root, "pack_after_days", &val)) {
+            app_data->pack_after_days = json_object_get_int(val);
+        }
         if (json_object_object_get_ex(root, "temperature", &val)) {
             app_data->temperature = json_object_get_double(val);
         }
@@ -114,10 +159,31 @@ void config_save(AppData *app_data) {
     json_object_object_add(root, "pane_position", json_object_new_int(app_data->pane_position));
     json_object_object_add(root, "history_panel_visible", json_object_new_boolean(app_data->history_panel_visible));
     json_object_object_add(root, "ollama_context_size", json_object_new_int(app_data->ollama_context_size));
+    json_object_object_add(root, "summarize_chats", json_object_new_boolean(app_data->summarize_chats));
+    if (app_data->summary_model) {
+        json_object_object_add(root, "summary_model", json_object_new_string(app_data->summary_model));
+    }
+    if (g_hash_table_size(app_data->keep_alive) > 0) {
+        json_object *keep_alive = json_object_new_object();
+        GHashTableIter iter;
+        gpointer model, duration;
+        g_hash_table_iter_init(&iter, app_data->keep_alive);
+        while (g_hash_table_iter_next(&iter, &model, &duration)) {
+            json_object_object_add(keep_alive, model, json_object_new_string(duration));
+        }
+        json_object_object_add(root, "keep_alive", keep_alive);
+    }
     if (app_data->theme) {
         json_object_object_add(root, "theme", json_object_new_string(app_data->theme));
     }
     json_object_object_add(root, "web_search_enabled", json_object_new_boolean(app_data->web_search_enabled));
+    json_object_object_add(root, "connect_timeout", json_object_new_int(app_data->connect_timeout));
+    json_object_object_add(root, "first_byte_timeout", json_object_new_int(app_data->first_byte_timeout));
+    json_object_object_add(root, "stall_timeout", json_object_new_int(app_data->stall_timeout));
+    json_object_object_add(root, "url_fetch_timeout", json_object_new_int(app_data->url_fetch_timeout));
+    json_object_object_add(root, "file_read_timeout", json_object_new_int(app_data->file_read_timeout));
+    json_object_object_add(root, "context_deadline", json_object_new_int(app_data->context_deadline));
+    json_object_object_add(root, "pack_after_days", json_object_new_int(app_data->pack_after_days));
 
     // Ollama Model Parameters
     json_object_object_add(root, "temperature", json_object_new_double(app_data->temperature));
@@ -133,8 +199,21 @@ void config_save(AppData *app_data) {
 
     char *filepath = get_config_filepath();
     const char *json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY);
-    g_file_set_contents(filepath, json_str, -1, NULL);
+    GBytes *contents = g_bytes_new(json_str, strlen(json_str));
+    persist_write(filepath, contents);
+    g_bytes_unref(contents);
 
     g_free(filepath);
     json_object_put(root);
 }
+
+/**
+ * How long Ollama should keep `model` loaded after a request, as configured
+ * for it or else for "*": a duration such as "30m", or seconds (negative for
+ * ever). NULL leaves it to Ollama.
+ */
+const char *config_get_keep_alive(AppData *app_data, const char *model) {
+    const char *keep_alive = model ? g_hash_table_lookup(app_data->keep_alive, model) : NULL;
+    if (!keep_alive || !*keep_alive) keep_alive = g_hash_table_lookup(app_data->keep_alive, "*");
+    return keep_alive && *keep_alive ? keep_alive : NULL;
+}
@@ -6,5 +6,6 @@
 void config_init(AppData *app_data);
 void config_load(AppData *app_data);
 void config_save(AppData *app_data);
+const char *config_get_keep_alive(AppData *app_data, const char *model);
 
 #endif // CONFIG_H
@@ -0,0 +1,265 @@
+#include <string.h>
+#include "context_budget.h"
+#include "json_util.h"
+
+/**
+ * Ollama cuts a prompt longer than num_ctx from the front, system prompt
+ * first, and evaluates all of it again on every turn. So the prompt is made
+ * to fit here instead: the system prompt, the chat's summary (which stands
+ * for the turns it covers, see chat_summary.c) and the newest message always
+ * go, then as many older turns as fit, with their attachments left out before
+ * any turn is; the attachments of the newest of those are put back while
+ * they fit.
+ *
+ * Ollama only reuses what it cached of the previous prompt up to the first
+ * byte that differs, so the prompt is kept the same from turn to turn for as
+ * long as possible: the system prompt is sent in one canonical form, every
+ * message in the wire form the conversation caches, and the messages sent
+ * stay those of the previous request, plus the new ones, while they fit.
+ * Only then is a new window chosen, and it is filled to WINDOW_FILL_PERCENT
+ * of the budget, so that the next turns fit in it again.
+ *
+ * Tokens are estimated from the size of each message's wire form at
+ * BYTES_PER_TOKEN, scaled by how far off the estimates were from the
+ * prompt_eval_count of past responses to the same model, as each model has
+ * a tokenizer of its own. Assistant messages use the eval_count stored with
+ * them.
+ */
+#define BYTES_PER_TOKEN 4.0
+#define MESSAGE_OVERHEAD 4   // role markers of the chat template, per message
+#define RESPONSE_RESERVE 1024 // at most, and a quarter of num_ctx for small ones
+#define MIN_SCALE 0.5
+#define MAX_SCALE 2.0
+#define WINDOW_FILL_PERCENT 75
+
+static GHashTable *scales = NULL; // model name to its scale, for those calibrated
+static char *system_text = NULL; // canonical system prompt `system_wire` holds
+static GBytes *system_wire = NULL;
+
+typedef struct {
+    GBytes *full;
+    GBytes *collapsed; // NULL if the message is sent in full
+    gint full_tokens;
+    gint collapsed_tokens;
+    ConversationRole role;
+} Candidate;
+
+// --- Private Helper Functions ---
+
+static double get_scale(const char *model) {
+    double *scale = scales && model ? g_hash_table_lookup(scales, model) : NULL;
+    return scale ? *scale : 1.0;
+}
+
+static gint estimate(gsize bytes, double scale) {
+    return (gint)(bytes / BYTES_PER_TOKEN * scale + 0.5);
+}
+
+static void clear_candidate(Candidate *candidate) {
+    g_bytes_unref(candidate->full);
+    if (candidate->collapsed) g_bytes_unref(candidate->collapsed);
+}
+
+// The summary as a system message following the system prompt.
+static GBytes *summary_to_wire(const char *summary) {
+    GString *json = g_string_new("{\"role\":\"system\",\"content\":");
+    char *content = g_strconcat("Summary of the conversation so far:\n\n", summary, NULL);
+    json_util_append_string(json, content, -1);
+    g_string_append_c(json, '}');
+    g_free(content);
+    return g_string_free_to_bytes(json);
+}
+
+static gint message_tokens(const ConversationMessage *message, GBytes *wire, double scale) {
+    if (message->role == CONVERSATION_ROLE_ASSISTANT && message->token_count > 0) {
+        return message->token_count + MESSAGE_OVERHEAD;
+    }
+    return estimate(g_bytes_get_size(wire), scale) + MESSAGE_OVERHEAD;
+}
+
+// The system prompt as a message, in the same bytes for as long as the
+// prompt is the same up to line endings and surrounding white space.
+static GBytes *get_system_wire(const char *system_prompt) {
+    char **lines = g_strsplit(system_prompt ? system_prompt : "", "\r\n", -1);
+    char *text = g_strstrip(g_strjoinv("\n", lines));
+    g_strfreev(lines);
+    if (*text == '\0') {
+        g_free(text);
+        return NULL;
+    }
+    if (g_strcmp0(text, system_text) != 0) {
+        g_free(system_text);
+        system_text = text;
+        if (system_wire) g_bytes_unref(system_wire);
+        GString *json = g_string_new("{\"role\":\"system\",\"content\":");
+        json_util_append_string(json, system_text, -1);
+        g_string_append_c(json, '}');
+        system_wire = g_string_free_to_bytes(json);
+    } else {
+        g_free(text);
+    }
+    return g_bytes_ref(system_wire);
+}
+
+// Adds the candidate for message `index`, the one before those in
+// `candidates`, which go newest first.
+static Candidate *add_candidate(GArray *candidates, Conversation *conversation, guint index, double scale) {
+    guint len = conversation_get_length(conversation);
+    const ConversationMessage *message = conversation_get_message(conversation, index);
+    Candidate candidate = { .full = conversation_get_wire_json(conversation, index), .role = message->role };
+    candidate.full_tokens = message_tokens(message, candidate.full, scale);
+    candidate.collapsed_tokens = candidate.full_tokens;
+    if (index < len - 1) {
+        candidate.collapsed = conversation_get_collapsed_wire_json(conversation, index);
+        if (candidate.collapsed) candidate.collapsed_tokens = message_tokens(message, candidate.collapsed, scale);
+    }
+    g_array_append_val(candidates, candidate);
+    return &g_array_index(candidates, Candidate, candidates->len - 1);
+}
+
+static void add_wire(ContextPlan *plan, GBytes *wire, double scale) {
+    plan->tokens += estimate(g_bytes_get_size(wire), scale) + MESSAGE_OVERHEAD;
+    g_ptr_array_add(plan->wire, wire);
+}
+
+// --- Public Functions ---
+
+// Tokens `bytes` of text take for `model`.
+gint context_budget_estimate(const char *model, gsize bytes) {
+    return estimate(bytes, get_scale(model));
+}
+
+// Tokens the prompt may take out of `num_ctx`, leaving room for the response.
+gint context_budget_get_limit(gint num_ctx) {
+    return num_ctx - MIN(num_ctx / 4, RESPONSE_RESERVE);
+}
+
+/**
+ * Chooses what is sent of `conversation`, after the system prompt and its
+ * summary. The messages of the previous request (see
+ * context_budget_remember()) and the ones added since are kept while they
+ * fit. Otherwise the whole history is sent if it fits; if not, newest first,
+ * every message as small as it can be sent, up to WINDOW_FILL_PERCENT of
+ * the budget, then the attachments of those kept, newest first, until one
+ * does not fit. The history starts with a user message. `draft_tokens` is
+ * room kept for a message not in the conversation yet. Tokens are estimated
+ * for `model`.
+ */
+ContextPlan *context_budget_plan(Conversation *conversation, const char *model, const char *system_prompt,
+                                 gint num_ctx, gint draft_tokens) {
+    double scale = get_scale(model);
+    ContextPlan *plan = g_new0(ContextPlan, 1);
+    plan->wire = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    GBytes *system = get_system_wire(system_prompt);
+    if (system) add_wire(plan, system, scale);
+    guint covers = 0;
+    const char *summary = conversation_get_summary(conversation, &covers);
+    if (summary) add_wire(plan, summary_to_wire(summary), scale);
+    plan->summarized = covers;
+    gint budget = context_budget_get_limit(num_ctx) - plan->tokens - draft_tokens;
+    guint len = conversation_get_length(conversation);
+
+    // Newest first
+    GArray *candidates = g_array_new(FALSE, TRUE, sizeof(Candidate));
+    g_array_set_clear_func(candidates, (GDestroyNotify)clear_candidate);
+    guint first, collapsed_end;
+    gint used = 0;
+    gboolean continues = conversation_get_window(conversation, &first, &collapsed_end) &&
+                         first >= covers && first < len;
+    for (guint i = len; continues && i-- > first;) {
+        Candidate *candidate = add_candidate(candidates, conversation, i, scale);
+        used += candidate->collapsed && i < collapsed_end ? candidate->collapsed_tokens : candidate->full_tokens;
+        continues = used <= budget;
+    }
+
+    if (!continues) {
+        gint total = 0;
+        for (guint j = 0; j < candidates->len; j++) total += g_array_index(candidates, Candidate, j).collapsed_tokens;
+        for (guint i = len - candidates->len; i > covers && total <= budget;) {
+            total += add_candidate(candidates, conversation, --i, scale)->collapsed_tokens;
+        }
+        gint target = total <= budget ? budget : budget / 100 * WINDOW_FILL_PERCENT;
+        guint count = 0;
+        used = 0;
+        while (count < candidates->len) {
+            gint tokens = g_array_index(candidates, Candidate, count).collapsed_tokens;
+            if (count > 0 && used + tokens > target) break;
+            used += tokens;
+            count++;
+        }
+        while (count > 1 && g_array_index(candidates, Candidate, count - 1).role != CONVERSATION_ROLE_USER) {
+            used -= g_array_index(candidates, Candidate, --count).collapsed_tokens;
+        }
+        collapsed_end = 0;
+        for (guint j = 0; j < count; j++) {
+            Candidate *candidate = &g_array_index(candidates, Candidate, j);
+            if (!candidate->collapsed) continue;
+            gint extra = candidate->full_tokens - candidate->collapsed_tokens;
+            if (used + extra > target) {
+                collapsed_end = len - j;
+                break;
+            }
+            used += extra;
+        }
+        first = len - count;
+    }
+
+    plan->first = first;
+    plan->collapsed_end = collapsed_end;
+    plan->continues = continues;
+    plan->tokens += used;
+    for (guint i = first; i < len; i++) {
+        Candidate *candidate = &g_array_index(candidates, Candidate, len - 1 - i);
+        gboolean collapse = candidate->collapsed && i < collapsed_end;
+        if (collapse) plan->collapsed++;
+        g_ptr_array_add(plan->wire, g_bytes_ref(collapse ? candidate->collapsed : candidate->full));
+    }
+    g_array_unref(candidates);
+    return plan;
+}
+
+// Has the next plan for `conversation` keep to the messages `plan` sends.
+void context_budget_remember(Conversation *conversation, const ContextPlan *plan) {
+    conversation_set_window(conversation, plan->first, plan->collapsed_end);
+}
+
+void context_budget_plan_free(ContextPlan *plan) {
+    if (!plan) return;
+    g_ptr_array_unref(plan->wire);
+    g_free(plan);
+}
+
+/**
+ * Moves the estimates for `model` halfway towards the prompt_eval_count
+ * Ollama reported for a prompt `estimated` at its current scale. Only
+ * prompts that did not start as the previous one did are taken, and counts
+ * far off the estimate are not: Ollama reports only the tokens it
+ * evaluated, which is less when it reused the start of the prompt from its
+ * cache.
+ */
+void context_budget_calibrate(const char *model, gint estimated, gint64 prompt_eval_count) {
+    if (!model || estimated <= 0 || prompt_eval_count <= 0) return;
+    double ratio = (double)prompt_eval_count / estimated;
+    if (ratio < MIN_SCALE || ratio > MAX_SCALE) return;
+    if (!scales) scales = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    double *scale = g_hash_table_lookup(scales, model);
+    if (!scale) {
+        scale = g_new(double, 1);
+        *scale = 1.0;
+        g_hash_table_insert(scales, g_strdup(model), scale);
+    }
+    *scale = CLAMP(*scale * (1.0 + ratio) / 2.0, MIN_SCALE, MAX_SCALE);
+}
+
+// How much of a prompt estimated at `estimated` tokens Ollama took from its
+// cache, going by the prompt_eval_count it reported; -1 if it did not.
+gint context_budget_cached_percent(gint estimated, gint64 prompt_eval_count) {
+    if (estimated <= 0 || prompt_eval_count <= 0) return -1;
+    return CLAMP(100 - (gint)(prompt_eval_count * 100 / estimated), 0, 100);
+}
+
+void context_budget_shutdown(void) {
+    g_clear_pointer(&scales, g_hash_table_unref);
+    g_clear_pointer(&system_text, g_free);
+    g_clear_pointer(&system_wire, g_bytes_unref);
+}
@@ -0,0 +1,30 @@
+#ifndef CONTEXT_BUDGET_H
+#define CONTEXT_BUDGET_H
+
+#include <glib.h>
+#include "conversation.h"
+
+// The messages of a chat sent in one request, chosen to fit num_ctx.
+typedef struct {
+    guint first;         // oldest message sent; those before it are left out
+    guint summarized;    // messages the chat's summary, sent first, stands for
+    GPtrArray *wire;     // GBytes: the system prompt, the summary and each message from `first` on
+    gint tokens;         // estimate for the prompt
+    guint collapsed;     // messages sent with their attachments left out
+    guint collapsed_end; // messages before it are sent without their attachments
+    gboolean continues;  // the prompt starts as the previous request's did
+} ContextPlan;
+
+// Token estimates for the context window of a chat. All functions are
+// called from the main thread.
+gint context_budget_estimate(const char *model, gsize bytes);
+gint context_budget_get_limit(gint num_ctx);
+ContextPlan *context_budget_plan(Conversation *conversation, const char *model, const char *system_prompt,
+                                 gint num_ctx, gint draft_tokens);
+void context_budget_remember(Conversation *conversation, const ContextPlan *plan);
+void context_budget_plan_free(ContextPlan *plan);
+void context_budget_calibrate(const char *model, gint estimated, gint64 prompt_eval_count);
+gint context_budget_cached_percent(gint estimated, gint64 prompt_eval_count);
+void context_budget_shutdown(void);
+
+#endif // CONTEXT_BUDGET_H
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <string.h>
+#include <gio/gio.h>
+#include "context_gather.h"
+#include "web_search.h"
+#include "blob_store.h"
+#include "trace.h"
+
+/**
+ * Every source is fetched concurrently: URLs on the shared curl transport,
+ * files through GIO's worker threads. Each has its own timeout, and the
+ * whole gather ends at the deadline with whatever arrived by then. What
+ * arrived goes to the blob store, and the attachments are reported in the
+ * order the sources were named, so the prompt does not depend on which one
+ * finished first.
+ *
+ * Callbacks of sources still in flight when the gather ends keep it alive
+ * through `ref_count` and are ignored.
+ */
+typedef enum {
+    SOURCE_URL,
+    SOURCE_FILE,
+} SourceKind;
+
+typedef enum {
+    SOURCE_PENDING,
+    SOURCE_DONE,
+    SOURCE_SKIPPED,
+    SOURCE_FAILED,
+} SourceState;
+
+typedef struct {
+    ContextGather *gather;
+    SourceKind kind;
+    SourceState state;
+    char *name;
+    ConversationAttachment *attachment; // NULL if nothing was gathered
+    char *detail; // shown in the status when failed or skipped
+    TransportRequest *request;
+    GCancellable *cancellable;
+    guint timeout_id;
+    TraceSpan *span; // file reads only
+} ContextSource;
+
+struct ContextGather {
+    int ref_count;
+    gboolean finished;
+    char *message;
+    GPtrArray *sources; // ContextSource
+    guint pending;
+    guint deadline_id;
+    Transport *transport;
+    TraceSpan *span;
+    ContextProgressFunc progress_func;
+    ContextDoneFunc done_func;
+    gpointer user_data;
+};
+
+// --- Private Helper Functions ---
+
+static void free_source(gpointer data) {
+    ContextSource *source = data;
+    g_free(source->name);
+    conversation_attachment_free(source->attachment);
+    g_free(source->detail);
+    g_clear_object(&source->cancellable);
+    g_free(source);
+}
+
+static ContextGather *gather_ref(ContextGather *gather) {
+    gather->ref_count++;
+    return gather;
+}
+
+static void gather_unref(ContextGather *gather) {
+    if (--gather->ref_count > 0) return;
+    g_ptr_array_unref(gather->sources);
+    g_free(gather->message);
+    g_free(gather);
+}
+
+static char *build_status(ContextGather *gather) {
+    GString *status = g_string_new(NULL);
+    for (guint i = 0; i < gather->sources->len; i++) {
+        ContextSource *source = g_ptr_array_index(gather->sources, i);
+        if (i > 0) g_string_append_c(status, '\n');
+        switch (source->state) {
+            case SOURCE_PENDING:
+                g_string_append_printf(status, "%s %s…", source->kind == SOURCE_URL ? "Fetching" : "Reading", source->name);
+                break;
+            case SOURCE_DONE:
+                g_string_append_printf(status, "✓ %s", source->name);
+                break;
+            case SOURCE_SKIPPED:
+            case SOURCE_FAILED:
+                g_string_append_printf(status, "✗ %s (%s)", source->name, source->detail);
+                break;
+        }
+    }
+    return g_string_free(status, FALSE);
+}
+
+static void report_progress(ContextGather *gather) {
+    char *status = build_status(gather);
+    gather->progress_func(status, gather->user_data);
+    g_free(status);
+}
+
+static GPtrArray *take_attachments(ContextGather *gather) {
+    GPtrArray *attachments = g_ptr_array_new_with_free_func((GDestroyNotify)conversation_attachment_free);
+    for (guint i = 0; i < gather->sources->len; i++) {
+        ContextSource *source = g_ptr_array_index(gather->sources, i);
+        if (source->attachment) g_ptr_array_add(attachments, g_steal_pointer(&source->attachment));
+    }
+    return attachments;
+}
+
+// Stores the contents of `source` and attaches them.
+static void attach_contents(ContextSource *source, ConversationAttachmentKind kind, const char *contents, gsize length) {
+    char *key = blob_store_put(contents, length);
+    source->attachment = conversation_attachment_new(kind, source->name, key);
+    g_free(key);
+}
+
+// Stops whatever is still running and reports the result once.
+static void finish(ContextGather *gather, gboolean cancelled) {
+    if (gather->finished) return;
+    gather->finished = TRUE;
+    g_clear_handle_id(&gather->deadline_id, g_source_remove);
+    for (guint i = 0; i < gather->sources->len; i++) {
+        ContextSource *source = g_ptr_array_index(gather->sources, i);
+        g_clear_handle_id(&source->timeout_id, g_source_remove);
+        if (source->state != SOURCE_PENDING) continue;
+        source->state = SOURCE_FAILED;
+        source->detail = g_strdup(cancelled ? "cancelled" : "timed out");
+        if (source->request) {
+            TransportRequest *request = source->request;
+            source->request = NULL;
+            transport_cancel(gather->transport, request);
+        }
+        if (source->cancellable) g_cancellable_cancel(source->cancellable);
+    }
+    if (gather->sources->len > 0) report_progress(gather);
+    GPtrArray *attachments = take_attachments(gather);
+    trace_span_add_int(gather->span, "sources", gather->sources->len);
+    trace_span_add_int(gather->span, "attachments", attachments->len);
+    trace_span_add_int(gather->span, "cancelled", cancelled);
+    trace_span_end(gather->span);
+    gather->span = NULL;
+    gather->done_func(gather->message, attachments, cancelled, gather->user_data);
+    g_ptr_array_unref(attachments);
+    gather_unref(gather);
+}
+
+static void source_finished(ContextSource *source) {
+    ContextGather *gather = source->gather;
+    g_clear_handle_id(&source->timeout_id, g_source_remove);
+    report_progress(gather);
+    if (--gather->pending == 0) {
+        finish(gather, FALSE);
+    }
+}
+
+static void on_url_fetched(const char *text, const char *error, gpointer user_data) {
+    ContextSource *source = user_data;
+    ContextGather *gather = source->gather;
+    source->request = NULL;
+    if (!gather->finished) {
+        if (text) {
+            source->state = SOURCE_DONE;
+            attach_contents(source, CONVERSATION_ATTACHMENT_URL, text, strlen(text));
+        } else {
+            source->state = SOURCE_FAILED;
+            source->detail = g_strdup(error);
+        }
+        source_finished(source);
+    }
+    gather_unref(gather);
+}
+
+static gboolean is_binary(const char *contents, gsize length) {
+    return memchr(contents, '\0', MIN(length, 1024)) != NULL;
+}
+
+static void on_file_loaded(GObject *object, GAsyncResult *result, gpointer user_data) {
+    ContextSource *source = user_data;
+    ContextGather *gather = source->gather;
+    char *contents = NULL;
+    gsize length = 0;
+    GError *error = NULL;
+    gboolean ok = g_file_load_contents_finish(G_FILE(object), result, &contents, &length, NULL, &error);
+    trace_span_add_int(source->span, "bytes", ok ? (gint64)length : -1);
+    trace_span_end(source->span);
+    source->span = NULL;
+    if (!gather->finished) {
+        if (!ok) {
+            source->state = SOURCE_FAILED;
+            source->detail = g_strdup(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ? "timed out" : error->message);
+            fprintf(stderr, "Error reading file %s: %s\n", source->name, error->message);
+        } else if (is_binary(contents, length)) {
+            source->state = SOURCE_SKIPPED;
+            source->detail = g_strdup("binary");
+            source->attachment = conversation_attachment_new(CONVERSATION_ATTACHMENT_BINARY_FILE, source->name, NULL);
+        } else {
+            source->state = SOURCE_DONE;
+            attach_contents(source, CONVERSATION_ATTACHMENT_FILE, contents, length);
+        }
+        source_finished(source);
+    }
+    g_clear_error(&error);
+    g_free(contents);
+    gather_unref(gather);
+}
+
+static gboolean on_file_timeout(gpointer user_data) {
+    ContextSource *source = user_data;
+    source->timeout_id = 0;
+    g_cancellable_cancel(source->cancellable);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_deadline(gpointer user_data) {
+    ContextGather *gather = user_data;
+    gather->deadline_id = 0;
+    finish(gather, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+static ContextSource *add_source(ContextGather *gather, SourceKind kind, const char *name) {
+    ContextSource *source = g_new0(ContextSource, 1);
+    source->gather = gather;
+    source->kind = kind;
+    source->name = g_strdup(name);
+    g_ptr_array_add(gather->sources, source);
+    gather->pending++;
+    return source;
+}
+
+// --- Public Functions ---
+
+/**
+ * Starts fetching `url` (may be NULL) and reading `files` (NULL-terminated,
+ * may be NULL). `done_func` is always called exactly once, possibly before
+ * this returns when there is nothing to gather. The gather must not be used
+ * after that.
+ */
+ContextGather *context_gather_start(const char *message, const char *url, char **files,
+                                    const ContextGatherOptions *options,
+                                    ContextProgressFunc progress_func, ContextDoneFunc done_func,
+                                    gpointer user_data) {
+    ContextGather *gather = g_new0(ContextGather, 1);
+    gather->ref_count = 1;
+    gather->message = g_strdup(message);
+    gather->sources = g_ptr_array_new_with_free_func(free_source);
+    gather->transport = options->transport;
+    gather->span = trace_span_begin(1, "context", "gather");
+    gather->progress_func = progress_func;
+    gather->done_func = done_func;
+    gather->user_data = user_data;
+
+    if (url) add_source(gather, SOURCE_URL, url);
+    for (char **file = files; file && *file; file++) {
+        add_source(gather, SOURCE_FILE, *file);
+    }
+    if (gather->pending == 0) {
+        finish(gather, FALSE);
+        return NULL;
+    }
+
+    report_progress(gather);
+    gather_ref(gather); // held until the gather finishes
+    for (guint i = 0; i < gather->sources->len; i++) {
+        ContextSource *source = g_ptr_array_index(gather->sources, i);
+        gather_ref(gather); // released by the source's callback
+        if (source->kind == SOURCE_URL) {
+            source->request = fetch_url_content_async(gather->transport, source->name, options->url_timeout,
+                                                      on_url_fetched, source);
+        } else {
+            GFile *file = g_file_new_for_path(source->name);
+            source->cancellable = g_cancellable_new();
+            if (options->file_timeout > 0) {
+                source->timeout_id = g_timeout_add_seconds(options->file_timeout, on_file_timeout, source);
+            }
+            source->span = trace_span_begin(trace_new_track(source->name), "context", "read file");
+            g_file_load_contents_async(file, source->cancellable, on_file_loaded, source);
+            g_object_unref(file);
+        }
+        if (gather->finished) break;
+    }
+    if (!gather->finished && options->deadline > 0) {
+        gather->deadline_id = g_timeout_add_seconds(options->deadline, on_deadline, gather);
+    }
+    gboolean finished = gather->finished;
+    gather_unref(gather);
+    return finished ? NULL : gather;
+}
+
+// Ends the gather now; `done_func` is called with `cancelled` set.
+void context_gather_cancel(ContextGather *gather) {
+    finish(gather, TRUE);
+}
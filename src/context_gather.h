@@ -0,0 +1,32 @@
+#ifndef CONTEXT_GATHER_H
+#define CONTEXT_GATHER_H
+
+#include <glib.h>
+#include "transport.h"
+#include "conversation.h"
+
+// Collects the context a user message refers to (a URL, @files)
+// concurrently and without blocking the main loop.
+typedef struct ContextGather ContextGather;
+
+typedef struct {
+    Transport *transport;
+    int url_timeout;  // seconds, per URL
+    int file_timeout; // seconds, per file
+    int deadline;     // seconds, for the whole gather
+} ContextGatherOptions;
+
+// `status` is a human-readable progress summary, one line per source.
+typedef void (*ContextProgressFunc)(const char *status, gpointer user_data);
+// `attachments` (ConversationAttachment) are what was gathered for `message`,
+// in the order the sources were named, with their contents in the blob store.
+typedef void (*ContextDoneFunc)(const char *message, GPtrArray *attachments, gboolean cancelled,
+                                gpointer user_data);
+
+ContextGather *context_gather_start(const char *message, const char *url, char **files,
+                                    const ContextGatherOptions *options,
+                                    ContextProgressFunc progress_func, ContextDoneFunc done_func,
+                                    gpointer user_data);
+void context_gather_cancel(ContextGather *gather);
+
+#endif // CONTEXT_GATHER_H
@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <string.h>
+#include <json-c/json.h>
+#include "conversation.h"
+#include "json_util.h"
+#include "blob_store.h"
+
+/**
+ * Append-only conversation store. Message records are kept in one contiguous
+ * array and their text in arena chunks that never move, so that every
+ * message can be handed out as a C string without copying. Pointers returned
+ * by conversation_get_content() stay valid as long as the conversation.
+ *
+ * A conversation read from a chat file keeps the file mapped (or, for a
+ * packed chat, its decompressed bytes) and, for each stored message, the
+ * offset of its record, which conversation_to_json()
+ * writes one per line. Records are only decoded, a page at a time, when a
+ * message is first looked at, so opening a long chat only decodes what is on
+ * screen. Writing the chat back or sending its messages to the model copies
+ * the records as they are. Decoding on demand makes reads modify the store:
+ * a conversation must only be used from one thread.
+ *
+ * Since messages never change once appended, their wire form is serialized
+ * at most once and kept in `wire_cache` for every later request.
+ *
+ * A user message that refers to files or pages stores only what the user
+ * typed, plus the blob keys of the attachments. The prompt the model sees,
+ * the attachments' contents followed by the message, is only put together
+ * when the message's wire form is.
+ *
+ * A long chat may also hold a summary of its first `summary_covers`
+ * messages, sent to the model in their place. It is written as the first
+ * line of the chat file, ahead of the messages.
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define DECODE_PAGE_SIZE 32
+
+typedef struct {
+    gsize offset; // in `data`
+    gsize len;
+    gboolean edited; // the decoded message changed: written from it, not copied
+} StoredRecord;
+
+struct Conversation {
+    gint ref_count;
+    GArray *messages; // ConversationMessage
+    GPtrArray *chunks; // text arena
+    gsize chunk_used;  // bytes used in the last chunk
+    gsize chunk_size;  // of the last chunk
+    GPtrArray *wire_cache; // GBytes per message, NULL until first requested
+    GBytes *data;      // the chat file the first records->len messages are in
+    GArray *records;   // StoredRecord, NULL if not read from a file
+    char *summary;     // NULL if none
+    guint summary_covers;
+    gboolean has_window; // messages the last request sent, not stored
+    guint window_first;
+    guint window_collapsed_end;
+};
+
+static void unref_bytes(gpointer bytes) {
+    if (bytes) g_bytes_unref(bytes);
+}
+
+// --- Private Helper Functions ---
+
+// Copies `len` bytes of text into the arena, NUL-terminated.
+static const char *store_text(Conversation *conversation, const char *text, gsize len) {
+    if (conversation->chunks->len == 0 || conversation->chunk_used + len + 1 > conversation->chunk_size) {
+        conversation->chunk_size = MAX(ARENA_CHUNK_SIZE, len + 1);
+        g_ptr_array_add(conversation->chunks, g_malloc(conversation->chunk_size));
+        conversation->chunk_used = 0;
+    }
+    char *chunk = g_ptr_array_index(conversation->chunks, conversation->chunks->len - 1);
+    char *copy = chunk + conversation->chunk_used;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    conversation->chunk_used += len + 1;
+    return copy;
+}
+
+static const char *attachment_kind_to_string(ConversationAttachmentKind kind) {
+    switch (kind) {
+        case CONVERSATION_ATTACHMENT_FILE: return "file";
+        case CONVERSATION_ATTACHMENT_URL: return "url";
+        case CONVERSATION_ATTACHMENT_BINARY_FILE: return "binary";
+    }
+    return "file";
+}
+
+static gboolean role_from_string(const char *role, ConversationRole *out) {
+    if (g_strcmp0(role, "user") == 0) {
+        *out = CONVERSATION_ROLE_USER;
+    } else if (g_strcmp0(role, "assistant") == 0) {
+        *out = CONVERSATION_ROLE_ASSISTANT;
+    } else if (g_strcmp0(role, "system") == 0) {
+        *out = CONVERSATION_ROLE_SYSTEM;
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Fills `message` from a message object in disk form.
+static gboolean message_from_json(Conversation *conversation, json_object *msg_obj, ConversationMessage *message) {
+    json_object *role_obj, *content_obj, *val;
+    if (!json_object_object_get_ex(msg_obj, "role", &role_obj) ||
+        !json_object_object_get_ex(msg_obj, "content", &content_obj) ||
+        !role_from_string(json_object_get_string(role_obj), &message->role)) {
+        return FALSE;
+    }
+    message->content_len = json_object_get_string_len(content_obj);
+    message->content = store_text(conversation, json_object_get_string(content_obj), message->content_len);
+    message->attachments = NULL;
+    if (json_object_object_get_ex(msg_obj, "attachments", &val) && json_object_is_type(val, json_type_array)) {
+        const char *attachments = json_object_to_json_string_ext(val, JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOSLASHESCAPE);
+        message->attachments = store_text(conversation, attachments, strlen(attachments));
+    }
+    message->created_at = json_object_object_get_ex(msg_obj, "created_at", &val) ? json_object_get_int64(val) : 0;
+    message->token_count = json_object_object_get_ex(msg_obj, "tokens", &val) ? json_object_get_int(val) : 0;
+    return TRUE;
+}
+
+// Takes the summary from a summary record, {"summary":"…","covers":N}.
+// Returns FALSE if `obj` is not one.
+static gboolean summary_from_json(Conversation *conversation, json_object *obj) {
+    json_object *summary_obj, *covers_obj;
+    if (!json_object_object_get_ex(obj, "summary", &summary_obj) ||
+        !json_object_object_get_ex(obj, "covers", &covers_obj)) {
+        return FALSE;
+    }
+    conversation_set_summary(conversation, json_object_get_string(summary_obj), json_object_get_int(covers_obj));
+    return TRUE;
+}
+
+static const char *record_data(Conversation *conversation, guint index) {
+    const StoredRecord *record = &g_array_index(conversation->records, StoredRecord, index);
+    return (const char *)g_bytes_get_data(conversation->data, NULL) + record->offset;
+}
+
+static void decode_record(Conversation *conversation, json_tokener *tokener, guint index) {
+    ConversationMessage *message = &g_array_index(conversation->messages, ConversationMessage, index);
+    const StoredRecord *record = &g_array_index(conversation->records, StoredRecord, index);
+    json_tokener_reset(tokener);
+    json_object *msg_obj = json_tokener_parse_ex(tokener, record_data(conversation, index), record->len);
+    if (!msg_obj || !message_from_json(conversation, msg_obj, message)) {
+        // Only its layout was checked when indexed, and its place in the chat
+        // is taken by then; show it as empty
+        fprintf(stderr, "Unreadable message %u in chat\n", index);
+        message->role = CONVERSATION_ROLE_USER;
+        message->content = store_text(conversation, "", 0);
+        message->content_len = 0;
+    }
+    if (msg_obj) json_object_put(msg_obj);
+}
+
+// Decodes the stored messages of the page that holds `index`.
+static void decode_page(Conversation *conversation, guint index) {
+    guint first = index - index % DECODE_PAGE_SIZE;
+    guint end = MIN(first + DECODE_PAGE_SIZE, conversation->records->len);
+    json_tokener *tokener = json_tokener_new();
+    for (guint i = first; i < end; i++) {
+        if (!g_array_index(conversation->messages, ConversationMessage, i).content) {
+            decode_record(conversation, tokener, i);
+        }
+    }
+    json_tokener_free(tokener);
+}
+
+static ConversationMessage *get_decoded(Conversation *conversation, guint index) {
+    ConversationMessage *message = &g_array_index(conversation->messages, ConversationMessage, index);
+    if (!message->content) decode_page(conversation, index);
+    return message;
+}
+
+// Returns the end of the JSON string starting at `p` (just past its opening
+// quote), that is its closing quote, or NULL.
+static const char *find_string_end(const char *p, const char *end) {
+    while (p < end) {
+        if (*p == '\\') {
+            p += 2;
+        } else if (*p == '"') {
+            return p;
+        } else {
+            p++;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Closing quote of the content of a message record laid out as
+ * conversation_append_message_json() writes it: role, then content. NULL if
+ * `data` does not start that way.
+ */
+static const char *find_content_end(const char *data, gsize len) {
+    static const char role_key[] = "{\"role\":\"";
+    static const char content_key[] = "\",\"content\":\"";
+    const char *end = data + len;
+    if (len < strlen(role_key) || memcmp(data, role_key, strlen(role_key)) != 0) return NULL;
+    const char *role = data + strlen(role_key);
+    const char *p = role;
+    while (p < end && g_ascii_isalpha(*p)) p++;
+    char name[16];
+    ConversationRole parsed;
+    if (p - role >= (gssize)sizeof(name)) return NULL;
+    memcpy(name, role, p - role);
+    name[p - role] = '\0';
+    if (!role_from_string(name, &parsed)) return NULL;
+    if ((gsize)(end - p) < strlen(content_key) || memcmp(p, content_key, strlen(content_key)) != 0) return NULL;
+    return find_string_end(p + strlen(content_key), end);
+}
+
+/**
+ * Records where each message of a chat file written by conversation_to_json()
+ * is, from the line structure alone: "[", one object per line, each but the
+ * last followed by a comma, and "]". Returns FALSE for any other layout.
+ * Only the summary record, which comes first, is parsed here. A message
+ * record keeps its place even if it cannot be read, so that the messages
+ * after it keep the indexes the chat's journal refers to them by; it is
+ * shown as empty once decoded, see decode_record().
+ */
+static gboolean index_records(Conversation *conversation, const char *contents, gsize length) {
+    static const char summary_key[] = "{\"summary\":";
+    const char *end = contents + length;
+    const char *line = contents;
+    gboolean started = FALSE;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', end - line);
+        const char *line_end = newline ? newline : end;
+        gsize len = line_end - line;
+        if (!started) {
+            if (len != 1 || line[0] != '[') return FALSE;
+            started = TRUE;
+        } else if (len == 1 && line[0] == ']') {
+            for (const char *p = line_end; p < end; p++) {
+                if (!g_ascii_isspace(*p)) return FALSE;
+            }
+            return TRUE;
+        } else if (len > 0) {
+            if (line[len - 1] == ',') len--;
+            if (len < 2 || line[0] != '{' || line[len - 1] != '}') return FALSE;
+            if (conversation->records->len == 0 && len > strlen(summary_key) &&
+                memcmp(line, summary_key, strlen(summary_key)) == 0) {
+                json_tokener *tokener = json_tokener_new();
+                json_object *summary = json_tokener_parse_ex(tokener, line, len);
+                json_tokener_free(tokener);
+                gboolean ok = summary && summary_from_json(conversation, summary);
+                if (summary) json_object_put(summary);
+                if (!ok) return FALSE;
+            } else {
+                StoredRecord record = { .offset = line - contents, .len = len };
+                g_array_append_val(conversation->records, record);
+            }
+        }
+        line = line_end + 1;
+    }
+    return FALSE;
+}
+
+// Parses the whole of a chat file in a layout index_records() does not know,
+// as written by older versions.
+static gboolean parse_file(Conversation *conversation, const char *contents, gsize length) {
+    json_tokener *tokener = json_tokener_new();
+    json_object *root = json_tokener_parse_ex(tokener, contents, length);
+    json_tokener_free(tokener);
+    if (!root) return FALSE;
+    gboolean ok = json_object_is_type(root, json_type_array);
+    int len = ok ? json_object_array_length(root) : 0;
+    for (int i = 0; i < len; i++) {
+        json_object *record = json_object_array_get_idx(root, i);
+        if (!summary_from_json(conversation, record)) {
+            conversation_append_from_json(conversation, record);
+        }
+    }
+    json_object_put(root);
+    return ok;
+}
+
+/**
+ * Wire form of a stored record, taken from its bytes without decoding it:
+ * the record up to its content, which conversation_append_message_json()
+ * writes first, then the closing brace. NULL if the record is laid out
+ * differently or has attachments to expand.
+ */
+static GBytes *wire_from_record(Conversation *conversation, guint index) {
+    const StoredRecord *record = &g_array_index(conversation->records, StoredRecord, index);
+    const char *data = record_data(conversation, index);
+    const char *end = data + record->len;
+    const char *content_end = find_content_end(data, record->len);
+    if (!content_end) return NULL;
+
+    static const char attachments_key[] = ",\"attachments\":";
+    gsize len = content_end + 1 - data;
+    if ((gsize)(end - data - len) > strlen(attachments_key) &&
+        memcmp(data + len, attachments_key, strlen(attachments_key)) == 0) {
+        return NULL;
+    }
+    if (content_end + 2 == end) {
+        // No metadata: the record is its own wire form
+        return g_bytes_new_from_bytes(conversation->data, record->offset, record->len);
+    }
+    char *wire = g_malloc(len + 1);
+    memcpy(wire, data, len);
+    wire[len] = '}';
+    return g_bytes_new_take(wire, len + 1);
+}
+
+/**
+ * Content of the message as the model is sent it: the text of each attachment,
+ * as it was gathered when the message was written, then the message itself.
+ * An attachment whose blob is gone is mentioned but left out, as are all of
+ * them when `collapsed`.
+ */
+static void append_expanded_content(GString *out, const ConversationMessage *message, gboolean collapsed) {
+    json_object *attachments = json_tokener_parse(message->attachments);
+    int count = attachments && json_object_is_type(attachments, json_type_array) ? json_object_array_length(attachments) : 0;
+    GString *text = g_string_new(NULL);
+    for (int i = 0; i < count; i++) {
+        json_object *attachment = json_object_array_get_idx(attachments, i);
+        json_object *val;
+        const char *kind = json_object_object_get_ex(attachment, "kind", &val) ? json_object_get_string(val) : "";
+        const char *name = json_object_object_get_ex(attachment, "name", &val) ? json_object_get_string(val) : "";
+        const char *key = json_object_object_get_ex(attachment, "blob", &val) ? json_object_get_string(val) : NULL;
+        gboolean is_url = g_strcmp0(kind, "url") == 0;
+        if (g_strcmp0(kind, "binary") == 0) {
+            g_string_append_printf(text, "Content from binary file %s was not included.\n\n", name);
+            continue;
+        }
+        if (collapsed) {
+            g_string_append_printf(text, "Content from %s %s was left out.\n\n", is_url ? "URL" : "file", name);
+            continue;
+        }
+        GBytes *blob = blob_store_get(key);
+        if (!blob) {
+            g_string_append_printf(text, "Content from %s %s is no longer available.\n\n", is_url ? "URL" : "file", name);
+            continue;
+        }
+        gsize size;
+        const char *data = g_bytes_get_data(blob, &size);
+        g_string_append_printf(text, "Content from %s %s:\n\n", is_url ? "URL" : "file", name);
+        g_string_append_len(text, data, size);
+        g_string_append(text, "\n\n---\n\n");
+        g_bytes_unref(blob);
+    }
+    if (text->len > 0) g_string_append(text, "User message: ");
+    g_string_append_len(text, message->content, message->content_len);
+    json_util_append_string(out, text->str, text->len);
+    g_string_free(text, TRUE);
+    if (attachments) json_object_put(attachments);
+}
+
+// --- Public Functions ---
+
+Conversation *conversation_new(void) {
+    Conversation *conversation = g_new0(Conversation, 1);
+    conversation->ref_count = 1;
+    conversation->messages = g_array_new(FALSE, TRUE, sizeof(ConversationMessage));
+    conversation->chunks = g_ptr_array_new_with_free_func(g_free);
+    conversation->wire_cache = g_ptr_array_new_with_free_func(unref_bytes);
+    return conversation;
+}
+
+/**
+ * Appends a message in the disk form of conversation_append_message_json().
+ * Returns FALSE, appending nothing, if the object is not a valid message.
+ */
+gboolean conversation_append_from_json(Conversation *conversation, json_object *msg_obj) {
+    ConversationMessage message = { 0 };
+    if (!message_from_json(conversation, msg_obj, &message)) return FALSE;
+    g_array_append_val(conversation->messages, message);
+    return TRUE;
+}
+
+// Reads a chat written by conversation_to_json() (or by older versions,
+// which stored the same array without metadata, in any layout). The
+// conversation keeps a reference to `bytes`.
+Conversation *conversation_new_from_bytes(GBytes *bytes) {
+    gsize length = 0;
+    const char *contents = g_bytes_get_data(bytes, &length);
+
+    Conversation *conversation = conversation_new();
+    conversation->records = g_array_new(FALSE, FALSE, sizeof(StoredRecord));
+    if (contents && index_records(conversation, contents, length)) {
+        conversation->data = g_bytes_ref(bytes);
+        g_array_set_size(conversation->messages, conversation->records->len);
+        return conversation;
+    }
+
+    g_array_set_size(conversation->records, 0);
+    if (!contents || !parse_file(conversation, contents, length)) {
+        conversation_unref(conversation);
+        return NULL;
+    }
+    return conversation;
+}
+
+Conversation *conversation_new_from_file(const char *path) {
+    GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+    if (!file) return NULL;
+    GBytes *bytes = g_mapped_file_get_bytes(file);
+    g_mapped_file_unref(file);
+    Conversation *conversation = conversation_new_from_bytes(bytes);
+    g_bytes_unref(bytes);
+    return conversation;
+}
+
+Conversation *conversation_ref(Conversation *conversation) {
+    g_atomic_int_inc(&conversation->ref_count);
+    return conversation;
+}
+
+void conversation_unref(Conversation *conversation) {
+    if (!conversation) return;
+    if (g_atomic_int_dec_and_test(&conversation->ref_count)) {
+        g_array_unref(conversation->messages);
+        g_ptr_array_unref(conversation->chunks);
+        g_ptr_array_unref(conversation->wire_cache);
+        if (conversation->records) g_array_unref(conversation->records);
+        if (conversation->data) g_bytes_unref(conversation->data);
+        g_free(conversation->summary);
+        g_free(conversation);
+    }
+}
+
+guint conversation_get_length(Conversation *conversation) {
+    return conversation->messages->len;
+}
+
+const ConversationMessage *conversation_get_message(Conversation *conversation, guint index) {
+    g_return_val_if_fail(index < conversation->messages->len, NULL);
+    return get_decoded(conversation, index);
+}
+
+const char *conversation_get_content(Conversation *conversation, guint index) {
+    const ConversationMessage *message = conversation_get_message(conversation, index);
+    return message ? message->content : NULL;
+}
+
+guint conversation_append(Conversation *conversation, ConversationRole role, const char *content, gssize len) {
+    if (len < 0) len = strlen(content);
+    ConversationMessage message = {
+        .role = role,
+        .content = store_text(conversation, content, len),
+        .content_len = len,
+        .created_at = g_get_real_time() / G_USEC_PER_SEC,
+    };
+    g_array_append_val(conversation->messages, message);
+    return conversation->messages->len - 1;
+}
+
+// Appends a message whose `attachments` (ConversationAttachment, may be NULL)
+// are sent ahead of it.
+guint conversation_append_with_attachments(Conversation *conversation, ConversationRole role, const char *content,
+                                           GPtrArray *attachments) {
+    guint index = conversation_append(conversation, role, content, -1);
+    if (!attachments || attachments->len == 0) return index;
+
+    GString *json = g_string_new("[");
+    for (guint i = 0; i < attachments->len; i++) {
+        const ConversationAttachment *attachment = g_ptr_array_index(attachments, i);
+        if (i > 0) g_string_append_c(json, ',');
+        g_string_append_printf(json, "{\"kind\":\"%s\",\"name\":", attachment_kind_to_string(attachment->kind));
+        json_util_append_string(json, attachment->name, -1);
+        if (attachment->blob) {
+            g_string_append(json, ",\"blob\":");
+            json_util_append_string(json, attachment->blob, -1);
+        }
+        g_string_append_c(json, '}');
+    }
+    g_string_append_c(json, ']');
+    g_array_index(conversation->messages, ConversationMessage, index).attachments =
+        store_text(conversation, json->str, json->len);
+    g_string_free(json, TRUE);
+    return index;
+}
+
+// A stored message is written back with the new count once the chat is
+// next written whole; until then it is copied from the file without it.
+void conversation_set_token_count(Conversation *conversation, guint index, gint token_count) {
+    g_return_if_fail(index < conversation->messages->len);
+    get_decoded(conversation, index)->token_count = token_count;
+    if (conversation->records && index < conversation->records->len) {
+        g_array_index(conversation->records, StoredRecord, index).edited = TRUE;
+    }
+}
+
+/**
+ * Replaces the summary: `summary` stands for the first `covers` messages when
+ * the chat is sent to the model. A summary covering more messages than the
+ * conversation holds, as left by a chat file that lost its last turns, is
+ * ignored.
+ */
+void conversation_set_summary(Conversation *conversation, const char *summary, guint covers) {
+    g_free(conversation->summary);
+    conversation->summary = g_strdup(summary);
+    conversation->summary_covers = covers;
+    conversation->has_window = FALSE; // the prompt changes from the summary on anyway
+}
+
+// The summary and, in `covers`, how many messages it stands for; NULL if
+// there is none.
+const char *conversation_get_summary(Conversation *conversation, guint *covers) {
+    if (!conversation->summary || conversation->summary_covers > conversation->messages->len) {
+        *covers = 0;
+        return NULL;
+    }
+    *covers = conversation->summary_covers;
+    return conversation->summary;
+}
+
+/**
+ * Remembers which messages the last request sent: those from `first` on,
+ * with the attachments of those before `collapsed_end` left out. The next
+ * request sends the same ones while they fit, so that its prompt starts as
+ * the previous one did.
+ */
+void conversation_set_window(Conversation *conversation, guint first, guint collapsed_end) {
+    conversation->has_window = TRUE;
+    conversation->window_first = first;
+    conversation->window_collapsed_end = collapsed_end;
+}
+
+gboolean conversation_get_window(Conversation *conversation, guint *first, guint *collapsed_end) {
+    *first = conversation->window_first;
+    *collapsed_end = conversation->window_collapsed_end;
+    return conversation->has_window;
+}
+
+const char *conversation_role_to_string(ConversationRole role) {
+    switch (role) {
+        case CONVERSATION_ROLE_SYSTEM: return "system";
+        case CONVERSATION_ROLE_USER: return "user";
+        case CONVERSATION_ROLE_ASSISTANT: return "assistant";
+    }
+    return "user";
+}
+
+ConversationAttachment *conversation_attachment_new(ConversationAttachmentKind kind, const char *name, const char *blob) {
+    ConversationAttachment *attachment = g_new0(ConversationAttachment, 1);
+    attachment->kind = kind;
+    attachment->name = g_strdup(name);
+    attachment->blob = g_strdup(blob);
+    return attachment;
+}
+
+void conversation_attachment_free(ConversationAttachment *attachment) {
+    if (!attachment) return;
+    g_free(attachment->name);
+    g_free(attachment->blob);
+    g_free(attachment);
+}
+
+void conversation_append_message_json(Conversation *conversation, guint index, gboolean with_metadata, GString *out) {
+    const StoredRecord *record = conversation->records && index < conversation->records->len
+                                     ? &g_array_index(conversation->records, StoredRecord, index) : NULL;
+    if (with_metadata && record && !record->edited) {
+        g_string_append_len(out, record_data(conversation, index), record->len);
+        return;
+    }
+    const ConversationMessage *message = conversation_get_message(conversation, index);
+    g_string_append(out, "{\"role\":\"");
+    g_string_append(out, conversation_role_to_string(message->role));
+    g_string_append(out, "\",\"content\":");
+    if (with_metadata || !message->attachments) {
+        json_util_append_string(out, message->content, message->content_len);
+    } else {
+        append_expanded_content(out, message, FALSE);
+    }
+    if (with_metadata) {
+        if (message->attachments) {
+            g_string_append(out, ",\"attachments\":");
+            g_string_append(out, message->attachments);
+        }
+        if (message->created_at > 0) {
+            g_string_append_printf(out, ",\"created_at\":%" G_GINT64_FORMAT, message->created_at);
+        }
+        if (message->token_count > 0) {
+            g_string_append_printf(out, ",\"tokens\":%d", message->token_count);
+        }
+    }
+    g_string_append_c(out, '}');
+}
+
+// The summary record, as written ahead of the messages and to journals.
+void conversation_append_summary_json(Conversation *conversation, GString *out) {
+    g_string_append(out, "{\"summary\":");
+    json_util_append_string(out, conversation->summary ? conversation->summary : "", -1);
+    g_string_append_printf(out, ",\"covers\":%u}", conversation->summary_covers);
+}
+
+// Disk form: a JSON array with one message per line, after the summary if
+// there is one.
+void conversation_to_json(Conversation *conversation, GString *out) {
+    g_string_append(out, "[\n");
+    gboolean first = TRUE;
+    if (conversation->summary) {
+        conversation_append_summary_json(conversation, out);
+        first = FALSE;
+    }
+    for (guint i = 0; i < conversation->messages->len; i++) {
+        if (!first) g_string_append(out, ",\n");
+        conversation_append_message_json(conversation, i, TRUE, out);
+        first = FALSE;
+    }
+    g_string_append(out, "\n]\n");
+}
+
+// Wire form of one message, serialized on first use. The returned bytes are
+// immutable, so they can be handed to the network thread.
+GBytes *conversation_get_wire_json(Conversation *conversation, guint index) {
+    g_return_val_if_fail(index < conversation->messages->len, NULL);
+    if (conversation->wire_cache->len < conversation->messages->len) {
+        g_ptr_array_set_size(conversation->wire_cache, conversation->messages->len);
+    }
+    GBytes *bytes = g_ptr_array_index(conversation->wire_cache, index);
+    if (!bytes && conversation->records && index < conversation->records->len) {
+        bytes = wire_from_record(conversation, index);
+        g_ptr_array_index(conversation->wire_cache, index) = bytes;
+    }
+    if (!bytes) {
+        const ConversationMessage *message = conversation_get_message(conversation, index);
+        GString *json = g_string_sized_new(message->content_len + 32);
+        conversation_append_message_json(conversation, index, FALSE, json);
+        bytes = g_string_free_to_bytes(json);
+        g_ptr_array_index(conversation->wire_cache, index) = bytes;
+    }
+    return g_bytes_ref(bytes);
+}
+
+// Wire form of a message with attachments, with their contents left out: for
+// older turns that no longer fit in the context window in full. NULL if the
+// message has no attachments.
+GBytes *conversation_get_collapsed_wire_json(Conversation *conversation, guint index) {
+    const ConversationMessage *message = conversation_get_message(conversation, index);
+    if (!message || !message->attachments) return NULL;
+    GString *json = g_string_sized_new(message->content_len + 128);
+    g_string_append(json, "{\"role\":\"");
+    g_string_append(json, conversation_role_to_string(message->role));
+    g_string_append(json, "\",\"content\":");
+    append_expanded_content(json, message, TRUE);
+    g_string_append_c(json, '}');
+    return g_string_free_to_bytes(json);
+}
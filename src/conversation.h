@@ -0,0 +1,70 @@
+#ifndef CONVERSATION_H
+#define CONVERSATION_H
+
+#include <glib.h>
+
+typedef enum {
+    CONVERSATION_ROLE_SYSTEM,
+    CONVERSATION_ROLE_USER,
+    CONVERSATION_ROLE_ASSISTANT,
+} ConversationRole;
+
+typedef enum {
+    CONVERSATION_ATTACHMENT_FILE,
+    CONVERSATION_ATTACHMENT_URL,
+    CONVERSATION_ATTACHMENT_BINARY_FILE, // named, but left out of the prompt
+} ConversationAttachmentKind;
+
+// Context the user referred to, sent ahead of their message.
+typedef struct {
+    ConversationAttachmentKind kind;
+    char *name; // path or URL
+    char *blob; // blob store key of the contents, NULL for binary files
+} ConversationAttachment;
+
+// Message record. The text lives in the conversation's string arena.
+typedef struct {
+    ConversationRole role;
+    const char *content; // NULL until a stored message is decoded
+    gsize content_len;
+    const char *attachments; // JSON array of the disk form, NULL if none
+    gint64 created_at; // unix time in seconds, 0 if unknown
+    gint token_count;  // as reported by Ollama, 0 if unknown
+} ConversationMessage;
+
+typedef struct Conversation Conversation;
+struct json_object;
+
+Conversation *conversation_new(void);
+Conversation *conversation_new_from_bytes(GBytes *bytes);
+Conversation *conversation_new_from_file(const char *path);
+Conversation *conversation_ref(Conversation *conversation);
+void conversation_unref(Conversation *conversation);
+
+guint conversation_get_length(Conversation *conversation);
+const ConversationMessage *conversation_get_message(Conversation *conversation, guint index);
+const char *conversation_get_content(Conversation *conversation, guint index);
+guint conversation_append(Conversation *conversation, ConversationRole role, const char *content, gssize len);
+guint conversation_append_with_attachments(Conversation *conversation, ConversationRole role, const char *content,
+                                           GPtrArray *attachments);
+void conversation_set_token_count(Conversation *conversation, guint index, gint token_count);
+void conversation_set_summary(Conversation *conversation, const char *summary, guint covers);
+const char *conversation_get_summary(Conversation *conversation, guint *covers);
+void conversation_set_window(Conversation *conversation, guint first, guint collapsed_end);
+gboolean conversation_get_window(Conversation *conversation, guint *first, guint *collapsed_end);
+
+const char *conversation_role_to_string(ConversationRole role);
+ConversationAttachment *conversation_attachment_new(ConversationAttachmentKind kind, const char *name, const char *blob);
+void conversation_attachment_free(ConversationAttachment *attachment);
+
+// Serialization. The wire form is what /api/chat expects in `messages`, with
+// attachments expanded into the content; the disk form keeps them as blob
+// keys and adds the metadata fields.
+void conversation_append_message_json(Conversation *conversation, guint index, gboolean with_metadata, GString *out);
+void conversation_append_summary_json(Conversation *conversation, GString *out);
+void conversation_to_json(Conversation *conversation, GString *out);
+gboolean conversation_append_from_json(Conversation *conversation, struct json_object *message);
+GBytes *conversation_get_wire_json(Conversation *conversation, guint index);
+GBytes *conversation_get_collapsed_wire_json(Conversation *conversation, guint index);
+
+#endif // CONVERSATION_H
@@ -0,0 +1,127 @@
+#include "conversation_model.h"
+
+/**
+ * GListModel view of a Conversation. Items are created the first time the
+ * list view asks for them and cached afterwards, so opening a chat costs the
+ * same whatever its length. A response that is still streaming is shown as
+ * an extra "pending" item after the stored messages.
+ */
+struct _ConversationModel {
+    GObject parent_instance;
+    Conversation *conversation;
+    GPtrArray *items;          // ChatMessageItem cache, NULL until requested
+    ChatMessageItem *pending;
+};
+
+static void conversation_model_list_model_init(GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(ConversationModel, conversation_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL, conversation_model_list_model_init))
+
+static GType conversation_model_get_item_type(GListModel *list) {
+    (void)list;
+    return CHAT_TYPE_MESSAGE_ITEM;
+}
+
+static guint conversation_model_get_n_items(GListModel *list) {
+    ConversationModel *model = CONVERSATION_MODEL(list);
+    return model->items->len + (model->pending ? 1 : 0);
+}
+
+static gpointer conversation_model_get_item(GListModel *list, guint position) {
+    ConversationModel *model = CONVERSATION_MODEL(list);
+    if (position < model->items->len) {
+        ChatMessageItem *item = g_ptr_array_index(model->items, position);
+        if (!item) {
+            item = chat_message_item_new(model->conversation, position);
+            g_ptr_array_index(model->items, position) = item;
+        }
+        return g_object_ref(item);
+    }
+    if (model->pending && position == model->items->len) {
+        return g_object_ref(model->pending);
+    }
+    return NULL;
+}
+
+static void conversation_model_list_model_init(GListModelInterface *iface) {
+    iface->get_item_type = conversation_model_get_item_type;
+    iface->get_n_items = conversation_model_get_n_items;
+    iface->get_item = conversation_model_get_item;
+}
+
+static void conversation_model_finalize(GObject *object) {
+    ConversationModel *model = CONVERSATION_MODEL(object);
+    g_ptr_array_unref(model->items);
+    g_clear_object(&model->pending);
+    conversation_unref(model->conversation);
+    G_OBJECT_CLASS(conversation_model_parent_class)->finalize(object);
+}
+
+static void conversation_model_class_init(ConversationModelClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = conversation_model_finalize;
+}
+
+static void unref_item(gpointer item) {
+    if (item) g_object_unref(item);
+}
+
+static void conversation_model_init(ConversationModel *model) {
+    model->items = g_ptr_array_new_with_free_func(unref_item);
+}
+
+ConversationModel *conversation_model_new(void) {
+    return g_object_new(CONVERSATION_TYPE_MODEL, NULL);
+}
+
+// Shows `conversation` (may be NULL). Any pending item belongs to the
+// previous conversation and is dropped.
+void conversation_model_set_conversation(ConversationModel *model, Conversation *conversation) {
+    guint removed = conversation_model_get_n_items(G_LIST_MODEL(model));
+    g_clear_object(&model->pending);
+    g_ptr_array_set_size(model->items, 0);
+    if (model->conversation) conversation_unref(model->conversation);
+    model->conversation = conversation ? conversation_ref(conversation) : NULL;
+    if (conversation) {
+        g_ptr_array_set_size(model->items, conversation_get_length(conversation));
+    }
+    g_list_model_items_changed(G_LIST_MODEL(model), 0, removed, model->items->len);
+}
+
+// Publishes messages appended to the conversation since the last call.
+void conversation_model_sync(ConversationModel *model) {
+    if (!model->conversation) return;
+    guint known = model->items->len;
+    guint length = conversation_get_length(model->conversation);
+    if (length <= known) return;
+    g_ptr_array_set_size(model->items, length);
+    g_list_model_items_changed(G_LIST_MODEL(model), known, 0, length - known);
+}
+
+// Shows `item` (created with chat_message_item_new_pending()) after the
+// stored messages. The model keeps its own reference.
+void conversation_model_begin_pending(ConversationModel *model, ChatMessageItem *item) {
+    g_return_if_fail(model->pending == NULL);
+    model->pending = g_object_ref(item);
+    g_list_model_items_changed(G_LIST_MODEL(model), model->items->len, 0, 1);
+}
+
+/**
+ * If the pending message was `stored` as the next message of the
+ * conversation, the item turns into that message in place and its row stays
+ * bound.
+ * Otherwise the pending item is removed.
+ */
+void conversation_model_end_pending(ConversationModel *model, gboolean stored) {
+    if (!model->pending) return;
+    guint position = model->items->len;
+    if (stored && model->conversation && conversation_get_length(model->conversation) > position) {
+        chat_message_item_finish(model->pending, model->conversation, position);
+        g_ptr_array_add(model->items, model->pending);
+        model->pending = NULL;
+        conversation_model_sync(model);
+    } else {
+        g_clear_object(&model->pending);
+        g_list_model_items_changed(G_LIST_MODEL(model), position, 1, 0);
+    }
+}
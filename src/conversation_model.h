@@ -0,0 +1,17 @@
+#ifndef CONVERSATION_MODEL_H
+#define CONVERSATION_MODEL_H
+
+#include <gio/gio.h>
+#include "conversation.h"
+#include "chat_message_item.h"
+
+#define CONVERSATION_TYPE_MODEL (conversation_model_get_type())
+G_DECLARE_FINAL_TYPE(ConversationModel, conversation_model, CONVERSATION, MODEL, GObject)
+
+ConversationModel *conversation_model_new(void);
+void conversation_model_set_conversation(ConversationModel *model, Conversation *conversation);
+void conversation_model_sync(ConversationModel *model);
+void conversation_model_begin_pending(ConversationModel *model, ChatMessageItem *item);
+void conversation_model_end_pending(ConversationModel *model, gboolean stored);
+
+#endif // CONVERSATION_MODEL_H
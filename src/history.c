@@ -1,10 +1,22 @@
 #include "history.h"
 #include "ui.h"
+#include "trace.h"
+#include "chat_journal.h"
+#include "chat_catalog.h"
+#include "chat_list_model.h"
+#include "chat_search.h"
+#include "blob_store.h"
+#include "chat_pack.h"
+#include "chat_watch.h"
+#include "chat_session.h"
 #include <glib/gstdio.h>
 #include <uuid/uuid.h>
 #include <string.h>
 
 static const char *HISTORY_DIR = ".local/share/ollama-chat";
+#define PACK_DELAY_SECONDS 60
+#define PACK_INTERVAL_SECONDS (60 * 60)
+#define SECONDS_PER_DAY (24 * 60 * 60)
 
 // --- Private Helper Functions ---
 
@@ -20,6 +32,152 @@ static char *get_chat_filepath(const char *chat_id) {
     return filepath;
 }
 
+// Has the row of `chat_id` show its catalog entry again.
+static void refresh_history_row(AppData *app_data, const char *chat_id) {
+    gint position = chat_catalog_get_position(app_data->chat_catalog, chat_id);
+    if (position < 0) return;
+    chat_list_model_changed(app_data->history_model, position);
+}
+
+// A chat history_open_chat() waits for.
+typedef struct {
+    AppData *app_data;
+    char *chat_id;
+    guint message_index; // to scroll to, G_MAXUINT for none
+} ChatOpen;
+
+// Lets go of the current chat's journal; its session keeps it if the chat is
+// generating.
+static void release_chat_journal(AppData *app_data) {
+    if (!chat_session_lookup(app_data, app_data->current_chat_id)) {
+        chat_journal_close(app_data->chat_journal);
+    }
+    app_data->chat_journal = NULL;
+}
+
+// Appends the messages added since the last save to the chat's journal and
+// updates the search index, the catalog and the chat's row.
+static void save_chat(AppData *app_data, const char *chat_id, Conversation *conversation,
+                      ChatJournal *journal, const char *model) {
+    TraceSpan *span = trace_span_begin(1, "history", "save");
+    chat_journal_sync(journal);
+    chat_search_index(app_data->chat_search, chat_id, conversation);
+    // The row's date follows the update, not only its title
+    chat_catalog_update(app_data->chat_catalog, chat_id, conversation, model);
+    refresh_history_row(app_data, chat_id);
+    trace_span_end(span);
+}
+
+// Whether the chat at `path` is old enough to be packed. Never the chat shown.
+static gboolean is_cold_chat(const char *path, gpointer user_data) {
+    AppData *app_data = (AppData *)user_data;
+    char *chat_id = g_path_get_basename(path);
+    const ChatCatalogEntry *entry = chat_catalog_lookup(app_data->chat_catalog, chat_id);
+    gint64 cutoff = g_get_real_time() / G_USEC_PER_SEC - (gint64)app_data->pack_after_days * SECONDS_PER_DAY;
+    gboolean cold = entry && entry->modified_at < cutoff && g_strcmp0(chat_id, app_data->current_chat_id) != 0 &&
+                    g_strcmp0(chat_id, app_data->loading_chat_id) != 0 && !chat_session_lookup(app_data, chat_id);
+    g_free(chat_id);
+    return cold;
+}
+
+// Has the chats that have not changed for `pack_after_days` packed, and
+// runs again every PACK_INTERVAL_SECONDS while the app is open. Whether a
+// chat still has loose files is left to the packing thread.
+static gboolean pack_cold_chats(gpointer user_data) {
+    AppData *app_data = (AppData *)user_data;
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < chat_catalog_get_length(app_data->chat_catalog); i++) {
+        const ChatCatalogEntry *entry = chat_catalog_get_entry(app_data->chat_catalog, i);
+        char *filepath = get_chat_filepath(entry->id);
+        if (is_cold_chat(filepath, app_data)) {
+            g_ptr_array_add(paths, filepath);
+        } else {
+            g_free(filepath);
+        }
+    }
+    chat_pack_migrate(paths, is_cold_chat, app_data);
+    g_ptr_array_unref(paths);
+    g_timeout_add_seconds(PACK_INTERVAL_SECONDS, pack_cold_chats, app_data);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Applies changes made to the history directory by someone else as edits to
+ * the catalog, the history list and the search index. The files of the
+ * current chat and of chats generating are written by this instance, so
+ * changes to them are ours.
+ */
+static void apply_history_changes(GPtrArray *ids, gpointer user_data) {
+    AppData *app_data = (AppData *)user_data;
+    TraceSpan *span = trace_span_begin(1, "history", "watch");
+    trace_span_add_int(span, "chats", ids->len);
+    chat_pack_refresh(); // a chat whose files went may have been packed
+    for (guint i = 0; i < ids->len; i++) {
+        const char *chat_id = g_ptr_array_index(ids, i);
+        if (g_strcmp0(chat_id, app_data->current_chat_id) == 0 || chat_session_lookup(app_data, chat_id)) continue;
+        gint position = chat_catalog_get_position(app_data->chat_catalog, chat_id);
+        char *filepath = get_chat_filepath(chat_id);
+        switch (chat_catalog_rescan(app_data->chat_catalog, chat_id)) {
+            case CHAT_CATALOG_ADDED:
+                chat_list_model_inserted(app_data->history_model, 0);
+                chat_search_index_file(app_data->chat_search, chat_id, filepath);
+                break;
+            case CHAT_CATALOG_UPDATED:
+                chat_list_model_changed(app_data->history_model, position);
+                chat_search_remove(app_data->chat_search, chat_id);
+                chat_search_index_file(app_data->chat_search, chat_id, filepath);
+                break;
+            case CHAT_CATALOG_REMOVED:
+                chat_list_model_removed(app_data->history_model, position);
+                chat_search_remove(app_data->chat_search, chat_id);
+                break;
+            case CHAT_CATALOG_UNCHANGED:
+                break;
+        }
+        g_free(filepath);
+    }
+    trace_span_end(span);
+}
+
+// Shows `conversation` as the chat `chat_id`, journaled by `journal`.
+static void show_chat(AppData *app_data, const char *chat_id, Conversation *conversation,
+                      ChatJournal *journal, guint message_index) {
+    release_chat_journal(app_data);
+    if (app_data->conversation) {
+        conversation_unref(app_data->conversation);
+    }
+    app_data->conversation = conversation;
+
+    if (app_data->current_chat_id) {
+        g_free(app_data->current_chat_id);
+    }
+    app_data->current_chat_id = g_strdup(chat_id);
+    chat_search_set_stored(app_data->chat_search, chat_id, conversation_get_length(conversation));
+    app_data->chat_journal = journal;
+
+    ui_redisplay_chat_history(app_data);
+    if (message_index != G_MAXUINT) ui_schedule_scroll_to_message(app_data, message_index);
+}
+
+// Shows the chat read for history_open_chat(), unless another was asked for
+// or it was deleted meanwhile.
+static void on_chat_loaded(Conversation *conversation, ChatJournal *journal, gpointer user_data) {
+    ChatOpen *open = (ChatOpen *)user_data;
+    AppData *app_data = open->app_data;
+    if (conversation && g_strcmp0(open->chat_id, app_data->loading_chat_id) == 0 &&
+        chat_catalog_get_position(app_data->chat_catalog, open->chat_id) >= 0) {
+        show_chat(app_data, open->chat_id, conversation, journal, open->message_index);
+    } else {
+        chat_journal_close(journal);
+        if (conversation) conversation_unref(conversation);
+    }
+    if (g_strcmp0(open->chat_id, app_data->loading_chat_id) == 0) {
+        g_clear_pointer(&app_data->loading_chat_id, g_free);
+    }
+    g_free(open->chat_id);
+    g_free(open);
+}
+
 static char *generate_uuid() {
     uuid_t b;
     uuid_generate_random(b);
@@ -28,178 +186,178 @@ static char *generate_uuid() {
     return uuid_str;
 }
 
-// --- Sorting Helper ---
-typedef struct {
-    char *filename;
-    GDateTime *modified_time;
-} ChatHistoryEntry;
-
-static gint compare_chat_history_entries(gconstpointer a, gconstpointer b, gpointer user_data) {
-    (void)user_data;
-    const ChatHistoryEntry *entry_a = a;
-    const ChatHistoryEntry *entry_b = b;
-    return g_date_time_compare(entry_b->modified_time, entry_a->modified_time);
-}
-
-
 // --- Public Functions ---
 
 void history_init(AppData *app_data) {
     char *history_path = get_history_path();
     g_mkdir_with_parents(history_path, 0755);
+    blob_store_init(history_path);
+    chat_pack_init(history_path);
     g_free(history_path);
-    
-    app_data->history_store = g_list_store_new(GTK_TYPE_STRING_OBJECT);
+
+    app_data->history_model = chat_list_model_new();
 }
 
+// Fills the history list from the chat catalog, and has the search index
+// pick up chats it does not hold yet. Later changes to the history directory
+// are picked up as they happen.
 void history_load_chats(AppData *app_data) {
-    g_list_store_remove_all(app_data->history_store);
-    char *history_path = get_history_path();
-    GDir *dir = g_dir_open(history_path, 0, NULL);
-    if (dir) {
-        const char *filename;
-        GSList *chat_entries = NULL;
-
-        while ((filename = g_dir_read_name(dir))) {
-            char *filepath = g_build_filename(history_path, filename, NULL);
-            GFileInfo *file_info = g_file_query_info(g_file_new_for_path(filepath),
-                                                     G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                                                     G_FILE_QUERY_INFO_NONE,
-                                                     NULL, NULL);
-            
-            if (file_info) {
-                GDateTime *modified_time = g_file_info_get_modification_date_time(file_info);
-                ChatHistoryEntry *entry = g_new(ChatHistoryEntry, 1);
-                entry->filename = g_strdup(filename);
-                entry->modified_time = modified_time;
-                chat_entries = g_slist_prepend(chat_entries, entry);
-                g_object_unref(file_info);
-            }
-            g_free(filepath);
+    if (!app_data->chat_catalog) {
+        char *history_path = get_history_path();
+        app_data->chat_catalog = chat_catalog_load(history_path);
+        app_data->chat_search = chat_search_open(history_path);
+        app_data->chat_watch = chat_watch_new(history_path, apply_history_changes, app_data);
+        g_free(history_path);
+        if (app_data->pack_after_days > 0) {
+            // Once startup is over
+            g_timeout_add_seconds(PACK_DELAY_SECONDS, pack_cold_chats, app_data);
         }
-        g_dir_close(dir);
-
-        chat_entries = g_slist_sort_with_data(chat_entries, compare_chat_history_entries, NULL);
+    }
 
-        for (GSList *l = chat_entries; l != NULL; l = l->next) {
-            ChatHistoryEntry *entry = l->data;
-            GtkStringObject *str_obj = gtk_string_object_new(entry->filename);
-            g_list_store_append(app_data->history_store, str_obj);
-            g_free(entry->filename);
-            g_date_time_unref(entry->modified_time);
-            g_free(entry);
-        }
-        g_slist_free(chat_entries);
+    chat_list_model_set_catalog(app_data->history_model, app_data->chat_catalog);
+    if (!app_data->chat_search) return;
+    for (guint i = 0; i < chat_catalog_get_length(app_data->chat_catalog); i++) {
+        const ChatCatalogEntry *entry = chat_catalog_get_entry(app_data->chat_catalog, i);
+        char *filepath = get_chat_filepath(entry->id);
+        chat_search_index_file(app_data->chat_search, entry->id, filepath);
+        g_free(filepath);
     }
-    g_free(history_path);
+}
+
+// Id of the chat selected in the history list, NULL if none.
+const char *history_get_selected_chat_id(AppData *app_data) {
+    ChatListItem *item = gtk_single_selection_get_selected_item(app_data->history_selection);
+    return item ? chat_list_item_get_id(item) : NULL;
 }
 
 void history_save_chat(AppData *app_data) {
-    if (!app_data->current_chat_id || !app_data->messages_array) return;
+    if (!app_data->chat_journal) return;
+    save_chat(app_data, app_data->current_chat_id, app_data->conversation, app_data->chat_journal,
+              app_data->current_model);
+}
 
-    char *filepath = get_chat_filepath(app_data->current_chat_id);
-    const char *json_str = json_object_to_json_string_ext(app_data->messages_array, JSON_C_TO_STRING_PRETTY);
-    g_file_set_contents(filepath, json_str, -1, NULL);
-    g_free(filepath);
+// Saves the chat of `session`, shown or not. Nothing is saved once the chat
+// was deleted.
+void history_save_session(ChatSession *session) {
+    if (!session->journal) return;
+    save_chat(session->app_data, session->chat_id, session->conversation, session->journal, session->model);
+}
+
+// Records the partially streamed response, so that a crash does not lose it.
+void history_checkpoint_response(ChatSession *session) {
+    if (!session->journal) return;
+    chat_journal_checkpoint(session->journal, session->response_buffer->str, session->response_buffer->len);
+}
+
+void history_close_chat(AppData *app_data) {
+    history_save_chat(app_data);
+    release_chat_journal(app_data);
 }
 
 void history_start_new_chat(AppData *app_data) {
-    if (app_data->current_chat_id && app_data->messages_array && json_object_array_length(app_data->messages_array) > 0) {
-        history_save_chat(app_data);
-    }
+    history_close_chat(app_data);
+    g_clear_pointer(&app_data->loading_chat_id, g_free);
 
     if (app_data->current_chat_id) {
         g_free(app_data->current_chat_id);
     }
     app_data->current_chat_id = generate_uuid();
     
-    if (app_data->messages_array) {
-        json_object_put(app_data->messages_array);
+    if (app_data->conversation) {
+        conversation_unref(app_data->conversation);
     }
-    app_data->messages_array = json_object_new_array();
+    app_data->conversation = conversation_new();
+    char *filepath = get_chat_filepath(app_data->current_chat_id);
+    app_data->chat_journal = chat_journal_new(filepath, app_data->conversation);
+    g_free(filepath);
     
-    ui_clear_chat_view(app_data);
+    ui_redisplay_chat_history(app_data);
     
-    GtkStringObject *str_obj = gtk_string_object_new(app_data->current_chat_id);
-    g_list_store_insert(app_data->history_store, 0, str_obj);
-    history_save_chat(app_data);
+    chat_catalog_add(app_data->chat_catalog, app_data->current_chat_id);
+    chat_list_model_inserted(app_data->history_model, 0);
+    gtk_single_selection_set_selected(app_data->history_selection, 0);
 }
 
-void history_load_selected_chat(GtkListBox *box, GtkListBoxRow *row, gpointer user_data) {
-    (void)box;
-    AppData *app_data = (AppData *)user_data;
-    if (!row) return;
+/**
+ * Shows the chat `chat_id`, scrolled to `message_index` unless that is
+ * G_MAXUINT, and selects its row in the history list. A chat that is not
+ * generating is read from disk first, without blocking, and shown once it
+ * is; asking for another chat before then drops this one.
+ */
+void history_open_chat(AppData *app_data, const char *chat_id, guint message_index) {
+    gint position = chat_catalog_get_position(app_data->chat_catalog, chat_id);
+    if (position < 0) return;
+    if (gtk_single_selection_get_selected(app_data->history_selection) != (guint)position) {
+        gtk_single_selection_set_selected(app_data->history_selection, position);
+    }
 
-    const char *chat_id = gtk_label_get_text(GTK_LABEL(gtk_list_box_row_get_child(row)));
-    
     if (app_data->current_chat_id && strcmp(app_data->current_chat_id, chat_id) == 0) {
+        g_clear_pointer(&app_data->loading_chat_id, g_free);
+        if (message_index != G_MAXUINT) ui_schedule_scroll_to_message(app_data, message_index);
         return; // Already loaded
     }
+    if (g_strcmp0(app_data->loading_chat_id, chat_id) == 0) return;
 
     history_save_chat(app_data);
 
+    // A chat that is generating has messages its files do not hold yet
+    ChatSession *session = chat_session_lookup(app_data, chat_id);
+    if (session) {
+        g_clear_pointer(&app_data->loading_chat_id, g_free);
+        show_chat(app_data, chat_id, conversation_ref(session->conversation), session->journal, message_index);
+        return;
+    }
+
+    g_free(app_data->loading_chat_id);
+    app_data->loading_chat_id = g_strdup(chat_id);
+    ChatOpen *open = g_new0(ChatOpen, 1);
+    open->app_data = app_data;
+    open->chat_id = g_strdup(chat_id);
+    open->message_index = message_index;
     char *filepath = get_chat_filepath(chat_id);
-    json_object *messages = json_object_from_file(filepath);
+    chat_journal_load(filepath, on_chat_loaded, open);
     g_free(filepath);
-
-    if (messages) {
-        if (app_data->messages_array) {
-            json_object_put(app_data->messages_array);
-        }
-        app_data->messages_array = messages;
-        
-        if (app_data->current_chat_id) {
-            g_free(app_data->current_chat_id);
-        }
-        app_data->current_chat_id = g_strdup(chat_id);
-        
-        ui_clear_chat_view(app_data);
-        ui_redisplay_chat_history(app_data);
-    }
 }
 
 void history_delete_chat(AppData *app_data, const char *chat_id) {
-    char *filepath = get_chat_filepath(chat_id);
-    g_remove(filepath);
+    char *id = g_strdup(chat_id); // may belong to the list item removed below
+    gboolean is_current = app_data->current_chat_id && strcmp(app_data->current_chat_id, id) == 0;
+    if (is_current) {
+        release_chat_journal(app_data);
+    }
+    ChatSession *session = chat_session_lookup(app_data, id);
+    if (session) {
+        // The session winds down on its own, without writing the chat again
+        chat_session_cancel(session);
+        chat_journal_close(session->journal);
+        session->journal = NULL;
+    }
+    char *filepath = get_chat_filepath(id);
+    chat_journal_remove_files(filepath);
     g_free(filepath);
-    
-    guint n_items = g_list_model_get_n_items(G_LIST_MODEL(app_data->history_store));
-    for (guint i = 0; i < n_items; i++) {
-        GtkStringObject *str_obj = g_list_model_get_item(G_LIST_MODEL(app_data->history_store), i);
-        const char* id_in_store = gtk_string_object_get_string(str_obj);
-        if (strcmp(id_in_store, chat_id) == 0) {
-            g_list_store_remove(app_data->history_store, i);
-            break;
-        }
+    chat_search_remove(app_data->chat_search, id);
+
+    gint position = chat_catalog_get_position(app_data->chat_catalog, id);
+    if (position >= 0) {
+        chat_catalog_remove(app_data->chat_catalog, id);
+        chat_list_model_removed(app_data->history_model, position);
     }
 
-    if (app_data->current_chat_id && strcmp(app_data->current_chat_id, chat_id) == 0) {
+    if (is_current) {
         history_start_new_chat(app_data);
     }
+    g_free(id);
 }
 
+// Sets the title shown in the history list; the chat keeps its id.
 void history_rename_chat(AppData *app_data, const char *chat_id, const char *new_title) {
-    char *old_filepath = get_chat_filepath(chat_id);
-    char *new_filepath = get_chat_filepath(new_title);
-
-    if (g_rename(old_filepath, new_filepath) == 0) {
-        guint n_items = g_list_model_get_n_items(G_LIST_MODEL(app_data->history_store));
-        for (guint i = 0; i < n_items; i++) {
-            GtkStringObject *str_obj = g_list_model_get_item(G_LIST_MODEL(app_data->history_store), i);
-            const char* id_in_store = gtk_string_object_get_string(str_obj);
-            if (strcmp(id_in_store, chat_id) == 0) {
-                g_list_store_remove(app_data->history_store, i);
-                GtkStringObject *new_str_obj = gtk_string_object_new(new_title);
-                g_list_store_insert(app_data->history_store, i, new_str_obj);
-                g_object_unref(new_str_obj);
-                break;
-            }
-        }
-        if (app_data->current_chat_id && strcmp(app_data->current_chat_id, chat_id) == 0) {
-            g_free(app_data->current_chat_id);
-            app_data->current_chat_id = g_strdup(new_title);
-        }
-    }
-    g_free(old_filepath);
-    g_free(new_filepath);
+    if (chat_catalog_get_position(app_data->chat_catalog, chat_id) < 0) return;
+    chat_catalog_set_title(app_data->chat_catalog, chat_id, new_title);
+    refresh_history_row(app_data, chat_id);
+}
+
+// Title shown for `chat_id` in the history list.
+const char *history_get_chat_title(AppData *app_data, const char *chat_id) {
+    const ChatCatalogEntry *entry = chat_catalog_lookup(app_data->chat_catalog, chat_id);
+    return entry ? chat_catalog_entry_get_title(entry) : chat_id;
 }
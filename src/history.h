@@ -7,9 +7,14 @@
 void history_init(AppData *app_data);
 void history_load_chats(AppData *app_data);
 void history_save_chat(AppData *app_data);
+void history_save_session(ChatSession *session);
+void history_checkpoint_response(ChatSession *session);
+void history_close_chat(AppData *app_data);
 void history_start_new_chat(AppData *app_data);
-void history_load_selected_chat(GtkListBox *box, GtkListBoxRow *row, gpointer user_data);
+void history_open_chat(AppData *app_data, const char *chat_id, guint message_index);
 void history_delete_chat(AppData *app_data, const char *chat_id);
 void history_rename_chat(AppData *app_data, const char *chat_id, const char *new_title);
+const char *history_get_selected_chat_id(AppData *app_data);
+const char *history_get_chat_title(AppData *app_data, const char *chat_id);
 
 #endif // HISTORY_H
@@ -0,0 +1,48 @@
+#include <math.h>
+#include <string.h>
+#include "json_util.h"
+
+// Appends `text` as a quoted JSON string. Runs of plain bytes are copied in
+// one go; only quotes, backslashes and control characters are escaped.
+void json_util_append_string(GString *out, const char *text, gssize len) {
+    if (len < 0) len = strlen(text);
+    const char *p = text;
+    const char *end = text + len;
+    g_string_append_c(out, '"');
+    while (p < end) {
+        const char *run = p;
+        while (p < end && (guchar)*p >= 0x20 && *p != '"' && *p != '\\') {
+            p++;
+        }
+        if (p > run) {
+            g_string_append_len(out, run, p - run);
+        }
+        if (p >= end) break;
+        switch (*p) {
+            case '"': g_string_append(out, "\\\""); break;
+            case '\\': g_string_append(out, "\\\\"); break;
+            case '\n': g_string_append(out, "\\n"); break;
+            case '\r': g_string_append(out, "\\r"); break;
+            case '\t': g_string_append(out, "\\t"); break;
+            default: g_string_append_printf(out, "\\u%04x", (guchar)*p); break;
+        }
+        p++;
+    }
+    g_string_append_c(out, '"');
+}
+
+// Locale-independent; prefers the short form (0.8, not 0.80000000000000004)
+// whenever it reads back as the same value. NaN and infinities, which JSON
+// cannot hold, are written as null.
+void json_util_append_double(GString *out, double value) {
+    if (!isfinite(value)) {
+        g_string_append(out, "null");
+        return;
+    }
+    char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_formatd(buffer, sizeof(buffer), "%.15g", value);
+    if (g_ascii_strtod(buffer, NULL) != value) {
+        g_ascii_formatd(buffer, sizeof(buffer), "%.17g", value);
+    }
+    g_string_append(out, buffer);
+}
@@ -0,0 +1,11 @@
+#ifndef JSON_UTIL_H
+#define JSON_UTIL_H
+
+#include <glib.h>
+
+// Helpers for writing JSON text directly into a GString, for payloads that
+// are too hot or too large to build as a json-c DOM first.
+void json_util_append_string(GString *out, const char *text, gssize len);
+void json_util_append_double(GString *out, double value);
+
+#endif // JSON_UTIL_H
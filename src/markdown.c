@@ -92,4 +92,108 @@ char *markdown_to_pango(const char *markdown) {
     }
 
     return g_string_free(pango, FALSE);
-}
\ No newline at end of file
+}
+
+// --- Incremental Block Parser ---
+
+static gboolean is_fence_line(const char *line, gsize len) {
+    gsize i = 0;
+    while (i < len && i < 3 && line[i] == ' ') i++;
+    return len - i >= 3 && strncmp(line + i, "```", 3) == 0;
+}
+
+static gboolean is_blank(const char *text, gsize len) {
+    for (gsize i = 0; i < len; i++) {
+        if (!g_ascii_isspace(text[i])) return FALSE;
+    }
+    return TRUE;
+}
+
+static void emit_block(MarkdownStream *stream, MarkdownBlockType type, const char *start, const char *end) {
+    if (type == MARKDOWN_BLOCK_TEXT) {
+        while (end > start && g_ascii_isspace(end[-1])) end--;
+        if (end == start) return;
+    } else if (end > start && end[-1] == '\n') {
+        end--;
+    }
+    stream->block_func(type, start, end - start, stream->lang, stream->user_data);
+}
+
+void markdown_stream_init(MarkdownStream *stream, MarkdownBlockFunc block_func, gpointer user_data) {
+    memset(stream, 0, sizeof(*stream));
+    stream->block_func = block_func;
+    stream->user_data = user_data;
+}
+
+void markdown_stream_clear(MarkdownStream *stream) {
+    g_free(stream->lang);
+    stream->lang = NULL;
+}
+
+/**
+ * `text` is the whole message so far; it may only have grown since the last
+ * call. Every line completed since then is classified once. Paragraphs end at
+ * a blank line and code blocks at their closing fence; finished blocks are
+ * handed to `block_func` and never looked at again.
+ */
+void markdown_stream_update(MarkdownStream *stream, const char *text, gsize len) {
+    while (stream->scan_pos < len) {
+        const char *line = text + stream->scan_pos;
+        const char *newline = memchr(line, '\n', len - stream->scan_pos);
+        if (!newline) break;
+        gsize line_len = newline - line;
+        gsize next = stream->scan_pos + line_len + 1;
+
+        if (stream->in_code) {
+            if (is_fence_line(line, line_len)) {
+                emit_block(stream, MARKDOWN_BLOCK_CODE, text + stream->block_start, line);
+                stream->in_code = FALSE;
+                g_free(stream->lang);
+                stream->lang = NULL;
+                stream->block_start = next;
+            }
+        } else if (is_fence_line(line, line_len)) {
+            emit_block(stream, MARKDOWN_BLOCK_TEXT, text + stream->block_start, line);
+            const char *lang = (const char *)memchr(line, '`', line_len) + 3;
+            stream->lang = g_strstrip(g_strndup(lang, newline - lang));
+            if (*stream->lang == '\0') {
+                g_free(stream->lang);
+                stream->lang = NULL;
+            }
+            stream->in_code = TRUE;
+            stream->block_start = next;
+        } else if (is_blank(line, line_len)) {
+            emit_block(stream, MARKDOWN_BLOCK_TEXT, text + stream->block_start, line);
+            stream->block_start = next;
+        }
+        stream->scan_pos = next;
+    }
+}
+
+// Freezes whatever is still open. An unterminated fence becomes a code block.
+void markdown_stream_finish(MarkdownStream *stream, const char *text, gsize len) {
+    markdown_stream_update(stream, text, len);
+    if (stream->block_start < len) {
+        emit_block(stream, stream->in_code ? MARKDOWN_BLOCK_CODE : MARKDOWN_BLOCK_TEXT,
+                   text + stream->block_start, text + len);
+    }
+    stream->block_start = stream->scan_pos = len;
+    stream->in_code = FALSE;
+    markdown_stream_clear(stream);
+}
+
+// Pango markup for the block that is still growing.
+char *markdown_stream_tail_to_pango(MarkdownStream *stream, const char *text, gsize len) {
+    const char *tail = text + stream->block_start;
+    gsize tail_len = len - stream->block_start;
+    if (stream->in_code) {
+        char *escaped = g_markup_escape_text(tail, tail_len);
+        char *markup = g_strconcat("<tt>", escaped, "</tt>", NULL);
+        g_free(escaped);
+        return markup;
+    }
+    char *copy = g_strndup(tail, tail_len);
+    char *markup = markdown_to_pango(copy);
+    g_free(copy);
+    return markup;
+}
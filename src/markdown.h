@@ -1,6 +1,34 @@
 #ifndef MARKDOWN_H
 #define MARKDOWN_H
 
+#include <glib.h>
+
 char *markdown_to_pango(const char *markdown);
 
+typedef enum {
+    MARKDOWN_BLOCK_TEXT,
+    MARKDOWN_BLOCK_CODE,
+} MarkdownBlockType;
+
+// `text` is not NUL-terminated. `lang` is NULL for text blocks and for code
+// fences without a language.
+typedef void (*MarkdownBlockFunc)(MarkdownBlockType type, const char *text, gsize len,
+                                  const char *lang, gpointer user_data);
+
+// Splits a growing message into frozen blocks plus one open tail block.
+typedef struct {
+    gsize scan_pos;    // first byte not yet classified
+    gsize block_start; // first byte of the open block
+    gboolean in_code;
+    char *lang;
+    MarkdownBlockFunc block_func;
+    gpointer user_data;
+} MarkdownStream;
+
+void markdown_stream_init(MarkdownStream *stream, MarkdownBlockFunc block_func, gpointer user_data);
+void markdown_stream_update(MarkdownStream *stream, const char *text, gsize len);
+void markdown_stream_finish(MarkdownStream *stream, const char *text, gsize len);
+char *markdown_stream_tail_to_pango(MarkdownStream *stream, const char *text, gsize len);
+void markdown_stream_clear(MarkdownStream *stream);
+
 #endif // MARKDOWN_H
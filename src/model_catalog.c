@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <json-c/json.h>
+#include "model_catalog.h"
+#include "json_util.h"
+#include "ollama_api.h"
+#include "persist.h"
+#include "transport.h"
+#include "trace.h"
+#include "ui.h"
+#include "ui_input.h"
+
+/**
+ * /api/tags lists the models with their digests; their context length and
+ * template only come from one /api/show request per model. Both are kept in
+ * a cache file, so the model dropdown is filled at startup before Ollama
+ * answers, and /api/show is only asked about models whose digest is not in
+ * the catalog yet (a model pulled again under the same name gets a new one).
+ * Up to MAX_SHOW_REQUESTS of those run at once.
+ */
+#define MAX_SHOW_REQUESTS 4
+#define SHOW_TIMEOUT 30
+#define DEFAULT_NUM_CTX 2048 // for models whose context length is unknown
+
+typedef struct {
+    AppData *app_data;
+    char *name;
+    char *digest;
+    ApiPost post;
+} ShowRequest;
+
+static GPtrArray *models = NULL;     // ModelInfo, in the order of /api/tags
+static GHashTable *by_name = NULL;   // name -> ModelInfo in `models`
+static GQueue pending = G_QUEUE_INIT; // names of models still to show
+static GHashTable *requests = NULL;  // ShowRequest set
+static gboolean details_changed = FALSE; // since the cache was last written
+
+// --- Private Helper Functions ---
+
+static void free_info(ModelInfo *info) {
+    g_free(info->name);
+    g_free(info->digest);
+    g_free(info->parameter_size);
+    g_free(info->quantization_level);
+    g_free(info->template);
+    g_free(info);
+}
+
+static char *get_cache_path(void) {
+    return g_build_filename(g_get_user_cache_dir(), "ollama-chat", "models.json", NULL);
+}
+
+// A copy of the string member `key` of `obj`; NULL if it is missing or empty.
+static char *dup_member(json_object *obj, const char *key) {
+    json_object *val;
+    if (!obj || !json_object_object_get_ex(obj, key, &val)) return NULL;
+    const char *str = json_object_get_string(val);
+    return str && *str ? g_strdup(str) : NULL;
+}
+
+static void copy_details(ModelInfo *to, const ModelInfo *from) {
+    g_free(to->parameter_size);
+    g_free(to->quantization_level);
+    g_free(to->template);
+    to->parameter_size = g_strdup(from->parameter_size);
+    to->quantization_level = g_strdup(from->quantization_level);
+    to->template = g_strdup(from->template);
+    to->context_length = from->context_length;
+    to->shown = from->shown;
+}
+
+// A model with `digest` whose details are known, under any name.
+static const ModelInfo *find_shown(const char *digest) {
+    for (guint i = 0; models && digest && i < models->len; i++) {
+        const ModelInfo *info = g_ptr_array_index(models, i);
+        if (info->shown && g_strcmp0(info->digest, digest) == 0) return info;
+    }
+    return NULL;
+}
+
+static void set_models(GPtrArray *updated) {
+    if (models) g_ptr_array_unref(models);
+    if (by_name) g_hash_table_unref(by_name);
+    models = updated;
+    by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < models->len; i++) {
+        ModelInfo *info = g_ptr_array_index(models, i);
+        g_hash_table_insert(by_name, info->name, info);
+    }
+}
+
+// Hands the model names to the rest of the app.
+static void publish_names(AppData *app_data) {
+    for (int i = 0; i < app_data->model_count; i++) {
+        g_free(app_data->models[i]);
+    }
+    free(app_data->models);
+    app_data->models = malloc(MAX(models->len, 1) * sizeof(char *));
+    app_data->model_count = 0;
+    if (!app_data->models) return;
+    for (guint i = 0; i < models->len; i++) {
+        app_data->models[app_data->model_count++] = g_strdup(((ModelInfo *)g_ptr_array_index(models, i))->name);
+    }
+}
+
+static void save_cache(void) {
+    json_object *root = json_object_new_object();
+    json_object *list = json_object_new_array();
+    for (guint i = 0; i < models->len; i++) {
+        const ModelInfo *info = g_ptr_array_index(models, i);
+        json_object *obj = json_object_new_object();
+        json_object_object_add(obj, "name", json_object_new_string(info->name));
+        if (info->digest) json_object_object_add(obj, "digest", json_object_new_string(info->digest));
+        if (info->parameter_size) {
+            json_object_object_add(obj, "parameter_size", json_object_new_string(info->parameter_size));
+        }
+        if (info->quantization_level) {
+            json_object_object_add(obj, "quantization_level", json_object_new_string(info->quantization_level));
+        }
+        json_object_object_add(obj, "context_length", json_object_new_int(info->context_length));
+        if (info->template) json_object_object_add(obj, "template", json_object_new_string(info->template));
+        json_object_object_add(obj, "shown", json_object_new_boolean(info->shown));
+        json_object_array_add(list, obj);
+    }
+    json_object_object_add(root, "models", list);
+
+    char *path = get_cache_path();
+    char *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0755);
+    const char *json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+    GBytes *contents = g_bytes_new(json_str, strlen(json_str));
+    persist_write(path, contents);
+    g_bytes_unref(contents);
+    g_free(dir);
+    g_free(path);
+    json_object_put(root);
+    details_changed = FALSE;
+}
+
+// The longest context of the model an /api/show response describes, from
+// "<architecture>.context_length" in its model_info.
+static gint parse_context_length(json_object *model_info) {
+    json_object *val;
+    if (json_object_object_get_ex(model_info, "general.architecture", &val)) {
+        char *key = g_strconcat(json_object_get_string(val), ".context_length", NULL);
+        gboolean found = json_object_object_get_ex(model_info, key, &val);
+        g_free(key);
+        if (found) return json_object_get_int(val);
+    }
+    json_object_object_foreach(model_info, key, value) {
+        if (g_str_has_suffix(key, ".context_length")) return json_object_get_int(value);
+    }
+    return 0;
+}
+
+static gboolean parse_show(ModelInfo *info, const char *data) {
+    json_object *root = data ? json_tokener_parse(data) : NULL;
+    if (!root) return FALSE;
+    json_object *details, *model_info;
+    if (json_object_object_get_ex(root, "details", &details)) {
+        char *parameter_size = dup_member(details, "parameter_size");
+        char *quantization_level = dup_member(details, "quantization_level");
+        if (parameter_size) {
+            g_free(info->parameter_size);
+            info->parameter_size = parameter_size;
+        }
+        if (quantization_level) {
+            g_free(info->quantization_level);
+            info->quantization_level = quantization_level;
+        }
+    }
+    if (json_object_object_get_ex(root, "model_info", &model_info)) {
+        info->context_length = parse_context_length(model_info);
+    }
+    g_free(info->template);
+    info->template = dup_member(root, "template");
+    info->shown = TRUE;
+    json_object_put(root);
+    return TRUE;
+}
+
+static void free_request(ShowRequest *request) {
+    api_post_clear(&request->post);
+    g_free(request->name);
+    g_free(request->digest);
+    g_free(request);
+}
+
+static gboolean is_being_shown(const char *digest) {
+    GHashTableIter iter;
+    gpointer request;
+    g_hash_table_iter_init(&iter, requests);
+    while (g_hash_table_iter_next(&iter, &request, NULL)) {
+        if (g_strcmp0(((ShowRequest *)request)->digest, digest) == 0) return TRUE;
+    }
+    return FALSE;
+}
+
+static void show_next(AppData *app_data);
+
+static void on_show_done(CURL *easy, CURLcode result, gpointer user_data) {
+    ShowRequest *request = (ShowRequest *)user_data;
+    AppData *app_data = request->app_data;
+    long status = 0;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+    g_hash_table_remove(requests, request);
+    if (result == CURLE_ABORTED_BY_CALLBACK) {
+        free_request(request);
+        return;
+    }
+
+    ModelInfo *info = g_hash_table_lookup(by_name, request->name);
+    if (result != CURLE_OK || status != 200) {
+        fprintf(stderr, "Error getting details of model %s: %s\n", request->name,
+                result != CURLE_OK ? curl_easy_strerror(result) : "unexpected response");
+    } else if (info && g_strcmp0(info->digest, request->digest) == 0 && parse_show(info, request->post.response.data)) {
+        // Other names for the same model
+        for (guint i = 0; i < models->len; i++) {
+            ModelInfo *other = g_ptr_array_index(models, i);
+            if (other != info && !other->shown && g_strcmp0(other->digest, info->digest) == 0) {
+                copy_details(other, info);
+            }
+        }
+        details_changed = TRUE;
+    }
+    free_request(request);
+
+    show_next(app_data);
+    if (g_hash_table_size(requests) == 0 && details_changed) {
+        save_cache();
+        ui_update_models_dropdown(app_data);
+        ui_input_update_context_usage(app_data);
+    }
+}
+
+static void start_show(AppData *app_data, const ModelInfo *info) {
+    GString *body = g_string_new("{\"model\":");
+    json_util_append_string(body, info->name, -1);
+    g_string_append_c(body, '}');
+
+    ShowRequest *request = g_new0(ShowRequest, 1);
+    request->app_data = app_data;
+    request->name = g_strdup(info->name);
+    request->digest = g_strdup(info->digest);
+    if (api_post_start(&request->post, app_data, "/api/show", body->str, body->len, SHOW_TIMEOUT, on_show_done,
+                       request, "model", "show")) {
+        g_hash_table_add(requests, request);
+    } else {
+        free_request(request);
+    }
+    g_string_free(body, TRUE);
+}
+
+// Starts /api/show requests for the pending models, up to MAX_SHOW_REQUESTS
+// at a time.
+static void show_next(AppData *app_data) {
+    while (g_hash_table_size(requests) < MAX_SHOW_REQUESTS && !g_queue_is_empty(&pending)) {
+        char *name = g_queue_pop_head(&pending);
+        const ModelInfo *info = g_hash_table_lookup(by_name, name);
+        if (info && !info->shown && !is_being_shown(info->digest)) start_show(app_data, info);
+        g_free(name);
+    }
+}
+
+// --- Public Functions ---
+
+// Fills the catalog, and the model names, from the cache of the last run.
+void model_catalog_load(AppData *app_data) {
+    requests = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GPtrArray *loaded = g_ptr_array_new_with_free_func((GDestroyNotify)free_info);
+    char *path = get_cache_path();
+    json_object *root = json_object_from_file(path);
+    g_free(path);
+    json_object *list;
+    if (root && json_object_object_get_ex(root, "models", &list) && json_object_is_type(list, json_type_array)) {
+        for (size_t i = 0; i < json_object_array_length(list); i++) {
+            json_object *obj = json_object_array_get_idx(list, i);
+            json_object *val;
+            char *name = dup_member(obj, "name");
+            if (!name) continue;
+            ModelInfo *info = g_new0(ModelInfo, 1);
+            info->name = name;
+            info->digest = dup_member(obj, "digest");
+            info->parameter_size = dup_member(obj, "parameter_size");
+            info->quantization_level = dup_member(obj, "quantization_level");
+            info->template = dup_member(obj, "template");
+            if (json_object_object_get_ex(obj, "context_length", &val)) info->context_length = json_object_get_int(val);
+            if (json_object_object_get_ex(obj, "shown", &val)) info->shown = json_object_get_boolean(val);
+            g_ptr_array_add(loaded, info);
+        }
+    }
+    if (root) json_object_put(root);
+    set_models(loaded);
+    if (models->len > 0) publish_names(app_data);
+}
+
+/**
+ * Takes the models listed in an /api/tags response. Models whose digest the
+ * catalog knows keep their details; the others are asked about with
+ * /api/show. Returns FALSE if the response is not a model list.
+ */
+gboolean model_catalog_update(AppData *app_data, const char *tags_json) {
+    json_object *root = tags_json ? json_tokener_parse(tags_json) : NULL;
+    json_object *list;
+    if (!root || !json_object_object_get_ex(root, "models", &list) || !json_object_is_type(list, json_type_array)) {
+        if (root) json_object_put(root);
+        return FALSE;
+    }
+
+    GPtrArray *updated = g_ptr_array_new_with_free_func((GDestroyNotify)free_info);
+    gboolean changed = json_object_array_length(list) != models->len;
+    g_queue_clear_full(&pending, g_free);
+    for (size_t i = 0; i < json_object_array_length(list); i++) {
+        json_object *obj = json_object_array_get_idx(list, i);
+        json_object *details = NULL;
+        char *name = dup_member(obj, "name");
+        if (!name) continue;
+        ModelInfo *info = g_new0(ModelInfo, 1);
+        info->name = name;
+        info->digest = dup_member(obj, "digest");
+        const ModelInfo *known = g_hash_table_lookup(by_name, name);
+        if (!known || g_strcmp0(known->digest, info->digest) != 0) {
+            changed = TRUE;
+            known = find_shown(info->digest);
+        } else if (i < models->len && g_ptr_array_index(models, i) != known) {
+            changed = TRUE; // reordered
+        }
+        if (known) {
+            copy_details(info, known);
+        } else if (json_object_object_get_ex(obj, "details", &details)) {
+            info->parameter_size = dup_member(details, "parameter_size");
+            info->quantization_level = dup_member(details, "quantization_level");
+        }
+        if (!info->shown) g_queue_push_tail(&pending, g_strdup(name));
+        g_ptr_array_add(updated, info);
+    }
+    json_object_put(root);
+
+    set_models(updated);
+    publish_names(app_data);
+    if (changed) save_cache();
+    show_next(app_data);
+    return TRUE;
+}
+
+// The catalog entry of `name`; NULL if Ollama did not list it.
+const ModelInfo *model_catalog_lookup(const char *name) {
+    return name && by_name ? g_hash_table_lookup(by_name, name) : NULL;
+}
+
+/**
+ * The num_ctx to request for `model`: the configured context length, but no
+ * more than the model supports; with 0 configured, all the model supports.
+ */
+gint model_catalog_get_num_ctx(AppData *app_data, const char *model) {
+    const ModelInfo *info = model_catalog_lookup(model);
+    gint limit = info ? info->context_length : 0;
+    if (app_data->ollama_context_size <= 0) return limit > 0 ? limit : DEFAULT_NUM_CTX;
+    return limit > 0 ? MIN(app_data->ollama_context_size, limit) : app_data->ollama_context_size;
+}
+
+void model_catalog_shutdown(void) {
+    g_queue_clear_full(&pending, g_free);
+    if (requests) {
+        GList *running = g_hash_table_get_keys(requests);
+        for (GList *l = running; l; l = l->next) {
+            transport_cancel(api_get_transport(), ((ShowRequest *)l->data)->post.request);
+        }
+        g_list_free(running);
+        g_clear_pointer(&requests, g_hash_table_unref);
+    }
+    g_clear_pointer(&by_name, g_hash_table_unref);
+    g_clear_pointer(&models, g_ptr_array_unref);
+}
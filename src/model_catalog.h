@@ -0,0 +1,24 @@
+#ifndef MODEL_CATALOG_H
+#define MODEL_CATALOG_H
+
+#include "app_data.h"
+
+typedef struct {
+    char *name;
+    char *digest;
+    char *parameter_size;     // as Ollama reports it, e.g. "8.0B"; NULL if unknown
+    char *quantization_level; // e.g. "Q4_K_M"; NULL if unknown
+    gint context_length;      // longest context the model supports, 0 if unknown
+    char *template;           // chat template, NULL if unknown
+    gboolean shown;           // details came from /api/show
+} ModelInfo;
+
+// The models Ollama has, with their details, cached on disk across runs.
+// All functions are called from the main thread.
+void model_catalog_load(AppData *app_data);
+gboolean model_catalog_update(AppData *app_data, const char *tags_json);
+const ModelInfo *model_catalog_lookup(const char *name);
+gint model_catalog_get_num_ctx(AppData *app_data, const char *model);
+void model_catalog_shutdown(void);
+
+#endif // MODEL_CATALOG_H
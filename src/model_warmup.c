@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <json-c/json.h>
+#include "model_warmup.h"
+#include "json_util.h"
+#include "ollama_api.h"
+#include "transport.h"
+#include "trace.h"
+#include "ui.h"
+
+/**
+ * Ollama loads a model on its first request, which otherwise happens inside
+ * the user's first message to it. So when a model is selected, and for the
+ * selected one once the models are listed at startup, a request with no
+ * prompt has Ollama load it (and keep it for the configured keep_alive)
+ * while the user is still typing. The status label counts the seconds it
+ * takes.
+ *
+ * Only the selected model is loaded: selecting another one cancels the
+ * request for the previous, which Ollama then finishes on its own.
+ */
+typedef struct {
+    AppData *app_data;
+    char *model;
+    ApiPost post;
+    gint64 started_at; // monotonic
+    guint tick_id;
+} WarmupRequest;
+
+static WarmupRequest *current = NULL;
+static char *loaded_model = NULL; // the last one a warm-up finished loading
+
+// --- Private Helper Functions ---
+
+static void free_request(WarmupRequest *request) {
+    if (request->tick_id) g_source_remove(request->tick_id);
+    api_post_clear(&request->post);
+    g_free(request->model);
+    g_free(request);
+}
+
+static gboolean on_tick(gpointer user_data) {
+    WarmupRequest *request = (WarmupRequest *)user_data;
+    gint64 seconds = (g_get_monotonic_time() - request->started_at) / G_USEC_PER_SEC;
+    char *status = g_strdup_printf("Loading %s… %" G_GINT64_FORMAT "s", request->model, seconds);
+    ui_schedule_update_status_label(request->app_data, status, NULL);
+    g_free(status);
+    return G_SOURCE_CONTINUE;
+}
+
+// Ollama's load_duration, in microseconds; 0 if the model was loaded already.
+static gint64 parse_load_duration(const char *data) {
+    json_object *root = data ? json_tokener_parse(data) : NULL;
+    json_object *val;
+    gint64 load = 0;
+    if (root && json_object_object_get_ex(root, "load_duration", &val)) load = json_object_get_int64(val) / 1000;
+    if (root) json_object_put(root);
+    return load;
+}
+
+static void on_warmup_done(CURL *easy, CURLcode result, gpointer user_data) {
+    WarmupRequest *request = (WarmupRequest *)user_data;
+    long status = 0;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+    if (result == CURLE_OK && status == 200) {
+        g_free(loaded_model);
+        loaded_model = g_strdup(request->model);
+        trace_span_add_int(request->post.span, "load_duration_us", parse_load_duration(request->post.response.data));
+        ui_schedule_update_status_label(request->app_data, "Connected", "success");
+    } else if (result != CURLE_ABORTED_BY_CALLBACK) {
+        fprintf(stderr, "Error loading model %s: %s\n", request->model,
+                result != CURLE_OK ? curl_easy_strerror(result)
+                                   : (request->post.response.data ? request->post.response.data : ""));
+        char *text = g_strdup_printf("Could not load %s", request->model);
+        ui_schedule_update_status_label(request->app_data, text, "error");
+        g_free(text);
+    }
+    if (current == request) current = NULL;
+    free_request(request);
+}
+
+// --- Public Functions ---
+
+/**
+ * Has Ollama load `model`, unless it is being loaded already. Cancels the
+ * warm-up of any other model.
+ */
+void model_warmup_start(AppData *app_data, const char *model) {
+    if (!model || !*model) return;
+    if (current && g_strcmp0(current->model, model) == 0) return;
+    if (current) transport_cancel(api_get_transport(), current->post.request);
+
+    GString *body = g_string_new("{\"model\":");
+    json_util_append_string(body, model, -1);
+    api_append_keep_alive(body, app_data, model);
+    g_string_append_c(body, '}');
+
+    WarmupRequest *request = g_new0(WarmupRequest, 1);
+    request->app_data = app_data;
+    request->model = g_strdup(model);
+    gboolean started = api_post_start(&request->post, app_data, "/api/generate", body->str, body->len,
+                                      (long)app_data->first_byte_timeout, on_warmup_done, request, "model",
+                                      "warm-up");
+    g_string_free(body, TRUE);
+    if (!started) {
+        free_request(request);
+        return;
+    }
+
+    current = request;
+    request->started_at = g_get_monotonic_time();
+    request->tick_id = g_timeout_add_seconds(1, on_tick, request);
+    char *status = g_strdup_printf("Loading %s…", model);
+    ui_schedule_update_status_label(app_data, status, NULL);
+    g_free(status);
+}
+
+// Whether the last warm-up that finished loaded `model`; recorded with chat
+// requests to compare their time to the first token.
+gboolean model_warmup_is_loaded(const char *model) {
+    return loaded_model && g_strcmp0(loaded_model, model) == 0;
+}
+
+void model_warmup_shutdown(void) {
+    if (current) transport_cancel(api_get_transport(), current->post.request);
+    g_clear_pointer(&loaded_model, g_free);
+}
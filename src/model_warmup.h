@@ -0,0 +1,12 @@
+#ifndef MODEL_WARMUP_H
+#define MODEL_WARMUP_H
+
+#include "app_data.h"
+
+// Loading models into Ollama ahead of the first message. All functions are
+// called from the main thread.
+void model_warmup_start(AppData *app_data, const char *model);
+gboolean model_warmup_is_loaded(const char *model);
+void model_warmup_shutdown(void);
+
+#endif // MODEL_WARMUP_H
@@ -1,31 +1,69 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
-#include <ctype.h>
 #include <curl/curl.h>
 #include <json-c/json.h>
 #include "ollama_api.h"
+#include "stream_decoder.h"
+#include "conversation.h"
+#include "json_util.h"
+#include "transport.h"
+#include "trace.h"
 #include "ui.h"
+#include "chat_session.h"
+#include "context_budget.h"
+#include "config.h"
+#include "model_warmup.h"
+#include "model_catalog.h"
+#include "chat_summary.h"
 
-#define STREAM_BUFFER_SIZE 1024 * 16
-
+/**
+ * Request body of /api/chat as a list of immutable segments: a header, the
+ * wire form of every message sent, separators and a trailer. curl pulls it
+ * through read_body_callback(), so the payload is never joined in memory.
+ */
 typedef struct {
+    GPtrArray *segments; // GBytes
+    guint segment;
+    gsize offset;
+    curl_off_t size;
+} ChatBody;
+
+struct ChatRequest {
     AppData *app_data;
-    char *message;
-} ChatThreadData;
+    ChatSession *session;     // NULL once the session ended, see api_detach_chat()
+    ChatBody *body;
+    StreamDecoder *decoder;
+    struct curl_slist *headers;
+    TransportRequest *request;
+    gboolean finished;        // the final `done` chunk arrived
+    gboolean timed_out;
+    curl_off_t transferred;   // bytes up and down at the last progress call
+    gint64 last_activity;     // monotonic time of the last transferred byte
+    guint watchdog_id;        // checks the idle limits once a second
+    char *summary_hold;       // summaries to the same server and model wait on the request
+    gboolean got_response;
+    // Tracing
+    TraceSpan *span;
+    int track;
+    gint64 sent_at;
+    gboolean got_content;
+};
 
 typedef struct {
     AppData *app_data;
-    char buffer[STREAM_BUFFER_SIZE];
-    size_t buffer_pos;
-} StreamData;
+    HttpResponse response;
+} ModelsRequest;
 
+static Transport *transport = NULL;
+static struct curl_slist *json_headers = NULL; // of every ApiPost
+
+// Collects a response in memory, NUL-terminated.
 static size_t write_callback(void *contents, size_t size, size_t nmemb, HttpResponse *response) {
     size_t real_size = size * nmemb;
     char *ptr = realloc(response->data, response->size + real_size + 1);
     if (!ptr) {
-        printf("Not enough memory (realloc returned NULL)\n");
+        g_printerr("Not enough memory (realloc returned NULL)\n");
         return 0;
     }
     response->data = ptr;
@@ -35,240 +73,388 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb, HttpResp
     return real_size;
 }
 
-static size_t stream_callback(void *contents, size_t size, size_t nmemb, StreamData *stream_data) {
-    if (stream_data->app_data->request_cancelled) {
-        return -1; // Abort the stream
+static void on_stream_content(const char *text, gsize len, gpointer user_data) {
+    ChatRequest *chat = (ChatRequest *)user_data;
+    if (!chat->got_content && chat->span) {
+        gint64 first_token = trace_now() - chat->sent_at;
+        trace_complete(chat->track, "chat", "first token", chat->sent_at, first_token);
+        trace_span_add_int(chat->span, "time_to_first_token_us", first_token);
     }
-    size_t real_size = size * nmemb;
-    if (stream_data->buffer_pos + real_size >= STREAM_BUFFER_SIZE) {
-        fprintf(stderr, "Stream buffer overflow. Increase STREAM_BUFFER_SIZE.\n");
-        stream_data->buffer_pos = 0;
-        return real_size;
+    chat->got_content = TRUE;
+    ui_push_response_text(chat->session, text, len);
+}
+
+// Ollama's own timings end where the final chunk arrived: model load, then
+// prompt evaluation, then generation.
+static void trace_stream_stats(ChatRequest *chat, const StreamStats *stats) {
+    gint64 end = trace_now();
+    gint64 eval = stats->eval_duration / 1000;
+    gint64 prompt_eval = stats->prompt_eval_duration / 1000;
+    gint64 load = stats->load_duration / 1000;
+    trace_complete(chat->track, "ollama", "eval", end - eval, eval);
+    trace_complete(chat->track, "ollama", "prompt_eval", end - eval - prompt_eval, prompt_eval);
+    if (load > 0) trace_complete(chat->track, "ollama", "load", end - eval - prompt_eval - load, load);
+
+    trace_span_add_int(chat->span, "prompt_eval_count", stats->prompt_eval_count);
+    trace_span_add_int(chat->span, "prompt_cached_percent",
+                       context_budget_cached_percent(chat->session->prompt_tokens, stats->prompt_eval_count));
+    trace_span_add_int(chat->span, "prompt_eval_duration_us", prompt_eval);
+    trace_span_add_int(chat->span, "eval_count", stats->eval_count);
+    trace_span_add_int(chat->span, "eval_duration_us", eval);
+    if (stats->eval_duration > 0) {
+        trace_span_add_double(chat->span, "tokens_per_second", stats->eval_count * 1e9 / stats->eval_duration);
     }
-    memcpy(&stream_data->buffer[stream_data->buffer_pos], contents, real_size);
-    stream_data->buffer_pos += real_size;
-    stream_data->buffer[stream_data->buffer_pos] = '\0';
-    char *line_start = stream_data->buffer;
-    char *line_end;
-    while ((line_end = strchr(line_start, '\n')) != NULL) {
-        *line_end = '\0';
-        gboolean has_content = FALSE;
-        for (char *p = line_start; *p; p++) {
-            if (!isspace((unsigned char)*p)) {
-                has_content = TRUE;
-                break;
-            }
-        }
-        if (has_content) {
-            json_object *json_obj = json_tokener_parse(line_start);
-            if (json_obj) {
-                json_object *message_obj, *content_obj, *done_obj;
-                if (json_object_object_get_ex(json_obj, "message", &message_obj)) {
-                    if (json_object_object_get_ex(message_obj, "content", &content_obj)) {
-                        const char *content = json_object_get_string(content_obj);
-                        if (content) { // No need to check strlen, send even empty strings from API
-                            char *valid_content = g_utf8_make_valid(content, -1);
-                            ui_schedule_update_response_label(stream_data->app_data, valid_content);
-                            // g_free(valid_content) is handled by the UI thread
-                        }
-                    }
-                }
-                if (json_object_object_get_ex(json_obj, "done", &done_obj)) {
-                    if (json_object_get_boolean(done_obj)) {
-                        ui_schedule_finalize_generation(stream_data->app_data);
-                    }
-                }
-                json_object_put(json_obj);
-            }
-        }
-        line_start = line_end + 1;
+}
+
+static void on_stream_done(const StreamStats *stats, gpointer user_data) {
+    ChatRequest *chat = (ChatRequest *)user_data;
+    chat->finished = TRUE;
+    if (chat->span) {
+        trace_stream_stats(chat, stats);
     }
-    // Move the remaining partial line to the beginning of the buffer
-    if (line_start < &stream_data->buffer[stream_data->buffer_pos]) {
-        size_t remaining_len = &stream_data->buffer[stream_data->buffer_pos] - line_start;
-        memmove(stream_data->buffer, line_start, remaining_len);
-        stream_data->buffer_pos = remaining_len;
-    } else {
-        stream_data->buffer_pos = 0;
+    ui_schedule_finalize_generation(chat->session, stats);
+}
+
+static size_t stream_callback(void *contents, size_t size, size_t nmemb, ChatRequest *chat) {
+    size_t real_size = size * nmemb;
+    if (!chat->session) return real_size; // the rest of a finished response, nobody to show it to
+    if (g_atomic_int_get(&chat->session->cancelled)) {
+        return -1; // Abort the stream
     }
+    chat->got_response = TRUE;
+    chat->last_activity = g_get_monotonic_time();
+    stream_decoder_feed(chat->decoder, contents, real_size);
     return real_size;
 }
 
-static void *get_models_thread(void *arg) {
-    AppData *app_data = (AppData *)arg;
-    CURL *curl;
-    CURLcode res;
-    HttpResponse response = {0};
-    curl = curl_easy_init();
-    if (curl) {
-        char url[256];
-        snprintf(url, sizeof(url), "%s/api/tags", app_data->base_url);
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
-        res = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
-        if (res == CURLE_OK && response.data) {
-            json_object *json_obj = json_tokener_parse(response.data);
-            if (json_obj) {
-                json_object *models_array_obj;
-                if (json_object_object_get_ex(json_obj, "models", &models_array_obj) &&
-                        json_object_is_type(models_array_obj, json_type_array))
-                {
-                    int array_len = json_object_array_length(models_array_obj);
-                    char **new_models = malloc(array_len * sizeof(char*));
-                    int new_model_count = 0;
-                    if (new_models) {
-                        for (int i = 0; i < array_len; i++) {
-                            json_object *model_obj = json_object_array_get_idx(models_array_obj, i);
-                            json_object *name_obj;
-                            if (json_object_object_get_ex(model_obj, "name", &name_obj)) {
-                                const char *name = json_object_get_string(name_obj);
-                                new_models[i] = g_strdup(name);
-                                if (new_models[i]) {
-                                    new_model_count++;
-                                }
-                            }
-                        }
-                        if (new_model_count == array_len) {
-                            // Free old models
-                            if (app_data->models) {
-                                for (int i = 0; i < app_data->model_count; i++) {
-                                    g_free(app_data->models[i]);
-                                }
-                                free(app_data->models);
-                            }
-                            app_data->models = new_models;
-                            app_data->model_count = new_model_count;
-                        } else {
-                            // Cleanup new_models if allocation failed
-                            for (int i = 0; i < new_model_count; i++) {
-                                g_free(new_models[i]);
-                            }
-                            free(new_models);
-                        }
-                    }
-                    ui_schedule_update_models_dropdown(app_data);
-                }
-                json_object_put(json_obj);
-            }
-        } else {
-            ui_schedule_update_status_label(app_data, "Disconnected", "error");
-        }
-        if (response.data) {
-            free(response.data);
-        }
+/**
+ * Called by curl while it works on the transfer, which on the multi
+ * interface is only when a socket or timer event comes in: it notes upload
+ * progress and aborts a cancelled request, but cannot be relied on to run
+ * while the connection is silent. chat_watchdog() enforces the idle limits.
+ */
+static int chat_progress_callback(ChatRequest *chat, curl_off_t dltotal, curl_off_t dlnow,
+                                  curl_off_t ultotal, curl_off_t ulnow) {
+    (void)dltotal; (void)ultotal;
+    if (chat->session && g_atomic_int_get(&chat->session->cancelled)) return 1;
+    if (dlnow + ulnow > chat->transferred) {
+        chat->transferred = dlnow + ulnow;
+        chat->last_activity = g_get_monotonic_time();
     }
-    return NULL;
+    return 0;
 }
 
-static void *send_chat_thread(void *arg) {
-    ChatThreadData *thread_data = (ChatThreadData *)arg;
-    AppData *app_data = thread_data->app_data;
-    char *message = thread_data->message;
-    CURL *curl;
-    CURLcode res;
-    curl = curl_easy_init();
-    if (curl) {
-        char url[256];
-        snprintf(url, sizeof(url), "%s/api/chat", app_data->base_url);
-        json_object *payload = json_object_new_object();
-        json_object_object_add(payload, "model", json_object_new_string(app_data->current_model));
-        // Create a new messages array and add the system prompt if it exists
-        json_object *messages_with_system = json_object_new_array();
-        if (app_data->system_prompt && strlen(app_data->system_prompt) > 0) {
-            json_object *system_msg = json_object_new_object();
-            json_object_object_add(system_msg, "role", json_object_new_string("system"));
-            json_object_object_add(system_msg, "content", json_object_new_string(app_data->system_prompt));
-            json_object_array_add(messages_with_system, system_msg);
-        }
-        // Add the rest of the messages
-        int len = json_object_array_length(app_data->messages_array);
-        for (int i = 0; i < len; i++) {
-            json_object_array_add(messages_with_system, json_object_get(json_object_array_get_idx(app_data->messages_array, i)));
-        }
-        json_object_object_add(payload, "messages", messages_with_system);
-        json_object_object_add(payload, "stream", json_object_new_boolean(TRUE));
-        json_object *options = json_object_new_object();
-        json_object_object_add(options, "temperature", json_object_new_double(app_data->temperature));
-        json_object_object_add(options, "top_p", json_object_new_double(app_data->top_p));
-        json_object_object_add(options, "top_k", json_object_new_int(app_data->top_k));
-        json_object_object_add(options, "seed", json_object_new_int(app_data->seed));
-        json_object_object_add(options, "num_ctx", json_object_new_int(app_data->ollama_context_size));
-        json_object_object_add(payload, "options", options);
-        const char *json_string = json_object_to_json_string(payload);
-        StreamData stream_data = {.app_data = app_data, .buffer_pos = 0};
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_string);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &stream_data);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        res = curl_easy_perform(curl);
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-        json_object_put(payload);
-        if (res != CURLE_OK && res != CURLE_WRITE_ERROR) {
-            ui_schedule_reset_send_button(app_data);
-        } else if (res == CURLE_WRITE_ERROR && app_data->request_cancelled) {
-            ui_schedule_reset_send_button(app_data);
+/**
+ * Runs once a second on the main loop, in place of a wall-clock cap: cancels
+ * the request once nothing was transferred for longer than the model may
+ * take to produce its first byte (prompt evaluation, model load), or than an
+ * answer in progress may stall.
+ */
+static gboolean chat_watchdog(gpointer user_data) {
+    ChatRequest *chat = (ChatRequest *)user_data;
+    AppData *app_data = chat->app_data;
+    int limit = chat->got_response ? app_data->stall_timeout : app_data->first_byte_timeout;
+    if (limit <= 0 || g_get_monotonic_time() - chat->last_activity <= (gint64)limit * G_USEC_PER_SEC) {
+        return G_SOURCE_CONTINUE;
+    }
+    chat->timed_out = TRUE;
+    chat->watchdog_id = 0;
+    transport_cancel(transport, chat->request); // frees `chat`
+    return G_SOURCE_REMOVE;
+}
+
+static void on_models_done(CURL *easy, CURLcode result, gpointer user_data) {
+    (void)easy;
+    ModelsRequest *request = (ModelsRequest *)user_data;
+    AppData *app_data = request->app_data;
+    if (result == CURLE_OK && model_catalog_update(app_data, request->response.data)) {
+        ui_schedule_update_models_dropdown(app_data);
+    } else if (result != CURLE_OK && result != CURLE_ABORTED_BY_CALLBACK) {
+        ui_schedule_update_status_label(app_data, "Disconnected", "error");
+    }
+    free(request->response.data);
+    g_free(request);
+}
+
+static void chat_body_add(ChatBody *body, GBytes *bytes) {
+    body->size += g_bytes_get_size(bytes);
+    g_ptr_array_add(body->segments, bytes);
+}
+
+static void chat_body_add_string(ChatBody *body, GString *str) {
+    chat_body_add(body, g_string_free_to_bytes(str));
+}
+
+static void chat_body_free(ChatBody *body) {
+    if (!body) return;
+    g_ptr_array_unref(body->segments);
+    g_free(body);
+}
+
+// Builds the /api/chat request body from the session's conversation. Only
+// the header and trailer are serialized per request; the system prompt and
+// messages come from the plan, in the same bytes from one request to the
+// next, so that Ollama can reuse the start of the prompt it has cached.
+static ChatBody *build_chat_body(AppData *app_data, ChatSession *session, const ContextPlan *plan, gint num_ctx) {
+    static const char separator[] = ",";
+    guint len = plan->wire->len;
+    ChatBody *body = g_new0(ChatBody, 1);
+    body->segments = g_ptr_array_new_full(2 * len + 2, (GDestroyNotify)g_bytes_unref);
+    GBytes *comma = g_bytes_new_static(separator, 1);
+
+    GString *header = g_string_sized_new(256);
+    g_string_append(header, "{\"model\":");
+    json_util_append_string(header, session->model ? session->model : "", -1);
+    g_string_append(header, ",\"messages\":[");
+    chat_body_add_string(body, header);
+    for (guint i = 0; i < len; i++) {
+        if (i > 0) chat_body_add(body, g_bytes_ref(comma));
+        chat_body_add(body, g_bytes_ref(g_ptr_array_index(plan->wire, i)));
+    }
+
+    GString *trailer = g_string_sized_new(128);
+    g_string_append(trailer, "],\"stream\":true,\"options\":{\"temperature\":");
+    json_util_append_double(trailer, app_data->temperature);
+    g_string_append(trailer, ",\"top_p\":");
+    json_util_append_double(trailer, app_data->top_p);
+    g_string_append_printf(trailer, ",\"top_k\":%d,\"seed\":%d,\"num_ctx\":%d}",
+                           app_data->top_k, app_data->seed, num_ctx);
+    api_append_keep_alive(trailer, app_data, session->model);
+    g_string_append_c(trailer, '}');
+    chat_body_add_string(body, trailer);
+    g_bytes_unref(comma);
+    return body;
+}
+
+static size_t read_body_callback(char *buffer, size_t size, size_t nitems, ChatBody *body) {
+    size_t room = size * nitems;
+    size_t written = 0;
+    while (written < room && body->segment < body->segments->len) {
+        gsize segment_size;
+        const char *data = g_bytes_get_data(g_ptr_array_index(body->segments, body->segment), &segment_size);
+        gsize n = MIN(segment_size - body->offset, room - written);
+        memcpy(buffer + written, data + body->offset, n);
+        written += n;
+        body->offset += n;
+        if (body->offset == segment_size) {
+            body->segment++;
+            body->offset = 0;
         }
     }
-    free(message);
-    free(thread_data);
-    return NULL;
+    return written;
+}
+
+// curl rewinds the body when it has to resend it (redirects, reused
+// connections that were closed by the server).
+static int seek_body_callback(ChatBody *body, curl_off_t offset, int origin) {
+    if (origin != SEEK_SET || offset < 0 || offset > body->size) return CURL_SEEKFUNC_CANTSEEK;
+    body->segment = 0;
+    body->offset = 0;
+    while (body->segment < body->segments->len) {
+        gsize segment_size = g_bytes_get_size(g_ptr_array_index(body->segments, body->segment));
+        if ((curl_off_t)segment_size > offset) break;
+        offset -= segment_size;
+        body->segment++;
+    }
+    body->offset = offset;
+    return CURL_SEEKFUNC_OK;
+}
+
+static void chat_request_free(ChatRequest *chat) {
+    if (chat->watchdog_id) g_source_remove(chat->watchdog_id);
+    if (chat->summary_hold) chat_summary_release(chat->summary_hold);
+    trace_span_end(chat->span);
+    stream_decoder_free(chat->decoder);
+    curl_slist_free_all(chat->headers);
+    chat_body_free(chat->body);
+    g_free(chat);
 }
 
+static void on_chat_done(CURL *easy, CURLcode result, gpointer user_data) {
+    (void)easy;
+    ChatRequest *chat = (ChatRequest *)user_data;
+    AppData *app_data = chat->app_data;
+    if (chat->session) {
+        chat->session->request = NULL;
+        if (result == CURLE_OK) stream_decoder_finish(chat->decoder);
+    }
+    if (chat->timed_out) {
+        ui_schedule_update_status_label(app_data, "Response timed out", "error");
+    } else if (result == CURLE_OPERATION_TIMEDOUT || result == CURLE_COULDNT_CONNECT) {
+        ui_schedule_update_status_label(app_data, "Disconnected", "error");
+    }
+    // Cancelled, failed or cut short before the final chunk
+    if (chat->session && !chat->finished) {
+        ui_schedule_reset_send_button(chat->session);
+    }
+    chat_request_free(chat);
+}
+
+// --- Public Functions ---
+
 void api_init(void) {
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    transport = transport_new();
+    json_headers = curl_slist_append(NULL, "Content-Type: application/json");
 }
 
 void api_cleanup(void) {
+    transport_free(transport);
+    transport = NULL;
+    curl_slist_free_all(json_headers);
+    json_headers = NULL;
     curl_global_cleanup();
 }
 
+// The shared transport, for other modules issuing HTTP requests.
+Transport *api_get_transport(void) {
+    return transport;
+}
+
 void api_get_models(AppData *app_data) {
-    pthread_t thread;
-    pthread_create(&thread, NULL, get_models_thread, app_data);
-    pthread_detach(thread);
+    CURL *curl = curl_easy_init();
+    if (!curl) return;
+    ModelsRequest *request = g_new0(ModelsRequest, 1);
+    request->app_data = app_data;
+    char url[256];
+    snprintf(url, sizeof(url), "%s/api/tags", app_data->base_url);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &request->response);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
+    transport_start(transport, curl, on_models_done, request);
 }
 
-void api_send_chat(AppData *app_data, char *message) {
-    ChatThreadData *thread_data = malloc(sizeof(ChatThreadData));
-    thread_data->app_data = app_data;
-    thread_data->message = message; // already a copy
-    pthread_t thread;
-    pthread_create(&thread, NULL, send_chat_thread, thread_data);
-    pthread_detach(thread);
+/**
+ * Appends the keep_alive field configured for `model` to a request body,
+ * if any: as a number when it is one, since Ollama reads a string as a
+ * duration with a unit.
+ */
+void api_append_keep_alive(GString *body, AppData *app_data, const char *model) {
+    const char *keep_alive = config_get_keep_alive(app_data, model);
+    if (!keep_alive) return;
+    char *end;
+    gint64 seconds = g_ascii_strtoll(keep_alive, &end, 10);
+    g_string_append(body, ",\"keep_alive\":");
+    if (end != keep_alive && *end == '\0') {
+        g_string_append_printf(body, "%" G_GINT64_FORMAT, seconds);
+    } else {
+        json_util_append_string(body, keep_alive, -1);
+    }
 }
 
-static void *check_connection_thread(void *arg) {
-    AppData *app_data = (AppData *)arg;
-    CURL *curl;
-    CURLcode res;
-    curl = curl_easy_init();
-    if (curl) {
-        char url[256];
-        snprintf(url, sizeof(url), "%s/api/tags", app_data->base_url);
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
-        res = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
-        if (res == CURLE_OK) {
-            api_get_models(app_data);
-        } else {
-            ui_schedule_update_status_label(app_data, "Disconnected", "error");
-        }
+// Sends the conversation of `session`, as much of it as fits in num_ctx.
+// The response is decoded as it arrives, on the main loop. Requests of
+// several sessions run side by side.
+void api_send_chat(ChatSession *session) {
+    AppData *app_data = session->app_data;
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        // Nothing was sent; the session ends without a response
+        g_printerr("Error starting chat request: could not create a curl handle\n");
+        ui_schedule_update_status_label(app_data, "Could not start request", "error");
+        ui_schedule_reset_send_button(session);
+        return;
     }
-    return NULL;
+    ChatRequest *chat = g_new0(ChatRequest, 1);
+    chat->app_data = app_data;
+    chat->session = session;
+    gint num_ctx = model_catalog_get_num_ctx(app_data, session->model);
+    ContextPlan *plan = context_budget_plan(session->conversation, session->model, app_data->system_prompt, num_ctx, 0);
+    chat->body = build_chat_body(app_data, session, plan, num_ctx);
+    session->prompt_tokens = plan->tokens;
+    session->prompt_continues = plan->continues;
+    context_budget_remember(session->conversation, plan);
+    chat->decoder = stream_decoder_new(on_stream_content, on_stream_done, chat);
+    chat->headers = curl_slist_append(chat->headers, "Content-Type: application/json");
+    chat->headers = curl_slist_append(chat->headers, "Expect:"); // no 100-continue round trip for large bodies
+    char url[256];
+    snprintf(url, sizeof(url), "%s/api/chat", app_data->base_url);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_body_callback);
+    curl_easy_setopt(curl, CURLOPT_READDATA, chat->body);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, seek_body_callback);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, chat->body);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, chat->body->size);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, chat);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, chat_progress_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, chat);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)app_data->connect_timeout);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chat->headers);
+    chat->last_activity = g_get_monotonic_time();
+    chat->sent_at = trace_now();
+    chat->summary_hold = chat_summary_hold(app_data->base_url, session->model);
+    chat->request = transport_start(transport, curl, on_chat_done, chat);
+    chat->track = transport_request_get_track(chat->request);
+    chat->watchdog_id = g_timeout_add_seconds(1, chat_watchdog, chat);
+    chat->span = trace_span_begin(chat->track, "chat", "chat");
+    trace_span_add_int(chat->span, "body_bytes", chat->body->size);
+    trace_span_add_int(chat->span, "messages", plan->wire->len);
+    trace_span_add_int(chat->span, "messages_left_out", plan->first);
+    trace_span_add_int(chat->span, "messages_collapsed", plan->collapsed);
+    trace_span_add_int(chat->span, "num_ctx", num_ctx);
+    trace_span_add_int(chat->span, "prompt_tokens_estimate", plan->tokens);
+    trace_span_add_int(chat->span, "prompt_continues", plan->continues);
+    trace_span_add_int(chat->span, "model_warmed_up", model_warmup_is_loaded(session->model));
+    context_budget_plan_free(plan);
+    session->request = chat;
+}
+
+// Stops the chat request of `session`, if any, without waiting for its next
+// byte.
+void api_cancel_chat(ChatSession *session) {
+    g_atomic_int_set(&session->cancelled, TRUE);
+    if (session->request) {
+        trace_instant(session->request->track, "chat", "cancel");
+        transport_cancel(transport, session->request->request);
+    }
+}
+
+/**
+ * Called as `session` ends. The final chunk schedules the end of the session
+ * as soon as it is decoded, and curl may still be finishing the transfer
+ * then; the request carries on without the session.
+ */
+void api_detach_chat(ChatSession *session) {
+    if (session->request) {
+        session->request->session = NULL;
+        session->request = NULL;
+    }
+}
+
+/**
+ * Starts a POST of the JSON `body` to `path` on the server, its response
+ * collected in `post`, with a trace span `name` in `category` on the
+ * request's track. `done_func` is called as transport_start() calls it.
+ * Returns FALSE, starting nothing, if no curl handle could be made.
+ */
+gboolean api_post_start(ApiPost *post, AppData *app_data, const char *path, const char *body, gsize len,
+                        long timeout, TransportDoneFunc done_func, gpointer user_data, const char *category,
+                        const char *name) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return FALSE;
+    char url[256];
+    snprintf(url, sizeof(url), "%s%s", app_data->base_url, path);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)len);
+    curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, body);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, json_headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &post->response);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)app_data->connect_timeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    post->request = transport_start(transport, curl, done_func, user_data);
+    post->span = trace_span_begin(transport_request_get_track(post->request), category, name);
+    trace_span_add_int(post->span, "body_bytes", len);
+    return TRUE;
 }
 
-void api_check_connection(AppData *app_data) {
-    pthread_t thread;
-    pthread_create(&thread, NULL, check_connection_thread, app_data);
-    pthread_detach(thread);
+// Ends the span of `post` and frees its response, so it can be started again.
+void api_post_clear(ApiPost *post) {
+    g_clear_pointer(&post->span, trace_span_end);
+    g_clear_pointer(&post->response.data, free);
+    post->response.size = 0;
 }
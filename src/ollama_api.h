@@ -2,18 +2,37 @@
 #define OLLAMA_API_H
 
 #include <stddef.h>
+#include <glib.h>
+#include "transport.h"
+#include "trace.h"
 
 typedef struct AppData AppData;
+typedef struct Transport Transport;
+typedef struct ChatSession ChatSession;
 
 typedef struct {
     char *data;
     size_t size;
 } HttpResponse;
 
+// A POST with a JSON body to the server, its response collected in memory.
+typedef struct {
+    HttpResponse response;
+    TransportRequest *request;
+    TraceSpan *span;
+} ApiPost;
+
 void api_init(void);
 void api_cleanup(void);
+Transport *api_get_transport(void);
 void api_get_models(AppData *app_data);
-void api_send_chat(AppData *app_data, char *message);
-void api_check_connection(AppData *app_data);
+void api_send_chat(ChatSession *session);
+void api_cancel_chat(ChatSession *session);
+void api_detach_chat(ChatSession *session);
+void api_append_keep_alive(GString *body, AppData *app_data, const char *model);
+gboolean api_post_start(ApiPost *post, AppData *app_data, const char *path, const char *body, gsize len,
+                        long timeout, TransportDoneFunc done_func, gpointer user_data, const char *category,
+                        const char *name);
+void api_post_clear(ApiPost *post);
 
 #endif // OLLAMA_API_H
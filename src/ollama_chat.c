@@ -4,6 +4,17 @@
 #include "ollama_api.h"
 #include "history.h"
 #include "config.h"
+#include "trace.h"
+#include "persist.h"
+#include "chat_catalog.h"
+#include "chat_search.h"
+#include "blob_store.h"
+#include "chat_pack.h"
+#include "chat_watch.h"
+#include "chat_session.h"
+#include "chat_summary.h"
+#include "model_warmup.h"
+#include "model_catalog.h"
 
 static AppData *app_data = NULL;
 
@@ -11,7 +22,7 @@ static void on_activate(GtkApplication *app, gpointer user_data) {
     (void) user_data;
     app_data = g_malloc0(sizeof(AppData));
     app_data->app = app;
-    app_data->response_buffer = g_string_new("");
+    app_data->sessions = g_hash_table_new(g_str_hash, g_str_equal);
     GtkIconTheme *icon_theme = gtk_icon_theme_get_for_display(gdk_display_get_default());
     gtk_icon_theme_add_search_path(icon_theme, "/usr/share/icons/hicolor/scalable/apps");
     config_init(app_data);
@@ -22,21 +33,21 @@ static void on_activate(GtkApplication *app, gpointer user_data) {
     }
     history_init(app_data);
     ui_build(app, app_data);
+    model_catalog_load(app_data);
+    ui_update_models_dropdown(app_data);
     history_load_chats(app_data);
-    if (g_list_model_get_n_items(G_LIST_MODEL(app_data->history_store)) == 0) {
+    if (chat_catalog_get_length(app_data->chat_catalog) == 0) {
         history_start_new_chat(app_data);
     } else {
         // Load the first chat in the list
-        GtkListBoxRow *first_row = gtk_list_box_get_row_at_index(app_data->history_list_box, 0);
-        if (first_row) {
-            history_load_selected_chat(app_data->history_list_box, first_row, app_data);
-            gtk_list_box_select_row(app_data->history_list_box, first_row);
-        }
+        history_open_chat(app_data, chat_catalog_get_entry(app_data->chat_catalog, 0)->id, G_MAXUINT);
     }
-    api_check_connection(app_data);
+    api_get_models(app_data);
 }
 
 int main(int argc, char *argv[]) {
+    trace_init();
+    persist_init();
     api_init();
     GtkApplication *app = gtk_application_new(
         "dev.datainquiry.ollama-chat", G_APPLICATION_DEFAULT_FLAGS);
@@ -44,7 +55,15 @@ int main(int argc, char *argv[]) {
     int status = g_application_run(G_APPLICATION(app), argc, argv);
     if (app_data) {
         config_save(app_data);
-        history_save_chat(app_data);
+        chat_summary_shutdown();
+        model_warmup_shutdown();
+        model_catalog_shutdown();
+        chat_watch_free(app_data->chat_watch);
+        history_close_chat(app_data);
+        chat_session_close_all(app_data);
+        chat_search_close(app_data->chat_search);
+        blob_store_shutdown();
+        chat_pack_shutdown();
         if (app_data->models) {
             for (int i = 0; i < app_data->model_count; i++) {
                 g_free(app_data->models[i]);
@@ -57,22 +76,35 @@ int main(int argc, char *argv[]) {
         if (app_data->system_prompt) {
             g_free(app_data->system_prompt);
         }
-        if (app_data->messages_array) {
-            json_object_put(app_data->messages_array);
+        g_free(app_data->summary_model);
+        if (app_data->keep_alive) {
+            g_hash_table_unref(app_data->keep_alive);
+        }
+        if (app_data->conversation) {
+            conversation_unref(app_data->conversation);
         }
         if (app_data->current_chat_id) {
             g_free(app_data->current_chat_id);
         }
-        if (app_data->history_store) {
-            g_object_unref(app_data->history_store);
+        g_free(app_data->loading_chat_id);
+        if (app_data->chat_model) {
+            g_object_unref(app_data->chat_model);
+        }
+        if (app_data->history_model) {
+            g_object_unref(app_data->history_model);
         }
+        chat_catalog_free(app_data->chat_catalog);
         if (app_data->theme) {
             g_free(app_data->theme);
         }
-        g_string_free(app_data->response_buffer, TRUE);
+        g_hash_table_unref(app_data->sessions);
+        context_budget_plan_free(app_data->context_plan);
+        context_budget_shutdown();
         g_free(app_data);
     }
     g_object_unref(app);
     api_cleanup();
+    persist_shutdown();
+    trace_shutdown();
     return status;
 }
@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "persist.h"
+#include "trace.h"
+
+/**
+ * One writer thread performs every history and config write, so that a slow
+ * disk never stalls the main loop. Jobs are queued in order; a job queued
+ * for a file while an earlier one for the same file is still waiting is
+ * merged into it: appends are concatenated and a whole-file write replaces
+ * whatever was pending. Jobs are only merged with the last pending job that
+ * touches the file, so the order of writes to each file is preserved.
+ *
+ * Whole-file writes go to a hidden temporary file that is fsync'd and then
+ * renamed over the target, and the directory is fsync'd so that the rename
+ * survives a crash too; appends are fsync'd before the next job starts.
+ * A removal therefore only happens once every write queued before it is on
+ * disk, and a call sees every file as the writes queued before it left it.
+ */
+typedef enum {
+    JOB_WRITE,
+    JOB_APPEND,
+    JOB_COMPACT,
+    JOB_REMOVE,
+    JOB_CALL,
+} JobKind;
+
+typedef struct {
+    JobKind kind;
+    char *path;
+    char *journal_path; // JOB_COMPACT: emptied once `path` is written; JOB_CALL: also read
+    GBytes *contents;   // JOB_WRITE, JOB_COMPACT
+    GByteArray *tail;   // appended after `contents`, or to the file for JOB_APPEND
+    PersistFunc func;   // JOB_CALL
+    gpointer data;
+} PersistJob;
+
+static GMutex persist_lock;
+static GCond persist_cond;
+static GQueue persist_queue = G_QUEUE_INIT;
+static GHashTable *pending_by_path = NULL; // path -> last queued PersistJob touching it
+static GThread *persist_thread = NULL;
+static guint64 jobs_queued = 0;
+static guint64 jobs_done = 0;
+static gboolean quitting = FALSE;
+static int persist_track = 0;
+
+// --- Private Helper Functions ---
+
+static void free_job(PersistJob *job) {
+    g_free(job->path);
+    g_free(job->journal_path);
+    if (job->contents) g_bytes_unref(job->contents);
+    if (job->tail) g_byte_array_unref(job->tail);
+    g_free(job);
+}
+
+static gboolean write_all(int fd, const guint8 *data, gsize len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return FALSE;
+        }
+        data += written;
+        len -= written;
+    }
+    return TRUE;
+}
+
+// Makes the entries of `dir` durable, such as a file just renamed into it.
+static void sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0) fprintf(stderr, "Error syncing directory %s: %s\n", dir, g_strerror(errno));
+    if (fd >= 0) close(fd);
+}
+
+static gboolean write_atomically(const char *path, GBytes *contents, GByteArray *tail) {
+    char *dir = g_path_get_dirname(path);
+    char *base = g_path_get_basename(path);
+    char *tmp_name = g_strdup_printf(".%s.tmp", base);
+    char *tmp_path = g_build_filename(dir, tmp_name, NULL);
+    gboolean ok = FALSE;
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        gsize len = 0;
+        const guint8 *data = contents ? g_bytes_get_data(contents, &len) : NULL;
+        ok = write_all(fd, data, len) && (!tail || write_all(fd, tail->data, tail->len)) && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(tmp_path, path) == 0;
+        if (!ok) unlink(tmp_path);
+    }
+    if (ok) {
+        sync_dir(dir);
+    } else {
+        fprintf(stderr, "Error writing %s: %s\n", path, g_strerror(errno));
+    }
+
+    g_free(tmp_path);
+    g_free(tmp_name);
+    g_free(base);
+    g_free(dir);
+    return ok;
+}
+
+static gboolean append_to_file(const char *path, GByteArray *data) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    gboolean ok = fd >= 0 && write_all(fd, data->data, data->len) && fdatasync(fd) == 0;
+    if (!ok) fprintf(stderr, "Error appending to %s: %s\n", path, g_strerror(errno));
+    if (fd >= 0) close(fd);
+    return ok;
+}
+
+static void empty_file(const char *path) {
+    int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) fprintf(stderr, "Error truncating %s: %s\n", path, g_strerror(errno));
+        return;
+    }
+    fsync(fd);
+    close(fd);
+}
+
+static void run_job(PersistJob *job) {
+    TraceSpan *span = trace_span_begin(persist_track, "persist",
+                                       job->kind == JOB_APPEND ? "append" : job->kind == JOB_REMOVE ? "remove" :
+                                       job->kind == JOB_CALL ? "call" : "write");
+    trace_span_add_string(span, "path", job->path);
+    switch (job->kind) {
+        case JOB_WRITE:
+            write_atomically(job->path, job->contents, job->tail);
+            break;
+        case JOB_APPEND:
+            append_to_file(job->path, job->tail);
+            break;
+        case JOB_COMPACT:
+            if (write_atomically(job->path, job->contents, NULL)) {
+                empty_file(job->journal_path);
+            }
+            break;
+        case JOB_REMOVE:
+            if (unlink(job->path) != 0 && errno != ENOENT) {
+                fprintf(stderr, "Error removing %s: %s\n", job->path, g_strerror(errno));
+            }
+            break;
+        case JOB_CALL:
+            job->func(job->data);
+            break;
+    }
+    trace_span_end(span);
+}
+
+static void forget_job(PersistJob *job) {
+    if (g_hash_table_lookup(pending_by_path, job->path) == job) {
+        g_hash_table_remove(pending_by_path, job->path);
+    }
+    if (job->journal_path && g_hash_table_lookup(pending_by_path, job->journal_path) == job) {
+        g_hash_table_remove(pending_by_path, job->journal_path);
+    }
+}
+
+static gpointer persist_thread_func(gpointer data) {
+    (void)data;
+    g_mutex_lock(&persist_lock);
+    for (;;) {
+        while (g_queue_is_empty(&persist_queue) && !quitting) {
+            g_cond_wait(&persist_cond, &persist_lock);
+        }
+        PersistJob *job = g_queue_pop_head(&persist_queue);
+        if (!job) break;
+        forget_job(job);
+        g_mutex_unlock(&persist_lock);
+
+        run_job(job);
+        free_job(job);
+
+        g_mutex_lock(&persist_lock);
+        jobs_done++;
+        g_cond_broadcast(&persist_cond);
+    }
+    g_mutex_unlock(&persist_lock);
+    return NULL;
+}
+
+static void enqueue(PersistJob *job) {
+    g_mutex_lock(&persist_lock);
+    g_queue_push_tail(&persist_queue, job);
+    // Replace rather than insert, so that the keys are this job's strings
+    g_hash_table_replace(pending_by_path, job->path, job);
+    if (job->journal_path) g_hash_table_replace(pending_by_path, job->journal_path, job);
+    jobs_queued++;
+    g_cond_broadcast(&persist_cond);
+    g_mutex_unlock(&persist_lock);
+}
+
+static PersistJob *new_job(JobKind kind, const char *path) {
+    PersistJob *job = g_new0(PersistJob, 1);
+    job->kind = kind;
+    job->path = g_strdup(path);
+    return job;
+}
+
+// --- Public Functions ---
+
+void persist_init(void) {
+    pending_by_path = g_hash_table_new(g_str_hash, g_str_equal);
+    persist_track = trace_new_track("persist");
+    persist_thread = g_thread_new("persist", persist_thread_func, NULL);
+}
+
+// Finishes every queued write, then stops the thread.
+void persist_shutdown(void) {
+    if (!persist_thread) return;
+    g_mutex_lock(&persist_lock);
+    quitting = TRUE;
+    g_cond_broadcast(&persist_cond);
+    g_mutex_unlock(&persist_lock);
+    g_thread_join(persist_thread);
+    persist_thread = NULL;
+    g_clear_pointer(&pending_by_path, g_hash_table_unref);
+}
+
+// Waits until everything queued so far is on disk. Unlike the other
+// functions, this may be called from any thread, as it only reads the
+// queue's counters under the lock; but not from a persist_call() func on
+// the writer thread, which would then wait on itself forever.
+void persist_flush(void) {
+    g_mutex_lock(&persist_lock);
+    guint64 target = jobs_queued;
+    while (jobs_done < target) {
+        g_cond_wait(&persist_cond, &persist_lock);
+    }
+    g_mutex_unlock(&persist_lock);
+}
+
+// Replaces the contents of `path`.
+void persist_write(const char *path, GBytes *contents) {
+    g_mutex_lock(&persist_lock);
+    PersistJob *pending = g_hash_table_lookup(pending_by_path, path);
+    if (pending && pending->kind != JOB_COMPACT && pending->kind != JOB_CALL) {
+        pending->kind = JOB_WRITE;
+        if (pending->contents) g_bytes_unref(pending->contents);
+        pending->contents = g_bytes_ref(contents);
+        g_clear_pointer(&pending->tail, g_byte_array_unref);
+        g_mutex_unlock(&persist_lock);
+        return;
+    }
+    g_mutex_unlock(&persist_lock);
+
+    PersistJob *job = new_job(JOB_WRITE, path);
+    job->contents = g_bytes_ref(contents);
+    enqueue(job);
+}
+
+// Appends `data` to `path`, creating it if needed.
+void persist_append(const char *path, GBytes *data) {
+    gsize len = 0;
+    const guint8 *bytes = g_bytes_get_data(data, &len);
+    g_mutex_lock(&persist_lock);
+    PersistJob *pending = g_hash_table_lookup(pending_by_path, path);
+    if (pending && pending->kind != JOB_COMPACT && pending->kind != JOB_REMOVE && pending->kind != JOB_CALL) {
+        if (!pending->tail) pending->tail = g_byte_array_new();
+        g_byte_array_append(pending->tail, bytes, len);
+        g_mutex_unlock(&persist_lock);
+        return;
+    }
+    g_mutex_unlock(&persist_lock);
+
+    PersistJob *job = new_job(JOB_APPEND, path);
+    job->tail = g_byte_array_sized_new(len);
+    g_byte_array_append(job->tail, bytes, len);
+    enqueue(job);
+}
+
+// Replaces `path` with `contents`, then empties `journal_path`, whose
+// records `contents` already includes.
+void persist_compact(const char *path, GBytes *contents, const char *journal_path) {
+    PersistJob *job = new_job(JOB_COMPACT, path);
+    job->contents = g_bytes_ref(contents);
+    job->journal_path = g_strdup(journal_path);
+    enqueue(job);
+}
+
+// Removes `path`, after the writes queued before.
+void persist_remove(const char *path) {
+    enqueue(new_job(JOB_REMOVE, path));
+}
+
+/**
+ * Runs `func(data)` on the writer thread once the jobs queued before are
+ * done. Writes to `path` or `other_path` (which may be NULL) queued after
+ * are not merged into earlier ones, so `func` can read and repair those
+ * files without the main loop waiting on the disk.
+ */
+void persist_call(const char *path, const char *other_path, PersistFunc func, gpointer data) {
+    PersistJob *job = new_job(JOB_CALL, path);
+    job->journal_path = g_strdup(other_path);
+    job->func = func;
+    job->data = data;
+    enqueue(job);
+}
@@ -0,0 +1,21 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <glib.h>
+
+// File writes done on a background thread, in the order they were queued
+// for any one file. All functions are called from the main thread, except
+// persist_flush(), which other threads may call as well.
+typedef void (*PersistFunc)(gpointer data);
+
+void persist_init(void);
+void persist_shutdown(void);
+void persist_flush(void);
+
+void persist_write(const char *path, GBytes *contents);
+void persist_append(const char *path, GBytes *data);
+void persist_compact(const char *path, GBytes *contents, const char *journal_path);
+void persist_remove(const char *path);
+void persist_call(const char *path, const char *other_path, PersistFunc func, gpointer data);
+
+#endif // PERSIST_H
@@ -0,0 +1,393 @@
+#include <string.h>
+#include "stream_decoder.h"
+
+/**
+ * Incremental decoder for the NDJSON stream returned by /api/chat.
+ *
+ * Complete lines are scanned in place from the curl chunk; only a trailing
+ * partial line is copied, into a buffer that grows as needed. The scanner
+ * knows the shape of Ollama's chunks and only extracts `message.content`,
+ * `done` and the timing counters, skipping everything else without building
+ * a DOM. A multi-byte UTF-8 sequence split across two chunks is held back
+ * and completed by the next one instead of being replaced.
+ */
+struct StreamDecoder {
+    GString *line;       // partial line carried over between chunks
+    GString *content;    // unescaped content of the current line
+    GString *repaired;   // scratch buffer used only for invalid UTF-8
+    char utf8_tail[4];
+    gsize utf8_tail_len;
+    StreamStats stats;
+    StreamContentFunc content_func;
+    StreamDoneFunc done_func;
+    gpointer user_data;
+};
+
+typedef struct {
+    const char *p;
+    const char *end;
+} Scanner;
+
+// --- Scanner Helpers ---
+
+static void skip_ws(Scanner *s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\r' || *s->p == '\n')) {
+        s->p++;
+    }
+}
+
+static gboolean expect(Scanner *s, char c) {
+    skip_ws(s);
+    if (s->p < s->end && *s->p == c) {
+        s->p++;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Reads a string without unescaping it. Used for object keys.
+static gboolean scan_raw_string(Scanner *s, const char **start, gsize *len) {
+    if (!expect(s, '"')) return FALSE;
+    *start = s->p;
+    while (s->p < s->end && *s->p != '"') {
+        if (*s->p == '\\') s->p++;
+        s->p++;
+    }
+    if (s->p >= s->end) return FALSE;
+    *len = s->p - *start;
+    s->p++;
+    return TRUE;
+}
+
+static gboolean key_equals(const char *key, gsize len, const char *name) {
+    return strlen(name) == len && memcmp(key, name, len) == 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static gboolean scan_hex4(Scanner *s, gunichar *out) {
+    if (s->end - s->p < 4) return FALSE;
+    gunichar value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_value(s->p[i]);
+        if (digit < 0) return FALSE;
+        value = (value << 4) | digit;
+    }
+    s->p += 4;
+    *out = value;
+    return TRUE;
+}
+
+// Appends the unescaped value of a JSON string to `out`.
+static gboolean scan_string(Scanner *s, GString *out) {
+    if (!expect(s, '"')) return FALSE;
+    while (s->p < s->end) {
+        const char *run = s->p;
+        while (s->p < s->end && *s->p != '"' && *s->p != '\\') {
+            s->p++;
+        }
+        if (s->p > run) {
+            g_string_append_len(out, run, s->p - run);
+        }
+        if (s->p >= s->end) return FALSE;
+        if (*s->p == '"') {
+            s->p++;
+            return TRUE;
+        }
+        s->p++; // backslash
+        if (s->p >= s->end) return FALSE;
+        char c = *s->p++;
+        switch (c) {
+            case '"': g_string_append_c(out, '"'); break;
+            case '\\': g_string_append_c(out, '\\'); break;
+            case '/': g_string_append_c(out, '/'); break;
+            case 'b': g_string_append_c(out, '\b'); break;
+            case 'f': g_string_append_c(out, '\f'); break;
+            case 'n': g_string_append_c(out, '\n'); break;
+            case 'r': g_string_append_c(out, '\r'); break;
+            case 't': g_string_append_c(out, '\t'); break;
+            case 'u': {
+                gunichar cp;
+                if (!scan_hex4(s, &cp)) return FALSE;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    gunichar low;
+                    Scanner peek = *s;
+                    if (peek.end - peek.p >= 6 && peek.p[0] == '\\' && peek.p[1] == 'u') {
+                        peek.p += 2;
+                        if (scan_hex4(&peek, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+                            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                            *s = peek;
+                        } else {
+                            cp = 0xFFFD;
+                        }
+                    } else {
+                        cp = 0xFFFD;
+                    }
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    cp = 0xFFFD;
+                }
+                g_string_append_unichar(out, cp);
+                break;
+            }
+            default:
+                return FALSE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean skip_value(Scanner *s) {
+    skip_ws(s);
+    if (s->p >= s->end) return FALSE;
+    if (*s->p == '"') {
+        const char *start;
+        gsize len;
+        return scan_raw_string(s, &start, &len);
+    }
+    if (*s->p == '{' || *s->p == '[') {
+        int depth = 0;
+        while (s->p < s->end) {
+            char c = *s->p;
+            if (c == '"') {
+                const char *start;
+                gsize len;
+                if (!scan_raw_string(s, &start, &len)) return FALSE;
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                depth--;
+                if (depth == 0) {
+                    s->p++;
+                    return TRUE;
+                }
+            }
+            s->p++;
+        }
+        return FALSE;
+    }
+    // Number or literal
+    while (s->p < s->end && *s->p != ',' && *s->p != '}' && *s->p != ']' &&
+           *s->p != ' ' && *s->p != '\t' && *s->p != '\r' && *s->p != '\n') {
+        s->p++;
+    }
+    return TRUE;
+}
+
+static gboolean scan_int64(Scanner *s, gint64 *out) {
+    skip_ws(s);
+    char buffer[32];
+    gsize len = 0;
+    while (s->p < s->end && len < sizeof(buffer) - 1 &&
+           ((*s->p >= '0' && *s->p <= '9') || *s->p == '-' || *s->p == '+' ||
+            *s->p == '.' || *s->p == 'e' || *s->p == 'E')) {
+        buffer[len++] = *s->p++;
+    }
+    if (len == 0) return FALSE;
+    buffer[len] = '\0';
+    *out = g_ascii_strtoll(buffer, NULL, 10);
+    return TRUE;
+}
+
+static gboolean scan_boolean(Scanner *s, gboolean *out) {
+    skip_ws(s);
+    if (s->end - s->p >= 4 && memcmp(s->p, "true", 4) == 0) {
+        s->p += 4;
+        *out = TRUE;
+        return TRUE;
+    }
+    if (s->end - s->p >= 5 && memcmp(s->p, "false", 5) == 0) {
+        s->p += 5;
+        *out = FALSE;
+        return TRUE;
+    }
+    return skip_value(s);
+}
+
+// Iterates over the members of an object, leaving the scanner on each value.
+static gboolean next_member(Scanner *s, gboolean *first, const char **key, gsize *key_len) {
+    skip_ws(s);
+    if (s->p >= s->end) return FALSE;
+    if (*s->p == '}') {
+        s->p++;
+        return FALSE;
+    }
+    if (!*first && !expect(s, ',')) return FALSE;
+    *first = FALSE;
+    if (!scan_raw_string(s, key, key_len)) return FALSE;
+    return expect(s, ':');
+}
+
+// --- UTF-8 Handling ---
+
+// Length of an incomplete but so far valid multi-byte sequence at the end of `s`.
+static gsize incomplete_utf8_tail(const char *s, gsize len) {
+    gsize max = MIN(len, 3);
+    for (gsize back = 1; back <= max; back++) {
+        guchar c = (guchar)s[len - back];
+        if ((c & 0xC0) == 0x80) continue; // continuation byte
+        gsize expected = (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+        return expected > back ? back : 0;
+    }
+    return 0;
+}
+
+static void emit_content(StreamDecoder *decoder, const char *text, gsize len) {
+    if (len == 0 || !decoder->content_func) return;
+    const char *invalid;
+    if (g_utf8_validate_len(text, len, &invalid)) {
+        decoder->content_func(text, len, decoder->user_data);
+        return;
+    }
+    GString *repaired = decoder->repaired;
+    g_string_truncate(repaired, 0);
+    const char *p = text;
+    const char *end = text + len;
+    while (p < end) {
+        if (g_utf8_validate_len(p, end - p, &invalid)) {
+            g_string_append_len(repaired, p, end - p);
+            break;
+        }
+        g_string_append_len(repaired, p, invalid - p);
+        g_string_append(repaired, "\xEF\xBF\xBD");
+        p = invalid + 1;
+    }
+    decoder->content_func(repaired->str, repaired->len, decoder->user_data);
+}
+
+static void flush_content(StreamDecoder *decoder, gboolean final) {
+    GString *content = decoder->content;
+    gsize tail = final ? 0 : incomplete_utf8_tail(content->str, content->len);
+    emit_content(decoder, content->str, content->len - tail);
+    memcpy(decoder->utf8_tail, content->str + content->len - tail, tail);
+    decoder->utf8_tail_len = tail;
+}
+
+// --- Line Decoding ---
+
+static void decode_message(StreamDecoder *decoder, Scanner *s) {
+    if (!expect(s, '{')) {
+        skip_value(s);
+        return;
+    }
+    gboolean first = TRUE;
+    const char *key;
+    gsize key_len;
+    while (next_member(s, &first, &key, &key_len)) {
+        if (key_equals(key, key_len, "content")) {
+            if (!scan_string(s, decoder->content)) return;
+        } else if (!skip_value(s)) {
+            return;
+        }
+    }
+}
+
+static void decode_line(StreamDecoder *decoder, const char *line, gsize len) {
+    Scanner s = {line, line + len};
+    skip_ws(&s);
+    if (s.p >= s.end) return;
+    if (!expect(&s, '{')) {
+        g_printerr("Unexpected line in chat stream\n");
+        return;
+    }
+
+    g_string_truncate(decoder->content, 0);
+    g_string_append_len(decoder->content, decoder->utf8_tail, decoder->utf8_tail_len);
+    decoder->utf8_tail_len = 0;
+
+    StreamStats *stats = &decoder->stats;
+    gboolean first = TRUE;
+    const char *key;
+    gsize key_len;
+    while (next_member(&s, &first, &key, &key_len)) {
+        gboolean ok;
+        if (key_equals(key, key_len, "message")) {
+            decode_message(decoder, &s);
+            ok = TRUE;
+        } else if (key_equals(key, key_len, "done")) {
+            ok = scan_boolean(&s, &stats->done);
+        } else if (key_equals(key, key_len, "total_duration")) {
+            ok = scan_int64(&s, &stats->total_duration);
+        } else if (key_equals(key, key_len, "load_duration")) {
+            ok = scan_int64(&s, &stats->load_duration);
+        } else if (key_equals(key, key_len, "prompt_eval_count")) {
+            ok = scan_int64(&s, &stats->prompt_eval_count);
+        } else if (key_equals(key, key_len, "prompt_eval_duration")) {
+            ok = scan_int64(&s, &stats->prompt_eval_duration);
+        } else if (key_equals(key, key_len, "eval_count")) {
+            ok = scan_int64(&s, &stats->eval_count);
+        } else if (key_equals(key, key_len, "eval_duration")) {
+            ok = scan_int64(&s, &stats->eval_duration);
+        } else {
+            ok = skip_value(&s);
+        }
+        if (!ok) break;
+    }
+
+    flush_content(decoder, stats->done);
+    if (stats->done && decoder->done_func) {
+        decoder->done_func(stats, decoder->user_data);
+    }
+}
+
+// --- Public Functions ---
+
+StreamDecoder *stream_decoder_new(StreamContentFunc content_func, StreamDoneFunc done_func, gpointer user_data) {
+    StreamDecoder *decoder = g_new0(StreamDecoder, 1);
+    decoder->line = g_string_sized_new(1024);
+    decoder->content = g_string_sized_new(256);
+    decoder->repaired = g_string_new("");
+    decoder->content_func = content_func;
+    decoder->done_func = done_func;
+    decoder->user_data = user_data;
+    return decoder;
+}
+
+void stream_decoder_feed(StreamDecoder *decoder, const char *data, gsize len) {
+    const char *p = data;
+    const char *end = data + len;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        if (!newline) {
+            g_string_append_len(decoder->line, p, end - p);
+            break;
+        }
+        if (decoder->line->len > 0) {
+            g_string_append_len(decoder->line, p, newline - p);
+            decode_line(decoder, decoder->line->str, decoder->line->len);
+            g_string_truncate(decoder->line, 0);
+        } else {
+            decode_line(decoder, p, newline - p);
+        }
+        p = newline + 1;
+    }
+}
+
+// Decodes a last line that was not terminated by a newline.
+void stream_decoder_finish(StreamDecoder *decoder) {
+    if (decoder->line->len > 0) {
+        decode_line(decoder, decoder->line->str, decoder->line->len);
+        g_string_truncate(decoder->line, 0);
+    }
+}
+
+void stream_decoder_reset(StreamDecoder *decoder) {
+    g_string_truncate(decoder->line, 0);
+    g_string_truncate(decoder->content, 0);
+    decoder->utf8_tail_len = 0;
+    memset(&decoder->stats, 0, sizeof(decoder->stats));
+}
+
+void stream_decoder_free(StreamDecoder *decoder) {
+    if (!decoder) return;
+    g_string_free(decoder->line, TRUE);
+    g_string_free(decoder->content, TRUE);
+    g_string_free(decoder->repaired, TRUE);
+    g_free(decoder);
+}
@@ -0,0 +1,30 @@
+#ifndef STREAM_DECODER_H
+#define STREAM_DECODER_H
+
+#include <glib.h>
+
+// Fields of the final `done` chunk of an /api/chat stream. Durations are in
+// nanoseconds, as reported by Ollama; missing fields are left at 0.
+typedef struct {
+    gboolean done;
+    gint64 total_duration;
+    gint64 load_duration;
+    gint64 prompt_eval_count;
+    gint64 prompt_eval_duration;
+    gint64 eval_count;
+    gint64 eval_duration;
+} StreamStats;
+
+// `text` is valid UTF-8 but not NUL-terminated; it is only valid during the call.
+typedef void (*StreamContentFunc)(const char *text, gsize len, gpointer user_data);
+typedef void (*StreamDoneFunc)(const StreamStats *stats, gpointer user_data);
+
+typedef struct StreamDecoder StreamDecoder;
+
+StreamDecoder *stream_decoder_new(StreamContentFunc content_func, StreamDoneFunc done_func, gpointer user_data);
+void stream_decoder_feed(StreamDecoder *decoder, const char *data, gsize len);
+void stream_decoder_finish(StreamDecoder *decoder);
+void stream_decoder_reset(StreamDecoder *decoder);
+void stream_decoder_free(StreamDecoder *decoder);
+
+#endif // STREAM_DECODER_H
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "trace.h"
+#include "json_util.h"
+
+/**
+ * Events are kept in memory as JSON fragments and written once, in the
+ * Trace Event Format read by chrome://tracing and ui.perfetto.dev, by
+ * trace_shutdown(). A track is a "thread" of the trace: spans on one track
+ * must nest, so concurrent requests each get their own track. Track 1 is
+ * the main loop.
+ */
+struct TraceSpan {
+    int track;
+    char *category;
+    char *name;
+    gint64 start;
+    GString *args;
+};
+
+static GMutex trace_lock;
+static GString *trace_events = NULL;
+static char *trace_path = NULL;
+static gint64 trace_origin = 0;
+static gint next_track = 1;
+
+// --- Private Helper Functions ---
+
+// Appends one event; `args` (JSON object members) may be NULL.
+static void append_event(char phase, int track, const char *category, const char *name,
+                         gint64 start, gint64 duration, const char *args) {
+    g_mutex_lock(&trace_lock);
+    if (trace_events->len > 0) g_string_append(trace_events, ",\n");
+    g_string_append_printf(trace_events, "{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%" G_GINT64_FORMAT,
+                           phase, (int)getpid(), track, start);
+    if (phase == 'X') {
+        g_string_append_printf(trace_events, ",\"dur\":%" G_GINT64_FORMAT, duration);
+    } else if (phase == 'i') {
+        g_string_append(trace_events, ",\"s\":\"t\"");
+    }
+    g_string_append(trace_events, ",\"cat\":");
+    json_util_append_string(trace_events, category, -1);
+    g_string_append(trace_events, ",\"name\":");
+    json_util_append_string(trace_events, name, -1);
+    if (args) {
+        g_string_append_printf(trace_events, ",\"args\":{%s}", args);
+    }
+    g_string_append_c(trace_events, '}');
+    g_mutex_unlock(&trace_lock);
+}
+
+static void add_key(TraceSpan *span, const char *key) {
+    if (span->args->len > 0) g_string_append_c(span->args, ',');
+    json_util_append_string(span->args, key, -1);
+    g_string_append_c(span->args, ':');
+}
+
+// --- Public Functions ---
+
+void trace_init(void) {
+    const char *path = g_getenv("OLLAMA_CHAT_TRACE");
+    if (!path || !*path) return;
+    trace_path = g_strdup(path);
+    trace_events = g_string_new(NULL);
+    trace_origin = g_get_monotonic_time();
+    trace_new_track("main loop");
+}
+
+// Writes the trace file. Spans still open are dropped.
+void trace_shutdown(void) {
+    if (!trace_events) return;
+    GString *json = g_string_new("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    g_mutex_lock(&trace_lock);
+    g_string_append_len(json, trace_events->str, trace_events->len);
+    g_mutex_unlock(&trace_lock);
+    g_string_append(json, "\n]}\n");
+    GError *error = NULL;
+    if (!g_file_set_contents(trace_path, json->str, json->len, &error)) {
+        fprintf(stderr, "Error writing trace %s: %s\n", trace_path, error->message);
+        g_error_free(error);
+    }
+    g_string_free(json, TRUE);
+    g_string_free(trace_events, TRUE);
+    trace_events = NULL;
+    g_clear_pointer(&trace_path, g_free);
+}
+
+gboolean trace_enabled(void) {
+    return trace_events != NULL;
+}
+
+gint64 trace_now(void) {
+    return g_get_monotonic_time() - trace_origin;
+}
+
+// Allocates a track; `name` (may be NULL) is shown in the trace viewer.
+int trace_new_track(const char *name) {
+    if (!trace_events) return 0;
+    int track = g_atomic_int_add(&next_track, 1);
+    if (name) trace_set_track_name(track, name);
+    return track;
+}
+
+void trace_set_track_name(int track, const char *name) {
+    if (!trace_events || track <= 0) return;
+    GString *args = g_string_new("\"name\":");
+    json_util_append_string(args, name, -1);
+    append_event('M', track, "__metadata", "thread_name", 0, 0, args->str);
+    g_string_free(args, TRUE);
+}
+
+TraceSpan *trace_span_begin(int track, const char *category, const char *name) {
+    if (!trace_events) return NULL;
+    TraceSpan *span = g_new0(TraceSpan, 1);
+    span->track = track > 0 ? track : 1;
+    span->category = g_strdup(category);
+    span->name = g_strdup(name);
+    span->start = trace_now();
+    span->args = g_string_new(NULL);
+    return span;
+}
+
+void trace_span_add_int(TraceSpan *span, const char *key, gint64 value) {
+    if (!span) return;
+    add_key(span, key);
+    g_string_append_printf(span->args, "%" G_GINT64_FORMAT, value);
+}
+
+void trace_span_add_double(TraceSpan *span, const char *key, double value) {
+    if (!span) return;
+    add_key(span, key);
+    json_util_append_double(span->args, value);
+}
+
+void trace_span_add_string(TraceSpan *span, const char *key, const char *value) {
+    if (!span) return;
+    add_key(span, key);
+    json_util_append_string(span->args, value ? value : "", -1);
+}
+
+gint64 trace_span_get_start(TraceSpan *span) {
+    return span ? span->start : 0;
+}
+
+// Records the span and frees it.
+void trace_span_end(TraceSpan *span) {
+    if (!span) return;
+    append_event('X', span->track, span->category, span->name, span->start, trace_now() - span->start,
+                 span->args->len > 0 ? span->args->str : NULL);
+    g_free(span->category);
+    g_free(span->name);
+    g_string_free(span->args, TRUE);
+    g_free(span);
+}
+
+void trace_complete(int track, const char *category, const char *name, gint64 start, gint64 duration) {
+    if (!trace_events) return;
+    append_event('X', track > 0 ? track : 1, category, name, start, duration, NULL);
+}
+
+void trace_instant(int track, const char *category, const char *name) {
+    if (!trace_events) return;
+    append_event('i', track > 0 ? track : 1, category, name, trace_now(), 0, NULL);
+}
@@ -0,0 +1,30 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+// Chrome/Perfetto trace output, enabled by setting OLLAMA_CHAT_TRACE to the
+// path of the JSON file to write at exit. When tracing is off,
+// trace_span_begin() returns NULL and every other call is a no-op.
+typedef struct TraceSpan TraceSpan;
+
+void trace_init(void);
+void trace_shutdown(void);
+gboolean trace_enabled(void);
+gint64 trace_now(void);
+int trace_new_track(const char *name);
+void trace_set_track_name(int track, const char *name);
+
+TraceSpan *trace_span_begin(int track, const char *category, const char *name);
+void trace_span_add_int(TraceSpan *span, const char *key, gint64 value);
+void trace_span_add_double(TraceSpan *span, const char *key, double value);
+void trace_span_add_string(TraceSpan *span, const char *key, const char *value);
+gint64 trace_span_get_start(TraceSpan *span);
+void trace_span_end(TraceSpan *span);
+
+// A span whose start and duration (in µs on the trace_now() clock) are
+// known only after the fact, e.g. from curl timings.
+void trace_complete(int track, const char *category, const char *name, gint64 start, gint64 duration);
+void trace_instant(int track, const char *category, const char *name);
+
+#endif // TRACE_H
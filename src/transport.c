@@ -0,0 +1,248 @@
+#include "transport.h"
+#include "trace.h"
+
+/**
+ * The multi handle keeps its connection cache across transfers, so requests
+ * to Ollama reuse an open keep-alive connection instead of reconnecting.
+ *
+ * Sockets curl wants watched are added to one GSource with
+ * g_source_add_unix_fd(); curl's timer maps to the source's ready time.
+ */
+typedef struct {
+    GSource source;
+    Transport *transport;
+} TransportSource;
+
+struct Transport {
+    CURLM *multi;
+    GSource *source;
+    GHashTable *sockets; // fd -> g_source_add_unix_fd() tag
+    GHashTable *requests; // running TransportRequest set
+};
+
+struct TransportRequest {
+    CURL *easy;
+    TransportDoneFunc done_func;
+    gpointer user_data;
+    int track;
+    TraceSpan *span;
+};
+
+typedef struct {
+    curl_socket_t fd;
+    int mask;
+} ReadySocket;
+
+// --- Private Helper Functions ---
+
+// Breaks the request down into curl's phases, all measured from its start.
+static void trace_request(TransportRequest *request, CURLcode result) {
+    CURL *easy = request->easy;
+    curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0, first_byte = 0;
+    long status = 0;
+    char *url = NULL;
+    curl_easy_getinfo(easy, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(easy, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(easy, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url);
+
+    gint64 start = trace_span_get_start(request->span);
+    int track = request->track;
+    if (dns > 0) trace_complete(track, "http", "dns", start, dns);
+    if (connect > dns) trace_complete(track, "http", "connect", start + dns, connect - dns);
+    if (tls > connect) trace_complete(track, "http", "tls", start + connect, tls - connect);
+    if (first_byte > pretransfer) trace_complete(track, "http", "ttfb", start + pretransfer, first_byte - pretransfer);
+
+    trace_set_track_name(track, url ? url : "request");
+    trace_span_add_string(request->span, "url", url);
+    trace_span_add_int(request->span, "status", status);
+    trace_span_add_string(request->span, "result", curl_easy_strerror(result));
+    trace_span_end(request->span);
+    request->span = NULL;
+}
+
+// Detaches a request from the multi handle, reports it and frees it.
+static void finish_request(Transport *transport, TransportRequest *request, CURLcode result) {
+    curl_multi_remove_handle(transport->multi, request->easy);
+    g_hash_table_remove(transport->requests, request);
+    if (request->done_func) {
+        request->done_func(request->easy, result, request->user_data);
+    }
+    // After the callback, so spans the caller opened on this track nest inside.
+    if (request->span) {
+        trace_request(request, result);
+    }
+    curl_easy_cleanup(request->easy);
+    g_free(request);
+}
+
+static void check_multi_info(Transport *transport) {
+    CURLMsg *msg;
+    int pending;
+    while ((msg = curl_multi_info_read(transport->multi, &pending))) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURLcode result = msg->data.result;
+        TransportRequest *request = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&request);
+        finish_request(transport, request, result);
+    }
+}
+
+static void socket_action(Transport *transport, curl_socket_t fd, int mask) {
+    int running;
+    curl_multi_socket_action(transport->multi, fd, mask, &running);
+}
+
+static gboolean transport_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+    (void)callback; (void)user_data;
+    Transport *transport = ((TransportSource *)source)->transport;
+
+    gint64 ready_time = g_source_get_ready_time(source);
+    if (ready_time != -1 && ready_time <= g_source_get_time(source)) {
+        g_source_set_ready_time(source, -1);
+        socket_action(transport, CURL_SOCKET_TIMEOUT, 0);
+    }
+
+    // Collect first: socket_action() may add or remove watched sockets.
+    GArray *ready = g_array_new(FALSE, FALSE, sizeof(ReadySocket));
+    GHashTableIter iter;
+    gpointer key, tag;
+    g_hash_table_iter_init(&iter, transport->sockets);
+    while (g_hash_table_iter_next(&iter, &key, &tag)) {
+        GIOCondition revents = g_source_query_unix_fd(source, tag);
+        if (!revents) continue;
+        ReadySocket socket = {.fd = GPOINTER_TO_INT(key), .mask = 0};
+        if (revents & G_IO_IN) socket.mask |= CURL_CSELECT_IN;
+        if (revents & G_IO_OUT) socket.mask |= CURL_CSELECT_OUT;
+        if (revents & (G_IO_ERR | G_IO_HUP)) socket.mask |= CURL_CSELECT_ERR;
+        g_array_append_val(ready, socket);
+    }
+    for (guint i = 0; i < ready->len; i++) {
+        ReadySocket *socket = &g_array_index(ready, ReadySocket, i);
+        socket_action(transport, socket->fd, socket->mask);
+    }
+    g_array_unref(ready);
+
+    check_multi_info(transport);
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs transport_source_funcs = {
+    .dispatch = transport_source_dispatch,
+};
+
+static int socket_callback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp) {
+    (void)easy; (void)socketp;
+    Transport *transport = userp;
+    gpointer key = GINT_TO_POINTER(fd);
+    gpointer tag = g_hash_table_lookup(transport->sockets, key);
+
+    if (what == CURL_POLL_REMOVE) {
+        if (tag) {
+            g_source_remove_unix_fd(transport->source, tag);
+            g_hash_table_remove(transport->sockets, key);
+        }
+        return 0;
+    }
+
+    GIOCondition condition = G_IO_ERR | G_IO_HUP;
+    if (what & CURL_POLL_IN) condition |= G_IO_IN;
+    if (what & CURL_POLL_OUT) condition |= G_IO_OUT;
+    if (tag) {
+        g_source_modify_unix_fd(transport->source, tag, condition);
+    } else {
+        tag = g_source_add_unix_fd(transport->source, fd, condition);
+        g_hash_table_insert(transport->sockets, key, tag);
+    }
+    return 0;
+}
+
+static int timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    (void)multi;
+    Transport *transport = userp;
+    if (timeout_ms < 0) {
+        g_source_set_ready_time(transport->source, -1);
+    } else {
+        g_source_set_ready_time(transport->source, g_get_monotonic_time() + (gint64)timeout_ms * 1000);
+    }
+    return 0;
+}
+
+// --- Public Functions ---
+
+Transport *transport_new(void) {
+    Transport *transport = g_new0(Transport, 1);
+    transport->multi = curl_multi_init();
+    transport->sockets = g_hash_table_new(g_direct_hash, g_direct_equal);
+    transport->requests = g_hash_table_new(g_direct_hash, g_direct_equal);
+    transport->source = g_source_new(&transport_source_funcs, sizeof(TransportSource));
+    ((TransportSource *)transport->source)->transport = transport;
+    g_source_set_name(transport->source, "transport");
+    g_source_attach(transport->source, NULL);
+
+    curl_multi_setopt(transport->multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(transport->multi, CURLMOPT_SOCKETDATA, transport);
+    curl_multi_setopt(transport->multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(transport->multi, CURLMOPT_TIMERDATA, transport);
+    return transport;
+}
+
+// Transfers still running are cancelled: their done callbacks get
+// CURLE_ABORTED_BY_CALLBACK before this returns.
+void transport_free(Transport *transport) {
+    if (!transport) return;
+    // Requests still running end as cancelled, so that their owners free
+    // what they passed as user_data.
+    while (g_hash_table_size(transport->requests) > 0) {
+        GHashTableIter iter;
+        gpointer key;
+        g_hash_table_iter_init(&iter, transport->requests);
+        g_hash_table_iter_next(&iter, &key, NULL);
+        finish_request(transport, key, CURLE_ABORTED_BY_CALLBACK);
+    }
+    g_hash_table_unref(transport->requests);
+    curl_multi_cleanup(transport->multi);
+    g_source_destroy(transport->source);
+    g_source_unref(transport->source);
+    g_hash_table_unref(transport->sockets);
+    g_free(transport);
+}
+
+/**
+ * Takes ownership of a configured easy handle and starts it. `done_func` is
+ * called from the main loop when the transfer ends, successfully or not.
+ */
+TransportRequest *transport_start(Transport *transport, CURL *easy, TransportDoneFunc done_func, gpointer user_data) {
+    TransportRequest *request = g_new0(TransportRequest, 1);
+    request->easy = easy;
+    request->done_func = done_func;
+    request->user_data = user_data;
+    if (trace_enabled()) {
+        request->track = trace_new_track(NULL); // named after the URL when done
+        request->span = trace_span_begin(request->track, "http", "request");
+    }
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, request);
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    g_hash_table_add(transport->requests, request);
+    curl_multi_add_handle(transport->multi, easy);
+    return request;
+}
+
+/**
+ * Aborts a running transfer at once, whether or not data is flowing: the
+ * handle leaves the multi stack and its connection is closed. `done_func` is
+ * called with CURLE_ABORTED_BY_CALLBACK before this returns. Must not be
+ * called from inside a curl callback.
+ */
+void transport_cancel(Transport *transport, TransportRequest *request) {
+    if (!g_hash_table_contains(transport->requests, request)) return;
+    finish_request(transport, request, CURLE_ABORTED_BY_CALLBACK);
+}
+
+// Trace track the request's spans are recorded on (0 when tracing is off).
+int transport_request_get_track(TransportRequest *request) {
+    return request ? request->track : 0;
+}
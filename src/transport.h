@@ -0,0 +1,22 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <glib.h>
+#include <curl/curl.h>
+
+// Single curl_multi engine driven by the GLib main loop. All callbacks,
+// including the easy handles' write callbacks, run on the main context.
+typedef struct Transport Transport;
+typedef struct TransportRequest TransportRequest;
+
+// Called once per transfer after it left the multi handle. The easy handle
+// is still valid (e.g. for curl_easy_getinfo) and is cleaned up afterwards.
+typedef void (*TransportDoneFunc)(CURL *easy, CURLcode result, gpointer user_data);
+
+Transport *transport_new(void);
+void transport_free(Transport *transport);
+TransportRequest *transport_start(Transport *transport, CURL *easy, TransportDoneFunc done_func, gpointer user_data);
+void transport_cancel(Transport *transport, TransportRequest *request);
+int transport_request_get_track(TransportRequest *request);
+
+#endif // TRANSPORT_H
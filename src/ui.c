@@ -40,7 +40,8 @@ void ui_build(GtkApplication *app, AppData *app_data) {
     g_signal_connect(app_data->model_dropdown, "notify::selected", G_CALLBACK(on_model_changed), app_data);
     
     GtkCssProvider *css_provider = gtk_css_provider_new();
-    const char *css = ".user-message { background: alpha(@accent_color, 0.1); }\n"
+    const char *css = ".chat-transcript, .chat-transcript > row { background: none; }\n"
+                     ".user-message { background: alpha(@accent_color, 0.1); }\n"
                      ".assistant-message { background: alpha(@theme_fg_color, 0.05); }\n"
                      ".success { color: @success_color; }\n"
                      ".error { color: @error_color; }\n"
@@ -1,8 +1,34 @@
 #include "ui_callbacks.h"
 #include "history.h"
 #include "ui.h"
-#include "markdown.h"
 #include "ui_chat_view.h"
+#include "chat_message_item.h"
+#include "conversation_model.h"
+#include "chat_session.h"
+#include "trace.h"
+#include "context_budget.h"
+#include "chat_summary.h"
+#include "ui_input.h"
+#include "model_warmup.h"
+#include "model_catalog.h"
+
+// Seconds between journal checkpoints of a streaming response
+#define RESPONSE_CHECKPOINT_INTERVAL 2
+
+// What the catalog knows of the current model, as the dropdown's tooltip.
+static void show_model_details(AppData *app_data) {
+    const ModelInfo *info = model_catalog_lookup(app_data->current_model);
+    GString *details = g_string_new(NULL);
+    if (info && info->parameter_size) g_string_append_printf(details, "%s parameters", info->parameter_size);
+    if (info && info->quantization_level) {
+        g_string_append_printf(details, "%s%s", details->len ? ", " : "", info->quantization_level);
+    }
+    if (info && info->context_length > 0) {
+        g_string_append_printf(details, "%s%d tokens of context", details->len ? ", " : "", info->context_length);
+    }
+    gtk_widget_set_tooltip_text(GTK_WIDGET(app_data->model_dropdown), details->len ? details->str : NULL);
+    g_string_free(details, TRUE);
+}
 
 void on_model_changed(GtkDropDown *dropdown, GParamSpec *pspec, gpointer user_data) {
     (void)pspec;
@@ -13,112 +39,143 @@ void on_model_changed(GtkDropDown *dropdown, GParamSpec *pspec, gpointer user_da
             g_free(app_data->current_model);
         }
         app_data->current_model = g_strdup(app_data->models[selected]);
+        show_model_details(app_data);
+        ui_input_update_context_usage(app_data);
+        model_warmup_start(app_data, app_data->current_model);
     }
 }
 
 
-typedef struct {
-    AppData *app_data;
-    char *text;
-} UpdateResponseData;
+static void render_response(ChatSession *session) {
+    AppData *app_data = session->app_data;
+    if (app_data->current_response_widget && chat_session_is_shown(session)) {
+        TraceSpan *span = trace_span_begin(1, "ui", "render");
+        trace_span_add_int(span, "bytes", session->response_buffer->len);
+        update_message_widget(app_data->current_response_widget,
+                              session->response_buffer->str, session->response_buffer->len);
+        trace_span_end(span);
+    }
+}
+
+// Renders whatever arrived since the last frame, once.
+static void flush_response(ChatSession *session) {
+    if (session->response_dirty) {
+        session->response_dirty = FALSE;
+        render_response(session);
+    }
+}
 
-static gboolean update_response_label_cb(gpointer data) {
-    UpdateResponseData *update_data = (UpdateResponseData *)data;
-    AppData *app_data = update_data->app_data;
-    char *text = update_data->text;
+static gboolean response_tick_cb(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
+    (void)widget; (void)frame_clock;
+    flush_response((ChatSession *)user_data);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean response_checkpoint_cb(gpointer user_data) {
+    history_checkpoint_response((ChatSession *)user_data);
+    return G_SOURCE_CONTINUE;
+}
 
-    if (app_data->current_response_label) {
-        g_string_append(app_data->response_buffer, text);
-        char *pango_markup = markdown_to_pango(app_data->response_buffer->str);
-        gtk_label_set_markup(GTK_LABEL(app_data->current_response_label), pango_markup);
-        g_free(pango_markup);
+static void stop_response_ticks(ChatSession *session) {
+    if (session->response_tick_id) {
+        gtk_widget_remove_tick_callback(GTK_WIDGET(session->app_data->chat_scroll), session->response_tick_id);
+        session->response_tick_id = 0;
     }
-    g_free(text);
-    g_free(update_data);
-    return G_SOURCE_REMOVE;
+    g_clear_handle_id(&session->response_checkpoint_id, g_source_remove);
 }
 
-static gboolean finalize_generation_cb(gpointer data) {
-    AppData *app_data = (AppData *)data;
-    app_data->is_generating = FALSE;
-    gtk_widget_set_sensitive(GTK_WIDGET(app_data->send_btn), TRUE);
-    gtk_button_set_icon_name(app_data->send_btn, "document-send-symbolic");
-    gtk_widget_set_tooltip_text(GTK_WIDGET(app_data->send_btn), "Send Message");
-    gtk_spinner_stop(app_data->spinner);
-    gtk_widget_set_visible(GTK_WIDGET(app_data->spinner), FALSE);
-
-    if (app_data->current_response_widget) {
-        const char *final_text = app_data->response_buffer->str;
-
-        // Save to history
-        json_object *assistant_msg_json = json_object_new_object();
-        json_object_object_add(assistant_msg_json, "role", json_object_new_string("assistant"));
-        json_object_object_add(assistant_msg_json, "content", json_object_new_string(final_text));
-        json_object_array_add(app_data->messages_array, assistant_msg_json);
-        history_save_chat(app_data);
-
-        // Rerender the widget with the final content
-        rerender_message_widget(app_data->current_response_widget, final_text);
+void ui_start_response_ticks(ChatSession *session) {
+    stop_response_ticks(session);
+    session->response_tick_id = gtk_widget_add_tick_callback(GTK_WIDGET(session->app_data->chat_scroll),
+                                                             response_tick_cb, session, NULL);
+    session->response_checkpoint_id = g_timeout_add_seconds(RESPONSE_CHECKPOINT_INTERVAL,
+                                                            response_checkpoint_cb, session);
+}
 
+// Freezes the row showing the streamed response, if the session's chat is
+// shown, and turns the pending transcript item into the stored message (or
+// drops it when nothing was `stored`).
+static void end_response(ChatSession *session, gboolean stored) {
+    AppData *app_data = session->app_data;
+    if (chat_session_is_shown(session)) {
+        if (app_data->current_response_widget) {
+            rerender_message_widget(app_data->current_response_widget, session->response_buffer->str);
+        }
+        conversation_model_end_pending(app_data->chat_model, stored);
         app_data->current_response_widget = NULL;
-        app_data->current_response_label = NULL;
-        
-        // Clear the buffer for the next response
-        g_string_assign(app_data->response_buffer, "");
     }
+    g_clear_object(&session->response_item);
+}
+
+// Appends the streamed response to the session's conversation and saves the
+// chat.
+static void store_response(ChatSession *session, gint token_count) {
+    guint index = conversation_append(session->conversation, CONVERSATION_ROLE_ASSISTANT,
+                                      session->response_buffer->str, session->response_buffer->len);
+    conversation_set_token_count(session->conversation, index, token_count);
+    history_save_session(session);
+    if (chat_session_is_shown(session)) ui_input_update_context_usage(session->app_data);
+    chat_summary_update(session->app_data, session->chat_id, session->conversation, session->model);
+}
 
+typedef struct {
+    ChatSession *session;
+    StreamStats stats;
+} FinalizeData;
+
+static gboolean finalize_generation_cb(gpointer data) {
+    FinalizeData *finalize_data = (FinalizeData *)data;
+    ChatSession *session = finalize_data->session;
+    flush_response(session);
+    stop_response_ticks(session);
+    gint64 prompt_eval_count = finalize_data->stats.prompt_eval_count;
+    if (!session->prompt_continues) context_budget_calibrate(session->model, session->prompt_tokens, prompt_eval_count);
+    if (chat_session_is_shown(session)) {
+        session->app_data->prompt_cached_percent = context_budget_cached_percent(session->prompt_tokens,
+                                                                                 prompt_eval_count);
+    }
+    if (session->response_item) {
+        store_response(session, (gint)finalize_data->stats.eval_count);
+        end_response(session, TRUE);
+    }
+    chat_session_free(session);
+    g_free(finalize_data);
     return G_SOURCE_REMOVE;
 }
 
 static gboolean scroll_to_bottom_cb(gpointer data) {
     AppData *app_data = (AppData *)data;
-    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(app_data->chat_scroll);
-    gtk_adjustment_set_value(vadj, gtk_adjustment_get_upper(vadj) - gtk_adjustment_get_page_size(vadj));
+    guint n_items = g_list_model_get_n_items(G_LIST_MODEL(app_data->chat_model));
+    if (n_items > 0) {
+        gtk_list_view_scroll_to(app_data->chat_list, n_items - 1, GTK_LIST_SCROLL_NONE, NULL);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+typedef struct {
+    AppData *app_data;
+    guint index;
+} ScrollToMessageData;
+
+static gboolean scroll_to_message_cb(gpointer data) {
+    ScrollToMessageData *scroll_data = (ScrollToMessageData *)data;
+    AppData *app_data = scroll_data->app_data;
+    if (scroll_data->index < g_list_model_get_n_items(G_LIST_MODEL(app_data->chat_model))) {
+        gtk_list_view_scroll_to(app_data->chat_list, scroll_data->index, GTK_LIST_SCROLL_NONE, NULL);
+    }
+    g_free(scroll_data);
     return G_SOURCE_REMOVE;
 }
 
 static gboolean update_models_dropdown_cb(gpointer data) {
     AppData *app_data = (AppData *)data;
+    ui_update_models_dropdown(app_data);
     if (app_data->model_count > 0) {
-        GtkStringList *string_list = gtk_string_list_new(NULL);
-        for (int i = 0; i < app_data->model_count; i++) {
-            gtk_string_list_append(string_list, app_data->models[i]);
-        }
-
-        gulong handler_id = (gulong)g_object_get_data(G_OBJECT(app_data->model_dropdown), "model-changed-handler-id");
-        if (handler_id > 0) {
-            g_signal_handler_disconnect(app_data->model_dropdown, handler_id);
-        }
-
-        gtk_drop_down_set_model(app_data->model_dropdown, G_LIST_MODEL(string_list));
-        g_object_unref(string_list);
-
-        guint selected_index = 0;
-        gboolean model_found = FALSE;
-        if (app_data->current_model) {
-            for (int i = 0; i < app_data->model_count; i++) {
-                if (g_strcmp0(app_data->current_model, app_data->models[i]) == 0) {
-                    selected_index = i;
-                    model_found = TRUE;
-                    break;
-                }
-            }
-        }
-
-        if (!model_found) {
-            if (app_data->current_model) g_free(app_data->current_model);
-            app_data->current_model = g_strdup(app_data->models[0]);
-        }
-        gtk_drop_down_set_selected(app_data->model_dropdown, selected_index);
-
-        if (handler_id > 0) {
-            g_signal_connect(app_data->model_dropdown, "notify::selected", G_CALLBACK(on_model_changed), app_data);
-        }
-
         gtk_widget_set_sensitive(GTK_WIDGET(app_data->send_btn), TRUE);
         gtk_label_set_text(app_data->status_label, "Connected");
         gtk_widget_remove_css_class(GTK_WIDGET(app_data->status_label), "error");
         gtk_widget_add_css_class(GTK_WIDGET(app_data->status_label), "success");
+        model_warmup_start(app_data, app_data->current_model);
     } else {
         gtk_label_set_text(app_data->status_label, "No models found");
         gtk_widget_remove_css_class(GTK_WIDGET(app_data->status_label), "success");
@@ -127,40 +184,98 @@ static gboolean update_models_dropdown_cb(gpointer data) {
     return G_SOURCE_REMOVE;
 }
 
+// Ends a session whose request was cancelled or failed, or that never sent
+// one.
 static gboolean reset_send_button_cb(gpointer data) {
-    AppData *app_data = (AppData *)data;
-    app_data->is_generating = FALSE;
-    gtk_widget_set_sensitive(GTK_WIDGET(app_data->send_btn), TRUE);
-    gtk_button_set_icon_name(app_data->send_btn, "document-send-symbolic");
-    gtk_widget_set_tooltip_text(GTK_WIDGET(app_data->send_btn), "Send Message");
-    gtk_spinner_stop(app_data->spinner);
-    gtk_widget_set_visible(GTK_WIDGET(app_data->spinner), FALSE);
+    ChatSession *session = (ChatSession *)data;
+    flush_response(session);
+    stop_response_ticks(session);
+    if (session->response_item) {
+        // Keep whatever arrived before the request was cancelled or failed
+        gboolean stored = session->response_buffer->len > 0;
+        if (stored) store_response(session, 0);
+        end_response(session, stored);
+    }
+    chat_session_free(session);
     return G_SOURCE_REMOVE;
 }
 
-void ui_schedule_update_response_label(AppData *app_data, char *text) {
-    UpdateResponseData *update_data = g_malloc(sizeof(UpdateResponseData));
-    update_data->app_data = app_data;
-    update_data->text = text;
-    g_idle_add(update_response_label_cb, update_data);
+// Shows whether the chat on screen is generating: the send button turns
+// into a stop button while it is.
+void ui_update_send_button(AppData *app_data) {
+    gboolean generating = chat_session_lookup(app_data, app_data->current_chat_id) != NULL;
+    if (generating) gtk_widget_set_sensitive(GTK_WIDGET(app_data->send_btn), TRUE);
+    gtk_button_set_icon_name(app_data->send_btn, generating ? "media-playback-stop-symbolic" : "document-send-symbolic");
+    gtk_widget_set_tooltip_text(GTK_WIDGET(app_data->send_btn), generating ? "Cancel Request" : "Send Message");
+    gtk_widget_set_visible(GTK_WIDGET(app_data->spinner), generating);
+    if (generating) {
+        gtk_spinner_start(app_data->spinner);
+    } else {
+        gtk_spinner_stop(app_data->spinner);
+    }
+}
+
+// Called for every decoded piece of content. The text is only appended
+// here; the tick callback renders it at most once per frame.
+void ui_push_response_text(ChatSession *session, const char *text, gsize len) {
+    g_string_append_len(session->response_buffer, text, len);
+    session->response_dirty = TRUE;
 }
 
-void ui_schedule_finalize_generation(AppData *app_data) {
-    g_idle_add(finalize_generation_cb, app_data);
+void ui_schedule_finalize_generation(ChatSession *session, const StreamStats *stats) {
+    FinalizeData *finalize_data = g_new(FinalizeData, 1);
+    finalize_data->session = session;
+    finalize_data->stats = *stats;
+    g_idle_add(finalize_generation_cb, finalize_data);
+}
+
+// Shows app_data->models in the dropdown, keeping the current model selected
+// if it is among them and selecting the first one otherwise.
+void ui_update_models_dropdown(AppData *app_data) {
+    if (app_data->model_count == 0) return;
+    GtkStringList *string_list = gtk_string_list_new(NULL);
+    guint selected_index = 0;
+    gboolean model_found = FALSE;
+    for (int i = 0; i < app_data->model_count; i++) {
+        gtk_string_list_append(string_list, app_data->models[i]);
+        if (!model_found && g_strcmp0(app_data->current_model, app_data->models[i]) == 0) {
+            selected_index = i;
+            model_found = TRUE;
+        }
+    }
+    if (!model_found) {
+        g_free(app_data->current_model);
+        app_data->current_model = g_strdup(app_data->models[0]);
+    }
+
+    g_signal_handlers_block_by_func(app_data->model_dropdown, on_model_changed, app_data);
+    gtk_drop_down_set_model(app_data->model_dropdown, G_LIST_MODEL(string_list));
+    gtk_drop_down_set_selected(app_data->model_dropdown, selected_index);
+    g_signal_handlers_unblock_by_func(app_data->model_dropdown, on_model_changed, app_data);
+    g_object_unref(string_list);
+    show_model_details(app_data);
 }
 
 void ui_schedule_update_models_dropdown(AppData *app_data) {
     g_idle_add(update_models_dropdown_cb, app_data);
 }
 
-void ui_schedule_reset_send_button(AppData *app_data) {
-    g_idle_add(reset_send_button_cb, app_data);
+void ui_schedule_reset_send_button(ChatSession *session) {
+    g_idle_add(reset_send_button_cb, session);
 }
 
 void ui_schedule_scroll_to_bottom(AppData *app_data) {
     g_idle_add(scroll_to_bottom_cb, app_data);
 }
 
+// Runs after a pending scroll to the bottom, so the message stays in view.
+void ui_schedule_scroll_to_message(AppData *app_data, guint index) {
+    ScrollToMessageData *scroll_data = g_new(ScrollToMessageData, 1);
+    scroll_data->app_data = app_data;
+    scroll_data->index = index;
+    g_idle_add(scroll_to_message_cb, scroll_data);
+}
+
 typedef struct {
     AppData *app_data;
     char *status;
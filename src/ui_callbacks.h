@@ -2,11 +2,15 @@
 #define UI_CALLBACKS_H
 
 #include "app_data.h"
+#include "stream_decoder.h"
 
-void ui_schedule_update_response_label(AppData *app_data, char *text);
-void ui_schedule_finalize_generation(AppData *app_data);
+void ui_push_response_text(ChatSession *session, const char *text, gsize len);
+void ui_start_response_ticks(ChatSession *session);
+void ui_schedule_finalize_generation(ChatSession *session, const StreamStats *stats);
+void ui_update_models_dropdown(AppData *app_data);
 void ui_schedule_update_models_dropdown(AppData *app_data);
-void ui_schedule_reset_send_button(AppData *app_data);
+void ui_schedule_reset_send_button(ChatSession *session);
+void ui_update_send_button(AppData *app_data);
 void ui_schedule_scroll_to_bottom(AppData *app_data);
 void ui_schedule_update_status_label(AppData *app_data, const char *status, const char *css_class);
 
@@ -2,6 +2,10 @@
 #include "ui_chat_view.h"
 #include "ui_callbacks.h"
 #include "markdown.h"
+#include "chat_message_item.h"
+#include "conversation_model.h"
+#include "chat_session.h"
+#include "ui_input.h"
 
 static gboolean revert_copy_icon(gpointer user_data) {
     gtk_button_set_icon_name(GTK_BUTTON(user_data), "edit-copy-symbolic");
@@ -9,29 +13,17 @@ static gboolean revert_copy_icon(gpointer user_data) {
 }
 
 /**
- * Data received by this function has been duplicated. Therefore,
- * it is deallocated here.
+ * `user_data` is the GtkListItem the button belongs to, so the text of
+ * whatever message the recycled row currently shows is copied.
  */
 static void on_copy_clicked(GtkButton *button, gpointer user_data) {
-    const char* text = (const char*) user_data;
+    ChatMessageItem *item = gtk_list_item_get_item(GTK_LIST_ITEM(user_data));
+    if (!item) return;
     gdk_clipboard_set_text(
             gdk_display_get_clipboard(
-                gtk_widget_get_display(GTK_WIDGET(button))), text);
+                gtk_widget_get_display(GTK_WIDGET(button))), chat_message_item_get_content(item));
     gtk_button_set_icon_name(button, "object-select-symbolic");
     g_timeout_add(1000, revert_copy_icon, button);
-    g_free(user_data);
-}
-
-static GtkWidget *create_chat_bubble_header(const ChatMessage *message) {
-    GtkWidget *header_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
-    GtkWidget *sender_label = gtk_label_new(NULL);
-    char *markup = g_markup_printf_escaped("<b>%s</b>", message->is_user ? "You" : "Assistant");
-    gtk_label_set_markup(GTK_LABEL(sender_label), markup);
-    g_free(markup);
-    gtk_widget_set_halign(sender_label, GTK_ALIGN_START);
-    gtk_widget_add_css_class(sender_label, "caption");
-    gtk_box_append(GTK_BOX(header_box), sender_label);
-    return header_box;
 }
 
 static GtkWidget *create_text_label(const char *pango_markup) {
@@ -54,6 +46,7 @@ static GtkWidget *create_code_block(const char *code, const char *lang) {
     gtk_text_buffer_set_text(GTK_TEXT_BUFFER(buffer), code, -1);
 
     GtkWidget *source_view = gtk_source_view_new_with_buffer(buffer);
+    g_object_unref(buffer);
     gtk_widget_set_hexpand(source_view, TRUE);
     gtk_source_view_set_show_line_numbers(GTK_SOURCE_VIEW(source_view), TRUE);
     gtk_text_view_set_editable(GTK_TEXT_VIEW(source_view), FALSE);
@@ -66,70 +59,80 @@ static GtkWidget *create_code_block(const char *code, const char *lang) {
     return scrolled_window;
 }
 
-static void parse_and_display_message(GtkBox *message_box, const char *content) {
-    const char *p = content;
-    while (*p) {
-        const char *code_start = strstr(p, "```");
-        if (code_start) {
-            if (code_start > p) {
-                char *text = g_strndup(p, code_start - p);
-                char *pango_markup = markdown_to_pango(text);
-                GtkWidget *label = create_text_label(pango_markup);
-                gtk_box_append(message_box, label);
-                g_free(text);
-                g_free(pango_markup);
-            }
-
-            const char *code_end = strstr(code_start + 3, "```");
-            if (code_end) {
-                const char *lang_end = strchr(code_start + 3, '\n');
-                char *lang = NULL;
-                if (lang_end && lang_end < code_end) {
-                    lang = g_strndup(code_start + 3, lang_end - (code_start + 3));
-                }
-
-                char *code = g_strndup(lang_end ? lang_end + 1 : code_start + 3, code_end - (lang_end ? lang_end + 1 : code_start + 3));
-                GtkWidget *code_widget = create_code_block(code, lang);
-                gtk_box_append(message_box, code_widget);
-
-                g_free(lang);
-                g_free(code);
-                p = code_end + 3;
-            } else {
-                p = code_start + 3;
-            }
-        } else {
-            char *pango_markup = markdown_to_pango(p);
-            GtkWidget *label = create_text_label(pango_markup);
-            gtk_box_append(message_box, label);
-            g_free(pango_markup);
-            break;
-        }
+// Rendering state of a message. While a response streams in, `tail_label`
+// shows the open block and frozen blocks are inserted in front of it.
+typedef struct {
+    MarkdownStream markdown;
+    GtkBox *message_box;
+    GtkLabel *tail_label;
+} MessageRenderState;
+
+static void free_render_state(gpointer data) {
+    MessageRenderState *state = (MessageRenderState *)data;
+    markdown_stream_clear(&state->markdown);
+    g_free(state);
+}
+
+static void append_block_widget(MarkdownBlockType type, const char *text, gsize len,
+                                const char *lang, gpointer user_data) {
+    MessageRenderState *state = (MessageRenderState *)user_data;
+    char *block_text = g_strndup(text, len);
+    GtkWidget *block;
+    if (type == MARKDOWN_BLOCK_CODE) {
+        block = create_code_block(block_text, lang);
+    } else {
+        char *pango_markup = markdown_to_pango(block_text);
+        block = create_text_label(pango_markup);
+        g_free(pango_markup);
+    }
+    g_free(block_text);
+
+    if (state->tail_label) {
+        GtkWidget *before_tail = gtk_widget_get_prev_sibling(GTK_WIDGET(state->tail_label));
+        gtk_box_insert_child_after(state->message_box, block, before_tail);
+    } else {
+        gtk_box_append(state->message_box, block);
     }
 }
 
-static void add_assistant_message_actions(GtkBox *header_box, const char *content) {
-    GtkWidget *spacer = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    gtk_widget_set_hexpand(spacer, TRUE);
-    gtk_box_append(header_box, spacer);
+static void parse_and_display_message(GtkBox *message_box, const char *content) {
+    MessageRenderState state = {.message_box = message_box};
+    markdown_stream_init(&state.markdown, append_block_widget, &state);
+    markdown_stream_finish(&state.markdown, content, strlen(content));
+}
 
-    GtkWidget *copy_btn = gtk_button_new_from_icon_name("edit-copy-symbolic");
-    gtk_widget_add_css_class(copy_btn, "copy-button");
-    // `content` is duplicated. The callback should deallocate the buffer.
-    g_signal_connect(copy_btn, "clicked", G_CALLBACK(on_copy_clicked), g_strdup(content));
-    gtk_box_append(header_box, copy_btn);
+// Removes everything below the header of a message bubble.
+static void clear_message_content(GtkBox *message_box) {
+    GtkWidget *header = gtk_widget_get_first_child(GTK_WIDGET(message_box));
+    GtkWidget *child;
+    while ((child = gtk_widget_get_next_sibling(header)) != NULL) {
+        gtk_box_remove(message_box, child);
+    }
 }
 
-static GtkWidget *create_message_widget(const ChatMessage *message) {
+// --- Transcript List Factory ---
+
+/**
+ * Rows are recycled: `setup` builds the bubble skeleton once per row widget,
+ * `bind` fills in the content of the message currently shown in that row and
+ * `unbind` drops it again. Only rows that are on screen (plus a small margin
+ * kept by GtkListView) hold any content widgets.
+ */
+static void on_message_setup(GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data) {
+    (void)factory; (void)user_data;
+    gtk_list_item_set_activatable(list_item, FALSE);
+    gtk_list_item_set_selectable(list_item, FALSE);
+    gtk_list_item_set_focusable(list_item, FALSE);
+
     GtkWidget *main_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
     gtk_widget_set_margin_start(main_box, 12);
     gtk_widget_set_margin_end(main_box, 12);
     gtk_widget_set_margin_top(main_box, 6);
     gtk_widget_set_margin_bottom(main_box, 6);
-    
+
     GtkWidget *frame = gtk_frame_new(NULL);
     gtk_widget_add_css_class(frame, "card");
-    
+
     GtkWidget *message_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
     gtk_widget_set_margin_start(message_box, 12);
     gtk_widget_set_margin_end(message_box, 12);
@@ -137,78 +140,148 @@ static GtkWidget *create_message_widget(const ChatMessage *message) {
     gtk_widget_set_margin_bottom(message_box, 8);
     gtk_widget_set_hexpand(message_box, TRUE);
 
-    GtkWidget *header_box = create_chat_bubble_header(message);
+    GtkWidget *header_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    GtkWidget *sender_label = gtk_label_new(NULL);
+    gtk_widget_set_halign(sender_label, GTK_ALIGN_START);
+    gtk_widget_add_css_class(sender_label, "caption");
+    gtk_box_append(GTK_BOX(header_box), sender_label);
+
+    GtkWidget *spacer = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_widget_set_hexpand(spacer, TRUE);
+    gtk_box_append(GTK_BOX(header_box), spacer);
+
+    GtkWidget *copy_btn = gtk_button_new_from_icon_name("edit-copy-symbolic");
+    gtk_widget_add_css_class(copy_btn, "copy-button");
+    g_signal_connect(copy_btn, "clicked", G_CALLBACK(on_copy_clicked), list_item);
+    gtk_box_append(GTK_BOX(header_box), copy_btn);
+
     gtk_box_append(GTK_BOX(message_box), header_box);
 
-    if (strlen(message->content) > 0) {
-        parse_and_display_message(GTK_BOX(message_box), message->content);
-    }
+    // Progress of a pending message, e.g. attachments being fetched
+    GtkWidget *status_label = gtk_label_new(NULL);
+    gtk_widget_set_halign(status_label, GTK_ALIGN_START);
+    gtk_label_set_xalign(GTK_LABEL(status_label), 0);
+    gtk_label_set_wrap(GTK_LABEL(status_label), TRUE);
+    gtk_widget_add_css_class(status_label, "caption");
+    gtk_widget_add_css_class(status_label, "dim-label");
+    gtk_widget_set_margin_start(status_label, 12);
+    gtk_widget_set_margin_end(status_label, 12);
+    gtk_widget_set_margin_bottom(status_label, 8);
+    gtk_widget_set_visible(status_label, FALSE);
 
-    gtk_frame_set_child(GTK_FRAME(frame), message_box);
-    
-    if (message->is_user) {
-        gtk_widget_add_css_class(frame, "user-message");
-    } else {
-        gtk_widget_add_css_class(frame, "assistant-message");
-        add_assistant_message_actions(GTK_BOX(header_box), message->content);
-    }
-    
+    GtkWidget *bubble_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_box_append(GTK_BOX(bubble_box), message_box);
+    gtk_box_append(GTK_BOX(bubble_box), status_label);
+    gtk_frame_set_child(GTK_FRAME(frame), bubble_box);
     gtk_box_append(GTK_BOX(main_box), frame);
 
-    GtkWidget *content_label = NULL;
-    if (strlen(message->content) == 0 && !message->is_user) {
-        content_label = gtk_label_new(NULL);
-        gtk_label_set_wrap(GTK_LABEL(content_label), TRUE);
-        gtk_label_set_wrap_mode(GTK_LABEL(content_label), PANGO_WRAP_WORD_CHAR);
-        gtk_widget_set_halign(content_label, GTK_ALIGN_START);
-        gtk_label_set_selectable(GTK_LABEL(content_label), TRUE);
-        gtk_label_set_xalign(GTK_LABEL(content_label), 0);
-        gtk_box_append(GTK_BOX(message_box), content_label);
-    }
+    g_object_set_data(G_OBJECT(main_box), "frame", frame);
+    g_object_set_data(G_OBJECT(main_box), "message_box", message_box);
+    g_object_set_data(G_OBJECT(main_box), "sender_label", sender_label);
+    g_object_set_data(G_OBJECT(main_box), "copy_button", copy_btn);
+    g_object_set_data(G_OBJECT(main_box), "status_label", status_label);
+    gtk_list_item_set_child(list_item, main_box);
+}
 
-    g_object_set_data(G_OBJECT(main_box), "content_label", content_label);
-    return main_box;
+static void update_status_label(ChatMessageItem *item, GtkLabel *status_label) {
+    const char *status = chat_message_item_get_status(item);
+    gtk_label_set_text(status_label, status ? status : "");
+    gtk_widget_set_visible(GTK_WIDGET(status_label), status != NULL);
 }
 
-GtkWidget *add_message_to_chat(AppData *app_data, const ChatMessage *message) {
-    GtkWidget *widget = create_message_widget(message);
-    gtk_box_append(app_data->chat_box, widget);
-    ui_schedule_scroll_to_bottom(app_data);
-    return widget;
+static void on_item_status_changed(GObject *object, GParamSpec *pspec, gpointer user_data) {
+    (void)pspec;
+    update_status_label(CHAT_MESSAGE_ITEM(object), GTK_LABEL(user_data));
 }
 
-void ui_clear_chat_view(AppData *app_data) {
-    GtkWidget *child;
-    while ((child = gtk_widget_get_first_child(GTK_WIDGET(app_data->chat_box))) != NULL) {
-        gtk_box_remove(app_data->chat_box, child);
+static void on_message_bind(GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data) {
+    (void)factory;
+    AppData *app_data = (AppData *)user_data;
+    ChatMessageItem *item = gtk_list_item_get_item(list_item);
+    GtkWidget *main_box = gtk_list_item_get_child(list_item);
+    GtkWidget *frame = g_object_get_data(G_OBJECT(main_box), "frame");
+    GtkBox *message_box = GTK_BOX(g_object_get_data(G_OBJECT(main_box), "message_box"));
+    gboolean is_user = chat_message_item_get_is_user(item);
+
+    char *markup = g_markup_printf_escaped("<b>%s</b>", is_user ? "You" : "Assistant");
+    gtk_label_set_markup(GTK_LABEL(g_object_get_data(G_OBJECT(main_box), "sender_label")), markup);
+    g_free(markup);
+    gtk_widget_set_visible(GTK_WIDGET(g_object_get_data(G_OBJECT(main_box), "copy_button")), !is_user);
+    gtk_widget_remove_css_class(frame, is_user ? "assistant-message" : "user-message");
+    gtk_widget_add_css_class(frame, is_user ? "user-message" : "assistant-message");
+
+    GtkLabel *status_label = GTK_LABEL(g_object_get_data(G_OBJECT(main_box), "status_label"));
+    update_status_label(item, status_label);
+    g_signal_connect(item, "notify::status", G_CALLBACK(on_item_status_changed), status_label);
+
+    if (chat_message_item_get_streaming(item)) {
+        GtkWidget *content_label = create_text_label("");
+        gtk_box_append(message_box, content_label);
+
+        MessageRenderState *state = g_new0(MessageRenderState, 1);
+        state->message_box = message_box;
+        state->tail_label = GTK_LABEL(content_label);
+        markdown_stream_init(&state->markdown, append_block_widget, state);
+        g_object_set_data_full(G_OBJECT(main_box), "render_state", state, free_render_state);
+
+        // A streaming item is only shown for the session of the shown chat
+        ChatSession *session = chat_session_lookup(app_data, app_data->current_chat_id);
+        app_data->current_response_widget = main_box;
+        if (session) {
+            update_message_widget(main_box, session->response_buffer->str, session->response_buffer->len);
+        }
+    } else {
+        parse_and_display_message(message_box, chat_message_item_get_content(item));
     }
 }
 
-static void chat_message_from_json(json_object *msg_obj, ChatMessage *msg) {
-    json_object *role_obj, *content_obj;
-    if (json_object_object_get_ex(msg_obj, "role", &role_obj) &&
-        json_object_object_get_ex(msg_obj, "content", &content_obj)) {
-        
-        const char *role = json_object_get_string(role_obj);
-        const char *content = json_object_get_string(content_obj);
-        
-        msg->is_user = (strcmp(role, "user") == 0);
-        strncpy(msg->content, content, MAX_MESSAGE_LEN - 1);
-        msg->content[MAX_MESSAGE_LEN - 1] = '\0';
+static void on_message_unbind(GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data) {
+    (void)factory;
+    AppData *app_data = (AppData *)user_data;
+    GtkWidget *main_box = gtk_list_item_get_child(list_item);
+    if (app_data->current_response_widget == main_box) {
+        app_data->current_response_widget = NULL;
     }
+    g_signal_handlers_disconnect_by_func(gtk_list_item_get_item(list_item), on_item_status_changed,
+                                         g_object_get_data(G_OBJECT(main_box), "status_label"));
+    g_object_set_data(G_OBJECT(main_box), "render_state", NULL);
+    clear_message_content(GTK_BOX(g_object_get_data(G_OBJECT(main_box), "message_box")));
+}
+
+// Appends a message to the current conversation and shows it.
+guint add_message_to_chat(AppData *app_data, ConversationRole role, const char *content) {
+    guint index = conversation_append(app_data->conversation, role, content, -1);
+    conversation_model_sync(app_data->chat_model);
+    ui_schedule_scroll_to_bottom(app_data);
+    return index;
+}
+
+// Shows a message that is not stored yet. Returns a new reference.
+ChatMessageItem *add_pending_message_to_chat(AppData *app_data, ConversationRole role, const char *text) {
+    ChatMessageItem *item = chat_message_item_new_pending(role, text);
+    conversation_model_begin_pending(app_data->chat_model, item);
+    ui_schedule_scroll_to_bottom(app_data);
+    return item;
+}
+
+void ui_clear_chat_view(AppData *app_data) {
+    app_data->current_response_widget = NULL;
+    conversation_model_set_conversation(app_data->chat_model, NULL);
 }
 
+// Only the model is switched here; items and widgets are created lazily for
+// visible rows. A chat that is generating gets its pending message back.
 void ui_redisplay_chat_history(AppData *app_data) {
-    if (!app_data->messages_array) return;
-    int len = json_object_array_length(app_data->messages_array);
-    for (int i = 0; i < len; i++) {
-        json_object *msg_obj = json_object_array_get_idx(app_data->messages_array, i);
-        ChatMessage msg = {0};
-        chat_message_from_json(msg_obj, &msg);
-        if (strlen(msg.content) > 0) {
-            add_message_to_chat(app_data, &msg);
-        }
+    app_data->current_response_widget = NULL;
+    conversation_model_set_conversation(app_data->chat_model, app_data->conversation);
+    ChatSession *session = chat_session_lookup(app_data, app_data->current_chat_id);
+    if (session && chat_session_get_pending_item(session)) {
+        conversation_model_begin_pending(app_data->chat_model, chat_session_get_pending_item(session));
     }
+    ui_update_send_button(app_data);
+    app_data->prompt_cached_percent = -1;
+    ui_input_update_context_usage(app_data);
+    ui_schedule_scroll_to_bottom(app_data);
 }
 
 GtkWidget *create_chat_view(AppData *app_data) {
@@ -218,26 +291,43 @@ GtkWidget *create_chat_view(AppData *app_data) {
     app_data->chat_scroll = GTK_SCROLLED_WINDOW(gtk_scrolled_window_new());
     gtk_scrolled_window_set_policy(app_data->chat_scroll, GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
     gtk_widget_set_vexpand(GTK_WIDGET(app_data->chat_scroll), TRUE);
-    app_data->chat_box = GTK_BOX(gtk_box_new(GTK_ORIENTATION_VERTICAL, 0));
-    gtk_scrolled_window_set_child(app_data->chat_scroll, GTK_WIDGET(app_data->chat_box));
+
+    app_data->chat_model = conversation_model_new();
+    GtkListItemFactory *factory = gtk_signal_list_item_factory_new();
+    g_signal_connect(factory, "setup", G_CALLBACK(on_message_setup), app_data);
+    g_signal_connect(factory, "bind", G_CALLBACK(on_message_bind), app_data);
+    g_signal_connect(factory, "unbind", G_CALLBACK(on_message_unbind), app_data);
+    GtkNoSelection *selection = gtk_no_selection_new(G_LIST_MODEL(g_object_ref(app_data->chat_model)));
+    app_data->chat_list = GTK_LIST_VIEW(gtk_list_view_new(GTK_SELECTION_MODEL(selection), factory));
+    gtk_widget_add_css_class(GTK_WIDGET(app_data->chat_list), "chat-transcript");
+    gtk_scrolled_window_set_child(app_data->chat_scroll, GTK_WIDGET(app_data->chat_list));
     gtk_box_append(GTK_BOX(chat_area_box), GTK_WIDGET(app_data->chat_scroll));
 
     return chat_area_box;
 }
 
-void rerender_message_widget(GtkWidget *widget, const char *new_content) {
-    GtkWidget *frame = gtk_widget_get_first_child(widget);
-    if (!frame) return;
-    GtkWidget *message_box = gtk_widget_get_first_child(frame);
-    if (!message_box) return;
+// Called once per frame while a response streams in. Only lines completed
+// since the last call are parsed, and only the open block is re-rendered.
+void update_message_widget(GtkWidget *widget, const char *content, gsize len) {
+    MessageRenderState *state = g_object_get_data(G_OBJECT(widget), "render_state");
+    if (!state || !state->tail_label) return;
+    markdown_stream_update(&state->markdown, content, len);
+    char *pango_markup = markdown_stream_tail_to_pango(&state->markdown, content, len);
+    gtk_label_set_markup(state->tail_label, pango_markup);
+    g_free(pango_markup);
+}
 
-    // Remove all children except the header
-    GtkWidget *header = gtk_widget_get_first_child(message_box);
-    GtkWidget *child;
-    while ((child = gtk_widget_get_next_sibling(header)) != NULL) {
-        gtk_box_remove(GTK_BOX(message_box), child);
+void rerender_message_widget(GtkWidget *widget, const char *new_content) {
+    // A streamed message only needs its open block frozen
+    MessageRenderState *state = g_object_get_data(G_OBJECT(widget), "render_state");
+    if (state && state->tail_label) {
+        markdown_stream_finish(&state->markdown, new_content, strlen(new_content));
+        gtk_box_remove(state->message_box, GTK_WIDGET(state->tail_label));
+        state->tail_label = NULL;
+        return;
     }
 
-    // Reparse and add the new content
-    parse_and_display_message(GTK_BOX(message_box), new_content);
+    GtkBox *message_box = GTK_BOX(g_object_get_data(G_OBJECT(widget), "message_box"));
+    clear_message_content(message_box);
+    parse_and_display_message(message_box, new_content);
 }
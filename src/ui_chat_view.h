@@ -6,7 +6,9 @@
 GtkWidget *create_chat_view(AppData *app_data);
 void ui_clear_chat_view(AppData *app_data);
 void ui_redisplay_chat_history(AppData *app_data);
-GtkWidget *add_message_to_chat(AppData *app_data, const ChatMessage *message);
+guint add_message_to_chat(AppData *app_data, ConversationRole role, const char *content);
+ChatMessageItem *add_pending_message_to_chat(AppData *app_data, ConversationRole role, const char *text);
+void update_message_widget(GtkWidget *widget, const char *content, gsize len);
 void rerender_message_widget(GtkWidget *widget, const char *new_content);
 
 #endif // UI_CHAT_VIEW_H
@@ -1,6 +1,7 @@
 #include "ui_dialogs.h"
 #include "config.h"
 #include "history.h"
+#include "ui_input.h"
 
 typedef struct {
     GtkSpinButton *temperature_spin;
@@ -8,6 +9,9 @@ typedef struct {
     GtkSpinButton *top_k_spin;
     GtkSpinButton *seed_spin;
     GtkSpinButton *context_length_spin;
+    GtkSwitch *summarize_switch;
+    GtkEntry *summary_model_entry;
+    GtkEntry *keep_alive_entry;
     GtkTextView *system_prompt_view;
     AppData *app_data;
 } PrefsWidgets;
@@ -21,6 +25,16 @@ static void on_prefs_dialog_response(GtkButton *button, gpointer user_data) {
     app_data->top_k = (int)gtk_spin_button_get_value(prefs_widgets->top_k_spin);
     app_data->seed = (int)gtk_spin_button_get_value(prefs_widgets->seed_spin);
     app_data->ollama_context_size = (int)gtk_spin_button_get_value(prefs_widgets->context_length_spin);
+    app_data->summarize_chats = gtk_switch_get_active(prefs_widgets->summarize_switch);
+    g_free(app_data->summary_model);
+    app_data->summary_model = g_strdup(gtk_editable_get_text(GTK_EDITABLE(prefs_widgets->summary_model_entry)));
+    char *keep_alive = g_strstrip(g_strdup(gtk_editable_get_text(GTK_EDITABLE(prefs_widgets->keep_alive_entry))));
+    if (*keep_alive) {
+        g_hash_table_insert(app_data->keep_alive, g_strdup("*"), keep_alive);
+    } else {
+        g_hash_table_remove(app_data->keep_alive, "*");
+        g_free(keep_alive);
+    }
 
     GtkTextBuffer *buffer = gtk_text_view_get_buffer(prefs_widgets->system_prompt_view);
     GtkTextIter start, end;
@@ -31,6 +45,7 @@ static void on_prefs_dialog_response(GtkButton *button, gpointer user_data) {
     g_free(system_prompt_text);
 
     config_save(app_data);
+    ui_input_update_context_usage(app_data);
     g_free(prefs_widgets);
 }
 
@@ -99,13 +114,41 @@ void show_preferences_dialog(AppData *app_data) {
     gtk_grid_attach(GTK_GRID(grid), GTK_WIDGET(prefs_widgets->seed_spin), 1, row++, 1, 1);
 
     // Context Length
-    GtkWidget *context_label = gtk_label_new("Context Length:");
+    GtkWidget *context_label = gtk_label_new("Context Length (0 for the model's):");
     gtk_widget_set_halign(context_label, GTK_ALIGN_START);
     prefs_widgets->context_length_spin = GTK_SPIN_BUTTON(gtk_spin_button_new_with_range(0, 16384, 1024));
     gtk_spin_button_set_value(prefs_widgets->context_length_spin, app_data->ollama_context_size);
     gtk_grid_attach(GTK_GRID(grid), context_label, 0, row, 1, 1);
     gtk_grid_attach(GTK_GRID(grid), GTK_WIDGET(prefs_widgets->context_length_spin), 1, row++, 1, 1);
 
+    // Summaries
+    GtkWidget *summarize_label = gtk_label_new("Summarize Long Chats:");
+    gtk_widget_set_halign(summarize_label, GTK_ALIGN_START);
+    prefs_widgets->summarize_switch = GTK_SWITCH(gtk_switch_new());
+    gtk_switch_set_active(prefs_widgets->summarize_switch, app_data->summarize_chats);
+    gtk_widget_set_halign(GTK_WIDGET(prefs_widgets->summarize_switch), GTK_ALIGN_START);
+    gtk_grid_attach(GTK_GRID(grid), summarize_label, 0, row, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), GTK_WIDGET(prefs_widgets->summarize_switch), 1, row++, 1, 1);
+
+    GtkWidget *summary_model_label = gtk_label_new("Summary Model:");
+    gtk_widget_set_halign(summary_model_label, GTK_ALIGN_START);
+    prefs_widgets->summary_model_entry = GTK_ENTRY(gtk_entry_new());
+    gtk_entry_set_placeholder_text(prefs_widgets->summary_model_entry, "Same as the chat");
+    gtk_editable_set_text(GTK_EDITABLE(prefs_widgets->summary_model_entry),
+                          app_data->summary_model ? app_data->summary_model : "");
+    gtk_grid_attach(GTK_GRID(grid), summary_model_label, 0, row, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), GTK_WIDGET(prefs_widgets->summary_model_entry), 1, row++, 1, 1);
+
+    // Keep Alive, for models without their own
+    GtkWidget *keep_alive_label = gtk_label_new("Keep Model Loaded:");
+    gtk_widget_set_halign(keep_alive_label, GTK_ALIGN_START);
+    prefs_widgets->keep_alive_entry = GTK_ENTRY(gtk_entry_new());
+    gtk_entry_set_placeholder_text(prefs_widgets->keep_alive_entry, "Ollama's default, e.g. 30m or -1");
+    const char *keep_alive = g_hash_table_lookup(app_data->keep_alive, "*");
+    gtk_editable_set_text(GTK_EDITABLE(prefs_widgets->keep_alive_entry), keep_alive ? keep_alive : "");
+    gtk_grid_attach(GTK_GRID(grid), keep_alive_label, 0, row, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), GTK_WIDGET(prefs_widgets->keep_alive_entry), 1, row++, 1, 1);
+
     // System Prompt
     GtkWidget *system_prompt_label = gtk_label_new("System Prompt:");
     gtk_widget_set_halign(system_prompt_label, GTK_ALIGN_START);
@@ -146,14 +189,13 @@ static void on_rename_dialog_response(GtkButton *button, gpointer user_data) {
     GtkWidget *entry = gtk_widget_get_first_child(main_box);
     const char *new_name = gtk_editable_get_text(GTK_EDITABLE(entry));
     
-    GtkListBoxRow *row = gtk_list_box_get_selected_row(app_data->history_list_box);
-    if (row && strlen(new_name) > 0) {
-        const char *old_name = gtk_label_get_text(GTK_LABEL(gtk_list_box_row_get_child(row)));
-        history_rename_chat(app_data, old_name, new_name);
+    const char *chat_id = history_get_selected_chat_id(app_data);
+    if (chat_id && strlen(new_name) > 0) {
+        history_rename_chat(app_data, chat_id, new_name);
     }
 }
 
-void show_rename_dialog(AppData *app_data, const char *old_name) {
+void show_rename_dialog(AppData *app_data, const char *chat_id) {
     GtkWidget *dialog = gtk_window_new();
     gtk_window_set_title(GTK_WINDOW(dialog), "Rename Chat");
     gtk_window_set_transient_for(GTK_WINDOW(dialog), GTK_WINDOW(app_data->window));
@@ -168,7 +210,7 @@ void show_rename_dialog(AppData *app_data, const char *old_name) {
     gtk_window_set_child(GTK_WINDOW(dialog), main_box);
 
     GtkWidget *entry = gtk_entry_new();
-    gtk_editable_set_text(GTK_EDITABLE(entry), old_name);
+    gtk_editable_set_text(GTK_EDITABLE(entry), history_get_chat_title(app_data, chat_id));
     gtk_box_append(GTK_BOX(main_box), entry);
 
     GtkWidget *action_area = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
@@ -4,7 +4,7 @@
 #include "app_data.h"
 
 void show_preferences_dialog(AppData *app_data);
-void show_rename_dialog(AppData *app_data, const char *old_name);
+void show_rename_dialog(AppData *app_data, const char *chat_id);
 void show_about_dialog(AppData *app_data);
 
 #endif // UI_DIALOGS_H
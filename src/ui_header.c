@@ -34,9 +34,8 @@ static void on_about_action(GSimpleAction *action, GVariant *parameter, gpointer
 static void on_rename_chat_action(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
     (void)action; (void)parameter;
     AppData *app_data = (AppData *)user_data;
-    GtkListBoxRow *row = gtk_list_box_get_selected_row(app_data->history_list_box);
-    if (row) {
-        const char *chat_id = gtk_label_get_text(GTK_LABEL(gtk_list_box_row_get_child(row)));
+    const char *chat_id = history_get_selected_chat_id(app_data);
+    if (chat_id) {
         show_rename_dialog(app_data, chat_id);
     }
 }
@@ -44,9 +43,8 @@ static void on_rename_chat_action(GSimpleAction *action, GVariant *parameter, gp
 static void on_delete_chat_action(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
     (void)action; (void)parameter;
     AppData *app_data = (AppData *)user_data;
-    GtkListBoxRow *row = gtk_list_box_get_selected_row(app_data->history_list_box);
-    if (row) {
-        const char *chat_id = gtk_label_get_text(GTK_LABEL(gtk_list_box_row_get_child(row)));
+    const char *chat_id = history_get_selected_chat_id(app_data);
+    if (chat_id) {
         history_delete_chat(app_data, chat_id);
     }
 }
@@ -1,44 +1,198 @@
+#include <string.h>
 #include "ui_history.h"
+#include "ui.h"
 #include "history.h"
+#include "chat_catalog.h"
+#include "chat_list_model.h"
+#include "chat_search.h"
 
-static GtkWidget* create_history_row(gpointer item, gpointer user_data) {
-    (void)user_data;
-    GtkStringObject *str_obj = GTK_STRING_OBJECT(item);
-    const char *id = gtk_string_object_get_string(str_obj);
-    GtkWidget *label = gtk_label_new(id);
-    gtk_widget_set_halign(label, GTK_ALIGN_START);
-    return label;
+#define SEARCH_RESULT_LIMIT 50
+
+// --- Chat List Factory ---
+
+// "14:05" for today, the date otherwise.
+static char *format_modified_at(gint64 modified_at) {
+    GDateTime *time = g_date_time_new_from_unix_local(modified_at);
+    GDateTime *now = g_date_time_new_now_local();
+    gboolean today = g_date_time_get_year(time) == g_date_time_get_year(now) &&
+                     g_date_time_get_day_of_year(time) == g_date_time_get_day_of_year(now);
+    char *text = g_date_time_format(time, today ? "%H:%M" : "%x");
+    g_date_time_unref(now);
+    g_date_time_unref(time);
+    return text;
+}
+
+static void update_chat_row(ChatListItem *item, GtkWidget *row_box) {
+    gtk_label_set_text(GTK_LABEL(g_object_get_data(G_OBJECT(row_box), "title_label")),
+                       chat_list_item_get_title(item));
+    gboolean busy = chat_list_item_get_busy(item);
+    GtkSpinner *spinner = GTK_SPINNER(g_object_get_data(G_OBJECT(row_box), "spinner"));
+    gtk_widget_set_visible(GTK_WIDGET(spinner), busy);
+    gtk_spinner_set_spinning(spinner, busy);
+    char *date = busy ? g_strdup("Generating…") : format_modified_at(chat_list_item_get_modified_at(item));
+    const char *preview = chat_list_item_get_preview(item);
+    char *details = preview ? g_strdup_printf("%s · %s", date, preview) : g_strdup(date);
+    gtk_label_set_text(GTK_LABEL(g_object_get_data(G_OBJECT(row_box), "details_label")), details);
+    g_free(details);
+    g_free(date);
+}
+
+static void on_chat_item_changed(GObject *object, GParamSpec *pspec, gpointer user_data) {
+    (void)pspec;
+    update_chat_row(CHAT_LIST_ITEM(object), GTK_WIDGET(user_data));
+}
+
+static void on_chat_row_context_menu(GtkGestureClick *gesture, int n_press, double x, double y, gpointer user_data) {
+    (void)gesture; (void)x; (void)y;
+    GtkListItem *list_item = GTK_LIST_ITEM(user_data);
+    guint position = gtk_list_item_get_position(list_item);
+    if (n_press != 1 || position == GTK_INVALID_LIST_POSITION) return;
+
+    GtkWidget *row_box = gtk_list_item_get_child(list_item);
+    AppData *app_data = g_object_get_data(G_OBJECT(row_box), "app_data");
+    gtk_single_selection_set_selected(app_data->history_selection, position);
+    gtk_popover_popup(GTK_POPOVER(g_object_get_data(G_OBJECT(row_box), "popover")));
+}
+
+/**
+ * Rows are recycled the same way as in the transcript: `setup` builds the
+ * labels and the context menu once per row widget and `bind` points them at
+ * the chat currently shown in that row.
+ */
+static void on_chat_setup(GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data) {
+    (void)factory;
+    AppData *app_data = (AppData *)user_data;
+    GtkWidget *row_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    gtk_widget_set_margin_start(row_box, 6);
+    gtk_widget_set_margin_end(row_box, 6);
+    gtk_widget_set_margin_top(row_box, 4);
+    gtk_widget_set_margin_bottom(row_box, 4);
+
+    GtkWidget *title_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    GtkWidget *title_label = gtk_label_new(NULL);
+    gtk_label_set_ellipsize(GTK_LABEL(title_label), PANGO_ELLIPSIZE_END);
+    gtk_label_set_xalign(GTK_LABEL(title_label), 0);
+    gtk_widget_set_hexpand(title_label, TRUE);
+    gtk_box_append(GTK_BOX(title_box), title_label);
+    GtkWidget *spinner = gtk_spinner_new();
+    gtk_widget_set_visible(spinner, FALSE);
+    gtk_box_append(GTK_BOX(title_box), spinner);
+    gtk_box_append(GTK_BOX(row_box), title_box);
+
+    GtkWidget *details_label = gtk_label_new(NULL);
+    gtk_label_set_ellipsize(GTK_LABEL(details_label), PANGO_ELLIPSIZE_END);
+    gtk_widget_set_halign(details_label, GTK_ALIGN_START);
+    gtk_widget_add_css_class(details_label, "caption");
+    gtk_widget_add_css_class(details_label, "dim-label");
+    gtk_box_append(GTK_BOX(row_box), details_label);
+
+    GMenu *menu = g_menu_new();
+    g_menu_append(menu, "Rename", "app.rename-chat");
+    g_menu_append(menu, "Delete", "app.delete-chat");
+    GtkWidget *popover = gtk_popover_menu_new_from_model(G_MENU_MODEL(menu));
+    gtk_widget_set_parent(popover, row_box);
+    g_object_unref(menu);
+
+    GtkGesture *context_gesture = gtk_gesture_click_new();
+    gtk_gesture_single_set_button(GTK_GESTURE_SINGLE(context_gesture), GDK_BUTTON_SECONDARY);
+    g_signal_connect(context_gesture, "pressed", G_CALLBACK(on_chat_row_context_menu), list_item);
+    gtk_widget_add_controller(row_box, GTK_EVENT_CONTROLLER(context_gesture));
+
+    g_object_set_data(G_OBJECT(row_box), "app_data", app_data);
+    g_object_set_data(G_OBJECT(row_box), "title_label", title_label);
+    g_object_set_data(G_OBJECT(row_box), "details_label", details_label);
+    g_object_set_data(G_OBJECT(row_box), "spinner", spinner);
+    g_object_set_data(G_OBJECT(row_box), "popover", popover);
+    gtk_list_item_set_child(list_item, row_box);
+}
+
+static void on_chat_bind(GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data) {
+    (void)factory; (void)user_data;
+    ChatListItem *item = gtk_list_item_get_item(list_item);
+    GtkWidget *row_box = gtk_list_item_get_child(list_item);
+    update_chat_row(item, row_box);
+    g_signal_connect(item, "notify", G_CALLBACK(on_chat_item_changed), row_box);
+}
+
+static void on_chat_unbind(GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data) {
+    (void)factory; (void)user_data;
+    g_signal_handlers_disconnect_by_func(gtk_list_item_get_item(list_item), on_chat_item_changed,
+                                         gtk_list_item_get_child(list_item));
+}
+
+// The popover is a child of the row box and has to be removed with it.
+static void on_chat_teardown(GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data) {
+    (void)factory; (void)user_data;
+    GtkWidget *row_box = gtk_list_item_get_child(list_item);
+    if (row_box) gtk_widget_unparent(g_object_get_data(G_OBJECT(row_box), "popover"));
+}
+
+static void on_chat_activated(GtkListView *list_view, guint position, gpointer user_data) {
+    (void)list_view;
+    AppData *app_data = (AppData *)user_data;
+    ChatListItem *item = g_list_model_get_item(G_LIST_MODEL(app_data->history_model), position);
+    if (!item) return;
+    history_open_chat(app_data, chat_list_item_get_id(item), G_MAXUINT);
+    g_object_unref(item);
+}
+
+// --- Search Results ---
+
+static GtkWidget *create_search_result_row(AppData *app_data, const ChatSearchResult *result) {
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    GtkWidget *title = gtk_label_new(history_get_chat_title(app_data, result->chat_id));
+    gtk_label_set_ellipsize(GTK_LABEL(title), PANGO_ELLIPSIZE_END);
+    gtk_widget_set_halign(title, GTK_ALIGN_START);
+    gtk_widget_add_css_class(title, "heading");
+    GtkWidget *snippet = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(snippet), result->snippet);
+    gtk_label_set_wrap(GTK_LABEL(snippet), TRUE);
+    gtk_label_set_lines(GTK_LABEL(snippet), 2);
+    gtk_label_set_ellipsize(GTK_LABEL(snippet), PANGO_ELLIPSIZE_END);
+    gtk_label_set_xalign(GTK_LABEL(snippet), 0);
+    gtk_widget_add_css_class(snippet, "dim-label");
+    gtk_box_append(GTK_BOX(box), title);
+    gtk_box_append(GTK_BOX(box), snippet);
+
+    GtkWidget *row = gtk_list_box_row_new();
+    gtk_list_box_row_set_child(GTK_LIST_BOX_ROW(row), box);
+    g_object_set_data_full(G_OBJECT(row), "chat-id", g_strdup(result->chat_id), g_free);
+    g_object_set_data(G_OBJECT(row), "message-index", GUINT_TO_POINTER(result->message_index));
+    return row;
+}
+
+// Shows the results of the latest query.
+static void on_search_results(GPtrArray *results, gpointer user_data) {
+    AppData *app_data = (AppData *)user_data;
+    gtk_list_box_remove_all(app_data->search_results_box);
+    for (guint i = 0; i < results->len; i++) {
+        const ChatSearchResult *result = g_ptr_array_index(results, i);
+        // The index may still hold a chat that was just deleted
+        if (!chat_catalog_lookup(app_data->chat_catalog, result->chat_id)) continue;
+        gtk_list_box_append(app_data->search_results_box, create_search_result_row(app_data, result));
+    }
+    g_ptr_array_unref(results);
+    gtk_stack_set_visible_child_name(app_data->history_stack, "results");
 }
 
-static void on_history_context_menu(GtkGestureClick *gesture, int n_press, double x, double y, gpointer user_data) {
-    (void)x;
+// The previous results stay up until the new ones arrive.
+static void on_search_changed(GtkSearchEntry *entry, gpointer user_data) {
     AppData *app_data = (AppData *)user_data;
-    GtkListBoxRow *row = gtk_list_box_get_row_at_y(app_data->history_list_box, y);
-
-    if (n_press == 1 && gtk_gesture_single_get_current_button(GTK_GESTURE_SINGLE(gesture)) == GDK_BUTTON_SECONDARY && row) {
-        gtk_list_box_select_row(app_data->history_list_box, row);
-
-        GMenu *menu = g_menu_new();
-        g_menu_append(menu, "Rename", "app.rename-chat");
-        g_menu_append(menu, "Delete", "app.delete-chat");
-
-        GtkWidget *popover = gtk_popover_menu_new_from_model(G_MENU_MODEL(menu));
-        gtk_widget_set_parent(popover, GTK_WIDGET(app_data->history_list_box));
-
-        graphene_rect_t bounds;
-        if (gtk_widget_compute_bounds(GTK_WIDGET(row), GTK_WIDGET(app_data->history_list_box), &bounds)) {
-            GdkRectangle rect = {
-                .x = bounds.origin.x,
-                .y = bounds.origin.y,
-                .width = bounds.size.width,
-                .height = bounds.size.height
-            };
-            gtk_popover_set_pointing_to(GTK_POPOVER(popover), &rect);
-        }
-
-        gtk_popover_popup(GTK_POPOVER(popover));
-        g_object_unref(menu);
+    const char *text = gtk_editable_get_text(GTK_EDITABLE(entry));
+    if (!text[0]) {
+        chat_search_cancel_queries(app_data->chat_search);
+        gtk_list_box_remove_all(app_data->search_results_box);
+        gtk_stack_set_visible_child_name(app_data->history_stack, "chats");
+        return;
     }
+    chat_search_query(app_data->chat_search, text, SEARCH_RESULT_LIMIT, on_search_results, app_data);
+}
+
+static void on_search_result_activated(GtkListBox *box, GtkListBoxRow *row, gpointer user_data) {
+    (void)box;
+    AppData *app_data = (AppData *)user_data;
+    const char *chat_id = g_object_get_data(G_OBJECT(row), "chat-id");
+    history_open_chat(app_data, chat_id, GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(row), "message-index")));
 }
 
 GtkWidget *create_history_panel(AppData *app_data) {
@@ -46,23 +200,51 @@ GtkWidget *create_history_panel(AppData *app_data) {
     gtk_revealer_set_transition_type(app_data->history_revealer, GTK_REVEALER_TRANSITION_TYPE_SLIDE_RIGHT);
     gtk_revealer_set_reveal_child(app_data->history_revealer, app_data->history_panel_visible);
 
+    GtkWidget *history_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_widget_set_size_request(history_box, 250, -1);
+
+    GtkWidget *search_entry = gtk_search_entry_new();
+    gtk_search_entry_set_placeholder_text(GTK_SEARCH_ENTRY(search_entry), "Search chats");
+    gtk_widget_set_margin_start(search_entry, 6);
+    gtk_widget_set_margin_end(search_entry, 6);
+    gtk_widget_set_margin_top(search_entry, 6);
+    gtk_widget_set_margin_bottom(search_entry, 6);
+    g_signal_connect(search_entry, "search-changed", G_CALLBACK(on_search_changed), app_data);
+    gtk_box_append(GTK_BOX(history_box), search_entry);
+
+    app_data->history_stack = GTK_STACK(gtk_stack_new());
+    gtk_widget_set_vexpand(GTK_WIDGET(app_data->history_stack), TRUE);
+    gtk_box_append(GTK_BOX(history_box), GTK_WIDGET(app_data->history_stack));
+
     GtkWidget *history_scroll = gtk_scrolled_window_new();
     gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(history_scroll), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
-    gtk_widget_set_size_request(history_scroll, 250, -1);
-    app_data->history_list_box = GTK_LIST_BOX(gtk_list_box_new());
-    gtk_list_box_set_selection_mode(app_data->history_list_box, GTK_SELECTION_SINGLE);
-    
-    gtk_list_box_bind_model(app_data->history_list_box, G_LIST_MODEL(app_data->history_store), create_history_row, NULL, NULL);
+    GtkListItemFactory *factory = gtk_signal_list_item_factory_new();
+    g_signal_connect(factory, "setup", G_CALLBACK(on_chat_setup), app_data);
+    g_signal_connect(factory, "bind", G_CALLBACK(on_chat_bind), app_data);
+    g_signal_connect(factory, "unbind", G_CALLBACK(on_chat_unbind), app_data);
+    g_signal_connect(factory, "teardown", G_CALLBACK(on_chat_teardown), app_data);
+    app_data->history_selection = gtk_single_selection_new(G_LIST_MODEL(g_object_ref(app_data->history_model)));
+    gtk_single_selection_set_autoselect(app_data->history_selection, FALSE);
+    gtk_single_selection_set_can_unselect(app_data->history_selection, TRUE);
+    app_data->history_list = GTK_LIST_VIEW(gtk_list_view_new(GTK_SELECTION_MODEL(app_data->history_selection), factory));
+    gtk_list_view_set_single_click_activate(app_data->history_list, TRUE);
+    gtk_widget_add_css_class(GTK_WIDGET(app_data->history_list), "navigation-sidebar");
+    g_signal_connect(app_data->history_list, "activate", G_CALLBACK(on_chat_activated), app_data);
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(history_scroll), GTK_WIDGET(app_data->history_list));
+    gtk_stack_add_named(app_data->history_stack, history_scroll, "chats");
 
-    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(history_scroll), GTK_WIDGET(app_data->history_list_box));
-    gtk_revealer_set_child(app_data->history_revealer, history_scroll);
-    
-    g_signal_connect(app_data->history_list_box, "row-activated", G_CALLBACK(history_load_selected_chat), app_data);
+    GtkWidget *results_scroll = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(results_scroll), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    app_data->search_results_box = GTK_LIST_BOX(gtk_list_box_new());
+    gtk_list_box_set_selection_mode(app_data->search_results_box, GTK_SELECTION_SINGLE);
+    GtkWidget *no_results = gtk_label_new("No matching messages");
+    gtk_widget_add_css_class(no_results, "dim-label");
+    gtk_list_box_set_placeholder(app_data->search_results_box, no_results);
+    g_signal_connect(app_data->search_results_box, "row-activated", G_CALLBACK(on_search_result_activated), app_data);
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(results_scroll), GTK_WIDGET(app_data->search_results_box));
+    gtk_stack_add_named(app_data->history_stack, results_scroll, "results");
 
-    GtkGesture *context_gesture = gtk_gesture_click_new();
-    gtk_gesture_single_set_button(GTK_GESTURE_SINGLE(context_gesture), GDK_BUTTON_SECONDARY);
-    g_signal_connect(context_gesture, "pressed", G_CALLBACK(on_history_context_menu), app_data);
-    gtk_widget_add_controller(GTK_WIDGET(app_data->history_list_box), GTK_EVENT_CONTROLLER(context_gesture));
+    gtk_revealer_set_child(app_data->history_revealer, history_box);
 
     return GTK_WIDGET(app_data->history_revealer);
 }
@@ -3,25 +3,133 @@
 #include "web_search.h"
 #include "history.h"
 #include "ui_chat_view.h"
+#include "ui_callbacks.h"
+#include "chat_message_item.h"
+#include "conversation_model.h"
+#include "context_gather.h"
+#include "chat_session.h"
+#include "context_budget.h"
+#include "model_catalog.h"
 
-static gboolean is_binary_file(const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) return FALSE;
+static char *format_tokens(gint tokens) {
+    if (tokens < 1000) return g_strdup_printf("%d", tokens);
+    return g_strdup_printf("%.1fk", tokens / 1000.0);
+}
+
+/**
+ * Shows how much of num_ctx the next request takes: the history as it would
+ * be sent, plus the message being typed. Called on every change to the
+ * input, so the history is not planned again here and the message is
+ * estimated from its length in characters.
+ */
+static void show_context_usage(AppData *app_data) {
+    ContextPlan *plan = app_data->context_plan;
+    gint draft_tokens = context_budget_estimate(app_data->current_model,
+                                                gtk_text_buffer_get_char_count(app_data->text_buffer));
+    gint num_ctx = model_catalog_get_num_ctx(app_data, app_data->current_model);
+    gint used = (plan ? plan->tokens : 0) + draft_tokens;
+    gboolean trimmed = (plan && (plan->first > plan->summarized || plan->collapsed > 0)) ||
+                       used > context_budget_get_limit(num_ctx);
+
+    char *used_text = format_tokens(used);
+    char *limit_text = format_tokens(num_ctx);
+    GString *label = g_string_new(NULL);
+    g_string_printf(label, "%s / %s", used_text, limit_text);
+    if (app_data->prompt_cached_percent >= 0) {
+        g_string_append_printf(label, " · %d%% cached", app_data->prompt_cached_percent);
+    }
+    gtk_label_set_text(app_data->context_label, label->str);
+    GString *tooltip = g_string_new(NULL);
+    g_string_printf(tooltip, "About %d of the %d tokens in the context window", used, num_ctx);
+    if (app_data->prompt_cached_percent >= 0) {
+        g_string_append_printf(tooltip, "; Ollama reused about %d%% of the last prompt from its cache",
+                               app_data->prompt_cached_percent);
+    }
+    if (plan && plan->summarized > 0) {
+        g_string_append_printf(tooltip, "; the first %u messages are sent as a summary", plan->summarized);
+    }
+    if (trimmed) g_string_append(tooltip, "; older messages or their attachments are left out to fit");
+    gtk_widget_set_tooltip_text(GTK_WIDGET(app_data->context_label), tooltip->str);
+    if (trimmed) {
+        gtk_widget_add_css_class(GTK_WIDGET(app_data->context_label), "warning");
+    } else {
+        gtk_widget_remove_css_class(GTK_WIDGET(app_data->context_label), "warning");
+    }
+    g_free(used_text);
+    g_free(limit_text);
+    g_string_free(label, TRUE);
+    g_string_free(tooltip, TRUE);
+}
 
-    unsigned char buffer[1024];
-    size_t bytes_read = fread(buffer, 1, sizeof(buffer), file);
-    fclose(file);
+static void on_input_changed(GtkTextBuffer *buffer, gpointer user_data) {
+    (void)buffer;
+    show_context_usage((AppData *)user_data);
+}
+
+static void on_context_progress(const char *status, gpointer user_data) {
+    ChatSession *session = (ChatSession *)user_data;
+    if (session->pending_user_item) {
+        chat_message_item_set_status(session->pending_user_item, status);
+    }
+}
+
+// The user message is complete: store it with its attachments and, unless the
+// user pressed Stop while they were gathered, send it. The user may have
+// switched to another chat by now.
+static void on_context_ready(const char *message, GPtrArray *attachments, gboolean cancelled, gpointer user_data) {
+    ChatSession *session = (ChatSession *)user_data;
+    AppData *app_data = session->app_data;
+    session->context_gather = NULL;
+    conversation_append_with_attachments(session->conversation, CONVERSATION_ROLE_USER, message, attachments);
+    if (chat_session_is_shown(session)) {
+        conversation_model_end_pending(app_data->chat_model, TRUE);
+    }
+    g_clear_object(&session->pending_user_item);
+    history_save_session(session);
+    if (chat_session_is_shown(session)) ui_input_update_context_usage(app_data);
+
+    if (cancelled) {
+        ui_schedule_reset_send_button(session);
+        return;
+    }
+    session->response_item = chat_message_item_new_pending(CONVERSATION_ROLE_ASSISTANT, NULL);
+    if (chat_session_is_shown(session)) {
+        conversation_model_begin_pending(app_data->chat_model, session->response_item);
+        ui_schedule_scroll_to_bottom(app_data);
+    }
+    ui_start_response_ticks(session);
+    api_send_chat(session);
+}
 
-    for (size_t i = 0; i < bytes_read; i++) {
-        if (buffer[i] == 0) {
-            return TRUE;
+// Names of the files referenced as @file, NULL-terminated.
+static char **find_file_references(const char *text) {
+    GPtrArray *files = g_ptr_array_new();
+    GRegex *regex = g_regex_new("@[\\w\\d\\._-]+", 0, 0, NULL);
+    GMatchInfo *match_info;
+    if (g_regex_match(regex, text, 0, &match_info)) {
+        while (g_match_info_matches(match_info)) {
+            char *match = g_match_info_fetch(match_info, 0);
+            if (match) {
+                g_ptr_array_add(files, g_strdup(match + 1));
+                g_free(match);
+            }
+            g_match_info_next(match_info, NULL);
         }
     }
-    return FALSE;
+    if (match_info) g_match_info_free(match_info);
+    if (regex) g_regex_unref(regex);
+    g_ptr_array_add(files, NULL);
+    return (char **)g_ptr_array_free(files, FALSE);
 }
 
+/**
+ * The user bubble appears at once. Referenced URLs and files are gathered
+ * in the background, with progress shown under the bubble, and the chat
+ * request goes out when they are in (or the deadline passes). Each chat
+ * generates one response at a time; other chats are not held up.
+ */
 static void send_message(AppData *app_data) {
-    if (app_data->is_generating) return;
+    if (chat_session_lookup(app_data, app_data->current_chat_id)) return;
 
     GtkTextIter start, end;
     gtk_text_buffer_get_bounds(app_data->text_buffer, &start, &end);
@@ -29,82 +137,22 @@ static void send_message(AppData *app_data) {
     char *stripped_text = g_strstrip(text);
 
     if (stripped_text && strlen(stripped_text) > 0) {
-        ChatMessage user_msg = {.is_user = TRUE};
-        strncpy(user_msg.content, stripped_text, MAX_MESSAGE_LEN - 1);
-
-        add_message_to_chat(app_data, &user_msg);
-
-        char *final_text_to_send = NULL;
-        GString *prepended_content = g_string_new("");
-
-        if (app_data->web_search_enabled) {
-            char *url = find_url(stripped_text);
-            if (url) {
-                char *url_content = fetch_url_content(url);
-                if (url_content) {
-                    g_string_append_printf(prepended_content, "Content from URL %s:\n\n%s\n\n---\n\n", url, url_content);
-                    g_free(url_content);
-                }
-                g_free(url);
-            }
-        }
-
-        GRegex *regex = g_regex_new("@[\\w\\d\\._-]+", 0, 0, NULL);
-        GMatchInfo *match_info;
-        if (g_regex_match(regex, stripped_text, 0, &match_info)) {
-            while (g_match_info_matches(match_info)) {
-                char *match = g_match_info_fetch(match_info, 0);
-                if (match) {
-                    char *filename = match + 1;
-                    if (is_binary_file(filename)) {
-                        g_string_append_printf(prepended_content, "Content from binary file %s was not included.\n\n", filename);
-                    } else {
-                        char *file_content = NULL;
-                        GError *error = NULL;
-                        if (g_file_get_contents(filename, &file_content, NULL, &error)) {
-                            g_string_append_printf(prepended_content, "Content from file %s:\n\n%s\n\n---\n\n", filename, file_content);
-                            g_free(file_content);
-                        } else {
-                            fprintf(stderr, "Error reading file %s: %s\n", filename, error->message);
-                            g_error_free(error);
-                        }
-                    }
-                    g_free(match);
-                }
-                g_match_info_next(match_info, NULL);
-            }
-        }
-        if (match_info) g_match_info_free(match_info);
-        if (regex) g_regex_unref(regex);
-
-        if (prepended_content->len > 0) {
-            final_text_to_send = g_strconcat(prepended_content->str, "User message: ", stripped_text, NULL);
-        } else {
-            final_text_to_send = g_strdup(stripped_text);
-        }
-        g_string_free(prepended_content, TRUE);
-
-        json_object *user_json = json_object_new_object();
-        json_object_object_add(user_json, "role", json_object_new_string("user"));
-        json_object_object_add(user_json, "content", json_object_new_string(final_text_to_send));
-        json_object_array_add(app_data->messages_array, user_json);
-        history_save_chat(app_data);
-
+        ChatSession *session = chat_session_new(app_data);
+        session->pending_user_item = add_pending_message_to_chat(app_data, CONVERSATION_ROLE_USER, stripped_text);
         gtk_text_buffer_set_text(app_data->text_buffer, "", -1);
 
-        ChatMessage assistant_msg = {.is_user = FALSE, .content = ""};
-        app_data->current_response_widget = add_message_to_chat(app_data, &assistant_msg);
-        app_data->current_response_label = GTK_LABEL(g_object_get_data(G_OBJECT(app_data->current_response_widget), "content_label"));
-
-        app_data->is_generating = TRUE;
-        app_data->request_cancelled = FALSE;
-        gtk_widget_set_sensitive(GTK_WIDGET(app_data->send_btn), TRUE);
-        gtk_button_set_icon_name(app_data->send_btn, "media-playback-stop-symbolic");
-        gtk_widget_set_tooltip_text(GTK_WIDGET(app_data->send_btn), "Cancel Request");
-        gtk_widget_set_visible(GTK_WIDGET(app_data->spinner), TRUE);
-        gtk_spinner_start(app_data->spinner);
-
-        api_send_chat(app_data, final_text_to_send);
+        char *url = app_data->web_search_enabled ? find_url(stripped_text) : NULL;
+        char **files = find_file_references(stripped_text);
+        ContextGatherOptions options = {
+            .transport = api_get_transport(),
+            .url_timeout = app_data->url_fetch_timeout,
+            .file_timeout = app_data->file_read_timeout,
+            .deadline = app_data->context_deadline,
+        };
+        session->context_gather = context_gather_start(stripped_text, url, files, &options,
+                                                       on_context_progress, on_context_ready, session);
+        g_free(url);
+        g_strfreev(files);
     }
     g_free(text);
 }
@@ -112,8 +160,9 @@ static void send_message(AppData *app_data) {
 static void on_send_clicked(GtkButton *button, gpointer user_data) {
     (void)button;
     AppData *app_data = (AppData *)user_data;
-    if (app_data->is_generating) {
-        app_data->request_cancelled = TRUE;
+    ChatSession *session = chat_session_lookup(app_data, app_data->current_chat_id);
+    if (session) {
+        chat_session_cancel(session);
     } else {
         send_message(app_data);
     }
@@ -191,8 +240,16 @@ GtkWidget *create_input_area(AppData *app_data) {
 
     app_data->spinner = GTK_SPINNER(gtk_spinner_new());
     gtk_widget_set_visible(GTK_WIDGET(app_data->spinner), FALSE);
+
+    app_data->context_label = GTK_LABEL(gtk_label_new(NULL));
+    app_data->prompt_cached_percent = -1;
+    gtk_widget_add_css_class(GTK_WIDGET(app_data->context_label), "caption");
+    gtk_widget_add_css_class(GTK_WIDGET(app_data->context_label), "dim-label");
+    gtk_widget_set_valign(GTK_WIDGET(app_data->context_label), GTK_ALIGN_CENTER);
+    g_signal_connect(app_data->text_buffer, "changed", G_CALLBACK(on_input_changed), app_data);
     
     gtk_box_append(GTK_BOX(input_box), text_scroll);
+    gtk_box_append(GTK_BOX(input_box), GTK_WIDGET(app_data->context_label));
     gtk_box_append(GTK_BOX(input_box), GTK_WIDGET(app_data->spinner));
     gtk_box_append(GTK_BOX(input_box), GTK_WIDGET(app_data->send_btn));
     gtk_frame_set_child(GTK_FRAME(input_frame), input_box);
@@ -202,4 +259,16 @@ GtkWidget *create_input_area(AppData *app_data) {
     gtk_widget_add_controller(GTK_WIDGET(app_data->text_view), key_controller);
 
     return input_frame;
-}
\ No newline at end of file
+}
+
+// Plans the shown chat's history again, after it, the estimates or the
+// settings changed.
+void ui_input_update_context_usage(AppData *app_data) {
+    g_clear_pointer(&app_data->context_plan, context_budget_plan_free);
+    if (app_data->conversation) {
+        app_data->context_plan = context_budget_plan(app_data->conversation, app_data->current_model,
+                                                     app_data->system_prompt,
+                                                     model_catalog_get_num_ctx(app_data, app_data->current_model), 0);
+    }
+    show_context_usage(app_data);
+}
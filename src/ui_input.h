@@ -4,5 +4,6 @@
 #include "app_data.h"
 
 GtkWidget *create_input_area(AppData *app_data);
+void ui_input_update_context_usage(AppData *app_data);
 
 #endif // UI_INPUT_H
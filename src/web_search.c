@@ -5,6 +5,7 @@
 #include <curl/curl.h>
 #include <glib.h>
 #include "web_search.h"
+#include "transport.h"
 
 struct MemoryStruct {
     char *memory;
@@ -149,40 +150,51 @@ static char *strip_html(const char *html) {
     return g_string_free(text, FALSE);
 }
 
-char *fetch_url_content(const char *url) {
-    CURL *curl_handle;
-    CURLcode res;
+typedef struct {
     struct MemoryStruct chunk;
+    UrlFetchFunc callback;
+    gpointer user_data;
+} UrlFetch;
+
+static void on_url_fetch_done(CURL *easy, CURLcode result, gpointer user_data) {
+    (void)easy;
+    UrlFetch *fetch = (UrlFetch *)user_data;
+    if (result == CURLE_OK) {
+        char *text_content = strip_html(fetch->chunk.memory);
+        fetch->callback(text_content, NULL, fetch->user_data);
+        g_free(text_content);
+    } else {
+        fetch->callback(NULL, curl_easy_strerror(result), fetch->user_data);
+    }
+    free(fetch->chunk.memory);
+    g_free(fetch);
+}
 
-    chunk.memory = malloc(1);
-    chunk.size = 0;
-
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl_handle = curl_easy_init();
+/**
+ * Fetches `url` on the shared transport and strips it to plain text.
+ * `callback` runs on the main loop with the page text, or with NULL and an
+ * error message (including when the request is cancelled or times out).
+ */
+TransportRequest *fetch_url_content_async(Transport *transport, const char *url, long timeout_secs,
+                                          UrlFetchFunc callback, gpointer user_data) {
+    CURL *curl_handle = curl_easy_init();
+    if (!curl_handle) {
+        callback(NULL, "could not create request", user_data);
+        return NULL;
+    }
+    UrlFetch *fetch = g_new0(UrlFetch, 1);
+    fetch->chunk.memory = malloc(1);
+    fetch->chunk.memory[0] = '\0';
+    fetch->callback = callback;
+    fetch->user_data = user_data;
 
     curl_easy_setopt(curl_handle, CURLOPT_URL, url);
     curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&chunk);
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&fetch->chunk);
     curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/108.0.0.0 Safari/537.36");
     curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
-
-    res = curl_easy_perform(curl_handle);
-
-    if (res != CURLE_OK) {
-        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-        free(chunk.memory);
-        curl_easy_cleanup(curl_handle);
-        curl_global_cleanup();
-        return NULL;
-    }
-
-    char *text_content = strip_html(chunk.memory);
-
-    curl_easy_cleanup(curl_handle);
-    free(chunk.memory);
-    curl_global_cleanup();
-
-    return text_content;
+    curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, timeout_secs);
+    return transport_start(transport, curl_handle, on_url_fetch_done, fetch);
 }
 
 char *find_url(const char *text) {
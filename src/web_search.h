@@ -1,8 +1,13 @@
 #ifndef WEB_SEARCH_H
 #define WEB_SEARCH_H
 
+#include "transport.h"
+
+typedef void (*UrlFetchFunc)(const char *text, const char *error, gpointer user_data);
+
 char *perform_web_search(const char *query);
-char *fetch_url_content(const char *url);
+TransportRequest *fetch_url_content_async(Transport *transport, const char *url, long timeout_secs,
+                                          UrlFetchFunc callback, gpointer user_data);
 char *find_url(const char *text);
 
 #endif // WEB_SEARCH_H
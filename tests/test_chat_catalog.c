@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <string.h>
+#include <utime.h>
+#include <glib/gstdio.h>
+#include "chat_catalog.h"
+#include "chat_journal.h"
+#include "chat_pack.h"
+#include "persist.h"
+#include "test_util.h"
+
+/**
+ * The catalog caching what the history list shows of each chat: built from
+ * the chat files when there is none, read back as it was written, kept in
+ * display order as chats are added and removed, compacted once most of its
+ * lines are stale, and brought in line with chats changed by someone else.
+ */
+#define CHAT_A "0b8f2c1e-3d4a-4b5c-8d6e-7f8091a2b3c4"
+#define CHAT_B "11111111-2222-4333-8444-555555555555"
+
+typedef struct {
+    char *dir;
+} Fixture;
+
+// --- Private Helper Functions ---
+
+static void fixture_set_up(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    fixture->dir = test_util_make_dir();
+    chat_pack_init(fixture->dir);
+}
+
+static void fixture_tear_down(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    persist_flush();
+    chat_pack_shutdown();
+    test_util_remove_dir(fixture->dir);
+}
+
+static char *chat_path(Fixture *fixture, const char *id) {
+    return g_build_filename(fixture->dir, id, NULL);
+}
+
+static void write_chat(Fixture *fixture, const char *id, const char *first_message, guint count) {
+    char *path = chat_path(fixture, id);
+    Conversation *conversation = conversation_new();
+    ChatJournal *journal = chat_journal_new(path, conversation);
+    for (guint i = 0; i < count; i++) {
+        conversation_append(conversation, i % 2 ? CONVERSATION_ROLE_ASSISTANT : CONVERSATION_ROLE_USER,
+                            i == 0 ? first_message : "more", -1);
+    }
+    chat_journal_sync(journal);
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+    g_free(path);
+    persist_flush();
+}
+
+// Sets the modification time of the chat's files to `seconds` from now.
+static void touch_chat(Fixture *fixture, const char *id, gint64 seconds) {
+    char *path = chat_path(fixture, id);
+    char *journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+    struct utimbuf times;
+    times.actime = times.modtime = g_get_real_time() / G_USEC_PER_SEC + seconds;
+    g_utime(path, &times);
+    g_utime(journal_path, &times);
+    g_free(journal_path);
+    g_free(path);
+}
+
+// Positions agree with the display order.
+static void assert_positions(ChatCatalog *catalog) {
+    for (guint i = 0; i < chat_catalog_get_length(catalog); i++) {
+        const ChatCatalogEntry *entry = chat_catalog_get_entry(catalog, i);
+        g_assert_cmpint(chat_catalog_get_position(catalog, entry->id), ==, (gint)i);
+    }
+}
+
+static guint count_lines(const char *path) {
+    char *contents = test_util_read_file(path);
+    g_assert_nonnull(contents);
+    guint lines = 0;
+    for (const char *c = contents; *c; c++) {
+        if (*c == '\n') lines++;
+    }
+    g_free(contents);
+    return lines;
+}
+
+// --- Tests ---
+
+static void test_built_from_chats(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    write_chat(fixture, "My old chat", "  hello there\nsecond line", 2);
+    write_chat(fixture, CHAT_A, "a question", 3);
+    ChatCatalog *catalog = chat_catalog_load(fixture->dir);
+    g_assert_cmpuint(chat_catalog_get_length(catalog), ==, 2);
+    assert_positions(catalog);
+
+    // Chats renamed before the catalog existed were named after their title
+    const ChatCatalogEntry *entry = chat_catalog_lookup(catalog, "My old chat");
+    g_assert_nonnull(entry);
+    g_assert_cmpstr(chat_catalog_entry_get_title(entry), ==, "My old chat");
+    g_assert_cmpstr(entry->preview, ==, "hello there");
+    g_assert_cmpuint(entry->message_count, ==, 2);
+    entry = chat_catalog_lookup(catalog, CHAT_A);
+    g_assert_null(entry->title);
+    g_assert_cmpstr(chat_catalog_entry_get_title(entry), ==, "a question");
+    g_assert_cmpuint(entry->message_count, ==, 3);
+    chat_catalog_free(catalog);
+    persist_flush();
+
+    // Read back from the catalog file alone
+    char *path = chat_path(fixture, CHAT_A);
+    chat_journal_remove_files(path);
+    g_free(path);
+    persist_flush();
+    catalog = chat_catalog_load(fixture->dir);
+    g_assert_cmpuint(chat_catalog_get_length(catalog), ==, 2);
+    g_assert_cmpstr(chat_catalog_lookup(catalog, CHAT_A)->preview, ==, "a question");
+    chat_catalog_free(catalog);
+}
+
+static void test_changes_persist(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    write_chat(fixture, CHAT_A, "first", 1);
+    ChatCatalog *catalog = chat_catalog_load(fixture->dir);
+    chat_catalog_add(catalog, CHAT_B);
+    g_assert_cmpint(chat_catalog_get_position(catalog, CHAT_B), ==, 0);
+    g_assert_cmpint(chat_catalog_get_position(catalog, CHAT_A), ==, 1);
+    g_assert_cmpstr(chat_catalog_entry_get_title(chat_catalog_lookup(catalog, CHAT_B)), ==, "New Chat");
+
+    Conversation *conversation = conversation_new();
+    conversation_append(conversation, CONVERSATION_ROLE_USER, "new question", -1);
+    g_assert_true(chat_catalog_update(catalog, CHAT_B, conversation, "llama3"));
+    g_assert_false(chat_catalog_update(catalog, CHAT_B, conversation, "llama3"));
+    conversation_unref(conversation);
+    chat_catalog_set_title(catalog, CHAT_A, "Renamed");
+    chat_catalog_free(catalog);
+    persist_flush();
+
+    catalog = chat_catalog_load(fixture->dir);
+    const ChatCatalogEntry *entry = chat_catalog_lookup(catalog, CHAT_B);
+    g_assert_cmpstr(entry->preview, ==, "new question");
+    g_assert_cmpstr(entry->model, ==, "llama3");
+    g_assert_cmpuint(entry->message_count, ==, 1);
+    g_assert_cmpstr(chat_catalog_entry_get_title(chat_catalog_lookup(catalog, CHAT_A)), ==, "Renamed");
+    chat_catalog_remove(catalog, CHAT_A);
+    g_assert_null(chat_catalog_lookup(catalog, CHAT_A));
+    g_assert_cmpint(chat_catalog_get_position(catalog, CHAT_A), ==, -1);
+    chat_catalog_free(catalog);
+    persist_flush();
+
+    catalog = chat_catalog_load(fixture->dir);
+    g_assert_cmpuint(chat_catalog_get_length(catalog), ==, 1);
+    g_assert_null(chat_catalog_lookup(catalog, CHAT_A));
+    chat_catalog_free(catalog);
+}
+
+static void test_positions(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    ChatCatalog *catalog = chat_catalog_load(fixture->dir);
+    GPtrArray *ids = g_ptr_array_new_with_free_func(g_free);
+    GRand *rand = g_rand_new_with_seed(1);
+    for (guint i = 0; i < 2000; i++) {
+        if (ids->len == 0 || g_rand_int_range(rand, 0, 3) > 0) {
+            char *id = g_uuid_string_random();
+            chat_catalog_add(catalog, id);
+            g_ptr_array_add(ids, id);
+        } else {
+            guint index = g_rand_int_range(rand, 0, ids->len);
+            chat_catalog_remove(catalog, g_ptr_array_index(ids, index));
+            g_ptr_array_remove_index_fast(ids, index);
+        }
+        g_assert_cmpuint(chat_catalog_get_length(catalog), ==, ids->len);
+        if (i % 100 == 0) assert_positions(catalog);
+    }
+    assert_positions(catalog);
+    g_rand_free(rand);
+    g_ptr_array_unref(ids);
+    chat_catalog_free(catalog);
+}
+
+static void test_torn_line(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    ChatCatalog *catalog = chat_catalog_load(fixture->dir);
+    chat_catalog_add(catalog, CHAT_A);
+    chat_catalog_free(catalog);
+    persist_flush();
+    char *path = g_build_filename(fixture->dir, ".catalog", NULL);
+    FILE *file = fopen(path, "a");
+    g_assert_nonnull(file);
+    fputs("{\"id\":\"" CHAT_B "\",\"modified_at\":", file);
+    fclose(file);
+    g_free(path);
+
+    catalog = chat_catalog_load(fixture->dir);
+    g_assert_cmpuint(chat_catalog_get_length(catalog), ==, 1);
+    g_assert_nonnull(chat_catalog_lookup(catalog, CHAT_A));
+    chat_catalog_free(catalog);
+}
+
+static void test_compacted(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    ChatCatalog *catalog = chat_catalog_load(fixture->dir);
+    chat_catalog_add(catalog, CHAT_A);
+    for (guint i = 0; i < 1000; i++) chat_catalog_set_title(catalog, CHAT_A, i % 2 ? "odd" : "even");
+    chat_catalog_free(catalog);
+    persist_flush();
+
+    char *path = g_build_filename(fixture->dir, ".catalog", NULL);
+    g_assert_cmpuint(count_lines(path), <=, 2 * 1 + 256 + 1);
+    g_free(path);
+    catalog = chat_catalog_load(fixture->dir);
+    g_assert_cmpstr(chat_catalog_lookup(catalog, CHAT_A)->title, ==, "odd");
+    chat_catalog_free(catalog);
+}
+
+static void test_rescan(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    write_chat(fixture, CHAT_A, "first", 1);
+    ChatCatalog *catalog = chat_catalog_load(fixture->dir);
+    g_assert_cmpint(chat_catalog_rescan(catalog, CHAT_A), ==, CHAT_CATALOG_UNCHANGED);
+
+    // Written by another instance
+    write_chat(fixture, CHAT_B, "from elsewhere", 2);
+    g_assert_cmpint(chat_catalog_rescan(catalog, CHAT_B), ==, CHAT_CATALOG_ADDED);
+    g_assert_cmpint(chat_catalog_get_position(catalog, CHAT_B), ==, 0);
+    g_assert_cmpstr(chat_catalog_lookup(catalog, CHAT_B)->preview, ==, "from elsewhere");
+
+    char *path = chat_path(fixture, CHAT_A);
+    ChatJournal *journal;
+    Conversation *conversation = test_util_load_chat(path, &journal);
+    conversation_append(conversation, CONVERSATION_ROLE_ASSISTANT, "an answer", -1);
+    conversation_append(conversation, CONVERSATION_ROLE_USER, "and another", -1);
+    chat_journal_sync(journal);
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+    persist_flush();
+    touch_chat(fixture, CHAT_A, 60);
+    g_assert_cmpint(chat_catalog_rescan(catalog, CHAT_A), ==, CHAT_CATALOG_UPDATED);
+    g_assert_cmpuint(chat_catalog_lookup(catalog, CHAT_A)->message_count, ==, 3);
+    g_assert_cmpint(chat_catalog_rescan(catalog, CHAT_A), ==, CHAT_CATALOG_UNCHANGED);
+
+    g_free(path);
+    path = chat_path(fixture, CHAT_B);
+    chat_journal_remove_files(path);
+    g_free(path);
+    persist_flush();
+    g_assert_cmpint(chat_catalog_rescan(catalog, CHAT_B), ==, CHAT_CATALOG_REMOVED);
+    g_assert_cmpuint(chat_catalog_get_length(catalog), ==, 1);
+    assert_positions(catalog);
+    chat_catalog_free(catalog);
+}
+
+static void test_chat_filenames(void) {
+    g_assert_true(chat_catalog_is_chat_filename(CHAT_A));
+    g_assert_false(chat_catalog_is_chat_filename(CHAT_A CHAT_JOURNAL_SUFFIX));
+    g_assert_false(chat_catalog_is_chat_filename(".catalog"));
+}
+
+// --- Public Functions ---
+
+int main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+    persist_init();
+    g_test_add("/chat_catalog/built_from_chats", Fixture, NULL, fixture_set_up, test_built_from_chats,
+               fixture_tear_down);
+    g_test_add("/chat_catalog/changes_persist", Fixture, NULL, fixture_set_up, test_changes_persist,
+               fixture_tear_down);
+    g_test_add("/chat_catalog/positions", Fixture, NULL, fixture_set_up, test_positions, fixture_tear_down);
+    g_test_add("/chat_catalog/torn_line", Fixture, NULL, fixture_set_up, test_torn_line, fixture_tear_down);
+    g_test_add("/chat_catalog/compacted", Fixture, NULL, fixture_set_up, test_compacted, fixture_tear_down);
+    g_test_add("/chat_catalog/rescan", Fixture, NULL, fixture_set_up, test_rescan, fixture_tear_down);
+    g_test_add_func("/chat_catalog/chat_filenames", test_chat_filenames);
+    int status = g_test_run();
+    persist_shutdown();
+    return status;
+}
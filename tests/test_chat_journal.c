@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "chat_journal.h"
+#include "chat_pack.h"
+#include "persist.h"
+#include "test_util.h"
+
+/**
+ * Replay of a chat's snapshot and journal, and the repairs made on load:
+ * an interrupted response is restored and written back, a record torn by a
+ * crash is dropped before anything is appended after it, and a stored
+ * message that cannot be read keeps its place.
+ */
+
+typedef struct {
+    char *dir;
+    char *path;
+} Fixture;
+
+// --- Private Helper Functions ---
+
+static void fixture_set_up(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    fixture->dir = test_util_make_dir();
+    fixture->path = g_build_filename(fixture->dir, "chat", NULL);
+    chat_pack_init(fixture->dir);
+}
+
+static void fixture_tear_down(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    persist_flush();
+    chat_pack_shutdown();
+    g_free(fixture->path);
+    test_util_remove_dir(fixture->dir);
+}
+
+// A new chat of `count` turns, journaled one message at a time.
+static void write_chat(const char *path, guint count) {
+    Conversation *conversation = conversation_new();
+    ChatJournal *journal = chat_journal_new(path, conversation);
+    for (guint i = 0; i < count; i++) {
+        char *content = g_strdup_printf("message %u", i);
+        conversation_append(conversation, i % 2 ? CONVERSATION_ROLE_ASSISTANT : CONVERSATION_ROLE_USER, content, -1);
+        chat_journal_sync(journal);
+        g_free(content);
+    }
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+}
+
+static void append_to_file(const char *path, const char *text) {
+    FILE *file = fopen(path, "a");
+    g_assert_nonnull(file);
+    fputs(text, file);
+    fclose(file);
+}
+
+// --- Tests ---
+
+static void test_replay(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    write_chat(fixture->path, 6);
+    ChatJournal *journal;
+    Conversation *conversation = test_util_load_chat(fixture->path, &journal);
+    g_assert_nonnull(conversation);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 6);
+    for (guint i = 0; i < 6; i++) {
+        char *content = g_strdup_printf("message %u", i);
+        g_assert_cmpstr(conversation_get_content(conversation, i), ==, content);
+        g_assert_cmpint(conversation_get_message(conversation, i)->role, ==,
+                        i % 2 ? CONVERSATION_ROLE_ASSISTANT : CONVERSATION_ROLE_USER);
+        g_free(content);
+    }
+    conversation_set_summary(conversation, "they counted", 4);
+    chat_journal_save_summary(journal);
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+
+    // Replayed from the journal, without waiting for the writes to land
+    conversation = test_util_load_chat(fixture->path, NULL);
+    guint covers = 0;
+    g_assert_cmpstr(conversation_get_summary(conversation, &covers), ==, "they counted");
+    g_assert_cmpuint(covers, ==, 4);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 6);
+    conversation_unref(conversation);
+}
+
+static void test_replay_skips_known_records(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    write_chat(fixture->path, 2);
+    persist_flush();
+    // A record the snapshot holds already, as a compaction cut short leaves
+    char *journal_path = g_strconcat(fixture->path, CHAT_JOURNAL_SUFFIX, NULL);
+    char *contents = test_util_read_file(journal_path);
+    g_assert_nonnull(contents);
+    append_to_file(journal_path, contents);
+    g_free(contents);
+    g_free(journal_path);
+
+    Conversation *conversation = chat_journal_read(fixture->path);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 2);
+    conversation_unref(conversation);
+}
+
+static void test_interrupted_response(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    Conversation *conversation = conversation_new();
+    ChatJournal *journal = chat_journal_new(fixture->path, conversation);
+    conversation_append(conversation, CONVERSATION_ROLE_USER, "hi", -1);
+    chat_journal_sync(journal);
+    chat_journal_checkpoint(journal, "Hel", 3);
+    chat_journal_checkpoint(journal, "Hello wor", 9);
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+
+    // Read only: the partial response is left out
+    persist_flush();
+    conversation = chat_journal_read(fixture->path);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 1);
+    conversation_unref(conversation);
+
+    conversation = test_util_load_chat(fixture->path, NULL);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 2);
+    g_assert_cmpint(conversation_get_message(conversation, 1)->role, ==, CONVERSATION_ROLE_ASSISTANT);
+    g_assert_cmpstr(conversation_get_content(conversation, 1), ==, "Hello wor");
+    conversation_unref(conversation);
+
+    // Written back as a stored message, not restored a second time
+    conversation = test_util_load_chat(fixture->path, NULL);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 2);
+    g_assert_cmpstr(conversation_get_content(conversation, 1), ==, "Hello wor");
+    conversation_unref(conversation);
+}
+
+static void test_torn_record(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    write_chat(fixture->path, 2);
+    persist_flush();
+    char *journal_path = g_strconcat(fixture->path, CHAT_JOURNAL_SUFFIX, NULL);
+    append_to_file(journal_path, "{\"index\":2,\"role\":\"user\",\"cont");
+
+    ChatJournal *journal;
+    Conversation *conversation = test_util_load_chat(fixture->path, &journal);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 2);
+    conversation_append(conversation, CONVERSATION_ROLE_USER, "after the crash", -1);
+    chat_journal_sync(journal);
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+    persist_flush();
+
+    char *contents = test_util_read_file(journal_path);
+    g_assert_null(strstr(contents, "\"cont{"));
+    g_assert_true(g_str_has_suffix(contents, "\n"));
+    g_free(contents);
+    g_free(journal_path);
+
+    conversation = test_util_load_chat(fixture->path, NULL);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 3);
+    g_assert_cmpstr(conversation_get_content(conversation, 2), ==, "after the crash");
+    conversation_unref(conversation);
+}
+
+static void test_unreadable_record(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    g_assert_true(g_file_set_contents(fixture->path,
+                                      "[\n"
+                                      "{\"role\":\"user\",\"content\":\"first\"},\n"
+                                      "{\"role\":\"narrator\",\"content\":\"lost\"},\n"
+                                      "{\"content\":\"other order\",\"role\":\"assistant\"}\n"
+                                      "]\n",
+                                      -1, NULL));
+    char *journal_path = g_strconcat(fixture->path, CHAT_JOURNAL_SUFFIX, NULL);
+    g_assert_true(g_file_set_contents(journal_path, "{\"index\":3,\"role\":\"user\",\"content\":\"appended\"}\n", -1,
+                                      NULL));
+    g_free(journal_path);
+
+    // Later messages keep their indexes, so the journal still applies
+    Conversation *conversation = chat_journal_read(fixture->path);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 4);
+    g_assert_cmpstr(conversation_get_content(conversation, 1), ==, "");
+    g_assert_cmpstr(conversation_get_content(conversation, 2), ==, "other order");
+    g_assert_cmpint(conversation_get_message(conversation, 2)->role, ==, CONVERSATION_ROLE_ASSISTANT);
+    g_assert_cmpstr(conversation_get_content(conversation, 3), ==, "appended");
+    conversation_unref(conversation);
+}
+
+static void test_compaction(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    Conversation *conversation = conversation_new();
+    ChatJournal *journal = chat_journal_new(fixture->path, conversation);
+    char *long_text = g_strnfill(4000, 'x');
+    for (guint i = 0; i < 60; i++) {
+        conversation_append(conversation, i % 2 ? CONVERSATION_ROLE_ASSISTANT : CONVERSATION_ROLE_USER, long_text, -1);
+        chat_journal_sync(journal);
+    }
+    g_free(long_text);
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+    persist_flush();
+
+    // The journal was folded into the snapshot at least once
+    char *journal_path = g_strconcat(fixture->path, CHAT_JOURNAL_SUFFIX, NULL);
+    GStatBuf st;
+    g_assert_cmpint(g_stat(journal_path, &st), ==, 0);
+    g_assert_cmpint(st.st_size, <, 60 * 4000);
+    g_free(journal_path);
+
+    conversation = test_util_load_chat(fixture->path, NULL);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, 60);
+    conversation_unref(conversation);
+}
+
+static void test_remove_files(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    write_chat(fixture->path, 2);
+    chat_journal_remove_files(fixture->path);
+    ChatJournal *journal = NULL;
+    g_assert_null(test_util_load_chat(fixture->path, &journal));
+    g_assert_null(journal);
+}
+
+// --- Public Functions ---
+
+int main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+    persist_init();
+    g_test_add("/chat_journal/replay", Fixture, NULL, fixture_set_up, test_replay, fixture_tear_down);
+    g_test_add("/chat_journal/replay_skips_known_records", Fixture, NULL, fixture_set_up,
+               test_replay_skips_known_records, fixture_tear_down);
+    g_test_add("/chat_journal/interrupted_response", Fixture, NULL, fixture_set_up, test_interrupted_response,
+               fixture_tear_down);
+    g_test_add("/chat_journal/torn_record", Fixture, NULL, fixture_set_up, test_torn_record, fixture_tear_down);
+    g_test_add("/chat_journal/unreadable_record", Fixture, NULL, fixture_set_up, test_unreadable_record,
+               fixture_tear_down);
+    g_test_add("/chat_journal/compaction", Fixture, NULL, fixture_set_up, test_compaction, fixture_tear_down);
+    g_test_add("/chat_journal/remove_files", Fixture, NULL, fixture_set_up, test_remove_files, fixture_tear_down);
+    int status = g_test_run();
+    persist_shutdown();
+    return status;
+}
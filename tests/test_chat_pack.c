@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "chat_journal.h"
+#include "chat_pack.h"
+#include "persist.h"
+#include "test_util.h"
+
+/**
+ * Moving chats into packs and reading them back: a packed chat reads the
+ * same as it did loose, also after the indexes are read again, a chat
+ * written loose again leaves its pack, one written while it was being
+ * packed stays loose, and an index whose entries point outside the pack, or
+ * at a frame of another length, is not trusted.
+ */
+#define CHATS 12
+#define MESSAGES 20
+
+typedef struct {
+    char *dir;
+    GPtrArray *paths;
+    char *before[CHATS]; // each chat as a snapshot, before it was packed
+    guint checked;       // chats the migration asked about
+    char *keep;          // path the migration must leave loose
+    char *change;        // path written to once packed, as by another instance
+} Fixture;
+
+// --- Private Helper Functions ---
+
+static char *read_snapshot(const char *path) {
+    GBytes *bytes = chat_journal_read_snapshot(path);
+    if (!bytes) return NULL;
+    char *text = g_strndup(g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
+    g_bytes_unref(bytes);
+    return text;
+}
+
+static void write_chat(const char *path, guint number) {
+    Conversation *conversation = conversation_new();
+    ChatJournal *journal = chat_journal_new(path, conversation);
+    for (guint i = 0; i < MESSAGES; i++) {
+        char *content = g_strdup_printf("Message %u of chat %u, with **markdown**:\n- item %u\n```c\nint x = %u;\n```\n",
+                                        i, number, i * number, i + number);
+        conversation_append(conversation, i % 2 ? CONVERSATION_ROLE_ASSISTANT : CONVERSATION_ROLE_USER, content, -1);
+        if (i % 5 == 4) chat_journal_sync(journal);
+        g_free(content);
+    }
+    // An interrupted response, restored in the packed copy
+    chat_journal_checkpoint(journal, "partial", 7);
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+}
+
+static void fixture_set_up(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    fixture->dir = test_util_make_dir();
+    fixture->paths = g_ptr_array_new_with_free_func(g_free);
+    chat_pack_init(fixture->dir);
+    for (guint i = 0; i < CHATS; i++) {
+        char *path = g_strdup_printf("%s/chat-%u", fixture->dir, i);
+        write_chat(path, i);
+        g_ptr_array_add(fixture->paths, path);
+    }
+    persist_flush();
+    for (guint i = 0; i < CHATS; i++) {
+        fixture->before[i] = read_snapshot(g_ptr_array_index(fixture->paths, i));
+        g_assert_nonnull(fixture->before[i]);
+    }
+}
+
+static void fixture_tear_down(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    persist_flush();
+    chat_pack_shutdown();
+    for (guint i = 0; i < CHATS; i++) g_free(fixture->before[i]);
+    g_ptr_array_unref(fixture->paths);
+    test_util_remove_dir(fixture->dir);
+}
+
+static gboolean check_chat(const char *path, gpointer user_data) {
+    Fixture *fixture = user_data;
+    fixture->checked++;
+    if (g_strcmp0(path, fixture->change) == 0) {
+        char *journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+        FILE *file = fopen(journal_path, "a");
+        g_assert_nonnull(file);
+        fprintf(file, "{\"index\":%u,\"role\":\"user\",\"content\":\"elsewhere\",\"created_at\":1}\n", MESSAGES);
+        fclose(file);
+        g_free(journal_path);
+    }
+    return g_strcmp0(path, fixture->keep) != 0;
+}
+
+// Packs every chat but `fixture->keep`, and waits until the loose files of
+// the others are gone.
+static void migrate(Fixture *fixture) {
+    chat_pack_migrate(fixture->paths, check_chat, fixture);
+    while (fixture->checked < CHATS) g_main_context_iteration(NULL, TRUE);
+    persist_flush();
+}
+
+// The packed chats read as they did loose. Not the one left loose: its
+// partial response is restored again, stamped with the time of reading.
+static void assert_unchanged(Fixture *fixture) {
+    for (guint i = 0; i < CHATS; i++) {
+        if (g_ptr_array_index(fixture->paths, i) == fixture->keep) continue;
+        char *after = read_snapshot(g_ptr_array_index(fixture->paths, i));
+        g_assert_cmpstr(after, ==, fixture->before[i]);
+        g_free(after);
+    }
+}
+
+static void write_pack(const char *dir, const char *index) {
+    char *pack_dir = g_build_filename(dir, ".packs", NULL);
+    g_assert_cmpint(g_mkdir_with_parents(pack_dir, 0755), ==, 0);
+    char *pack = g_build_filename(pack_dir, "0000000000000001-0.pack", NULL);
+    char *index_path = g_build_filename(pack_dir, "0000000000000001-0.index", NULL);
+    g_assert_true(g_file_set_contents(pack, "abcdefgh", 8, NULL));
+    g_assert_true(g_file_set_contents(index_path, index, -1, NULL));
+    g_free(index_path);
+    g_free(pack);
+    g_free(pack_dir);
+}
+
+// --- Tests ---
+
+static void test_roundtrip(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    fixture->keep = g_ptr_array_index(fixture->paths, 3);
+    migrate(fixture);
+    for (guint i = 0; i < CHATS; i++) {
+        const char *path = g_ptr_array_index(fixture->paths, i);
+        char *journal_path = g_strconcat(path, CHAT_JOURNAL_SUFFIX, NULL);
+        g_assert_cmpint(g_file_test(path, G_FILE_TEST_EXISTS), ==, i == 3);
+        g_assert_cmpint(g_file_test(journal_path, G_FILE_TEST_EXISTS), ==, i == 3);
+        g_free(journal_path);
+        GBytes *packed = chat_pack_read(path);
+        g_assert_true((packed != NULL) == (i != 3));
+        if (packed) g_bytes_unref(packed);
+    }
+    assert_unchanged(fixture);
+    GPtrArray *ids = chat_pack_list_ids();
+    g_assert_cmpuint(ids->len, ==, CHATS - 1);
+    g_ptr_array_unref(ids);
+
+    // The same chats once the indexes are read again
+    chat_pack_shutdown();
+    chat_pack_init(fixture->dir);
+    assert_unchanged(fixture);
+    g_assert_cmpint(chat_pack_get_modified_at(g_ptr_array_index(fixture->paths, 0)), >, 0);
+    g_assert_cmpint(chat_pack_get_modified_at(g_ptr_array_index(fixture->paths, 3)), ==, 0);
+}
+
+static void test_written_loose_again(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    migrate(fixture);
+    const char *path = g_ptr_array_index(fixture->paths, 5);
+    ChatJournal *journal;
+    Conversation *conversation = test_util_load_chat(path, &journal);
+    g_assert_nonnull(conversation);
+    persist_flush();
+    g_assert_false(g_file_test(path, G_FILE_TEST_EXISTS));
+    guint length = conversation_get_length(conversation);
+    conversation_append(conversation, CONVERSATION_ROLE_USER, "one more", -1);
+    chat_journal_sync(journal);
+    chat_journal_close(journal);
+    conversation_unref(conversation);
+    persist_flush();
+
+    g_assert_true(g_file_test(path, G_FILE_TEST_EXISTS));
+    g_assert_null(chat_pack_read(path));
+    conversation = chat_journal_read(path);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, length + 1);
+    g_assert_cmpstr(conversation_get_content(conversation, length), ==, "one more");
+    conversation_unref(conversation);
+
+    // Its pack's index no longer lists it
+    chat_pack_shutdown();
+    chat_pack_init(fixture->dir);
+    g_assert_null(chat_pack_read(path));
+}
+
+static void test_changed_after_read(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    fixture->change = g_ptr_array_index(fixture->paths, 7);
+    migrate(fixture);
+    const char *path = fixture->change;
+    g_assert_true(g_file_test(path, G_FILE_TEST_EXISTS));
+    g_assert_null(chat_pack_read(path));
+    Conversation *conversation = chat_journal_read(path);
+    g_assert_cmpuint(conversation_get_length(conversation), ==, MESSAGES + 1);
+    g_assert_cmpstr(conversation_get_content(conversation, MESSAGES), ==, "elsewhere");
+    conversation_unref(conversation);
+    g_assert_nonnull(chat_pack_read(g_ptr_array_index(fixture->paths, 6)));
+}
+
+static void test_removed(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    migrate(fixture);
+    for (guint i = 0; i < CHATS; i++) chat_journal_remove_files(g_ptr_array_index(fixture->paths, i));
+    persist_flush();
+    GPtrArray *ids = chat_pack_list_ids();
+    g_assert_cmpuint(ids->len, ==, 0);
+    g_ptr_array_unref(ids);
+    // The emptied pack is gone
+    char *pack_dir = g_build_filename(fixture->dir, ".packs", NULL);
+    GDir *dir = g_dir_open(pack_dir, 0, NULL);
+    g_assert_nonnull(dir);
+    g_assert_null(g_dir_read_name(dir));
+    g_dir_close(dir);
+    g_free(pack_dir);
+}
+
+static void test_bad_index(void) {
+    char *dir = test_util_make_dir();
+    write_pack(dir, "{\"dict_size\":0}\n"
+                    "{\"id\":\"long\",\"offset\":0,\"size\":8,\"length\":99999999999,\"modified_at\":1}\n"
+                    "{\"id\":\"outside\",\"offset\":18446744073709551615,\"size\":2,\"length\":5,\"modified_at\":1}\n"
+                    "{\"id\":\"past_end\",\"offset\":4,\"size\":8,\"length\":5,\"modified_at\":1}\n");
+    chat_pack_init(dir);
+    const char *ids[] = { "long", "outside", "past_end" };
+    for (guint i = 0; i < G_N_ELEMENTS(ids); i++) {
+        char *path = g_build_filename(dir, ids[i], NULL);
+        g_assert_null(chat_pack_read(path));
+        g_assert_null(chat_journal_read(path));
+        g_free(path);
+    }
+    chat_pack_shutdown();
+    test_util_remove_dir(dir);
+}
+
+// --- Public Functions ---
+
+int main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+    persist_init();
+    g_test_add("/chat_pack/roundtrip", Fixture, NULL, fixture_set_up, test_roundtrip, fixture_tear_down);
+    g_test_add("/chat_pack/written_loose_again", Fixture, NULL, fixture_set_up, test_written_loose_again,
+               fixture_tear_down);
+    g_test_add("/chat_pack/changed_after_read", Fixture, NULL, fixture_set_up, test_changed_after_read,
+               fixture_tear_down);
+    g_test_add("/chat_pack/removed", Fixture, NULL, fixture_set_up, test_removed, fixture_tear_down);
+    g_test_add_func("/chat_pack/bad_index", test_bad_index);
+    int status = g_test_run();
+    persist_shutdown();
+    return status;
+}
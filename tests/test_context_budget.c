@@ -0,0 +1,220 @@
+#include <string.h>
+#include "blob_store.h"
+#include "context_budget.h"
+#include "persist.h"
+#include "test_util.h"
+
+/**
+ * The planner choosing what of a chat is sent in num_ctx: all of it while it
+ * fits, then the newest turns starting with a user message, attachments left
+ * out before turns are, the summary in place of the turns it covers, and the
+ * same window again on the next turn while it fits. Also the per-model
+ * calibration of the token estimates.
+ */
+
+// --- Private Helper Functions ---
+
+// A chat of `turns` user and assistant turns of about `bytes` each.
+static Conversation *make_chat(guint turns, gsize bytes) {
+    Conversation *conversation = conversation_new();
+    char *text = g_strnfill(bytes, 'w');
+    for (guint i = 0; i < turns; i++) {
+        conversation_append(conversation, CONVERSATION_ROLE_USER, text, -1);
+        conversation_append(conversation, CONVERSATION_ROLE_ASSISTANT, text, -1);
+    }
+    g_free(text);
+    return conversation;
+}
+
+static gboolean wire_contains(GBytes *wire, const char *text) {
+    gsize size;
+    const char *data = g_bytes_get_data(wire, &size);
+    return g_strstr_len(data, size, text) != NULL;
+}
+
+// --- Tests ---
+
+static void test_limit(void) {
+    g_assert_cmpint(context_budget_get_limit(2048), ==, 1536);
+    g_assert_cmpint(context_budget_get_limit(8192), ==, 7168);
+    g_assert_cmpint(context_budget_get_limit(100), ==, 75);
+}
+
+static void test_calibration_per_model(void) {
+    g_assert_cmpint(context_budget_estimate("calibrated", 400), ==, 100);
+    context_budget_calibrate("calibrated", 1000, 1300);
+    g_assert_cmpint(context_budget_estimate("calibrated", 400), ==, 115);
+    g_assert_cmpint(context_budget_estimate("other", 400), ==, 100);
+    g_assert_cmpint(context_budget_estimate(NULL, 400), ==, 100);
+
+    // Counts far off the estimate, as a cached prompt gives, are not taken
+    context_budget_calibrate("calibrated", 1000, 100);
+    context_budget_calibrate("calibrated", 1000, 5000);
+    g_assert_cmpint(context_budget_estimate("calibrated", 400), ==, 115);
+
+    g_assert_cmpint(context_budget_cached_percent(1000, 250), ==, 75);
+    g_assert_cmpint(context_budget_cached_percent(1000, 0), ==, -1);
+    g_assert_cmpint(context_budget_cached_percent(100, 500), ==, 0);
+}
+
+static void test_everything_fits(void) {
+    Conversation *conversation = make_chat(3, 40);
+    ContextPlan *plan = context_budget_plan(conversation, "fits", "Be brief.", 8192, 0);
+    g_assert_cmpuint(plan->first, ==, 0);
+    g_assert_cmpuint(plan->collapsed, ==, 0);
+    g_assert_false(plan->continues);
+    g_assert_cmpuint(plan->wire->len, ==, 1 + 6);
+    g_assert_true(wire_contains(g_ptr_array_index(plan->wire, 0), "Be brief."));
+    g_assert_cmpint(plan->tokens, >, 0);
+    g_assert_cmpint(plan->tokens, <=, context_budget_get_limit(8192));
+    context_budget_plan_free(plan);
+    conversation_unref(conversation);
+}
+
+static void test_window_kept(void) {
+    Conversation *conversation = make_chat(30, 400);
+    ContextPlan *plan = context_budget_plan(conversation, "window", NULL, 4096, 0);
+    guint first = plan->first;
+    g_assert_cmpuint(first, >, 0);
+    context_budget_remember(conversation, plan);
+    context_budget_plan_free(plan);
+
+    // The next turn is sent after the same messages
+    conversation_append(conversation, CONVERSATION_ROLE_USER, "and then?", -1);
+    plan = context_budget_plan(conversation, "window", NULL, 4096, 0);
+    g_assert_true(plan->continues);
+    g_assert_cmpuint(plan->first, ==, first);
+    context_budget_remember(conversation, plan);
+    context_budget_plan_free(plan);
+
+    // Until they no longer fit
+    char *long_text = g_strnfill(4000, 'w');
+    conversation_append(conversation, CONVERSATION_ROLE_ASSISTANT, long_text, -1);
+    conversation_append(conversation, CONVERSATION_ROLE_USER, long_text, -1);
+    g_free(long_text);
+    plan = context_budget_plan(conversation, "window", NULL, 4096, 0);
+    g_assert_false(plan->continues);
+    g_assert_cmpuint(plan->first, >, first);
+    context_budget_plan_free(plan);
+    conversation_unref(conversation);
+}
+
+static void test_trimmed(void) {
+    Conversation *conversation = make_chat(20, 400);
+    ContextPlan *plan = context_budget_plan(conversation, "trimmed", "Be brief.", 2048, 0);
+    guint length = conversation_get_length(conversation);
+    g_assert_cmpuint(plan->first, >, 0);
+    g_assert_cmpuint(plan->first, <, length);
+    g_assert_cmpint(conversation_get_message(conversation, plan->first)->role, ==, CONVERSATION_ROLE_USER);
+    g_assert_cmpuint(plan->wire->len, ==, 1 + length - plan->first);
+    g_assert_cmpint(plan->tokens, <=, context_budget_get_limit(2048));
+    context_budget_plan_free(plan);
+
+    // Room kept for the message being typed
+    plan = context_budget_plan(conversation, "trimmed", "Be brief.", 2048, 500);
+    g_assert_cmpint(plan->tokens + 500, <=, context_budget_get_limit(2048));
+    context_budget_plan_free(plan);
+    conversation_unref(conversation);
+}
+
+static void test_assistant_token_count(void) {
+    Conversation *conversation = make_chat(1, 40);
+    ContextPlan *plan = context_budget_plan(conversation, "counted", NULL, 8192, 0);
+    gint tokens = plan->tokens;
+    context_budget_plan_free(plan);
+    GBytes *wire = conversation_get_wire_json(conversation, 1);
+    gint estimated = context_budget_estimate("counted", g_bytes_get_size(wire));
+    g_bytes_unref(wire);
+
+    // The eval_count Ollama reported replaces the estimate
+    conversation_set_token_count(conversation, 1, 500);
+    plan = context_budget_plan(conversation, "counted", NULL, 8192, 0);
+    g_assert_cmpint(plan->tokens, ==, tokens - estimated + 500);
+    context_budget_plan_free(plan);
+    conversation_unref(conversation);
+}
+
+static void test_summary(void) {
+    Conversation *conversation = make_chat(20, 400);
+    conversation_set_summary(conversation, "They talked at length.", 10);
+    ContextPlan *plan = context_budget_plan(conversation, "summary", "Be brief.", 2048, 0);
+    g_assert_cmpuint(plan->summarized, ==, 10);
+    g_assert_cmpuint(plan->first, >=, 10);
+    g_assert_true(wire_contains(g_ptr_array_index(plan->wire, 1), "Summary of the conversation so far"));
+    g_assert_true(wire_contains(g_ptr_array_index(plan->wire, 1), "They talked at length."));
+    g_assert_cmpuint(plan->wire->len, ==, 2 + conversation_get_length(conversation) - plan->first);
+    context_budget_plan_free(plan);
+    conversation_unref(conversation);
+}
+
+static void test_system_prompt_canonical(void) {
+    Conversation *conversation = make_chat(1, 40);
+    ContextPlan *plan = context_budget_plan(conversation, "system", "  Be brief.\r\nAlways.  ", 8192, 0);
+    ContextPlan *same = context_budget_plan(conversation, "system", "Be brief.\nAlways.", 8192, 0);
+    g_assert_true(g_bytes_equal(g_ptr_array_index(plan->wire, 0), g_ptr_array_index(same->wire, 0)));
+    context_budget_plan_free(same);
+    context_budget_plan_free(plan);
+
+    plan = context_budget_plan(conversation, "system", " \n ", 8192, 0);
+    g_assert_cmpuint(plan->wire->len, ==, 2);
+    context_budget_plan_free(plan);
+    conversation_unref(conversation);
+}
+
+static void test_attachments_collapsed(void) {
+    char *dir = test_util_make_dir();
+    blob_store_init(dir);
+    char *file = g_strnfill(4000, 'f');
+    char *key = blob_store_put(file, strlen(file));
+    Conversation *conversation = conversation_new();
+    for (guint i = 0; i < 6; i++) {
+        GPtrArray *attachments = g_ptr_array_new_with_free_func((GDestroyNotify)conversation_attachment_free);
+        g_ptr_array_add(attachments, conversation_attachment_new(CONVERSATION_ATTACHMENT_FILE, "f.txt", key));
+        conversation_append_with_attachments(conversation, CONVERSATION_ROLE_USER, "about the file", attachments);
+        g_ptr_array_unref(attachments);
+        guint answer = conversation_append(conversation, CONVERSATION_ROLE_ASSISTANT, "an answer", -1);
+        conversation_set_token_count(conversation, answer, 50);
+    }
+    conversation_append(conversation, CONVERSATION_ROLE_USER, "last", -1);
+
+    ContextPlan *plan = context_budget_plan(conversation, "attachments", NULL, 8192, 0);
+    g_assert_cmpuint(plan->collapsed, ==, 0);
+    context_budget_plan_free(plan);
+
+    // The turns all go, some without their attachments, newest kept in full
+    plan = context_budget_plan(conversation, "attachments", NULL, 2048, 0);
+    g_assert_cmpuint(plan->first, ==, 0);
+    g_assert_cmpuint(plan->collapsed, >, 0);
+    g_assert_cmpuint(plan->collapsed_end, >, 0);
+    g_assert_true(wire_contains(g_ptr_array_index(plan->wire, plan->wire->len - 3), "ffff"));
+    g_assert_false(wire_contains(g_ptr_array_index(plan->wire, 0), "ffff"));
+    g_assert_cmpint(plan->tokens, <=, context_budget_get_limit(2048));
+    context_budget_plan_free(plan);
+
+    conversation_unref(conversation);
+    g_free(key);
+    g_free(file);
+    persist_flush();
+    blob_store_shutdown();
+    test_util_remove_dir(dir);
+}
+
+// --- Public Functions ---
+
+int main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+    persist_init();
+    g_test_add_func("/context_budget/limit", test_limit);
+    g_test_add_func("/context_budget/calibration_per_model", test_calibration_per_model);
+    g_test_add_func("/context_budget/everything_fits", test_everything_fits);
+    g_test_add_func("/context_budget/window_kept", test_window_kept);
+    g_test_add_func("/context_budget/trimmed", test_trimmed);
+    g_test_add_func("/context_budget/assistant_token_count", test_assistant_token_count);
+    g_test_add_func("/context_budget/summary", test_summary);
+    g_test_add_func("/context_budget/system_prompt_canonical", test_system_prompt_canonical);
+    g_test_add_func("/context_budget/attachments_collapsed", test_attachments_collapsed);
+    int status = g_test_run();
+    context_budget_shutdown();
+    persist_shutdown();
+    return status;
+}
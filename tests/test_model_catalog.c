@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <glib/gstdio.h>
+#include "model_catalog.h"
+#include "app_data.h"
+#include "ollama_api.h"
+#include "persist.h"
+#include "test_util.h"
+#include "ui.h"
+#include "ui_input.h"
+
+/**
+ * The model catalog against a small Ollama stand-in on the loopback
+ * interface, which answers /api/show with the details in `show_details`:
+ * details are kept while a model's digest is unchanged and asked for again
+ * once it changes, one /api/show serves every name of a model, num_ctx is
+ * clamped to what the model supports, and the cache file reads back as it
+ * was written. The parts of ollama_api.c and the UI the catalog calls are
+ * replaced below.
+ */
+
+typedef struct {
+    AppData *app_data;
+} Fixture;
+
+static Transport *transport = NULL;
+static int server_socket = -1;
+static GThread *server_thread = NULL;
+static char *base_url = NULL;
+
+static GMutex show_lock;
+static GHashTable *show_details = NULL; // model name -> context length it reports
+static guint show_count = 0;            // /api/show requests started
+static guint models_published = 0;     // calls of ui_update_models_dropdown()
+
+// --- Private Helper Functions ---
+
+static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    HttpResponse *response = (HttpResponse *)userp;
+    char *ptr = realloc(response->data, response->size + realsize + 1);
+    if (!ptr) return 0;
+    response->data = ptr;
+    memcpy(&response->data[response->size], contents, realsize);
+    response->size += realsize;
+    response->data[response->size] = '\0';
+    return realsize;
+}
+
+// The reply of the stand-in to a POST of `body` to /api/show.
+static char *show_reply(const char *body) {
+    const char *name = strstr(body, "\"model\":\"");
+    if (!name) return g_strdup("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    name += strlen("\"model\":\"");
+    char *model = g_strndup(name, strcspn(name, "\""));
+    g_mutex_lock(&show_lock);
+    gpointer context_length = g_hash_table_lookup(show_details, model);
+    g_mutex_unlock(&show_lock);
+    g_free(model);
+    if (!context_length) return g_strdup("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+    char *json = g_strdup_printf("{\"details\":{\"parameter_size\":\"8.0B\",\"quantization_level\":\"Q4_K_M\"},"
+                                 "\"model_info\":{\"general.architecture\":\"llama\",\"llama.context_length\":%d},"
+                                 "\"template\":\"{{ .Prompt }}\"}",
+                                 GPOINTER_TO_INT(context_length));
+    char *reply = g_strdup_printf("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+                                  "Connection: close\r\n\r\n%s",
+                                  strlen(json), json);
+    g_free(json);
+    return reply;
+}
+
+// Answers one connection: reads the request up to the end of its body.
+static void serve(int client) {
+    GString *request = g_string_new(NULL);
+    char buffer[4096];
+    gssize got;
+    gsize body_start = 0;
+    gsize wanted = 0;
+    while ((got = read(client, buffer, sizeof(buffer))) > 0) {
+        g_string_append_len(request, buffer, got);
+        const char *end_of_headers = body_start ? NULL : strstr(request->str, "\r\n\r\n");
+        if (end_of_headers) {
+            body_start = end_of_headers - request->str + 4;
+            const char *length = g_strstr_len(request->str, body_start, "Content-Length:");
+            wanted = body_start + (length ? strtoul(length + strlen("Content-Length:"), NULL, 10) : 0);
+        }
+        if (body_start && request->len >= wanted) break;
+    }
+    if (body_start) {
+        char *reply = show_reply(request->str + body_start);
+        gsize length = strlen(reply);
+        gsize written = 0;
+        while (written < length && (got = write(client, reply + written, length - written)) > 0) written += got;
+        g_free(reply);
+    }
+    g_string_free(request, TRUE);
+    close(client);
+}
+
+static gpointer server_thread_func(gpointer data) {
+    (void)data;
+    int client;
+    while ((client = accept(server_socket, NULL, NULL)) >= 0) serve(client);
+    return NULL;
+}
+
+static void start_server(void) {
+    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(server_socket, >=, 0);
+    struct sockaddr_in address = { 0 };
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_len = sizeof(address);
+    g_assert_cmpint(bind(server_socket, (struct sockaddr *)&address, address_len), ==, 0);
+    g_assert_cmpint(listen(server_socket, 16), ==, 0);
+    g_assert_cmpint(getsockname(server_socket, (struct sockaddr *)&address, &address_len), ==, 0);
+    base_url = g_strdup_printf("http://127.0.0.1:%u", ntohs(address.sin_port));
+    server_thread = g_thread_new("server", server_thread_func, NULL);
+}
+
+static void stop_server(void) {
+    shutdown(server_socket, SHUT_RDWR);
+    g_thread_join(server_thread);
+    close(server_socket);
+    g_free(base_url);
+}
+
+static void set_show_details(const char *model, gint context_length) {
+    g_mutex_lock(&show_lock);
+    g_hash_table_insert(show_details, g_strdup(model), GINT_TO_POINTER(context_length));
+    g_mutex_unlock(&show_lock);
+}
+
+static char *get_cache_path(void) {
+    return g_build_filename(g_get_user_cache_dir(), "ollama-chat", "models.json", NULL);
+}
+
+static void fixture_set_up(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    char *path = get_cache_path();
+    g_remove(path);
+    g_free(path);
+    fixture->app_data = g_new0(AppData, 1);
+    fixture->app_data->base_url = base_url;
+    fixture->app_data->connect_timeout = 5;
+    show_count = 0;
+    models_published = 0;
+    model_catalog_load(fixture->app_data);
+}
+
+static void fixture_tear_down(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    model_catalog_shutdown();
+    persist_flush();
+    for (int i = 0; i < fixture->app_data->model_count; i++) g_free(fixture->app_data->models[i]);
+    free(fixture->app_data->models);
+    g_free(fixture->app_data);
+    g_mutex_lock(&show_lock);
+    g_hash_table_remove_all(show_details);
+    g_mutex_unlock(&show_lock);
+}
+
+// Waits for the /api/show requests started so far, which the catalog
+// announces with ui_update_models_dropdown() once all are done.
+static void wait_for_shows(void) {
+    while (models_published == 0) g_main_context_iteration(NULL, TRUE);
+    models_published = 0;
+}
+
+static void update(Fixture *fixture, const char *models) {
+    char *tags = g_strdup_printf("{\"models\":[%s]}", models);
+    g_assert_true(model_catalog_update(fixture->app_data, tags));
+    g_free(tags);
+}
+
+// --- Replaced Functions ---
+
+gboolean api_post_start(ApiPost *post, AppData *app_data, const char *path, const char *body, gsize len,
+                        long timeout, TransportDoneFunc done_func, gpointer user_data, const char *category,
+                        const char *name) {
+    (void)category;
+    (void)name;
+    g_assert_cmpstr(path, ==, "/api/show");
+    show_count++;
+    CURL *curl = curl_easy_init();
+    if (!curl) return FALSE;
+    char *url = g_strconcat(app_data->base_url, path, NULL);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)len);
+    curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, body);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &post->response);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    g_free(url);
+    post->request = transport_start(transport, curl, done_func, user_data);
+    return TRUE;
+}
+
+void api_post_clear(ApiPost *post) {
+    g_clear_pointer(&post->response.data, free);
+    post->response.size = 0;
+}
+
+Transport *api_get_transport(void) {
+    return transport;
+}
+
+void ui_update_models_dropdown(AppData *app_data) {
+    (void)app_data;
+    models_published++;
+}
+
+void ui_input_update_context_usage(AppData *app_data) {
+    (void)app_data;
+}
+
+// --- Tests ---
+
+static void test_details_kept(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    set_show_details("llama3:latest", 8192);
+    set_show_details("qwen2:7b", 32768);
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\",\"details\":{\"parameter_size\":\"8B\"}},"
+                    "{\"name\":\"qwen2:7b\",\"digest\":\"d2\"}");
+    g_assert_cmpint(fixture->app_data->model_count, ==, 2);
+    g_assert_cmpstr(fixture->app_data->models[0], ==, "llama3:latest");
+    // Before /api/show answers, the details /api/tags gave
+    g_assert_cmpstr(model_catalog_lookup("llama3:latest")->parameter_size, ==, "8B");
+    g_assert_false(model_catalog_lookup("llama3:latest")->shown);
+    wait_for_shows();
+    g_assert_cmpuint(show_count, ==, 2);
+    const ModelInfo *info = model_catalog_lookup("llama3:latest");
+    g_assert_true(info->shown);
+    g_assert_cmpint(info->context_length, ==, 8192);
+    g_assert_cmpstr(info->parameter_size, ==, "8.0B");
+    g_assert_cmpstr(info->quantization_level, ==, "Q4_K_M");
+    g_assert_cmpstr(info->template, ==, "{{ .Prompt }}");
+    g_assert_cmpint(model_catalog_lookup("qwen2:7b")->context_length, ==, 32768);
+
+    // Listed again with the same digests, also in another order
+    update(fixture, "{\"name\":\"qwen2:7b\",\"digest\":\"d2\"},{\"name\":\"llama3:latest\",\"digest\":\"d1\"}");
+    g_assert_cmpuint(show_count, ==, 2);
+    g_assert_cmpstr(fixture->app_data->models[0], ==, "qwen2:7b");
+    g_assert_cmpint(model_catalog_lookup("llama3:latest")->context_length, ==, 8192);
+    g_assert_true(model_catalog_lookup("llama3:latest")->shown);
+    g_assert_null(model_catalog_lookup("gone"));
+}
+
+static void test_digest_changed(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    set_show_details("llama3:latest", 8192);
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\"}");
+    wait_for_shows();
+    g_assert_cmpuint(show_count, ==, 1);
+
+    // Pulled again under the same name
+    set_show_details("llama3:latest", 131072);
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d3\"}");
+    g_assert_cmpuint(show_count, ==, 2);
+    g_assert_false(model_catalog_lookup("llama3:latest")->shown);
+    wait_for_shows();
+    const ModelInfo *info = model_catalog_lookup("llama3:latest");
+    g_assert_true(info->shown);
+    g_assert_cmpstr(info->digest, ==, "d3");
+    g_assert_cmpint(info->context_length, ==, 131072);
+}
+
+static void test_aliases_shared(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    set_show_details("llama3:latest", 8192);
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\"},{\"name\":\"llama3:8b\",\"digest\":\"d1\"}");
+    wait_for_shows();
+    g_assert_cmpuint(show_count, ==, 1);
+    const ModelInfo *alias = model_catalog_lookup("llama3:8b");
+    g_assert_true(alias->shown);
+    g_assert_cmpint(alias->context_length, ==, 8192);
+    g_assert_cmpstr(alias->template, ==, "{{ .Prompt }}");
+
+    // A name added later for a model already shown
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\"},{\"name\":\"mine\",\"digest\":\"d1\"}");
+    g_assert_cmpuint(show_count, ==, 1);
+    g_assert_true(model_catalog_lookup("mine")->shown);
+    g_assert_cmpint(model_catalog_lookup("mine")->context_length, ==, 8192);
+}
+
+static void test_show_failed(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    set_show_details("llama3:latest", 8192);
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\"},{\"name\":\"unknown\",\"digest\":\"d2\"}");
+    wait_for_shows();
+    g_assert_false(model_catalog_lookup("unknown")->shown);
+    g_assert_cmpint(model_catalog_lookup("unknown")->context_length, ==, 0);
+
+    // Asked about again with the next model list
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\"},{\"name\":\"unknown\",\"digest\":\"d2\"}");
+    g_assert_cmpuint(show_count, ==, 3);
+}
+
+static void test_num_ctx(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    AppData *app_data = fixture->app_data;
+    set_show_details("llama3:latest", 8192);
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\"}");
+    wait_for_shows();
+
+    app_data->ollama_context_size = 0;
+    g_assert_cmpint(model_catalog_get_num_ctx(app_data, "llama3:latest"), ==, 8192);
+    g_assert_cmpint(model_catalog_get_num_ctx(app_data, "unknown"), ==, 2048);
+    g_assert_cmpint(model_catalog_get_num_ctx(app_data, NULL), ==, 2048);
+    app_data->ollama_context_size = 4096;
+    g_assert_cmpint(model_catalog_get_num_ctx(app_data, "llama3:latest"), ==, 4096);
+    g_assert_cmpint(model_catalog_get_num_ctx(app_data, "unknown"), ==, 4096);
+    app_data->ollama_context_size = 65536;
+    g_assert_cmpint(model_catalog_get_num_ctx(app_data, "llama3:latest"), ==, 8192);
+    g_assert_cmpint(model_catalog_get_num_ctx(app_data, "unknown"), ==, 65536);
+}
+
+static void test_cache_reloaded(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    set_show_details("llama3:latest", 8192);
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\"},{\"name\":\"qwen2:7b\",\"digest\":\"d2\"}");
+    wait_for_shows();
+    model_catalog_shutdown();
+    persist_flush();
+
+    // Read back at the next start, before Ollama is asked
+    AppData *app_data = g_new0(AppData, 1);
+    model_catalog_load(app_data);
+    g_assert_cmpint(app_data->model_count, ==, 2);
+    g_assert_cmpstr(app_data->models[0], ==, "llama3:latest");
+    g_assert_cmpstr(app_data->models[1], ==, "qwen2:7b");
+    const ModelInfo *info = model_catalog_lookup("llama3:latest");
+    g_assert_true(info->shown);
+    g_assert_cmpstr(info->digest, ==, "d1");
+    g_assert_cmpint(info->context_length, ==, 8192);
+    g_assert_cmpstr(info->parameter_size, ==, "8.0B");
+    g_assert_cmpstr(info->quantization_level, ==, "Q4_K_M");
+    g_assert_cmpstr(info->template, ==, "{{ .Prompt }}");
+    info = model_catalog_lookup("qwen2:7b");
+    g_assert_false(info->shown);
+    g_assert_null(info->template);
+    for (int i = 0; i < app_data->model_count; i++) g_free(app_data->models[i]);
+    free(app_data->models);
+    g_free(app_data);
+
+    // Shown models are not asked about again
+    update(fixture, "{\"name\":\"llama3:latest\",\"digest\":\"d1\"}");
+    g_assert_cmpuint(show_count, ==, 2);
+}
+
+static void test_not_a_model_list(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    g_assert_false(model_catalog_update(fixture->app_data, "{\"error\":\"busy\"}"));
+    g_assert_false(model_catalog_update(fixture->app_data, "not json"));
+    g_assert_false(model_catalog_update(fixture->app_data, NULL));
+    g_assert_cmpint(fixture->app_data->model_count, ==, 0);
+}
+
+// --- Public Functions ---
+
+int main(int argc, char **argv) {
+    char *cache_dir = test_util_make_dir();
+    g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+    g_test_init(&argc, &argv, NULL);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    persist_init();
+    transport = transport_new();
+    show_details = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    start_server();
+
+    g_test_add("/model_catalog/details_kept", Fixture, NULL, fixture_set_up, test_details_kept, fixture_tear_down);
+    g_test_add("/model_catalog/digest_changed", Fixture, NULL, fixture_set_up, test_digest_changed,
+               fixture_tear_down);
+    g_test_add("/model_catalog/aliases_shared", Fixture, NULL, fixture_set_up, test_aliases_shared,
+               fixture_tear_down);
+    g_test_add("/model_catalog/show_failed", Fixture, NULL, fixture_set_up, test_show_failed, fixture_tear_down);
+    g_test_add("/model_catalog/num_ctx", Fixture, NULL, fixture_set_up, test_num_ctx, fixture_tear_down);
+    g_test_add("/model_catalog/cache_reloaded", Fixture, NULL, fixture_set_up, test_cache_reloaded,
+               fixture_tear_down);
+    g_test_add("/model_catalog/not_a_model_list", Fixture, NULL, fixture_set_up, test_not_a_model_list,
+               fixture_tear_down);
+    int status = g_test_run();
+
+    stop_server();
+    g_hash_table_unref(show_details);
+    transport_free(transport);
+    persist_shutdown();
+    curl_global_cleanup();
+    test_util_remove_dir(cache_dir);
+    return status;
+}
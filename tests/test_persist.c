@@ -0,0 +1,110 @@
+#include <string.h>
+#include "persist.h"
+#include "test_util.h"
+
+/**
+ * The writer thread: jobs queued for one file are merged in order, a
+ * removal waits for the writes queued before it, and persist_flush() waits
+ * for every earlier job when called from another thread too.
+ */
+
+typedef struct {
+    char *dir;
+    char *path;
+} Fixture;
+
+// --- Private Helper Functions ---
+
+static void fixture_set_up(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    fixture->dir = test_util_make_dir();
+    fixture->path = g_build_filename(fixture->dir, "file", NULL);
+}
+
+static void fixture_tear_down(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    persist_flush();
+    g_free(fixture->path);
+    test_util_remove_dir(fixture->dir);
+}
+
+static void write_text(const char *path, const char *text) {
+    GBytes *bytes = g_bytes_new(text, strlen(text));
+    persist_write(path, bytes);
+    g_bytes_unref(bytes);
+}
+
+static void append_text(const char *path, const char *text) {
+    GBytes *bytes = g_bytes_new(text, strlen(text));
+    persist_append(path, bytes);
+    g_bytes_unref(bytes);
+}
+
+static void assert_contents(const char *path, const char *expected) {
+    char *contents = test_util_read_file(path);
+    g_assert_cmpstr(contents, ==, expected);
+    g_free(contents);
+}
+
+// A persist_call() func that holds up the writer thread before it finishes.
+static void slow_call(gpointer data) {
+    g_usleep(50 * G_TIME_SPAN_MILLISECOND);
+    g_atomic_int_set((gint *)data, TRUE);
+}
+
+static gpointer flush_thread_func(gpointer data) {
+    persist_flush();
+    return GINT_TO_POINTER(g_atomic_int_get((gint *)data));
+}
+
+// --- Tests ---
+
+static void test_merged_writes(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    append_text(fixture->path, "a");
+    append_text(fixture->path, "b");
+    persist_flush();
+    assert_contents(fixture->path, "ab");
+
+    append_text(fixture->path, "c");
+    write_text(fixture->path, "new");
+    append_text(fixture->path, "d");
+    persist_flush();
+    assert_contents(fixture->path, "newd");
+}
+
+static void test_remove_after_write(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    write_text(fixture->path, "gone");
+    persist_remove(fixture->path);
+    append_text(fixture->path, "kept");
+    persist_flush();
+    assert_contents(fixture->path, "kept");
+
+    persist_remove(fixture->path);
+    persist_flush();
+    g_assert_false(g_file_test(fixture->path, G_FILE_TEST_EXISTS));
+}
+
+static void test_flush_from_thread(Fixture *fixture, gconstpointer data) {
+    (void)data;
+    gint called = FALSE;
+    persist_call(fixture->path, NULL, slow_call, &called);
+    GThread *thread = g_thread_new("flush", flush_thread_func, &called);
+    g_assert_true(GPOINTER_TO_INT(g_thread_join(thread)));
+}
+
+// --- Public Functions ---
+
+int main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+    persist_init();
+    g_test_add("/persist/merged_writes", Fixture, NULL, fixture_set_up, test_merged_writes, fixture_tear_down);
+    g_test_add("/persist/remove_after_write", Fixture, NULL, fixture_set_up, test_remove_after_write,
+               fixture_tear_down);
+    g_test_add("/persist/flush_from_thread", Fixture, NULL, fixture_set_up, test_flush_from_thread,
+               fixture_tear_down);
+    int status = g_test_run();
+    persist_shutdown();
+    return status;
+}
@@ -0,0 +1,72 @@
+#include <glib/gstdio.h>
+#include "test_util.h"
+
+typedef struct {
+    Conversation *conversation;
+    ChatJournal *journal;
+    gboolean done;
+} Loaded;
+
+// --- Private Helper Functions ---
+
+static void on_loaded(Conversation *conversation, ChatJournal *journal, gpointer user_data) {
+    Loaded *loaded = user_data;
+    loaded->conversation = conversation;
+    loaded->journal = journal;
+    loaded->done = TRUE;
+}
+
+// --- Public Functions ---
+
+// A new empty directory for one test, removed with test_util_remove_dir().
+char *test_util_make_dir(void) {
+    GError *error = NULL;
+    char *dir = g_dir_make_tmp("ollama-chat-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    return dir;
+}
+
+// Removes `dir` with everything in it, and frees it.
+void test_util_remove_dir(char *dir) {
+    GDir *gdir = g_dir_open(dir, 0, NULL);
+    if (gdir) {
+        const char *filename;
+        while ((filename = g_dir_read_name(gdir))) {
+            char *path = g_build_filename(dir, filename, NULL);
+            if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                test_util_remove_dir(path);
+            } else {
+                g_remove(path);
+                g_free(path);
+            }
+        }
+        g_dir_close(gdir);
+    }
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+// Runs the main loop until `*done` is set by a callback.
+void test_util_wait(const gboolean *done) {
+    while (!*done) g_main_context_iteration(NULL, TRUE);
+}
+
+// The contents of `path`, or NULL if it cannot be read.
+char *test_util_read_file(const char *path) {
+    char *contents = NULL;
+    return g_file_get_contents(path, &contents, NULL, NULL) ? contents : NULL;
+}
+
+// Loads the chat at `path` with chat_journal_load(), its journal left open
+// in `journal` unless that is NULL.
+Conversation *test_util_load_chat(const char *path, ChatJournal **journal) {
+    Loaded loaded = { 0 };
+    chat_journal_load(path, on_loaded, &loaded);
+    test_util_wait(&loaded.done);
+    if (journal) {
+        *journal = loaded.journal;
+    } else if (loaded.journal) {
+        chat_journal_close(loaded.journal);
+    }
+    return loaded.conversation;
+}
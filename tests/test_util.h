@@ -0,0 +1,14 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <glib.h>
+#include "chat_journal.h"
+
+// Helpers shared by the unit tests.
+char *test_util_make_dir(void);
+void test_util_remove_dir(char *dir);
+void test_util_wait(const gboolean *done);
+char *test_util_read_file(const char *path);
+Conversation *test_util_load_chat(const char *path, ChatJournal **journal);
+
+#endif // TEST_UTIL_H